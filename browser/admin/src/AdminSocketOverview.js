@@ -233,6 +233,7 @@ var AdminSocketOverview = AdminSocketBase.extend({
 		this.socket.send('sent_bytes');
 		this.socket.send('recv_bytes');
 		this.socket.send('uptime');
+		this.socket.send('conversion_rate');
 	},
 
 	onSocketOpen: function() {
@@ -323,7 +324,8 @@ var AdminSocketOverview = AdminSocketBase.extend({
 			textMsg.startsWith('active_users_count') ||
 			textMsg.startsWith('sent_bytes') ||
 			textMsg.startsWith('recv_bytes') ||
-			textMsg.startsWith('uptime'))
+			textMsg.startsWith('uptime') ||
+			textMsg.startsWith('conversion_rate'))
 		{
 			textMsg = textMsg.split(' ');
 			var sCommand = textMsg[0];
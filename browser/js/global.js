@@ -541,6 +541,33 @@ window.app = {
 					break;
 				}
 				var type = String.fromCharCode(arr[i+0]);
+				var serial, size, data;
+				if (type == 't' || type == 'b')
+				{
+					// Binary framing: big-endian 32-bit serial and size.
+					if (left < 9)
+					{
+						global.app.console.debug('truncated binary frame');
+						break;
+					}
+					serial = ((arr[i+1] << 24) | (arr[i+2] << 16) | (arr[i+3] << 8) | arr[i+4]) >>> 0;
+					size = ((arr[i+5] << 24) | (arr[i+6] << 16) | (arr[i+7] << 8) | arr[i+8]) >>> 0;
+					i += 9;
+
+					if (type == 't')
+						data = this.decode(arr, i, i + size);
+					else
+						data = this.doSlice(arr, i, i + size);
+
+					if (serial !== ((that.inSerial + 1) >>> 0)) {
+						global.app.console.debug('Error: serial mismatch ' + serial + ' vs. ' + (that.inSerial + 1));
+					}
+					that.inSerial = serial;
+					this.onmessage({ data: data });
+
+					i += size - 1; // no trailing '\n', undo the loop-increment
+					continue;
+				}
 				if (type != 'T' && type != 'B')
 				{
 					global.app.console.debug('wrong data type: ' + type);
@@ -560,7 +587,7 @@ window.app = {
 				while (arr[i] != 10) // '\n'
 					i++;
 				numStr = this.decode(arr, start, i);
-				var serial = parseInt(numStr, 16);
+				serial = parseInt(numStr, 16);
 
 				i++; // skip \n
 
@@ -575,11 +602,10 @@ window.app = {
 				while (arr[i] != 10) // '\n'
 					i++;
 				numStr = this.decode(arr, start, i);
-				var size = parseInt(numStr, 16);
+				size = parseInt(numStr, 16);
 
 				i++; // skip \n
 
-				var data;
 				if (type == 'T')
 					data = this.decode(arr, i, i + size);
 				else
@@ -734,6 +760,7 @@ window.app = {
 
 			var req = new XMLHttpRequest();
 			req.open('POST', that.getEndPoint('open'));
+			req.setRequestHeader('X-COOL-Proxy-Framing', 'binary');
 			req.responseType = 'text';
 			req.addEventListener('load', function() {
 				global.app.console.debug('got session: ' + this.responseText);
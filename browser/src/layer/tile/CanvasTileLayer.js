@@ -1495,7 +1495,13 @@ L.CanvasTileLayer = L.Layer.extend({
 			current: true, // is this currently visible
 			canvas: null,  // canvas ready to render
 			imgDataCache: null, // flat byte array of canvas data
+			imgDataWireId: 0, // wireId of the imgDataCache content
+			prevImgData: null, // pixels before the last delta, for neighbours to copy from
+			prevImgDataWireId: 0, // wireId of the prevImgData content
 			rawDeltas: null, // deltas ready to decompress
+			neighbourCopies: false, // do rawDeltas copy rows from neighbouring tiles
+			expandedImgData: null, // what the first expandedLength bytes of such rawDeltas expand to
+			expandedLength: 0,
 			deltaCount: 0, // how many deltas on top of the keyframe
 			updateCount: 0, // how many updates did we have
 			loadCount: 0, // how many times did we get a new keyframe
@@ -6393,6 +6399,9 @@ L.CanvasTileLayer = L.Layer.extend({
 			delete tile.canvas;
 		}
 		tile.imgDataCache = null;
+		tile.imgDataWireId = 0;
+		tile.prevImgData = null;
+		tile.prevImgDataWireId = 0;
 	},
 
 	_removeTile: function (key) {
@@ -6490,7 +6499,10 @@ L.CanvasTileLayer = L.Layer.extend({
 				if (this._debugDeltas)
 					window.app.console.log('Restoring a tile from cached delta at ' +
 							       this._tileCoordsToKey(tile.coords));
-				this._applyDelta(tile, tile.rawDeltas, true, false);
+				if (tile.expandedImgData)
+					this._restoreExpandedTile(tile);
+				else
+					this._applyDelta(tile, tile.rawDeltas, true, false);
 			}
 		}
 		tile.lastRendered = now;
@@ -6498,6 +6510,24 @@ L.CanvasTileLayer = L.Layer.extend({
 			tile.missingContent++;
 	},
 
+	// The neighbours' pixels that deltas copied rows from are long gone
+	// by now, so restore from what they expanded to, and apply the rest.
+	_restoreExpandedTile: function(tile) {
+		var ctx = this._ensureContext(tile);
+		if (!ctx) // out of canvas / texture memory.
+			return;
+
+		var expanded = tile.expandedImgData;
+		var imgData = new ImageData(new Uint8ClampedArray(expanded.data),
+					    expanded.width, expanded.height);
+		tile.imgDataCache = imgData;
+		tile.imgDataWireId = tile.wireId;
+		ctx.putImageData(imgData, 0, 0);
+
+		if (tile.expandedLength < tile.rawDeltas.length)
+			this._applyDelta(tile, tile.rawDeltas.subarray(tile.expandedLength), false, false);
+	},
+
 	_maybeGarbageCollect: function() {
 		if (!(++this._gcCounter % 53))
 			this._garbageCollect();
@@ -6542,6 +6572,7 @@ L.CanvasTileLayer = L.Layer.extend({
 			if (tile.canvas)
 				canvasKeys.push(keys[i]);
 			totalSize += tile.rawDeltas ? tile.rawDeltas.length : 0;
+			totalSize += tile.expandedImgData ? tile.expandedImgData.data.length : 0;
 		}
 
 		// Trim ourselves down to size.
@@ -6568,11 +6599,15 @@ L.CanvasTileLayer = L.Layer.extend({
 				if (tile.rawDeltas && !tile.current)
 				{
 					totalSize -= tile.rawDeltas.length;
+					totalSize -= tile.expandedImgData ? tile.expandedImgData.data.length : 0;
 					if (this._debugDeltas)
 						window.app.console.log('Reclaim delta ' + key + ' memory: ' +
 								       tile.rawDeltas.length + ' bytes');
 					this._reclaimTileCanvasMemory(tile);
 					tile.rawDeltas = null;
+					tile.neighbourCopies = false;
+					tile.expandedImgData = null;
+					tile.expandedLength = 0;
 					// force keyframe
 					tile.wireId = 0;
 					tile.invalidFrom = 0;
@@ -6716,6 +6751,13 @@ L.CanvasTileLayer = L.Layer.extend({
 			if (tile.rawDeltas && tile.rawDeltas != rawDelta) // help the gc?
 				tile.rawDeltas.length = 0;
 			tile.rawDeltas = rawDelta; // overwrite
+			tile.neighbourCopies = false;
+			tile.expandedImgData = null;
+			tile.expandedLength = 0;
+		}
+		else if (!wireMessage)
+		{
+			// re-applying the end of tile.rawDeltas: already stored.
 		}
 		else if (!tile.rawDeltas)
 		{
@@ -6747,6 +6789,8 @@ L.CanvasTileLayer = L.Layer.extend({
 		var allDeltas = window.fzstd.decompress(rawDelta);
 
 		var imgData;
+		var prevImgData = null;
+		var prevImgDataWireId = tile.imgDataWireId;
 
 		// May have been changed by _ensureContext garbage collection
 		var canvas = tile.canvas;
@@ -6771,6 +6815,8 @@ L.CanvasTileLayer = L.Layer.extend({
 			{
 				// FIXME: use zstd to de-compress directly into a Uint8ClampedArray
 				len = canvas.width * canvas.height * 4;
+				if (!prevImgData && tile.imgDataCache)
+					prevImgData = tile.imgDataCache.data;
 				var pixelArray = this._unpremultiply(delta.subarray(0, len));
 				imgData = new ImageData(pixelArray, canvas.width, canvas.height);
 
@@ -6791,8 +6837,31 @@ L.CanvasTileLayer = L.Layer.extend({
 
 				// copy old data to work from:
 				var oldData = new Uint8ClampedArray(imgData.data);
+				if (!prevImgData)
+					prevImgData = oldData;
 
-				len = this._applyDeltaChunk(imgData, delta, oldData, canvas.width, canvas.height);
+				len = this._applyDeltaChunk(imgData, delta, oldData, canvas.width, canvas.height, tile);
+				if (len < 0)
+				{
+					// We no longer have the neighbour's rows this delta copies:
+					// drop what we have, and fetch a keyframe.
+					window.app.console.debug('Unusual: Delta copies rows from a missing neighbour of ' +
+								 this._tileCoordsToKey(tile.coords));
+					tile.imgDataCache = null;
+					tile.imgDataWireId = 0;
+					tile.prevImgData = null;
+					tile.prevImgDataWireId = 0;
+					tile.rawDeltas = null;
+					tile.neighbourCopies = false;
+					tile.expandedImgData = null;
+					tile.expandedLength = 0;
+					tile.wireId = 0;
+					tile.invalidFrom = 0;
+					this._fetchKeyframeQueue.push(tile.coords);
+					if (traceEvent)
+						traceEvent.finish();
+					return;
+				}
 				if (this._debugDeltas)
 					window.app.console.log('Applied chunk ' + i++ + ' of total size ' + delta.length +
 							       ' at stream offset ' + offset + ' size ' + len);
@@ -6806,14 +6875,45 @@ L.CanvasTileLayer = L.Layer.extend({
 		{
 			// hold onto the original imgData for reuse in the no keyframe case
 			tile.imgDataCache = imgData;
+			tile.imgDataWireId = tile.wireId;
+			// and onto what it was, for neighbours' deltas made against that.
+			tile.prevImgData = prevImgData;
+			tile.prevImgDataWireId = prevImgData ? prevImgDataWireId : 0;
 			ctx.putImageData(imgData, 0, 0);
+
+			// Replaying deltas that copy from neighbours needs their pixels as
+			// they were then: keep what they expand to, for when the canvas goes.
+			if (tile.neighbourCopies)
+			{
+				if (!tile.expandedImgData)
+					tile.expandedImgData = new ImageData(canvas.width, canvas.height);
+				tile.expandedImgData.data.set(imgData.data);
+				tile.expandedLength = tile.rawDeltas.length;
+			}
 		}
 
 		if (traceEvent)
 			traceEvent.finish();
 	},
 
-	_applyDeltaChunk: function(imgData, delta, oldData, width, height) {
+	// Returns the pixels of the tile above (direction -1) or below (1)
+	// as they were at wireId, if we have them.
+	_getNeighbourImgData: function(tile, direction, wireId) {
+		var coords = tile.coords;
+		var key = new L.TileCoordData(coords.x, coords.y + direction * this._getTileSize(),
+					      coords.z, coords.part, coords.mode).key();
+		var neighbour = this._tiles[key];
+		if (!neighbour)
+			return null;
+		if (neighbour.imgDataCache && neighbour.imgDataWireId === wireId)
+			return neighbour.imgDataCache.data;
+		if (neighbour.prevImgData && neighbour.prevImgDataWireId === wireId)
+			return neighbour.prevImgData;
+		return null;
+	},
+
+	// Returns the length of the delta applied, or -1 if it can't be.
+	_applyDeltaChunk: function(imgData, delta, oldData, width, height, tile) {
 		var pixSize = width * height * 4;
 		if (this._debugDeltas)
 			window.app.console.log('Applying a delta of length ' +
@@ -6859,6 +6959,23 @@ L.CanvasTileLayer = L.Layer.extend({
 					}
 				}
 				break;
+			case 67: // 'C': // copy rows from a neighbouring tile
+				count = delta[i+1];
+				srcRow = delta[i+2];
+				destRow = delta[i+3];
+				var direction = delta[i+4] ? 1 : -1;
+				var wireId = (delta[i+5] | (delta[i+6] << 8) | (delta[i+7] << 16) | (delta[i+8] << 24)) >>> 0;
+				if (this._debugDeltasDetail)
+					window.app.console.log('[' + i + ']: copy ' + count + ' row(s) ' + srcRow + ' of the tile ' +
+							       (direction > 0 ? 'below' : 'above') + ' at wireId ' + wireId + ' to ' + destRow);
+				i += 9;
+				var neighbourData = this._getNeighbourImgData(tile, direction, wireId);
+				if (!neighbourData)
+					return -1;
+				imgData.data.set(neighbourData.subarray(srcRow * width * 4, (srcRow + count) * width * 4),
+						 destRow * width * 4);
+				tile.neighbourCopies = true;
+				break;
 			case 100: // 'd': // new run
 				destRow = delta[i+1];
 				var destCol = delta[i+2];
@@ -6937,6 +7054,12 @@ L.CanvasTileLayer = L.Layer.extend({
 			tile = this.createTile(coords, key, tileMsgObj.wireId);
 
 		tile.viewId = tileMsgObj.nviewid;
+
+		// an empty delta leaves the content as it was, at a new wireId.
+		if (img && !img.isKeyframe && img.rawData.length === 0 &&
+		    tile.imgDataCache && tile.imgDataWireId === tile.wireId)
+			tile.imgDataWireId = +tileMsgObj.wireId;
+
 		// update monotonic timestamp
 		tile.wireId = +tileMsgObj.wireId;
 		if (tile.invalidFrom == tile.wireId)
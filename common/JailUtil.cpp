@@ -158,6 +158,7 @@ void removeAuxFolders(const std::string &root)
 {
     FileUtil::removeFile(Poco::Path(root, "tmp").toString(), true);
     FileUtil::removeFile(Poco::Path(root, "linkable").toString(), true);
+    FileUtil::removeFile(Poco::Path(root, JAIL_TEMPLATE_SUBPATH).toString(), true);
 }
 
 bool tryRemoveJail(const std::string& root)
@@ -28,6 +28,9 @@ constexpr const char CHILDROOT_TMP_INCOMING_PATH[] = "/tmp/incoming";
 /// The LO installation directory with jail.
 constexpr const char LO_JAIL_SUBPATH[] = "lo";
 
+/// The template jail, cloned when mounting is disabled, within child-root.
+constexpr const char JAIL_TEMPLATE_SUBPATH[] = "jail-template";
+
 /// Bind mount a jail directory.
 bool bind(const std::string& source, const std::string& target);
 
@@ -14,6 +14,7 @@
 #include <atomic>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 
@@ -36,8 +37,9 @@ public:
             const enum Dir dir) :
         _forwardToken(getForwardToken(message.data(), message.size())),
         _data(copyDataAfterOffset(message.data(), message.size(), _forwardToken.size())),
-        _tokens(StringVector::tokenize(_data.data(), _data.size())),
-        _id(makeId(dir)),
+        _tokens(StringVector::tokenize(_data.data(), getFirstLineLength())),
+        _idNum(makeId()),
+        _dir(dir),
         _type(detectType())
     {
         LOG_TRC("Message " << abbr());
@@ -51,8 +53,9 @@ public:
             const size_t reserve) :
         _forwardToken(getForwardToken(message.data(), message.size())),
         _data(copyDataAfterOffset(message.data(), message.size(), _forwardToken.size())),
-        _tokens(StringVector::tokenize(message.data() + _forwardToken.size(), message.size() - _forwardToken.size())),
-        _id(makeId(dir)),
+        _tokens(StringVector::tokenize(_data.data(), getFirstLineLength())),
+        _idNum(makeId()),
+        _dir(dir),
         _type(detectType())
     {
         _data.reserve(std::max(reserve, message.size()));
@@ -66,8 +69,24 @@ public:
             const enum Dir dir) :
         _forwardToken(getForwardToken(p, len)),
         _data(copyDataAfterOffset(p, len, _forwardToken.size())),
-        _tokens(StringVector::tokenize(_data.data(), _data.size())),
-        _id(makeId(dir)),
+        _tokens(StringVector::tokenize(_data.data(), getFirstLineLength())),
+        _idNum(makeId()),
+        _dir(dir),
+        _type(detectType())
+    {
+        LOG_TRC("Message " << abbr());
+    }
+
+    /// Construct a message by taking over the given buffer, without copying it.
+    /// Only a forward token, if any, is moved out of the way.
+    /// Note: data must include the full first-line.
+    Message(std::vector<char>&& data,
+            const enum Dir dir) :
+        _forwardToken(getForwardToken(data.data(), data.size())),
+        _data(adoptDataAfterOffset(std::move(data), _forwardToken.size())),
+        _tokens(StringVector::tokenize(_data.data(), getFirstLineLength())),
+        _idNum(makeId()),
+        _dir(dir),
         _type(detectType())
     {
         LOG_TRC("Message " << abbr());
@@ -76,11 +95,13 @@ public:
     size_t size() const { return _data.size(); }
     const std::vector<char>& data() const { return _data; }
 
+    /// The tokens of the first line.
     const StringVector& tokens() const { return _tokens; }
+
     const std::string& forwardToken() const { return _forwardToken; }
-    std::string firstToken() const { return _tokens[0]; }
-    bool firstTokenMatches(const std::string& target) const { return _tokens[0] == target; }
-    std::string operator[](size_t index) const { return _tokens[index]; }
+    std::string firstToken() const { return std::string(getFirstToken()); }
+    bool firstTokenMatches(const std::string& target) const { return getFirstToken() == target; }
+    std::string operator[](size_t index) const { return tokens()[index]; }
 
     /// Find a subarray in the raw message.
     int find(const char* sub, const std::size_t subLen) const
@@ -100,22 +121,23 @@ public:
 
     bool getTokenInteger(const std::string& name, int& value)
     {
-        return COOLProtocol::getTokenInteger(_tokens, name, value);
+        return COOLProtocol::getTokenInteger(tokens(), name, value);
     }
 
     /// Return the abbreviated message for logging purposes.
     std::string abbr() const {
-        return _id + ' ' + COOLProtocol::getAbbreviatedMessage(_data.data(), _data.size());
+        return id() + ' ' + COOLProtocol::getAbbreviatedMessage(_data.data(), _data.size());
     }
-    const std::string& id() const { return _id; }
+    std::string id() const { return (_dir == Dir::In ? 'i' : 'o') + std::to_string(_idNum); }
 
     /// Returns the json part of the message, if any.
     std::string jsonString() const
     {
-        if (_tokens.size() > 1 && _tokens[1].size() >= 1 &&
-            (_tokens[1][0] == '{' || _tokens[1][0] == '['))
+        const StringVector& lineTokens = tokens();
+        if (lineTokens.size() > 1 && lineTokens[1].size() >= 1 &&
+            (lineTokens[1][0] == '{' || lineTokens[1][0] == '['))
         {
-            const size_t firstTokenSize = _tokens[0].size();
+            const size_t firstTokenSize = lineTokens[0].size();
             return std::string(_data.data() + firstTokenSize, _data.size() - firstTokenSize);
         }
 
@@ -149,10 +171,30 @@ public:
 private:
 
     /// Constructs a unique ID.
-    static std::string makeId(const enum Dir dir)
+    static unsigned makeId()
     {
         static std::atomic<unsigned> Counter;
-        return (dir == Dir::In ? 'i' : 'o') + std::to_string(++Counter);
+        return ++Counter;
+    }
+
+    /// The length of the first line, excluding the new-line.
+    std::size_t getFirstLineLength() const
+    {
+        if (_data.empty())
+            return 0;
+
+        const void* newLine = std::memchr(_data.data(), '\n', _data.size());
+        return newLine ? static_cast<const char*>(newLine) - _data.data() : _data.size();
+    }
+
+    /// The first token, without tokenizing the first line.
+    std::string_view getFirstToken() const
+    {
+        std::size_t i = 0;
+        while (i < _data.size() && _data[i] != ' ' && _data[i] != '\n')
+            ++i;
+
+        return std::string_view(_data.data(), i);
     }
 
     void assignFirstLineIfEmpty()
@@ -165,13 +207,14 @@ private:
 
     Type detectType() const
     {
-        if (_tokens.equals(0, "tile:") ||
-            _tokens.equals(0, "tilecombine:") ||
-            _tokens.equals(0, "delta:") ||
-            _tokens.equals(0, "renderfont:") ||
-            _tokens.equals(0, "rendersearchresult:") ||
-            _tokens.equals(0, "windowpaint:") ||
-            _tokens.equals(0, "urp:") )
+        const std::string_view token = getFirstToken();
+        if (token == "tile:" ||
+            token == "tilecombine:" ||
+            token == "delta:" ||
+            token == "renderfont:" ||
+            token == "rendersearchresult:" ||
+            token == "windowpaint:" ||
+            token == "urp:")
         {
             return Type::Binary;
         }
@@ -208,11 +251,26 @@ private:
             return std::vector<char>();
     }
 
+    static std::vector<char> adoptDataAfterOffset(std::vector<char>&& data, size_t fromOffset)
+    {
+        size_t i;
+        for (i = fromOffset; i < data.size(); ++i)
+        {
+            if (data[i] != ' ')
+                break;
+        }
+
+        // Only forwarded messages have anything to skip.
+        data.erase(data.begin(), data.begin() + i);
+        return std::move(data);
+    }
+
 private:
     const std::string _forwardToken;
     std::vector<char> _data;
     const StringVector _tokens;
-    const std::string _id;
+    const unsigned _idNum;
+    const Dir _dir;
     std::string _firstLine;
     const Type _type;
 };
@@ -38,19 +38,27 @@ void TileQueue::put_impl(const Payload& value)
         const TileCombined tileCombined = TileCombined::parse(msg);
         for (const auto& tile : tileCombined.getTiles())
         {
-            const std::string newMsg = tile.serialize("tile");
-
-            removeTileDuplicate(newMsg);
-
-            MessageQueue::put_impl(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
+            putTile(Payload(), tile);
         }
         return;
     }
     else if (firstToken == "tile")
     {
-        removeTileDuplicate(std::string(value.data(), value.size()));
+        std::optional<TileDesc> tile;
+        try
+        {
+            tile = TileDesc::parse(StringVector::tokenize(value.data(), value.size()));
+        }
+        catch (const std::exception& exc)
+        {
+            // Leave it to the handler of the message to report.
+            LOG_WRN("Queueing unparsable tile request [" << COOLProtocol::getAbbreviatedMessage(value)
+                                                         << "]: " << exc.what());
+            MessageQueue::put_impl(value);
+            return;
+        }
 
-        MessageQueue::put_impl(value);
+        putTile(value, *tile);
         return;
     }
     else if (firstToken == "callback")
@@ -72,31 +80,83 @@ void TileQueue::put_impl(const Payload& value)
     MessageQueue::put_impl(value);
 }
 
-void TileQueue::removeTileDuplicate(const std::string& tileMsg)
+std::size_t TileQueue::TileKeyHasher::operator()(const TileDesc& tile) const
 {
-    assert(COOLProtocol::matchPrefix("tile", tileMsg, /*ignoreWhitespace*/ true));
+    std::size_t hash = tile.getPart();
+
+    hash = (hash << 5) + hash + tile.getEditMode();
+    hash = (hash << 5) + hash + tile.getWidth();
+    hash = (hash << 5) + hash + tile.getHeight();
+    hash = (hash << 5) + hash + tile.getTilePosX();
+    hash = (hash << 5) + hash + tile.getTilePosY();
+    hash = (hash << 5) + hash + tile.getTileWidth();
+    hash = (hash << 5) + hash + tile.getTileHeight();
+    hash = (hash << 5) + hash + tile.getNormalizedViewId();
+    hash = (hash << 5) + hash + tile.getWireId();
+
+    return hash;
+}
 
+bool TileQueue::TileKeyEqual::operator()(const TileDesc& lhs, const TileDesc& rhs) const
+{
     // Ver is always provided at this point and it is necessary to
     // return back to clients the last rendered version of a tile
     // in case there are new invalidations and requests while rendering.
     // Here we compare duplicates without 'ver' since that's irrelevant.
-    size_t newMsgPos = tileMsg.find(" ver");
-    if (newMsgPos == std::string::npos)
-    {
-        newMsgPos = tileMsg.size() - 1;
-    }
+    return lhs.getPart() == rhs.getPart() && lhs.getEditMode() == rhs.getEditMode() &&
+           lhs.getWidth() == rhs.getWidth() && lhs.getHeight() == rhs.getHeight() &&
+           lhs.getTilePosX() == rhs.getTilePosX() && lhs.getTilePosY() == rhs.getTilePosY() &&
+           lhs.getTileWidth() == rhs.getTileWidth() &&
+           lhs.getTileHeight() == rhs.getTileHeight() &&
+           lhs.getNormalizedViewId() == rhs.getNormalizedViewId() &&
+           lhs.getOldWireId() == rhs.getOldWireId() && lhs.getWireId() == rhs.getWireId();
+}
 
-    for (size_t i = 0; i < getQueue().size(); ++i)
+void TileQueue::putTile(Payload payload, const TileDesc& tile)
+{
+    removeTileDuplicate(tile);
+
+    _tileIndex[tile] = pushBack(std::move(payload), tile);
+}
+
+void TileQueue::removeTileDuplicate(const TileDesc& tile)
+{
+    const auto indexIt = _tileIndex.find(tile);
+    if (indexIt == _tileIndex.end())
+        return;
+
+    const auto it = findItem(indexIt->second);
+    assert(it != getQueue().end() && "Indexed tile request is not queued");
+    if (it != getQueue().end())
     {
-        auto& it = getQueue()[i];
-        if (it.size() > newMsgPos &&
-            strncmp(tileMsg.data(), it.data(), newMsgPos) == 0)
-        {
-            LOG_TRC("Remove duplicate tile request: " << std::string(it.data(), it.size()) << " -> " << COOLProtocol::getAbbreviatedMessage(tileMsg));
-            getQueue().erase(getQueue().begin() + i);
-            break;
-        }
+        LOG_TRC("Remove duplicate tile request: " << it->_tile->serialize("tile") << " -> "
+                                                  << tile.serialize("tile"));
+        getQueue().erase(it);
     }
+
+    _tileIndex.erase(indexIt);
+}
+
+TileQueue::QueueItem TileQueue::takeItem(std::size_t index)
+{
+    QueueItem item = std::move(getQueue()[index]);
+    getQueue().erase(getQueue().begin() + index);
+
+    if (item._tile)
+        _tileIndex.erase(*item._tile);
+
+    return item;
+}
+
+std::vector<TileQueue::QueueItem>::iterator TileQueue::findItem(uint64_t seq)
+{
+    auto it = std::lower_bound(getQueue().begin(), getQueue().end(), seq,
+                               [](const QueueItem& item, uint64_t value)
+                               { return item._seq < value; });
+    if (it != getQueue().end() && it->_seq == seq)
+        return it;
+
+    return getQueue().end();
 }
 
 namespace {
@@ -250,7 +310,13 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
             std::size_t i = 0;
             while (i < getQueue().size())
             {
-                auto& it = getQueue()[i];
+                if (getQueue()[i]._tile)
+                {
+                    ++i;
+                    continue;
+                }
+
+                const Payload& it = getQueue()[i]._payload;
 
                 StringVector queuedTokens = StringVector::tokenize(it.data(), it.size());
                 if (queuedTokens.size() < 3)
@@ -381,7 +447,10 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
             isDuplicateCommand functor(unoCommand, tokens);
             for (std::size_t i = 0; i < getQueue().size(); ++i)
             {
-                auto& it = getQueue()[i];
+                if (getQueue()[i]._tile)
+                    continue;
+
+                const Payload& it = getQueue()[i]._payload;
 
                 StringVector::tokenize_foreach(functor, it.data(), it.size());
 
@@ -416,10 +485,10 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
 
             for (std::size_t i = 0; i < getQueue().size(); ++i)
             {
-                const auto& it = getQueue()[i];
+                const Payload& it = getQueue()[i]._payload;
 
                 // skip non-callbacks quickly
-                if (!COOLProtocol::matchPrefix("callback", it))
+                if (getQueue()[i]._tile || !COOLProtocol::matchPrefix("callback", it))
                     continue;
 
                 StringVector queuedTokens = StringVector::tokenize(it.data(), it.size());
@@ -466,10 +535,8 @@ std::string TileQueue::removeCallbackDuplicate(const std::string& callbackMsg)
     return std::string();
 }
 
-int TileQueue::priority(const std::string& tileMsg)
+int TileQueue::priority(const TileDesc& tile)
 {
-    TileDesc tile = TileDesc::parse(tileMsg); //FIXME: Expensive, avoid.
-
     for (int i = static_cast<int>(_viewOrder.size()) - 1; i >= 0; --i)
     {
         auto& cursor = _cursorPositions[_viewOrder[i]];
@@ -485,19 +552,17 @@ void TileQueue::deprioritizePreviews()
 {
     for (size_t i = 0; i < getQueue().size(); ++i)
     {
-        const Payload front = getQueue().front();
-        const std::string message(front.data(), front.size());
+        const QueueItem& front = getQueue().front();
 
         // stop at the first non-tile or non-'id' (preview) message
-        std::string id;
-        if (!COOLProtocol::matchPrefix("tile", message) ||
-            !COOLProtocol::getTokenStringFromMessage(message, "id", id))
+        if (!front._tile || !isPreview(*front._tile))
         {
             break;
         }
 
-        getQueue().erase(getQueue().begin());
-        getQueue().push_back(front);
+        QueueItem item = takeItem(0);
+        const TileDesc tile = *item._tile;
+        _tileIndex[tile] = pushBack(std::move(item._payload), std::move(item._tile));
     }
 }
 
@@ -505,25 +570,28 @@ TileQueue::Payload TileQueue::get_impl()
 {
     LOG_TRC("MessageQueue depth: " << getQueue().size());
 
-    const Payload front = getQueue().front();
-
-    std::string msg(front.data(), front.size());
+    const QueueItem& front = getQueue().front();
 
-    std::string id;
-    bool isTile = COOLProtocol::matchPrefix("tile", msg);
-    bool isPreview = isTile && COOLProtocol::getTokenStringFromMessage(msg, "id", id);
+    const bool isTile = front._tile.has_value();
+    const bool isPreview = isTile && TileQueue::isPreview(*front._tile);
     if (!isTile || isPreview)
     {
         // Don't combine non-tiles or tiles with id.
-        LOG_TRC("MessageQueue res: " << COOLProtocol::getAbbreviatedMessage(msg));
-        getQueue().erase(getQueue().begin());
+        QueueItem item = takeItem(0);
+        if (item._payload.empty())
+        {
+            const std::string msg = item._tile->serialize("tile");
+            item._payload.assign(msg.data(), msg.data() + msg.size());
+        }
+
+        LOG_TRC("MessageQueue res: " << COOLProtocol::getAbbreviatedMessage(item._payload));
 
         // de-prioritize the other tiles with id - usually the previews in
         // Impress
         if (isPreview)
             deprioritizePreviews();
 
-        return front;
+        return std::move(item._payload);
     }
 
     // We are handling a tile; first try to find one that is at the cursor's
@@ -532,24 +600,21 @@ TileQueue::Payload TileQueue::get_impl()
     int prioritySoFar = -1;
     for (size_t i = 0; i < getQueue().size(); ++i)
     {
-        auto& it = getQueue()[i];
-        const std::string prio(it.data(), it.size());
+        const QueueItem& it = getQueue()[i];
 
         // avoid starving - stop the search when we reach a non-tile,
         // otherwise we may keep growing the queue of unhandled stuff (both
         // tiles and non-tiles)
-        if (!COOLProtocol::matchPrefix("tile", prio) ||
-            COOLProtocol::getTokenStringFromMessage(prio, "id", id))
+        if (!it._tile || TileQueue::isPreview(*it._tile))
         {
             break;
         }
 
-        const int p = priority(prio);
+        const int p = priority(*it._tile);
         if (p > prioritySoFar)
         {
             prioritySoFar = p;
             prioritized = i;
-            msg = prio;
 
             // found the highest priority already?
             if (prioritySoFar == static_cast<int>(_viewOrder.size()) - 1)
@@ -559,44 +624,37 @@ TileQueue::Payload TileQueue::get_impl()
         }
     }
 
-    getQueue().erase(getQueue().begin() + prioritized);
-
     std::vector<TileDesc> tiles;
-    tiles.emplace_back(TileDesc::parse(msg));
+    tiles.emplace_back(*takeItem(prioritized)._tile);
 
-    // Combine as many tiles as possible with the top one.
-    for (size_t i = 0; i < getQueue().size(); )
+    // Combine as many tiles as possible with the top one,
+    // compacting the rest of the queue in a single pass.
+    std::vector<QueueItem>& queue = getQueue();
+    auto last = queue.begin();
+    for (auto it = queue.begin(); it != queue.end(); ++it)
     {
-        auto& it = getQueue()[i];
-        msg = std::string(it.data(), it.size());
-        if (!COOLProtocol::matchPrefix("tile", msg) ||
-            COOLProtocol::getTokenStringFromMessage(msg, "id", id))
+        // Don't combine non-tiles or tiles with id.
+        // Check if it's on the same row.
+        if (it->_tile && !TileQueue::isPreview(*it->_tile) && tiles[0].canCombine(*it->_tile))
         {
-            // Don't combine non-tiles or tiles with id.
-            ++i;
+            LOG_TRC("Combining candidate: " << it->_tile->serialize("tile"));
+            _tileIndex.erase(*it->_tile);
+            tiles.emplace_back(std::move(*it->_tile));
             continue;
         }
 
-        TileDesc tile2 = TileDesc::parse(msg);
-        LOG_TRC("Combining candidate: " << COOLProtocol::getAbbreviatedMessage(msg));
-
-        // Check if it's on the same row.
-        if (tiles[0].canCombine(tile2))
-        {
-            tiles.emplace_back(tile2);
-            getQueue().erase(getQueue().begin() + i);
-        }
-        else
-        {
-            ++i;
-        }
+        if (last != it)
+            *last = std::move(*it);
+        ++last;
     }
 
+    queue.erase(last, queue.end());
+
     LOG_TRC("Combined " << tiles.size() << " tiles, leaving " << getQueue().size() << " in queue.");
 
     if (tiles.size() == 1)
     {
-        msg = tiles[0].serialize("tile");
+        const std::string msg = tiles[0].serialize("tile");
         LOG_TRC("MessageQueue res: " << COOLProtocol::getAbbreviatedMessage(msg));
         return Payload(msg.data(), msg.data() + msg.size());
     }
@@ -13,13 +13,17 @@
 
 #include <stdexcept>
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <map>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Log.hpp"
 #include "Protocol.hpp"
+#include <TileDesc.hpp>
 
 /// Thread-safe message queue (FIFO).
 class MessageQueue
@@ -84,6 +88,18 @@ public:
     }
 
 protected:
+    /// A queued message. Tile requests also carry their parsed descriptor,
+    /// so they never need to be parsed again while queued. The payload of
+    /// a tile split out of a tilecombine is empty; it is serialized from
+    /// the descriptor when needed.
+    struct QueueItem
+    {
+        Payload _payload;
+        std::optional<TileDesc> _tile;
+        /// Increases along the queue, so items can be found by bisection.
+        uint64_t _seq;
+    };
+
     virtual void put_impl(const Payload& value)
     {
         StringVector tokens = StringVector::tokenize(value.data(), value.size());
@@ -92,7 +108,7 @@ protected:
             const std::string newMsg = combineTextInput(tokens);
             if (!newMsg.empty())
             {
-                _queue.push_back(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
+                pushBack(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
                 return;
             }
         }
@@ -101,27 +117,35 @@ protected:
             const std::string newMsg = combineRemoveText(tokens);
             if (!newMsg.empty())
             {
-                _queue.push_back(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
+                pushBack(Payload(newMsg.data(), newMsg.data() + newMsg.size()));
                 return;
             }
         }
 
-        _queue.emplace_back(value);
+        pushBack(value);
     }
 
     virtual Payload get_impl()
     {
-        Payload result = _queue.front();
+        Payload result = std::move(_queue.front()._payload);
         _queue.erase(_queue.begin());
         return result;
     }
 
-    void clear_impl()
+    virtual void clear_impl()
     {
         _queue.clear();
     }
 
-    std::vector<Payload>& getQueue() { return _queue; }
+    /// Appends a message to the queue and returns its sequence number.
+    uint64_t pushBack(Payload payload, std::optional<TileDesc> tile = std::nullopt)
+    {
+        const uint64_t seq = _nextSeq++;
+        _queue.push_back(QueueItem{ std::move(payload), std::move(tile), seq });
+        return seq;
+    }
+
+    std::vector<QueueItem>& getQueue() { return _queue; }
 
     /// Search the queue for a previous textinput message and if found, remove it and combine its
     /// input with that in the current textinput message. We check that there aren't any interesting
@@ -139,7 +163,13 @@ protected:
         int i = getQueue().size() - 1;
         while (i >= 0)
         {
-            auto& it = getQueue()[i];
+            if (getQueue()[i]._tile)
+            {
+                --i;
+                continue;
+            }
+
+            const Payload& it = getQueue()[i]._payload;
 
             const std::string queuedMessage(it.data(), it.size());
             StringVector queuedTokens = StringVector::tokenize(it.data(), it.size());
@@ -198,7 +228,13 @@ protected:
         int i = getQueue().size() - 1;
         while (i >= 0)
         {
-            auto& it = getQueue()[i];
+            if (getQueue()[i]._tile)
+            {
+                --i;
+                continue;
+            }
+
+            const Payload& it = getQueue()[i]._payload;
 
             const std::string queuedMessage(it.data(), it.size());
             StringVector queuedTokens = StringVector::tokenize(it.data(), it.size());
@@ -242,7 +278,8 @@ protected:
     }
 
 private:
-    std::vector<Payload> _queue;
+    std::vector<QueueItem> _queue;
+    uint64_t _nextSeq = 0;
 };
 
 /// MessageQueue specialized for priority handling of tiles.
@@ -322,9 +359,39 @@ protected:
 
     virtual Payload get_impl() override;
 
+    virtual void clear_impl() override
+    {
+        MessageQueue::clear_impl();
+        _tileIndex.clear();
+    }
+
 private:
-    /// Search the queue for a duplicate tile and remove it (if present).
-    void removeTileDuplicate(const std::string& tileMsg);
+    /// Hashes the fields that identify a tile request, all but the version.
+    struct TileKeyHasher
+    {
+        std::size_t operator()(const TileDesc& tile) const;
+    };
+
+    /// Compares the fields that identify a tile request, all but the version.
+    struct TileKeyEqual
+    {
+        bool operator()(const TileDesc& lhs, const TileDesc& rhs) const;
+    };
+
+    /// Queue a tile request, replacing any queued duplicate.
+    void putTile(Payload payload, const TileDesc& tile);
+
+    /// Remove the queued duplicate of the tile (if present).
+    void removeTileDuplicate(const TileDesc& tile);
+
+    /// Remove the item at @index from the queue and the tile index.
+    QueueItem takeItem(std::size_t index);
+
+    /// The position of the item with the given sequence number.
+    std::vector<QueueItem>::iterator findItem(uint64_t seq);
+
+    /// Tiles with an id are previews (e.g. the slide sorter in Impress).
+    static bool isPreview(const TileDesc& tile) { return tile.getId() >= 0; }
 
     /// Search the queue for a duplicate callback and remove it (if present).
     ///
@@ -341,11 +408,15 @@ private:
     /// Priority of the given tile message.
     /// -1 means the lowest prio (the tile does not intersect any of the cursors),
     /// the higher the number, the bigger is priority [up to _viewOrder.size()-1].
-    int priority(const std::string& tileMsg);
+    int priority(const TileDesc& tile);
 
 private:
     std::map<int, CursorPosition> _cursorPositions;
 
+    /// The sequence number of the queued request for each tile. There is
+    /// at most one queued request per tile, since newer ones replace it.
+    std::unordered_map<TileDesc, uint64_t, TileKeyHasher, TileKeyEqual> _tileIndex;
+
     /// Check the views in the order of how the editing (cursor movement) has
     /// been happening (0 == oldest, size() - 1 == newest).
     std::vector<int> _viewOrder;
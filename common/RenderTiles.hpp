@@ -11,9 +11,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <fstream>
@@ -25,21 +27,71 @@
 #include "Rectangle.hpp"
 #include "TileDesc.hpp"
 
+/// A pool of threads to run batches of independent tasks, such as the
+/// encoding of the tiles of one render. The tasks of a batch are numbered,
+/// and each thread (the caller included) is dealt a range of them. Once its
+/// range is done a thread steals half of what is left of another's, so
+/// uneven tasks balance out without a shared queue, a lock per task, or
+/// an allocation per task.
 class ThreadPool {
+    /// The task indices left to one thread, packed as (begin << 32 | end)
+    /// so the owner and the thieves can both update it with a single CAS.
+    struct alignas(64) WorkRange
+    {
+        std::atomic<uint64_t> _range{ 0 };
+    };
+
+    typedef void (*TaskFn)(const void* context, std::size_t index);
+
     std::mutex _mutex;
     std::condition_variable _cond;
     std::condition_variable _complete;
-    typedef std::function<void()> ThreadFn;
-    std::queue<ThreadFn> _work;
     std::vector<std::thread> _threads;
-    size_t _working;
+    std::unique_ptr<WorkRange[]> _ranges; ///< One per thread, the caller's is the first.
+    std::size_t _rangeCount;
+    TaskFn _taskFn;
+    const void* _taskContext;
+    std::atomic<std::size_t> _remaining;
+    uint64_t _batch; ///< Bumped under _mutex to wake the threads for a new batch.
+    std::size_t _busy; ///< The threads in runTasks, under _mutex.
     bool   _shutdown;
     std::atomic<bool> _running;
+    std::atomic<uint64_t> _steals;
+
+    static uint64_t pack(uint64_t begin, uint64_t end) { return (begin << 32) | end; }
+    static std::size_t getBegin(uint64_t range) { return range >> 32; }
+    static std::size_t getEnd(uint64_t range) { return range & 0xffffffff; }
+
 public:
     ThreadPool()
-        : _working(0),
+        : ThreadPool(getDefaultConcurrency())
+    {
+    }
+
+    /// Uses @maxConcurrency threads, including the caller's.
+    explicit ThreadPool(int maxConcurrency)
+        : _rangeCount(1),
+          _taskFn(nullptr),
+          _taskContext(nullptr),
+          _remaining(0),
+          _batch(0),
+          _busy(0),
           _shutdown(false),
-          _running(false)
+          _running(false),
+          _steals(0)
+    {
+        LOG_TRC("PNG compression thread pool size " << maxConcurrency);
+
+        _rangeCount = std::max(maxConcurrency, 1);
+        _ranges = std::make_unique<WorkRange[]>(_rangeCount);
+        for (std::size_t i = 1; i < _rangeCount; ++i)
+            _threads.push_back(std::thread(&ThreadPool::work, this, i));
+    }
+
+    ~ThreadPool() { stop(); }
+
+    /// The number of threads to use, including the caller's.
+    static int getDefaultConcurrency()
     {
         int maxConcurrency = 2;
 #if WASMAPP
@@ -50,106 +102,183 @@ public:
         // coverity[tainted_return_value] - we trust the contents of this variable
         const char *max = getenv("MAX_CONCURRENCY");
         if (max)
-            maxConcurrency = atoi(max);
+        {
+            // Never more than we can actually run on, given the affinity and
+            // any cgroup CPU quota of the container we are in.
+            maxConcurrency = std::min(atoi(max), Util::getAvailableCpus());
+        }
 #endif
-        LOG_TRC("PNG compression thread pool size " << maxConcurrency);
-        for (int i = 1; i < maxConcurrency; ++i)
-            _threads.push_back(std::thread(&ThreadPool::work, this));
+        return std::max(maxConcurrency, 1);
     }
 
-    ~ThreadPool() { stop(); }
-
     void stop()
     {
         {
             std::unique_lock< std::mutex > lock(_mutex);
-            assert(_working == 0);
+            assert(!_running);
             _shutdown = true;
         }
         _cond.notify_all();
         for (auto& it : _threads)
             it.join();
+        _threads.clear();
     }
 
-    size_t count() const
+    /// Runs fn(0) to fn(count - 1), in any order and possibly in parallel,
+    /// and returns once they are all done.
+    template <typename Fn> void run(std::size_t count, const Fn& fn)
     {
-        return _work.size();
-    }
+        if (count == 0)
+            return;
 
-    void pushWork(const ThreadFn &fn)
-    {
-        std::unique_lock< std::mutex > lock(_mutex);
         assert(!_running);
-        assert(_working == 0);
-        _work.push(fn);
-    }
+        assert(count <= 0xffffffff);
+        _running = true;
 
-    void runOne(std::unique_lock< std::mutex >& lock)
-    {
-        assert(_running);
-        assert(!_work.empty());
-
-        ThreadFn fn = _work.front();
-        _work.pop();
-        _working++;
-        lock.unlock();
-
-        try {
-            fn();
-        } catch(...) {
-            LOG_ERR("Exception in thread pool execution.");
-        }
+        // Avoid notifying threads if we don't need to.
+        const bool useThreads = !_threads.empty() && count > 1;
 
-        lock.lock();
-        _working--;
-        if (_work.empty() && _working == 0)
-            _complete.notify_all();
-    }
+        {
+            std::unique_lock< std::mutex > lock(_mutex, std::defer_lock);
+            if (!_threads.empty())
+            {
+                // A thread still looking for tasks of the previous batch would
+                // write back what it steals over the ranges of this one. And one
+                // woken late for an earlier batch would start on this one half
+                // set up, so hold the lock until it is published.
+                lock.lock();
+                _complete.wait(lock, [this]() { return _busy == 0; });
+            }
 
-    void run()
-    {
-        std::unique_lock< std::mutex > lock(_mutex);
-        assert(!_running);
-        assert(_working == 0);
+            _taskFn = [](const void* context, std::size_t index)
+            { (*static_cast<const Fn*>(context))(index); };
+            _taskContext = &fn;
+            _remaining.store(count, std::memory_order_relaxed);
 
-        _running = true;
+            const std::size_t ranges = (useThreads ? std::min(_rangeCount, count) : 1);
+            for (std::size_t i = 0; i < ranges; ++i)
+                _ranges[i]._range.store(pack(count * i / ranges, count * (i + 1) / ranges),
+                                        std::memory_order_release);
+
+            if (useThreads)
+                ++_batch;
+        }
 
-        // Avoid notifying threads if we don't need to.
-        bool useThreads = _threads.size() > 1 && _work.size() > 1;
         if (useThreads)
             _cond.notify_all();
 
-        while(!_work.empty())
-            runOne(lock);
+        runTasks(0);
 
-        if (useThreads && (_working > 0 || !_work.empty()))
-            _complete.wait(lock, [this]() { return _working == 0 && _work.empty(); } );
+        if (_remaining.load(std::memory_order_acquire) > 0)
+        {
+            std::unique_lock< std::mutex > lock(_mutex);
+            _complete.wait(lock, [this]()
+                           { return _remaining.load(std::memory_order_acquire) == 0; });
+        }
 
         _running = false;
+    }
 
-        assert(_working==0);
-        assert(_work.empty());
+    void dumpState(std::ostream& oss)
+    {
+        oss << "\tthreadPool:"
+            << "\n\t\tshutdown: " << _shutdown
+            << "\n\t\trunning: " << _running
+            << "\n\t\tremaining: " << _remaining
+            << "\n\t\tbusy: " << _busy
+            << "\n\t\tthread count " << _threads.size()
+            << "\n\t\tbatches: " << _batch
+            << "\n\t\tsteals: " << _steals
+            << "\n";
     }
 
-    void work()
+private:
+    void work(std::size_t slot)
     {
+        uint64_t batch = 0;
         std::unique_lock< std::mutex > lock(_mutex);
-        while (!_shutdown)
+        while (true)
         {
-            _cond.wait(lock);
-            while (!_shutdown && !_work.empty() && _running)
-                runOne(lock);
+            _cond.wait(lock, [&]() { return _shutdown || _batch != batch; });
+            if (_shutdown)
+                break;
+
+            batch = _batch;
+            ++_busy;
+            lock.unlock();
+            runTasks(slot);
+            lock.lock();
+            if (--_busy == 0)
+                _complete.notify_all();
         }
     }
 
-    void dumpState(std::ostream& oss)
+    /// Runs tasks from our range, then from those of the others, until none are left to take.
+    void runTasks(std::size_t slot)
     {
-        oss << "\tthreadPool:"
-            << "\n\t\tshutdown: " << _shutdown
-            << "\n\t\tworking: " << _working
-            << "\n\t\twork count: " << count()
-            << "\n\t\tthread count " << _threads.size()
-            << "\n";
+        std::size_t index;
+        while (popTask(slot, index) || stealTasks(slot, index))
+        {
+            try
+            {
+                _taskFn(_taskContext, index);
+            }
+            catch (...)
+            {
+                LOG_ERR("Exception in thread pool execution.");
+            }
+
+            if (_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                std::unique_lock< std::mutex > lock(_mutex);
+                _complete.notify_all();
+            }
+        }
+    }
+
+    /// Takes the first task of our own range.
+    bool popTask(std::size_t slot, std::size_t& index)
+    {
+        std::atomic<uint64_t>& own = _ranges[slot]._range;
+        uint64_t range = own.load(std::memory_order_acquire);
+        while (getBegin(range) < getEnd(range))
+        {
+            if (own.compare_exchange_weak(range, pack(getBegin(range) + 1, getEnd(range)),
+                                          std::memory_order_acq_rel))
+            {
+                index = getBegin(range);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// Takes the back half of another thread's range, keeping the first task
+    /// of it to run now and the rest as our own range.
+    bool stealTasks(std::size_t slot, std::size_t& index)
+    {
+        for (std::size_t i = 1; i < _rangeCount; ++i)
+        {
+            std::atomic<uint64_t>& victim = _ranges[(slot + i) % _rangeCount]._range;
+            uint64_t range = victim.load(std::memory_order_acquire);
+            while (getBegin(range) < getEnd(range))
+            {
+                const std::size_t begin = getBegin(range);
+                const std::size_t end = getEnd(range);
+                const std::size_t middle = begin + (end - begin) / 2;
+                if (victim.compare_exchange_weak(range, pack(begin, middle),
+                                                 std::memory_order_acq_rel))
+                {
+                    ++_steals;
+                    index = middle;
+                    _ranges[slot]._range.store(pack(middle + 1, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        return false;
     }
 };
 
@@ -187,6 +316,17 @@ namespace RenderTiles
         renderedTiles.back().setImgSize(imgSize);
     }
 
+    /// The version the client has of the tile at @x, @y of @tiles, if requested.
+    static TileWireId getOldWireId(const std::vector<TileDesc> &tiles, int x, int y)
+    {
+        for (const auto& tile : tiles)
+        {
+            if (tile.getTilePosX() == x && tile.getTilePosY() == y)
+                return tile.getOldWireId();
+        }
+        return 0;
+    }
+
     // FIXME: we should perhaps increment only on a plausible edit
     static TileWireId getCurrentWireId(bool increment = false)
     {
@@ -196,7 +336,7 @@ namespace RenderTiles
         return nextId;
     }
 
-    bool doRender(std::shared_ptr<lok::Document> document,
+    inline bool doRender(std::shared_ptr<lok::Document> document,
                   DeltaGenerator &deltaGen,
                   TileCombined &tileCombined,
                   ThreadPool &pngPool,
@@ -281,6 +421,21 @@ namespace RenderTiles
         std::vector<TileDesc> renderedTiles;
         std::vector<TileWireId> renderingIds;
 
+        // What each encoding task needs to know about its tile.
+        struct TileJob
+        {
+            size_t _tileIndex;
+            int _offsetX;
+            int _offsetY;
+            TileWireId _wireId;
+            bool _forceKeyframe;
+            TileWireId _aboveWireId;
+            TileWireId _belowWireId;
+        };
+
+        std::vector<TileJob> jobs;
+        jobs.reserve(tileRecs.size());
+
         size_t tileIndex = 0;
 
         std::mutex pngMutex;
@@ -313,55 +468,66 @@ namespace RenderTiles
                 LOG_TRC("Queued encoding of tile #" << tileIndex << " at (" << positionX << ',' << positionY << ") with " <<
                         (forceKeyframe?"force keyframe" : "allow delta") << ", wireId: " << wireId);
 
-                // Queue to be executed later in parallel inside 'run'
-                pngPool.pushWork([=,&output,&pixmap,&tiles,&renderedTiles,
-                                  &pngMutex,&deltaGen]()
-                    {
-                        std::vector< char > data;
-                        data.reserve(pixmapWidth * pixmapHeight * 1);
-
-                        // FIXME: don't try to store & create deltas for read-only documents.
-                        if (tiles[tileIndex].getId() < 0) // not a preview
-                        {
-                            // Can we create a delta ?
-                            LOG_TRC("Compress new tile #" << tileIndex);
-                            assert(pixelWidth <= 256 && pixelHeight <= 256);
-                            deltaGen.compressOrDelta(pixmap.data(), offsetX, offsetY,
-                                                     pixelWidth, pixelHeight,
-                                                     pixmapWidth, pixmapHeight,
-                                                     TileLocation(
-                                                         tileRect.getLeft(),
-                                                         tileRect.getTop(),
-                                                         tileRect.getWidth(),
-                                                         tileCombined.getPart(),
-                                                         canonicalViewId
-                                                         ),
-                                                     data, wireId, forceKeyframe, dumpTiles, mode);
-                        }
-                        else
-                        {
-                            // FIXME: write our own trivial PNG encoding code using deflate.
-                            LOG_TRC("Encode a new png for tile #" << tileIndex);
-                            if (!Png::encodeSubBufferToPNG(pixmap.data(), offsetX, offsetY, pixelWidth, pixelHeight,
-                                                           pixmapWidth, pixmapHeight, data, mode))
-                            {
-                                // FIXME: Return error.
-                                // sendTextFrameAndLogError("error: cmd=tile kind=failure");
-                                LOG_ERR("Failed to encode tile into PNG.");
-                                return;
-                            }
-                        }
-
-                        LOG_TRC("Tile " << tileIndex << " is " << data.size() << " bytes.");
-                        std::unique_lock<std::mutex> pngLock(pngMutex);
-                        output.insert(output.end(), data.begin(), data.end());
-                        pushRendered(renderedTiles, tiles[tileIndex], wireId, data.size());
-                    });
+                // Deltas may only copy rows from the neighbours the client has.
+                const TileWireId aboveWireId = getOldWireId(
+                    tiles, tileRect.getLeft(), tileRect.getTop() - tileRect.getWidth());
+                const TileWireId belowWireId = getOldWireId(
+                    tiles, tileRect.getLeft(), tileRect.getTop() + tileRect.getWidth());
+
+                jobs.push_back({ tileIndex, offsetX, offsetY, wireId, forceKeyframe,
+                                 aboveWireId, belowWireId });
             }
             tileIndex++;
         }
 
-        pngPool.run();
+        // Encode in parallel.
+        pngPool.run(jobs.size(), [&](size_t jobIndex)
+            {
+                const TileJob& job = jobs[jobIndex];
+                const size_t index = job._tileIndex;
+                const Util::Rectangle& tileRect = tileRecs[index];
+
+                std::vector< char > data;
+                data.reserve(pixmapWidth * pixmapHeight * 1);
+
+                // FIXME: don't try to store & create deltas for read-only documents.
+                if (tiles[index].getId() < 0) // not a preview
+                {
+                    // Can we create a delta ?
+                    LOG_TRC("Compress new tile #" << index);
+                    assert(pixelWidth <= 256 && pixelHeight <= 256);
+                    deltaGen.compressOrDelta(pixmap.data(), job._offsetX, job._offsetY,
+                                             pixelWidth, pixelHeight,
+                                             pixmapWidth, pixmapHeight,
+                                             TileLocation(
+                                                 tileRect.getLeft(),
+                                                 tileRect.getTop(),
+                                                 tileRect.getWidth(),
+                                                 tileCombined.getPart(),
+                                                 canonicalViewId
+                                                 ),
+                                             data, job._wireId, job._forceKeyframe, dumpTiles, mode,
+                                             job._aboveWireId, job._belowWireId);
+                }
+                else
+                {
+                    // FIXME: write our own trivial PNG encoding code using deflate.
+                    LOG_TRC("Encode a new png for tile #" << index);
+                    if (!Png::encodeSubBufferToPNG(pixmap.data(), job._offsetX, job._offsetY, pixelWidth, pixelHeight,
+                                                   pixmapWidth, pixmapHeight, data, mode))
+                    {
+                        // FIXME: Return error.
+                        // sendTextFrameAndLogError("error: cmd=tile kind=failure");
+                        LOG_ERR("Failed to encode tile into PNG.");
+                        return;
+                    }
+                }
+
+                LOG_TRC("Tile " << index << " is " << data.size() << " bytes.");
+                std::unique_lock<std::mutex> pngLock(pngMutex);
+                output.insert(output.end(), data.begin(), data.end());
+                pushRendered(renderedTiles, tiles[index], job._wireId, data.size());
+            });
 
         duration = std::chrono::steady_clock::now() - start;
         const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(duration);
@@ -42,7 +42,8 @@ Session::Session(const std::shared_ptr<ProtocolHandlerInterface> &protocol,
     _haveDocPassword(false),
     _isDocPasswordProtected(false),
     _watermarkOpacity(0.2),
-    _accessibilityState(false)
+    _accessibilityState(false),
+    _tileDictionary(false)
 {
 }
 
@@ -76,6 +77,37 @@ bool Session::sendBinaryFrame(const char *buffer, int length)
     return _protocol->sendBinaryMessage(buffer, length) >= length;
 }
 
+bool Session::sendMessageFrame(const std::shared_ptr<Message>& message)
+{
+    const std::vector<char>& data = message->data();
+    if (!_protocol)
+    {
+        LOG_TRC("ERR - missing protocol " << getName() << ": Send: " << message->abbr());
+        return false;
+    }
+
+    LOG_TRC("Send: " << message->abbr());
+
+    // Keep the message alive while its data is referenced.
+    const std::shared_ptr<const void> owner(message, &data);
+    return _protocol->sendSharedMessage(owner, data.data(), data.size(), message->isBinary())
+           >= static_cast<int>(data.size());
+}
+
+bool Session::sendTextFrameAndFlush(const std::string& text)
+{
+    if (!_protocol)
+    {
+        LOG_TRC("ERR - missing protocol " << getName() << ": Send: ["
+                                          << getAbbreviatedMessage(text) << ']');
+        return false;
+    }
+
+    LOG_TRC("Send and flush: [" << getAbbreviatedMessage(text) << ']');
+    return _protocol->sendTextMessage(text.data(), text.size(), /*flush=*/true)
+           >= static_cast<int>(text.size());
+}
+
 void Session::parseDocOptions(const StringVector& tokens, int& part, std::string& timestamp, std::string& doctemplate)
 {
     // First token is the "load" command itself.
@@ -215,6 +247,11 @@ void Session::parseDocOptions(const StringVector& tokens, int& part, std::string
             _accessibilityState = value == "true";
             ++offset;
         }
+        else if (name == "tileDictionary")
+        {
+            _tileDictionary = value == "true";
+            ++offset;
+        }
     }
 
     Util::mapAnonymized(_userId, _userIdAnonym);
@@ -294,6 +331,16 @@ void Session::getIOStats(uint64_t &sent, uint64_t &recv)
     _protocol->getIOStats(sent, recv);
 }
 
+void Session::getCompressionStats(uint64_t &raw, uint64_t &compressed,
+                                  std::chrono::microseconds &time)
+{
+    raw = 0;
+    compressed = 0;
+    time = std::chrono::microseconds::zero();
+    if (_protocol)
+        _protocol->getCompressionStats(raw, compressed, time);
+}
+
 void Session::dumpState(std::ostream& os)
 {
     os << "\n\t\tid: " << _id
@@ -111,6 +111,14 @@ public:
     virtual bool sendBinaryFrame(const char* buffer, int length);
     virtual bool sendTextFrame(const char* buffer, const int length);
 
+    /// Sends @message as is, referencing rather than copying
+    /// its data where possible, eg. when fanned out to many sessions.
+    bool sendMessageFrame(const std::shared_ptr<Message>& message);
+
+    /// Sends a text frame and writes it out to the socket right away,
+    /// rather than when the socket is next polled.
+    bool sendTextFrameAndFlush(const std::string& text);
+
     /// Get notified that the underlying transports disconnected
     void onDisconnect() override { /* ignore */ }
 
@@ -202,6 +210,8 @@ public:
 
     void getIOStats(uint64_t &sent, uint64_t &recv);
 
+    void getCompressionStats(uint64_t &raw, uint64_t &compressed, std::chrono::microseconds &time);
+
     void setUserId(const std::string& userId) { _userId = userId; }
 
     const std::string& getUserId() const { return _userId; }
@@ -262,6 +272,8 @@ public:
 
     bool getAccessibilityState() const { return _accessibilityState; }
 
+    bool getTileDictionary() const { return _tileDictionary; }
+
 protected:
     Session(const std::shared_ptr<ProtocolHandlerInterface> &handler,
             const std::string& name, const std::string& id, bool readonly);
@@ -381,6 +393,9 @@ private:
 
     /// Specifies whether accessibility support is enabled for this session.
     bool _accessibilityState;
+
+    /// Whether the client can decompress tiles primed with a zstd dictionary.
+    bool _tileDictionary;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -12,9 +12,17 @@
 #include <config.h>
 #include <Simd.hpp>
 
+#include <cstdint>
+#include <cstring>
+
 #if ENABLE_SIMD
 #  include <immintrin.h>
 #endif
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
 
 namespace simd {
 
@@ -29,6 +37,100 @@ bool init()
     return HasAVX2;
 }
 
+namespace {
+
+#if ENABLE_SIMD
+// Unlike DeltaSimd.c, the rest of this file is not built with -mavx2, so
+// that no inlined C++ code built for AVX2 can end up being used elsewhere.
+// Only this function, which uses nothing but intrinsics, targets AVX2.
+__attribute__((target("avx2")))
+std::size_t maskAVX2(const unsigned char* from, unsigned char* to, std::size_t len,
+                     const unsigned char* key)
+{
+    const __m256i vkey = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key));
+
+    std::size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + i), _mm256_xor_si256(data, vkey));
+    }
+
+    return i;
+}
+#endif
+
+/// Masks what the baseline instruction set allows, returns the bytes done.
+std::size_t maskVector(const unsigned char* from, unsigned char* to, std::size_t len,
+                       const unsigned char* key)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i vkey = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(to + i), _mm_xor_si128(data, vkey));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t vkey = vld1q_u8(key);
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(to + i, veorq_u8(vld1q_u8(from + i), vkey));
+#else
+    (void)from;
+    (void)to;
+    (void)len;
+    (void)key;
+#endif
+    return i;
+}
+
+} // namespace
+
+void maskPayload(const unsigned char* from, unsigned char* to, std::size_t len,
+                 const unsigned char* mask, std::size_t offset)
+{
+    // Most messages are a few bytes of keystrokes and mouse moves.
+    if (len < 16)
+    {
+        maskPayloadScalar(from, to, len, mask, offset);
+        return;
+    }
+
+    // The mask repeated, in memory order, so that every step below masks a
+    // multiple of 4 bytes and the next one can start at the same place in it.
+    unsigned char key[32];
+    for (std::size_t k = 0; k < sizeof(key); ++k)
+        key[k] = mask[(offset + k) % 4];
+
+    std::size_t i = 0;
+#if ENABLE_SIMD
+    if (HasAVX2)
+        i = maskAVX2(from, to, len, key);
+#endif
+    i += maskVector(from + i, to + i, len - i, key);
+
+    std::uint64_t key64;
+    std::memcpy(&key64, key, sizeof(key64));
+    for (; i + sizeof(key64) <= len; i += sizeof(key64))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, from + i, sizeof(word));
+        word ^= key64;
+        std::memcpy(to + i, &word, sizeof(word));
+    }
+
+    for (; i < len; ++i)
+        to[i] = from[i] ^ key[i % 4];
+}
+
+void maskPayloadScalar(const unsigned char* from, unsigned char* to, std::size_t len,
+                       const unsigned char* mask, std::size_t offset)
+{
+    for (std::size_t i = 0; i < len; ++i)
+        to[i] = from[i] ^ mask[(offset + i) % 4];
+}
+
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
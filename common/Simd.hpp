@@ -13,9 +13,20 @@
 
 #include <config.h>
 
+#include <cstddef>
+
 namespace simd {
     bool init();
     extern bool HasAVX2;
+
+    /// XORs @len bytes at @from with the 4-byte websocket @mask into @to,
+    /// which may be @from, as if the payload started at byte @offset of the mask.
+    void maskPayload(const unsigned char* from, unsigned char* to, std::size_t len,
+                     const unsigned char* mask, std::size_t offset = 0);
+
+    /// The byte-wise equivalent of maskPayload, for reference.
+    void maskPayloadScalar(const unsigned char* from, unsigned char* to, std::size_t len,
+                           const unsigned char* mask, std::size_t offset = 0);
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -25,6 +25,7 @@
 #endif
 
 #ifdef __linux__
+#  include <sched.h>
 #  include <sys/prctl.h>
 #  include <sys/syscall.h>
 #  include <sys/vfs.h>
@@ -46,6 +47,7 @@
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -370,6 +372,106 @@ namespace Util
 #endif
     }
 
+    /// Returns the first line of the file at @path, or an empty string.
+    static std::string getFileLine(const std::string& path)
+    {
+        std::string result;
+        FILE* file = fopen(path.c_str(), "r");
+        if (file != nullptr)
+        {
+            char line[4096] = { 0 };
+            if (fgets(line, sizeof(line), file))
+                result = line;
+            fclose(file);
+        }
+
+        return result;
+    }
+
+    /// Whether the comma-separated list of cgroup v1 controllers has the cpu one.
+    static bool isCpuController(const std::string& controllers)
+    {
+        const StringVector tokens = StringVector::tokenize(controllers, ',');
+        for (std::size_t i = 0; i < tokens.size(); ++i)
+        {
+            if (tokens.equals(i, "cpu"))
+                return true;
+        }
+
+        return false;
+    }
+
+    /// Returns the cgroup's CPU quota in CPUs, or 0 if unlimited or not available.
+    static double getCGroupCpuQuota()
+    {
+#ifdef __linux__
+        FILE* cg = fopen("/proc/self/cgroup", "r");
+        if (cg == nullptr)
+            return 0;
+
+        double quota = 0;
+        char line[4096] = { 0 };
+        while (quota == 0 && fgets(line, sizeof(line), cg))
+        {
+            StringVector bits = StringVector::tokenize(line, strlen(line), ':');
+            if (bits.size() < 3)
+                continue;
+
+            std::string path = bits[2];
+            if (!path.empty() && path.back() == '\n')
+                path.pop_back();
+
+            long long limit = 0;
+            long long period = 0;
+            if (bits[0] == "0" && bits[1].empty())
+            {
+                // cgroup v2: "<quota> <period>" or "max <period>".
+                FILE* file = fopen(("/sys/fs/cgroup" + path + "/cpu.max").c_str(), "r");
+                if (file != nullptr)
+                {
+                    char max[64] = { 0 };
+                    if (fscanf(file, "%63s %lld", max, &period) == 2 && strcmp(max, "max") != 0)
+                        limit = atoll(max);
+                    fclose(file);
+                }
+            }
+            else if (isCpuController(bits[1]))
+            {
+                // cgroup v1: a quota of -1 means unlimited.
+                const std::string groupPath = "/sys/fs/cgroup/" + bits[1] + path;
+                limit = atoll(getFileLine(groupPath + "/cpu.cfs_quota_us").c_str());
+                period = atoll(getFileLine(groupPath + "/cpu.cfs_period_us").c_str());
+            }
+
+            if (limit > 0 && period > 0)
+                quota = static_cast<double>(limit) / period;
+        }
+
+        fclose(cg);
+        LOG_TRC("cgroup CPU quota: " << quota);
+        return quota;
+#else
+        return 0;
+#endif
+    }
+
+    int getAvailableCpus()
+    {
+        int cpus = std::max<int>(std::thread::hardware_concurrency(), 1);
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+            cpus = CPU_COUNT(&set);
+#endif
+
+        const double quota = getCGroupCpuQuota();
+        if (quota > 0)
+            cpus = std::min<int>(cpus, std::max<int>(std::ceil(quota), 1));
+
+        return cpus;
+    }
+
     std::pair<std::size_t, std::size_t> getPssAndDirtyFromSMaps(FILE* file)
     {
         std::size_t numPSSKb = 0;
@@ -255,6 +255,10 @@ namespace Util
     /// Returns the cgroup's soft memory limit, or 0 if not available in bytes
     std::size_t getCGroupMemSoftLimit();
 
+    /// Returns the number of CPUs we can run on: those in our affinity mask,
+    /// limited by the cgroup's CPU quota, if any.
+    int getAvailableCpus();
+
     /// Returns the process PSS in KB (works only when we have perms for /proc/pid/smaps).
     size_t getMemoryUsagePSS(const pid_t pid);
 
@@ -0,0 +1,55 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "config.h"
+
+#include <net/HttpRequest.hpp>
+
+/// Parse the request header as it trickles in, which must agree with
+/// parsing it all at once.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    const char* p = reinterpret_cast<const char*>(data);
+
+    http::RequestHeaderParser incremental;
+    http::FieldParseState state = http::FieldParseState::Unknown;
+    for (size_t i = 0; i <= size; ++i)
+    {
+        state = incremental.parse(p, i);
+        if (state == http::FieldParseState::Valid || state == http::FieldParseState::Invalid)
+            break;
+    }
+
+    http::RequestHeaderParser whole;
+    if (whole.parse(p, size) != state)
+        abort();
+
+    if (state == http::FieldParseState::Valid)
+    {
+        if (whole.getHeaderSize() != incremental.getHeaderSize() ||
+            whole.getHeaderSize() > static_cast<int64_t>(size) ||
+            whole.getUrl() != incremental.getUrl() ||
+            whole.getFieldCount() != incremental.getFieldCount() ||
+            whole.getContentLength() != incremental.getContentLength())
+        {
+            abort();
+        }
+
+        // Everything parsed must be within the header.
+        const char* const end = p + whole.getHeaderSize();
+        for (size_t i = 0; i < whole.getFieldCount(); ++i)
+        {
+            const std::string_view name = whole.getFieldName(i);
+            const std::string_view value = whole.getFieldValue(i);
+            if (name.empty() || name.data() < p || name.data() + name.size() > end ||
+                value.data() < p || value.data() + value.size() > end)
+            {
+                abort();
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
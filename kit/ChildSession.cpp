@@ -441,6 +441,7 @@ bool ChildSession::_handleInput(const char *buffer, int length)
                tokens.equals(0, "windowmouse") ||
                tokens.equals(0, "windowgesture") ||
                tokens.equals(0, "uno") ||
+               tokens.equals(0, "backgroundsave") ||
                tokens.equals(0, "selecttext") ||
                tokens.equals(0, "windowselecttext") ||
                tokens.equals(0, "selectgraphic") ||
@@ -549,6 +550,9 @@ bool ChildSession::_handleInput(const char *buffer, int length)
             }
             else if (tokens[1].find(".uno:Save") != std::string::npos)
             {
+                // Don't race with a background save writing the same file.
+                _docManager->joinBackgroundSave();
+
                 // Disable processing of other messages while saving document
                 InputProcessingManager processInput(getProtocol(), false);
                 return unoCommand(tokens);
@@ -556,6 +560,10 @@ bool ChildSession::_handleInput(const char *buffer, int length)
 
             return unoCommand(tokens);
         }
+        else if (tokens.equals(0, "backgroundsave"))
+        {
+            return backgroundSave(tokens);
+        }
         else if (tokens.equals(0, "selecttext"))
         {
             return selectText(tokens, LokEventTargetEnum::Document);
@@ -1896,6 +1904,59 @@ bool ChildSession::unoCommand(const StringVector& tokens)
     return true;
 }
 
+bool ChildSession::backgroundSave(const StringVector& tokens)
+{
+    // Only one save at a time, since they all write the same file.
+    _docManager->joinBackgroundSave();
+
+    SigUtil::addActivity(getId(), "background save");
+
+    // Save as .uno:Save would: in the format of the file, keeping its password.
+    const std::string format = Poco::Path(Poco::URI(getJailedFilePath()).getPath()).getExtension();
+    std::string filterOptions;
+    appendPasswordFilterOptions(filterOptions);
+
+    _backgroundSaveArgs = tokens.cat(' ', 1);
+    if (_docManager->startBackgroundSave(getId(), getJailedFilePath(), format, filterOptions))
+        return true;
+
+    // Couldn't fork; save in the foreground with the same arguments.
+    LOG_WRN("Failed to start background save of [" << getJailedFilePathAnonym()
+                                                   << "], saving in the foreground");
+    return foregroundSave(_backgroundSaveArgs);
+}
+
+bool ChildSession::foregroundSave(const std::string& saveArgs)
+{
+    const StringVector saveTokens = StringVector::tokenize("uno .uno:Save " + saveArgs);
+
+    // Disable processing of other messages while saving document
+    InputProcessingManager processInput(getProtocol(), false);
+    return unoCommand(saveTokens);
+}
+
+void ChildSession::backgroundSaveTimedOut()
+{
+    // WSD still waits for the result of its save, which this one will give.
+    LOG_WRN("Background save of [" << getJailedFilePathAnonym()
+                                   << "] timed out, saving in the foreground");
+    foregroundSave(_backgroundSaveArgs);
+}
+
+void ChildSession::backgroundSaveDone(bool success)
+{
+#if !MOBILEAPP
+    consistencyCheckJail();
+
+    renameForUpload(getJailedFilePath());
+#endif
+
+    // Mimic Core's LOK_CALLBACK_UNO_COMMAND_RESULT, so WSD handles it as any other save.
+    sendTextFrame(std::string("unocommandresult: {\"commandName\":\".uno:Save\",\"success\":") +
+                  (success ? "true}" : "false,\"result\":{\"type\":\"string\",\"value\":"
+                                       "\"background save failed\"}}"));
+}
+
 bool ChildSession::selectText(const StringVector& tokens,
                               const LokEventTargetEnum target)
 {
@@ -2250,6 +2311,25 @@ bool ChildSession::resetSelection(const StringVector& tokens)
     return true;
 }
 
+bool ChildSession::appendPasswordFilterOptions(std::string& filterOptions) const
+{
+    if (!_docManager->isDocPasswordProtected() || !_docManager->haveDocPassword())
+        return false;
+
+    if (_docManager->getDocPasswordType() == DocumentPasswordType::ToView)
+    {
+        filterOptions += std::string(",Password=") + _docManager->getDocPassword() +
+                         std::string("PASSWORDEND");
+    }
+    else
+    {
+        filterOptions += std::string(",PasswordToModify=") + _docManager->getDocPassword() +
+                         std::string("PASSWORDTOMODIFYEND");
+    }
+
+    return true;
+}
+
 bool ChildSession::saveAs(const StringVector& tokens)
 {
     std::string wopiFilename, url, format, filterOptions;
@@ -2310,18 +2390,8 @@ bool ChildSession::saveAs(const StringVector& tokens)
         filterOptions = "EmbedImages";
     }
 
-    if (_docManager->isDocPasswordProtected() && _docManager->haveDocPassword())
+    if (appendPasswordFilterOptions(filterOptions))
     {
-        if (_docManager->getDocPasswordType() == DocumentPasswordType::ToView)
-        {
-            filterOptions += std::string(",Password=") + _docManager->getDocPassword() +
-                             std::string("PASSWORDEND");
-        }
-        else
-        {
-            filterOptions += std::string(",PasswordToModify=") + _docManager->getDocPassword() +
-                             std::string("PASSWORDTOMODIFYEND");
-        }
         // Password might have changed since load
         setHaveDocPassword(true);
         setDocPassword(_docManager->getDocPassword());
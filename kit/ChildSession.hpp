@@ -87,6 +87,16 @@ public:
     virtual DocumentPasswordType getDocPasswordType() const = 0;
 
     virtual void updateActivityHeader() const = 0;
+
+    /// Save the document to @url in a forked snapshot of the Kit, on behalf of @sessionId,
+    /// with the given saveAs @format and @filterOptions (either may be empty).
+    /// Returns false if the save couldn't be started and must be done in the foreground.
+    virtual bool startBackgroundSave(const std::string& sessionId, const std::string& url,
+                                     const std::string& format,
+                                     const std::string& filterOptions) = 0;
+
+    /// Wait for a background save in progress, if any, to finish and report its result.
+    virtual void joinBackgroundSave() = 0;
 };
 
 struct RecordedEvent
@@ -237,6 +247,12 @@ public:
 
     void loKitCallback(const int type, const std::string& payload);
 
+    /// Reports the result of a background save to the client, as .uno:Save would.
+    void backgroundSaveDone(bool success);
+
+    /// Saves in the foreground after a background save took too long.
+    void backgroundSaveTimedOut();
+
     /// Initializes the watermark support, if enabled and required.
     /// Returns true if watermark is enabled and initialized.
     bool initWatermark()
@@ -324,6 +340,11 @@ private:
     bool dialogEvent(const StringVector& tokens);
     bool completeFunction(const StringVector& tokens);
     bool unoCommand(const StringVector& tokens);
+    bool backgroundSave(const StringVector& tokens);
+    bool foregroundSave(const std::string& saveArgs);
+    /// Appends the filter options to keep the document's password, if any, when saving it.
+    /// Returns true if there was such a password.
+    bool appendPasswordFilterOptions(std::string& filterOptions) const;
     bool selectText(const StringVector& tokens, const LokEventTargetEnum target);
     bool selectGraphic(const StringVector& tokens);
     bool renderWindow(const StringVector& tokens);
@@ -408,6 +429,7 @@ public:
             // FIXME: _pixmapCache
             << "\n\texportAsWopiUrl: " << _exportAsWopiUrl
             << "\n\tviewRenderedState: " << _viewRenderState
+            << "\n\tbackgroundSaveArgs: " << _backgroundSaveArgs
             << "\n\tisDumpingTiles: " << _isDocLoaded
             << "\n\tclientVisibleArea: " << _clientVisibleArea.toString()
             << "\n\thasURP: " << _hasURP
@@ -451,6 +473,9 @@ private:
     /// stores info about the view
     std::string _viewRenderState;
 
+    /// the .uno:Save arguments of the last background save, to redo it in the foreground
+    std::string _backgroundSaveArgs;
+
     /// the canonical id unique to the set of rendering properties of this session
     int _canonicalViewId;
 
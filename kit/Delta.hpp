@@ -18,6 +18,7 @@
 #include <assert.h>
 #include <zlib.h>
 #include <zstd.h>
+#include <zdict.h>
 #include <Log.hpp>
 #include <Common.hpp>
 #include <FileUtil.hpp>
@@ -62,6 +63,44 @@ struct TileLocation {
     }
 };
 
+/// A zstd dictionary trained on typical tile content, used to prime
+/// the compression of keyframes and deltas, which are otherwise too
+/// small to build up much of a history of their own.
+class TileDictionary final
+{
+    std::vector<char> _data;
+    unsigned _id;
+    ZSTD_CDict* _cdict;
+    ZSTD_DDict* _ddict;
+
+public:
+    TileDictionary(std::vector<char> data, int compressionLevel)
+        : _data(std::move(data))
+        , _id(ZDICT_getDictID(_data.data(), _data.size()))
+        , _cdict(ZSTD_createCDict(_data.data(), _data.size(), compressionLevel))
+        , _ddict(ZSTD_createDDict(_data.data(), _data.size()))
+    {
+    }
+
+    TileDictionary(const TileDictionary&) = delete;
+    TileDictionary& operator=(const TileDictionary&) = delete;
+
+    ~TileDictionary()
+    {
+        ZSTD_freeCDict(_cdict);
+        ZSTD_freeDDict(_ddict);
+    }
+
+    /// Only trained dictionaries with a header and non-zero id are usable:
+    /// clients need the id to match frames up with the dictionary.
+    bool isValid() const { return _id != 0 && _cdict && _ddict; }
+
+    unsigned getId() const { return _id; }
+    const std::vector<char>& getData() const { return _data; }
+    const ZSTD_CDict* getCDict() const { return _cdict; }
+    const ZSTD_DDict* getDDict() const { return _ddict; }
+};
+
 /// A quick and dirty, thread-safe delta generator for last tile changes
 class DeltaGenerator {
 
@@ -70,6 +109,92 @@ class DeltaGenerator {
     // fast - and deltas take lots of size off.
     static const int compressionLevel = -3;
 
+    /// Per-thread zstd contexts, re-used for every tile compressed
+    /// on that thread rather than created and freed each time.
+    class ZstdContexts final
+    {
+        ZSTD_CCtx* _cctx;
+        ZSTD_DCtx* _dctx;
+
+        ZstdContexts()
+            : _cctx(ZSTD_createCCtx())
+            , _dctx(ZSTD_createDCtx())
+        {
+        }
+
+    public:
+        ZstdContexts(const ZstdContexts&) = delete;
+        ZstdContexts& operator=(const ZstdContexts&) = delete;
+
+        ~ZstdContexts()
+        {
+            ZSTD_freeCCtx(_cctx);
+            ZSTD_freeDCtx(_dctx);
+        }
+
+        static ZstdContexts& get()
+        {
+            static thread_local ZstdContexts contexts;
+            return contexts;
+        }
+
+        /// The compression context, reset for a new frame at @level,
+        /// primed with @dictionary if given.
+        ZSTD_CCtx* compression(int level, const TileDictionary* dictionary = nullptr)
+        {
+            ZSTD_CCtx_reset(_cctx, ZSTD_reset_session_and_parameters);
+            ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, level);
+            if (dictionary)
+                ZSTD_CCtx_refCDict(_cctx, dictionary->getCDict());
+            return _cctx;
+        }
+
+        /// The decompression context, reset for a new frame,
+        /// primed with @dictionary if given.
+        ZSTD_DCtx* decompression(const TileDictionary* dictionary = nullptr)
+        {
+            ZSTD_DCtx_reset(_dctx, ZSTD_reset_session_and_parameters);
+            if (dictionary)
+                ZSTD_DCtx_refDDict(_dctx, dictionary->getDDict());
+            return _dctx;
+        }
+    };
+
+    /// Compresses @size bytes at @data into @output from @start on, where
+    /// @written bytes of this frame are already; grows @output as needed.
+    static bool compressInto(ZSTD_CCtx* cctx, std::vector<char>& output,
+                             size_t start, size_t& written,
+                             const void* data, size_t size, ZSTD_EndDirective endOp)
+    {
+        ZSTD_inBuffer inb;
+        inb.src = data;
+        inb.size = size;
+        inb.pos = 0;
+
+        for (;;)
+        {
+            // Grow geometrically, so we don't clear the whole compress bound.
+            if (output.size() - start == written)
+                output.resize(output.size() + std::max<size_t>(written, 4096));
+
+            ZSTD_outBuffer outb;
+            outb.dst = output.data() + start;
+            outb.size = output.size() - start;
+            outb.pos = written;
+
+            const size_t remaining = ZSTD_compressStream2(cctx, &outb, &inb, endOp);
+            if (ZSTD_isError(remaining))
+            {
+                LOG_ERR("failed to compress image: " << remaining << " is: " << ZSTD_getErrorName(remaining));
+                return false;
+            }
+            written = outb.pos;
+
+            if (inb.pos == inb.size && (endOp != ZSTD_e_end || remaining == 0))
+                return true;
+        }
+    }
+
     static constexpr size_t _rleMaskUnits = 256 / 64;
 
     /// Bitmap row with a CRC for quick vertical shift detection
@@ -77,6 +202,7 @@ class DeltaGenerator {
         size_t _rleSize;
         uint64_t _rleMask[_rleMaskUnits];
         uint32_t *_rleData;
+        uint64_t _rleHash; // of the above, to find identical rows quickly.
     public:
         class PixIterator final
         {
@@ -132,6 +258,7 @@ class DeltaGenerator {
         DeltaBitmapRow()
             : _rleSize(0)
             , _rleData(nullptr)
+            , _rleHash(0)
         {
             memset(_rleMask, 0, sizeof(_rleMask));
         }
@@ -200,6 +327,18 @@ class DeltaGenerator {
             *scratchLen = outp;
         }
 
+        /// Hashes the RLE form, which is much smaller than the pixels for most rows.
+        static uint64_t hashRle(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize)
+        {
+            constexpr uint64_t multiplier = 0x9e3779b97f4a7c15; // 2^64 / golden ratio
+            uint64_t hash = rleSize;
+            for (size_t i = 0; i < _rleMaskUnits; ++i)
+                hash = (hash ^ rleMask[i]) * multiplier;
+            for (size_t i = 0; i < rleSize; ++i)
+                hash = (hash ^ rleData[i]) * multiplier;
+            return hash ^ (hash >> 32);
+        }
+
     public:
 
         void initRow(const uint32_t *from, unsigned int width)
@@ -249,11 +388,18 @@ class DeltaGenerator {
             }
             else
                 _rleData = nullptr;
+
+            _rleHash = hashRle(_rleMask, scratch, _rleSize);
+        }
+
+        uint64_t getHash() const
+        {
+            return _rleHash;
         }
 
         bool identical(const DeltaBitmapRow &other) const
         {
-            if (_rleSize != other._rleSize)
+            if (_rleHash != other._rleHash || _rleSize != other._rleSize)
                 return false;
             if (memcmp(_rleMask, other._rleMask, sizeof(_rleMask)))
                 return false;
@@ -355,6 +501,17 @@ class DeltaGenerator {
             }
         }
 
+        /// A placeholder with no rows, to look up the entry at @loc.
+        explicit DeltaData(const TileLocation &loc)
+            : _loc(loc)
+            , _inUse(false)
+            , _wid(0)
+            , _width(0)
+            , _height(0)
+            , _rows(nullptr)
+        {
+        }
+
         ~DeltaData()
         {
             delete[] _rows;
@@ -403,23 +560,6 @@ class DeltaGenerator {
             return total;
         }
 
-        void replaceAndFree(std::shared_ptr<DeltaData> &repl)
-        {
-            assert (_loc == repl->_loc);
-            if (repl.get() == this)
-            {
-                assert(!"replacing with yourself should never happen");
-                return;
-            }
-            _wid = repl->_wid;
-            _width = repl->_width;
-            _height = repl->_height;
-            delete[] _rows;
-            _rows = repl->_rows;
-            repl->_rows = nullptr;
-            repl.reset();
-        }
-
         inline void use()
         {
             const bool wasInUse = _inUse.exchange(true); (void)wasInUse;
@@ -441,6 +581,57 @@ class DeltaGenerator {
         DeltaBitmapRow *_rows;
     };
 
+    /// Finds the rows of a tile by their hash, to look for moved rows
+    /// without comparing against every row.
+    class RowIndex final {
+        static constexpr int _buckets = 512; // a power of two, over the max. height.
+        int16_t _head[_buckets];
+        int16_t _next[256];
+        const DeltaData &_data;
+
+        static int bucket(uint64_t hash)
+        {
+            return hash & (_buckets - 1);
+        }
+
+    public:
+        RowIndex(const DeltaData &data)
+            : _data(data)
+        {
+            assert (data.getHeight() <= 256);
+
+            std::fill(std::begin(_head), std::end(_head), -1);
+            // Insert backwards so that each chain is in row order.
+            for (int y = data.getHeight() - 1; y >= 0; --y)
+            {
+                const int b = bucket(data.getRow(y).getHash());
+                _next[y] = _head[b];
+                _head[b] = y;
+            }
+        }
+
+        /// Returns the first row identical to @row, counting from row @start
+        /// and wrapping around, or -1 if there is none.
+        int find(const DeltaBitmapRow &row, int start) const
+        {
+            const int height = _data.getHeight();
+            int best = -1;
+            int bestDistance = height;
+            for (int y = _head[bucket(row.getHash())]; y >= 0; y = _next[y])
+            {
+                const int distance = (y - start + height) % height;
+                if (distance < bestDistance && _data.getRow(y).identical(row))
+                {
+                    best = y;
+                    bestDistance = distance;
+                    if (distance == 0)
+                        break;
+                }
+            }
+            return best;
+        }
+    };
+
     struct DeltaHasher {
         std::size_t operator()(const std::shared_ptr<DeltaData> &t) const
         {
@@ -457,9 +648,12 @@ class DeltaGenerator {
     };
 
     std::mutex _deltaGuard;
-    /// The last several bitmap entries as a cache
+    /// The last several bitmap entries as a cache, they are replaced
+    /// rather than modified, as neighbouring tiles may be reading them.
     std::unordered_set<std::shared_ptr<DeltaData>, DeltaHasher, DeltaCompare> _deltaEntries;
     size_t _maxEntries;
+    /// Optional dictionary priming our compression.
+    std::shared_ptr<const TileDictionary> _dictionary;
 
     void rebalanceDeltasT(bool bDropAll = false)
     {
@@ -481,6 +675,51 @@ class DeltaGenerator {
         }
     }
 
+    /// Returns the cached tile above (@below false) or below @loc, if any,
+    /// and only if it is version @wid, which the client has. Expects _deltaGuard held.
+    std::shared_ptr<DeltaData> findNeighbourT(const TileLocation &loc, bool below, TileWireId wid)
+    {
+        if (wid == 0)
+            return nullptr;
+
+        // Tiles are square: the neighbour is one tile size away.
+        const int top = below ? loc._top + loc._size : loc._top - loc._size;
+        const auto it = _deltaEntries.find(std::make_shared<DeltaData>(
+            TileLocation(loc._left, top, loc._size, loc._part, loc._canonicalViewId)));
+        if (it == _deltaEntries.end() || (*it)->getWid() != wid)
+            return nullptr;
+        return *it;
+    }
+
+    /// Appends the copy of row @y from row @match of the @below or above
+    /// tile of wire id @wid, extending the last such copy if it can.
+    static void copyNeighbourRow(std::vector<uint8_t> &output, size_t &lastCopy,
+                                 bool below, TileWireId wid, int match, int y)
+    {
+        if (lastCopy > 0)
+        {
+            const uint8_t cnt = output[lastCopy];
+            if (output[lastCopy + 1] + cnt == match &&
+                output[lastCopy + 2] + cnt == y &&
+                output[lastCopy + 3] == below &&
+                cnt < 255)
+            {
+                output[lastCopy]++;
+                return;
+            }
+        }
+
+        output.push_back('C');   // copy-row from a neighbour
+        lastCopy = output.size();
+        output.push_back(1);     // count - updated later.
+        output.push_back(match); // src
+        output.push_back(y);     // dest
+        output.push_back(below);
+        // The client must have exactly this version of the neighbour.
+        for (int shift = 0; shift < 32; shift += 8)
+            output.push_back((wid >> shift) & 0xff);
+    }
+
     static void
     copy_row (unsigned char *dest, const unsigned char *srcBytes, unsigned int count, LibreOfficeKitTileMode mode)
     {
@@ -497,11 +736,15 @@ class DeltaGenerator {
         }
     }
 
+    /// Rows not found in @prev are also looked for in the tiles @above
+    /// and @below, if given, as they are what scroll into a tile.
     bool makeDelta(
         const DeltaData &prev,
         const DeltaData &cur,
         std::vector<char>& outStream,
-        LibreOfficeKitTileMode mode)
+        LibreOfficeKitTileMode mode,
+        const DeltaData *above = nullptr,
+        const DeltaData *below = nullptr)
     {
         // TODO: should we split and compress alpha separately ?
         if (prev.getWidth() != cur.getWidth() || prev.getHeight() != cur.getHeight())
@@ -527,48 +770,78 @@ class DeltaGenerator {
         // How do the rows look against each other ?
         size_t lastMatchOffset = 0;
         size_t lastCopy = 0;
+        std::unique_ptr<RowIndex> prevRows; // only built if some rows changed.
+
+        // Neighbours of another size, eg. at the edge of the document, won't do.
+        if (above && (above->getWidth() != cur.getWidth() || above->getHeight() != cur.getHeight()))
+            above = nullptr;
+        if (below && (below->getWidth() != cur.getWidth() || below->getHeight() != cur.getHeight()))
+            below = nullptr;
+        std::unique_ptr<RowIndex> aboveRows;
+        std::unique_ptr<RowIndex> belowRows;
+        size_t lastNeighbourCopy = 0;
+        bool neighbourCopies = false;
         for (int y = 0; y < prev.getHeight(); ++y)
         {
             // Life is good where rows match:
             if (prev.getRow(y).identical(cur.getRow(y)))
                 continue;
 
-            // Hunt for other rows
-            bool matched = false;
-            for (int yn = 0; yn < prev.getHeight() && !matched; ++yn)
+            // Hunt for other rows, nearest to where the last one moved from first
+            if (!prevRows)
+                prevRows = std::make_unique<RowIndex>(prev);
+            const int found = prevRows->find(cur.getRow(y), (y + lastMatchOffset) % prev.getHeight());
+            if (found >= 0)
             {
-                size_t match = (y + lastMatchOffset + yn) % prev.getHeight();
-                if (prev.getRow(match).identical(cur.getRow(y)))
+                const size_t match = found;
+
+                // TODO: if offsets are >256 - use 16bits?
+                if (lastCopy > 0)
                 {
-                    // TODO: if offsets are >256 - use 16bits?
-                    if (lastCopy > 0)
+                    // check if we can extend the last copy
+                    uint8_t cnt = output[lastCopy];
+                    if (output[lastCopy + 1] + cnt == match &&
+                        output[lastCopy + 2] + cnt == y &&
+                        // make sure we're not copying from out of bounds of the previous tile
+                        output[lastCopy + 1] + cnt + 1 < prev.getHeight())
                     {
-                        // check if we can extend the last copy
-                        uint8_t cnt = output[lastCopy];
-                        if (output[lastCopy + 1] + cnt == match &&
-                            output[lastCopy + 2] + cnt == y &&
-                            // make sure we're not copying from out of bounds of the previous tile
-                            output[lastCopy + 1] + cnt + 1 < prev.getHeight())
-                        {
-                            output[lastCopy]++;
-                            matched = true;
-                            continue;
-                        }
+                        output[lastCopy]++;
+                        continue;
                     }
+                }
 
-                    lastMatchOffset = match - y;
-                    output.push_back('c');   // copy-row
-                    lastCopy = output.size();
-                    output.push_back(1);     // count - updated later.
-                    output.push_back(match); // src
-                    output.push_back(y);     // dest
+                lastMatchOffset = match - y;
+                output.push_back('c');   // copy-row
+                lastCopy = output.size();
+                output.push_back(1);     // count - updated later.
+                output.push_back(match); // src
+                output.push_back(y);     // dest
+                continue;
+            }
 
-                    matched = true;
+            // Has it scrolled in from a neighbour ? Rows from above
+            // arrive at the top and from below at the bottom.
+            const bool fromBelow = y >= cur.getHeight() / 2;
+            const DeltaData *neighbour = fromBelow ? below : above;
+            if (neighbour)
+            {
+                std::unique_ptr<RowIndex> &neighbourRows = fromBelow ? belowRows : aboveRows;
+                if (!neighbourRows)
+                    neighbourRows = std::make_unique<RowIndex>(*neighbour);
+                // Prefer continuing the last copy, then the edge nearest to us.
+                int start = fromBelow ? 0 : neighbour->getHeight() - 1;
+                if (lastNeighbourCopy > 0 && output[lastNeighbourCopy + 3] == fromBelow)
+                    start = (output[lastNeighbourCopy + 1] + output[lastNeighbourCopy]) %
+                            neighbour->getHeight();
+                const int neighbourMatch = neighbourRows->find(cur.getRow(y), start);
+                if (neighbourMatch >= 0)
+                {
+                    copyNeighbourRow(output, lastNeighbourCopy, fromBelow,
+                                     neighbour->getWid(), neighbourMatch, y);
+                    neighbourCopies = true;
                     continue;
                 }
             }
-            if (matched)
-                continue;
 
             // Our row is just that different:
             prev.getRow(y).diffRowTo(cur.getRow(y), prev.getWidth(), y, output, mode);
@@ -587,28 +860,25 @@ class DeltaGenerator {
         // terminating this delta so we can detect the next one.
         output.push_back('t');
 
-        // FIXME: avoid allocation & make this more efficient.
-        size_t maxCompressed = ZSTD_COMPRESSBOUND(output.size());
-        std::unique_ptr<char, void (*)(void*)> compressed((char*)malloc(maxCompressed), free);
-
         // compress for speed, not size - and trust to deltas.
-        size_t compSize = ZSTD_compress(compressed.get(), maxCompressed,
-                                        output.data(), output.size(),
-                                        compressionLevel);
+        // Deltas that depend on neighbouring tiles are flagged for WSD.
+        outStream.push_back(neighbourCopies ? 'N' : 'D');
+        const size_t oldSize = outStream.size();
+        outStream.resize(oldSize + ZSTD_COMPRESSBOUND(output.size()));
+
+        ZSTD_CCtx* cctx = ZstdContexts::get().compression(compressionLevel, _dictionary.get());
+        const size_t compSize = ZSTD_compress2(cctx, &outStream[oldSize], outStream.size() - oldSize,
+                                               output.data(), output.size());
         if (ZSTD_isError(compSize))
         {
             LOG_ERR("Failed to compress delta of size " << output.size() << " with " << ZSTD_getErrorName(compSize));
+            outStream.resize(oldSize - 1);
             return false;
         }
+        outStream.resize(oldSize + compSize);
 
         LOG_TRC("Compressed delta of size " << output.size() << " to size " << compSize);
-//                << Util::dumpHex(std::string((char *)compressed.get(), compSize)));
-
-        // FIXME: should get zstd to drop it directly in-place really.
-        outStream.push_back('D');
-        size_t oldSize = outStream.size();
-        outStream.resize(oldSize + compSize);
-        memcpy(&outStream[oldSize], compressed.get(), compSize);
+//                << Util::dumpHex(std::string(&outStream[oldSize], compSize)));
 
         return true;
     }
@@ -639,6 +909,49 @@ class DeltaGenerator {
         rebalanceDeltasT(true);
     }
 
+    /// Primes all subsequent keyframes and deltas with @dictionary.
+    /// Not guarded: only change it between renders, and dropCache()
+    /// when turning it off, so the next tiles are keyframes without it.
+    void setDictionary(const std::shared_ptr<const TileDictionary>& dictionary)
+    {
+        _dictionary = dictionary;
+    }
+
+    const std::shared_ptr<const TileDictionary>& getDictionary() const { return _dictionary; }
+
+    /// Creates a dictionary of at most @capacity bytes from @samples,
+    /// eg. the uncompressed rows or deltas of typical tiles.
+    static std::shared_ptr<const TileDictionary>
+    trainDictionary(const std::vector<std::vector<char>>& samples, size_t capacity = 64 * 1024)
+    {
+        std::vector<char> joined;
+        std::vector<size_t> sizes;
+        for (const auto& sample : samples)
+        {
+            joined.insert(joined.end(), sample.begin(), sample.end());
+            sizes.push_back(sample.size());
+        }
+
+        std::vector<char> data(capacity);
+        const size_t size = ZDICT_trainFromBuffer(data.data(), data.size(), joined.data(),
+                                                  sizes.data(), sizes.size());
+        if (ZDICT_isError(size))
+        {
+            LOG_ERR("Failed to train tile dictionary from " << samples.size()
+                                                            << " samples: " << ZDICT_getErrorName(size));
+            return nullptr;
+        }
+        data.resize(size);
+
+        return createDictionary(std::move(data));
+    }
+
+    /// Wraps the bytes of a trained dictionary, ready for our compression level.
+    static std::shared_ptr<const TileDictionary> createDictionary(std::vector<char> data)
+    {
+        return std::make_shared<TileDictionary>(std::move(data), compressionLevel);
+    }
+
     void dumpState(std::ostream& oss)
     {
         oss << "\tdelta generator with " << _deltaEntries.size() << " entries vs. max " << _maxEntries << "\n";
@@ -657,6 +970,9 @@ class DeltaGenerator {
      *   if so - returns @true and appends the delta to @output
      * stores @pixmap, and other data to accelerate delta
      * creation in a limited size cache.
+     * Rows are only copied from the tiles above and below if the
+     * client acknowledged having version @aboveWid or @belowWid of
+     * them, 0 if unknown.
      */
     bool createDelta(
         unsigned char* pixmap, size_t startX, size_t startY,
@@ -665,7 +981,8 @@ class DeltaGenerator {
         const TileLocation &loc,
         std::vector<char>& output,
         TileWireId wid, bool forceKeyframe,
-        LibreOfficeKitTileMode mode)
+        LibreOfficeKitTileMode mode,
+        TileWireId aboveWid = 0, TileWireId belowWid = 0)
     {
         if ((width & 0x1) != 0) // power of two - RGBA
         {
@@ -688,6 +1005,8 @@ class DeltaGenerator {
                 wid, pixmap, startX, startY, width, height,
                 loc, bufferWidth, bufferHeight));
         std::shared_ptr<DeltaData> cacheEntry;
+        std::shared_ptr<DeltaData> above;
+        std::shared_ptr<DeltaData> below;
 
         {
             // protect _deltaEntries
@@ -701,6 +1020,12 @@ class DeltaGenerator {
             }
             cacheEntry = *it;
             cacheEntry->use();
+
+            if (!forceKeyframe)
+            {
+                above = findNeighbourT(loc, false, aboveWid);
+                below = findNeighbourT(loc, true, belowWid);
+            }
         }
 
         // interestingly cacheEntry may no longer be in the cache by here.
@@ -709,10 +1034,19 @@ class DeltaGenerator {
 
         bool delta = false;
         if (!forceKeyframe)
-            delta = makeDelta(*cacheEntry, *update, output, mode);
+            delta = makeDelta(*cacheEntry, *update, output, mode, above.get(), below.get());
 
-        // no two threads can be working on the same DeltaData.
-        cacheEntry->replaceAndFree(update);
+        {
+            std::unique_lock<std::mutex> guard(_deltaGuard);
+
+            // Replace rather than modify the entry, unless it was dropped meanwhile.
+            auto it = _deltaEntries.find(update);
+            if (it != _deltaEntries.end() && *it == cacheEntry)
+            {
+                _deltaEntries.erase(it);
+                _deltaEntries.insert(update);
+            }
+        }
 
         cacheEntry->unuse();
         return delta;
@@ -729,7 +1063,8 @@ class DeltaGenerator {
         const TileLocation &loc,
         std::vector<char>& output,
         TileWireId wid, bool forceKeyframe,
-        bool dumpTiles, LibreOfficeKitTileMode mode)
+        bool dumpTiles, LibreOfficeKitTileMode mode,
+        TileWireId aboveWid = 0, TileWireId belowWid = 0)
     {
         #if !ENABLE_DEBUG
         dumpTiles = false;
@@ -776,26 +1111,13 @@ class DeltaGenerator {
 
         if (!createDelta(pixmap, startX, startY, width, height,
                          bufferWidth, bufferHeight,
-                         loc, output, wid, forceKeyframe, mode))
+                         loc, output, wid, forceKeyframe, mode, aboveWid, belowWid))
         {
-            // FIXME: should stream it in =)
-            size_t maxCompressed = ZSTD_COMPRESSBOUND((size_t)width * height * 4);
-
-            std::unique_ptr<char, void (*)(void*)> compressed((char*)malloc(maxCompressed), free);
-            if (!compressed)
-            {
-                LOG_ERR("Failed to allocate buffer of size " << maxCompressed << " to compress into");
-                return 0;
-            }
-
-            ZSTD_CCtx *cctx = ZSTD_createCCtx();
-
-            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compressionLevel);
+            output.push_back('Z');
+            const size_t start = output.size();
+            size_t compSize = 0;
 
-            ZSTD_outBuffer outb;
-            outb.dst = compressed.get();
-            outb.size = maxCompressed;
-            outb.pos = 0;
+            ZSTD_CCtx *cctx = ZstdContexts::get().compression(compressionLevel, _dictionary.get());
 
             unsigned char fixedupLine[width * 4];
 
@@ -804,34 +1126,19 @@ class DeltaGenerator {
             {
                 copy_row(fixedupLine, pixmap + ((startY + y) * bufferWidth * 4) + (startX * 4), width, mode);
 
-                ZSTD_inBuffer inb;
-                inb.src = fixedupLine;
-                inb.size = width * 4;
-                inb.pos = 0;
-
                 bool lastRow = (y == height - 1);
 
                 ZSTD_EndDirective endOp = lastRow ? ZSTD_e_end : ZSTD_e_continue;
-                size_t compSize = ZSTD_compressStream2(cctx, &outb, &inb, endOp);
-                if (ZSTD_isError(compSize))
+                if (!compressInto(cctx, output, start, compSize, fixedupLine, width * 4, endOp))
                 {
-                    LOG_ERR("failed to compress image: " << compSize << " is: " << ZSTD_getErrorName(compSize));
-                    ZSTD_freeCCtx(cctx);
+                    output.resize(start - 1);
                     return 0;
                 }
             }
 
-            ZSTD_freeCCtx(cctx);
-
-            size_t compSize = outb.pos;
+            output.resize(start + compSize);
             LOG_TRC("Compressed image of size " << (width * height * 4) << " to size " << compSize);
-//                    << Util::dumpHex(std::string((char *)compressed, compSize)));
-
-            // FIXME: get zstd to compress directly into this buffer.
-            output.push_back('Z');
-            size_t oldSize = output.size();
-            output.resize(oldSize + compSize);
-            memcpy(&output[oldSize], compressed.get(), compSize);
+//                    << Util::dumpHex(std::string(&output[start], compSize)));
         }
         else
         {
@@ -855,12 +1162,14 @@ class DeltaGenerator {
     }
 
     // used only by test code
-    static Blob expand(const Blob &blob)
+    static Blob expand(const Blob &blob, const TileDictionary* dictionary = nullptr)
     {
         Blob img = std::make_shared<BlobData>();
         img->resize(1024*1024*4); // lots of extra space.
 
-        size_t const dSize = ZSTD_decompress(img->data(), img->size(), blob->data(), blob->size());
+        size_t const dSize = ZSTD_decompressDCtx(ZstdContexts::get().decompression(dictionary),
+                                                 img->data(), img->size(),
+                                                 blob->data(), blob->size());
         if (ZSTD_isError(dSize))
         {
             LOG_ERR("Failed to decompress blob of size " << blob->size() << " with " << ZSTD_getErrorName(dSize));
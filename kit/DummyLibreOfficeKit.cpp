@@ -13,6 +13,7 @@
 
 #include "DummyLibreOfficeKit.hpp"
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
@@ -99,7 +100,7 @@ static void doc_setTextSelection (LibreOfficeKitDocument* pThis,
                                   int nType,
                                   int nX,
                                   int nY);
-static char* doc_hyperlinkInfoAtPosition () (LibreOfficeKitDocument* pThis,
+static char* doc_hyperlinkInfoAtPosition (LibreOfficeKitDocument* pThis,
                                   int nX,
                                   int nY);
 static char* doc_getTextSelection(LibreOfficeKitDocument* pThis,
@@ -266,11 +267,20 @@ static void lo_registerCallback (LibreOfficeKit* pThis,
 static int doc_saveAs(LibreOfficeKitDocument* pThis, const char* sUrl, const char* pFormat, const char* pFilterOptions)
 {
     (void) pThis;
-    (void) sUrl;
     (void) pFormat;
     (void) pFilterOptions;
 
-    return true;
+    // Write out something, so saving can be verified.
+    const char* pPath = sUrl;
+    if (strncmp(pPath, "file://", 7) == 0)
+        pPath += 7;
+
+    FILE* pFile = fopen(pPath, "w");
+    if (!pFile)
+        return false;
+
+    const bool bWritten = fputs("Dummy document\n", pFile) >= 0;
+    return fclose(pFile) == 0 && bWritten;
 }
 
 static int doc_getDocumentType (LibreOfficeKitDocument* pThis)
@@ -330,6 +340,7 @@ static void doc_setPartMode(LibreOfficeKitDocument* pThis,
 static int doc_getEditMode(LibreOfficeKitDocument* pThis)
 {
     (void) pThis;
+    return 0;
 }
 
 static void doc_paintTile(LibreOfficeKitDocument* pThis,
@@ -339,15 +350,33 @@ static void doc_paintTile(LibreOfficeKitDocument* pThis,
                           const int nTileWidth, const int nTileHeight)
 {
     (void) pThis;
-    (void) pBuffer;
-    (void) nCanvasWidth;
-    (void) nCanvasHeight;
-    (void) nTilePosX;
-    (void) nTilePosY;
-    (void) nTileWidth;
-    (void) nTileHeight;
 
-    // TODO maybe at least clean the buffer?
+    // Paint a synthetic page: white, with lines of "text" every quarter
+    // inch, and a diagonal band that moves with every paint, so that
+    // repainting gives a mix of unchanged and changed tiles.
+    static unsigned paintCount = 0;
+    ++paintCount;
+
+    for (int y = 0; y < nCanvasHeight; ++y)
+    {
+        const long docY = nTilePosY + static_cast<long>(y) * nTileHeight / nCanvasHeight;
+        unsigned char* row = pBuffer + static_cast<size_t>(y) * nCanvasWidth * 4;
+        for (int x = 0; x < nCanvasWidth; ++x)
+        {
+            const long docX = nTilePosX + static_cast<long>(x) * nTileWidth / nCanvasWidth;
+
+            unsigned char value = 0xff;
+            if (docY % 360 < 200 && (docX / 120) % 9 != 0)
+                value = (docX * 31 + docY * 17) % 96;
+            if (((docX + docY) / 960 + paintCount) % 32 == 0)
+                value /= 2;
+
+            row[x * 4 + 0] = value;
+            row[x * 4 + 1] = value;
+            row[x * 4 + 2] = value;
+            row[x * 4 + 3] = 0xff;
+        }
+    }
 }
 
 
@@ -446,6 +475,7 @@ static char* doc_hyperlinkInfoAtPosition(LibreOfficeKitDocument* pThis, int nX,
     (void) pThis;
     (void) nX;
     (void) nY;
+    return nullptr;
 }
 
 static char* doc_getTextSelection(LibreOfficeKitDocument* pThis, const char* pMimeType, char** pUsedMimeType)
@@ -90,6 +90,9 @@ void dump_forkit_state()
         << "  ClientPortNumber: " << ClientPortNumber << "\n"
         << "  MasterLocation: " << MasterLocation
         << "\n";
+#if !MOBILEAPP
+    dumpJailSetupStats(oss);
+#endif
 
     const std::string msg = oss.str();
     fprintf(stderr, "%s", msg.c_str());
@@ -746,6 +749,16 @@ int forkit_main(int argc, char** argv)
         const auto conf = std::getenv("COOL_CONFIG");
         config::initialize(std::string(conf ? conf : std::string()));
         EnableExperimental = config::getBool("experimental_features", false);
+        SocketPoll::UseEpoll = config::getBool("net.use_epoll", false);
+
+        initJailSetupStats();
+
+        // Without mounting, kits clone a prepared jail rather than link each file.
+        if (!NoCapsForKit && !JailUtil::isBindMountingEnabled() &&
+            config::getBool("clone_jail_template", true))
+        {
+            prepareJailTemplate(childRoot, sysTemplate, loTemplate);
+        }
     }
 #endif
 
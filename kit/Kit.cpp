@@ -17,10 +17,13 @@
 #include <config_version.h>
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <limits>
 #ifdef __linux__
 #include <ftw.h>
+#include <sys/ioctl.h>
 #include <sys/vfs.h>
+#include <linux/fs.h>
 #include <linux/magic.h>
 #include <sys/capability.h>
 #include <sys/sysmacros.h>
@@ -34,8 +37,12 @@
 #endif
 #include <unistd.h>
 #include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <sysexits.h>
 
 #include <atomic>
@@ -45,12 +52,15 @@
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string>
 #include <sstream>
 #include <thread>
 #include <mutex>
+#include <vector>
 
 #define LOK_USE_UNSTABLE_API
 #include <LibreOfficeKit/LibreOfficeKitInit.h>
@@ -175,6 +185,9 @@ namespace
     static std::string UserDirPath;
     static std::string InstDirPath;
 
+    /// Trained tile compression dictionaries by document type, loaded before entering the jail.
+    static std::map<std::string, std::shared_ptr<const TileDictionary>> TileDictionaries;
+
     std::string pathFromFileURL(const std::string &uri)
     {
         std::string decoded;
@@ -543,6 +556,220 @@ namespace
         }
     }
 
+    /// The jail template prepared by forkit, see prepareJailTemplate(), or empty.
+    std::string JailTemplatePath;
+    std::string sourceForCloneJail;
+    std::string destinationForCloneJail;
+    unsigned cloneJailLinkCount = 0;
+    unsigned cloneJailReflinkCount = 0;
+    unsigned cloneJailCopyCount = 0;
+
+    /// A directory created while cloning, with the timestamps to restore once populated.
+    struct ClonedJailDir
+    {
+        std::string _path;
+        struct timespec _times[2];
+    };
+    std::vector<ClonedJailDir> clonedJailDirs;
+
+    /// Clones the template file @fpath as @newPath. We hard-link, like linkOrCopy,
+    /// and fall back to sharing the extents with a reflink (e.g. when the template
+    /// file has as many links as the file-system allows), and then to copying.
+    bool cloneJailFile(const char* fpath, const std::string& newPath, mode_t mode)
+    {
+        if (::link(fpath, newPath.c_str()) == 0)
+        {
+            ++cloneJailLinkCount;
+            return true;
+        }
+
+        LOG_TRC("link(\"" << fpath << "\", \"" << newPath << "\") failed: " << strerror(errno)
+                          << ". Will try to reflink.");
+
+#ifdef FICLONE
+        const int srcFd = ::open(fpath, O_RDONLY | O_CLOEXEC);
+        if (srcFd >= 0)
+        {
+            const int dstFd =
+                ::open(newPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode & 07777);
+            if (dstFd >= 0)
+            {
+                const bool reflinked = (::ioctl(dstFd, FICLONE, srcFd) == 0);
+                ::close(dstFd);
+                if (reflinked)
+                {
+                    ::close(srcFd);
+                    ++cloneJailReflinkCount;
+                    return true;
+                }
+
+                ::unlink(newPath.c_str());
+            }
+
+            ::close(srcFd);
+        }
+#else
+        (void)mode;
+#endif
+
+        ++cloneJailCopyCount;
+        return FileUtil::copy(fpath, newPath, /*log=*/false, /*throw_on_error=*/false);
+    }
+
+    int cloneJailFunction(const char* fpath, const struct stat* sb, int typeflag,
+                          struct FTW* ftwbuf)
+    {
+        if (ftwbuf->level == 0)
+            return FTW_CONTINUE; // The jail directory itself already exists.
+
+        const std::string newPath = destinationForCloneJail + (fpath + sourceForCloneJail.size());
+        switch (typeflag)
+        {
+            case FTW_F:
+                if (!cloneJailFile(fpath, newPath, sb->st_mode))
+                {
+                    LOG_ERR("nftw: Failed to clone [" << fpath << "] to [" << newPath << ']');
+                    return FTW_STOP;
+                }
+                break;
+            case FTW_D:
+                if (::mkdir(newPath.c_str(), sb->st_mode & 07777) != 0 && errno != EEXIST)
+                {
+                    LOG_SYS("nftw: mkdir(\"" << newPath << "\") failed");
+                    return FTW_STOP;
+                }
+                clonedJailDirs.push_back({ newPath, { sb->st_atim, sb->st_mtim } });
+                break;
+            case FTW_SL:
+            case FTW_SLN:
+            {
+                const std::size_t size = sb->st_size;
+                std::vector<char> target(size + 1);
+                const ssize_t written = readlink(fpath, target.data(), size);
+                if (written <= 0 || static_cast<std::size_t>(written) > size)
+                {
+                    LOG_SYS("nftw: readlink(\"" << fpath << "\") failed");
+                    return FTW_STOP;
+                }
+                target[written] = '\0';
+
+                if (symlink(target.data(), newPath.c_str()) == -1)
+                {
+                    LOG_SYS("nftw: symlink(\"" << target.data() << "\", \"" << newPath
+                                               << "\") failed");
+                    return FTW_STOP;
+                }
+            }
+            break;
+            case FTW_DNR:
+                LOG_ERR("nftw: Cannot read directory '" << fpath << '\'');
+                return FTW_STOP;
+            case FTW_NS:
+                LOG_ERR("nftw: stat failed for '" << fpath << '\'');
+                return FTW_STOP;
+            default:
+                LOG_ERR("nftw: unexpected typeflag: '" << typeflag);
+                return FTW_STOP;
+        }
+
+        return FTW_CONTINUE;
+    }
+
+    /// Instantiates the jail at @destination from the prepared template at @source.
+    /// Unlike linkOrCopy, the template is already filtered and on the same
+    /// file-system as the jail, so this is a plain walk with one link per file.
+    bool cloneJailTemplate(const std::string& source, const std::string& destination)
+    {
+        sourceForCloneJail = source;
+        if (sourceForCloneJail.back() == '/')
+            sourceForCloneJail.pop_back();
+        destinationForCloneJail = destination;
+        if (destinationForCloneJail.back() == '/')
+            destinationForCloneJail.pop_back();
+        cloneJailLinkCount = 0;
+        cloneJailReflinkCount = 0;
+        cloneJailCopyCount = 0;
+        clonedJailDirs.clear();
+
+        if (nftw(sourceForCloneJail.c_str(), cloneJailFunction, 10, FTW_PHYS) != 0)
+        {
+            LOG_ERR("cloneJailTemplate: nftw() failed for '" << sourceForCloneJail << '\'');
+            return false;
+        }
+
+        // Populating the directories has touched their mtime, which fontconfig checks.
+        for (auto it = clonedJailDirs.rbegin(); it != clonedJailDirs.rend(); ++it)
+        {
+            if (::utimensat(AT_FDCWD, it->_path.c_str(), it->_times, 0) != 0)
+                LOG_SYS("cloneJailTemplate: utimensat(\"" << it->_path << "\") failed");
+        }
+
+        clonedJailDirs.clear();
+
+        LOG_DBG("Cloned jail template [" << sourceForCloneJail << "] to ["
+                                         << destinationForCloneJail << "] with "
+                                         << cloneJailLinkCount << " links, "
+                                         << cloneJailReflinkCount << " reflinks and "
+                                         << cloneJailCopyCount << " copies.");
+        return true;
+    }
+
+    /// How the files of a jail were set up.
+    enum class JailSetupMethod
+    {
+        Mount,
+        Clone,
+        LinkOrCopy,
+        Count
+    };
+
+    const char* jailSetupMethodString(JailSetupMethod method)
+    {
+        switch (method)
+        {
+            case JailSetupMethod::Mount:
+                return "mount";
+            case JailSetupMethod::Clone:
+                return "clone";
+            case JailSetupMethod::LinkOrCopy:
+                return "link/copy";
+            default:
+                return "unknown";
+        }
+    }
+
+    /// Jail setup timings. These live in memory shared between
+    /// forkit and the kits it forks, which record their own.
+    struct JailSetupStats
+    {
+        static constexpr std::size_t MethodCount = static_cast<std::size_t>(JailSetupMethod::Count);
+
+        std::atomic<std::uint64_t> _count[MethodCount];
+        std::atomic<std::uint64_t> _totalUs[MethodCount];
+        std::atomic<std::uint64_t> _maxUs[MethodCount];
+        std::atomic<std::uint64_t> _lastUs;
+        std::atomic<int> _lastMethod;
+    };
+    JailSetupStats* SharedJailSetupStats = nullptr;
+
+    void recordJailSetup(JailSetupMethod method, std::chrono::microseconds duration)
+    {
+        if (!SharedJailSetupStats)
+            return;
+
+        const std::size_t index = static_cast<std::size_t>(method);
+        const std::uint64_t us = duration.count();
+        ++SharedJailSetupStats->_count[index];
+        SharedJailSetupStats->_totalUs[index] += us;
+        std::uint64_t max = SharedJailSetupStats->_maxUs[index];
+        while (us > max && !SharedJailSetupStats->_maxUs[index].compare_exchange_weak(max, us))
+        {
+        }
+
+        SharedJailSetupStats->_lastUs = us;
+        SharedJailSetupStats->_lastMethod = static_cast<int>(method);
+    }
+
 #if CODE_COVERAGE
     std::string childRootForGCDAFiles;
     std::string sourceForGCDAFiles;
@@ -717,7 +944,8 @@ public:
         _editorChangeWarning(false),
         _lastMemTrimTime(std::chrono::steady_clock::now()),
         _mobileAppDocId(mobileAppDocId),
-        _inputProcessingEnabled(true)
+        _inputProcessingEnabled(true),
+        _recyclable(false)
     {
         LOG_INF("Document ctor for [" << _docKey <<
                 "] url [" << anonymizeUrl(_url) << "] on child [" << _jailId <<
@@ -750,10 +978,44 @@ public:
         DocumentData::deallocate(_mobileAppDocId);
 #endif
 
+#if !MOBILEAPP
+        singletonDocument = nullptr;
+#endif
     }
 
     const std::string& getUrl() const { return _url; }
 
+    /// A recyclable document doesn't take the Kit down with it when its last
+    /// session is gone, so the Kit can load the next document.
+    void setRecyclable(bool recyclable) { _recyclable = recyclable; }
+    bool isRecyclable() const { return _recyclable; }
+
+    /// Removes the document, and anything saved next to it, from the jail.
+    void removeDocumentFiles() const
+    {
+#if !MOBILEAPP
+        if (_jailedUrl.empty())
+            return;
+
+        std::string docsRoot = Poco::URI(_jailedUrl).getPath();
+        const std::size_t pos = docsRoot.find(JAILED_DOCUMENT_ROOT);
+        if (pos == std::string::npos)
+        {
+            LOG_WRN("Unexpected jailed document path [" << anonymizeUrl(docsRoot) << ']');
+            return;
+        }
+
+        docsRoot.resize(pos + sizeof(JAILED_DOCUMENT_ROOT) - 1);
+
+        std::vector<std::string> entries;
+        Poco::File(docsRoot).list(entries);
+        for (const std::string& entry : entries)
+            FileUtil::removeFile(docsRoot + entry, /*recursive=*/true);
+
+        LOG_DBG("Removed " << entries.size() << " entries from " << docsRoot);
+#endif
+    }
+
     /// Post the message - in the unipoll world we're in the right thread anyway
     bool postMessage(const char* data, int size, const WSOpCode code) const
     {
@@ -835,7 +1097,7 @@ public:
 
             num_sessions = _sessions.size();
 #if !MOBILEAPP
-            if (num_sessions == 0)
+            if (num_sessions == 0 && !_recyclable)
             {
                 LOG_FTL("Document [" << anonymizeUrl(_url) << "] has no more views, exiting bluntly.");
                 flushAndExit(EX_OK);
@@ -1275,7 +1537,7 @@ private:
         if (viewCount == 1)
         {
 #if !MOBILEAPP
-            if (_sessions.empty())
+            if (_sessions.empty() && !_recyclable)
             {
                 LOG_INF("Document [" << anonymizeUrl(_url) << "] has no more views, exiting bluntly.");
                 flushAndExit(EX_OK);
@@ -1358,6 +1620,53 @@ private:
         SigUtil::setActivityHeader(ss.str());
     }
 
+    bool startBackgroundSave(const std::string& sessionId, const std::string& url,
+                             const std::string& format, const std::string& filterOptions) override
+    {
+#if !MOBILEAPP
+        if (!_loKitDocument || !_backgroundSave.start(_loKitDocument, url, format, filterOptions))
+            return false;
+
+        _backgroundSaveSessionId = sessionId;
+        return true;
+#else
+        (void)sessionId;
+        (void)url;
+        (void)format;
+        (void)filterOptions;
+        return false;
+#endif
+    }
+
+    void joinBackgroundSave() override { checkBackgroundSave(/*wait=*/true); }
+
+    /// Reports the result of the background save, if any, once it's done.
+    void checkBackgroundSave(bool wait = false)
+    {
+#if !MOBILEAPP
+        if (!_backgroundSave.isRunning())
+            return;
+
+        const BackgroundSave::Result result = _backgroundSave.check(wait);
+        if (result == BackgroundSave::Result::Running)
+            return;
+
+        // Prefer the session that requested the save, but any will do for WSD.
+        auto it = _sessions.find(_backgroundSaveSessionId);
+        if (it == _sessions.end())
+            it = _sessions.begin();
+
+        if (it == _sessions.end())
+            LOG_WRN("No session left to report the background save result to");
+        else if (result == BackgroundSave::Result::TimedOut)
+            it->second->backgroundSaveTimedOut();
+        else
+            it->second->backgroundSaveDone(result == BackgroundSave::Result::Succeeded);
+#else
+        (void)wait;
+#endif
+    }
+
     /// Notify all views of viewId and their associated usernames
     void notifyViewInfo() override
     {
@@ -1679,6 +1988,13 @@ private:
             // No support for changing them after opening a document.
             _renderOpts = renderOpts;
             spellOnline = session->getSpellOnline();
+
+            // Nothing is rendered yet, so it is safe to pick the dictionary now,
+            // if the client can decompress tiles with it.
+            const auto dictIt = TileDictionaries.find(
+                LOKitHelper::getDocumentTypeAsString(_loKitDocument->get()));
+            if (dictIt != TileDictionaries.end() && session->getTileDictionary())
+                _deltaGen.setDictionary(dictIt->second);
         }
         else
         {
@@ -1707,6 +2023,17 @@ private:
             LOG_INF("Creating view to url [" << uriAnonym << "] for session [" << sessionId << "] with " << options << '.');
             _loKitDocument->createView(options.c_str());
             LOG_TRC("View to url [" << uriAnonym << "] created.");
+
+            // Tiles are shared by all the views, so a client that can't decompress
+            // them with the dictionary turns it off for the rest of the document.
+            if (_deltaGen.getDictionary() && !session->getTileDictionary())
+            {
+                LOG_INF("Session [" << sessionId << "] can't use the tile dictionary, "
+                                       "dropping it and the tiles compressed with it");
+                _deltaGen.setDictionary(nullptr);
+                _deltaGen.dropCache();
+                sendTextFrame("droptiles");
+            }
         }
 
         LOG_INF("Initializing for rendering session [" << sessionId << "] on document url [" <<
@@ -1742,6 +2069,17 @@ private:
         session->initWatermark();
         invalidateCanonicalId(session->getId());
 
+        // Announce the dictionary once per session, before any tile using it.
+        if (const std::shared_ptr<const TileDictionary>& dictionary = _deltaGen.getDictionary())
+        {
+            std::vector<char> message;
+            const std::string header = "tiledict: id=" + std::to_string(dictionary->getId()) + '\n';
+            message.reserve(header.size() + dictionary->getData().size());
+            message.insert(message.end(), header.begin(), header.end());
+            message.insert(message.end(), dictionary->getData().begin(), dictionary->getData().end());
+            session->sendBinaryFrame(message.data(), static_cast<int>(message.size()));
+        }
+
         return _loKitDocument;
     }
 
@@ -2119,8 +2457,15 @@ public:
             << "\n\teditorChangeWarning: " << _editorChangeWarning
             << "\n\tmobileAppDocId: " << _mobileAppDocId
             << "\n\tinputProcessingEnabled: " << _inputProcessingEnabled
+            << "\n\trecyclable: " << _recyclable
             << "\n";
 
+#if !MOBILEAPP
+        if (_backgroundSave.isRunning())
+            oss << "\tbackgroundSave: running for " << _backgroundSave.elapsed()
+                << " for session " << _backgroundSaveSessionId << '\n';
+#endif
+
         // dumpState:
         // TODO: _websocketHandler - but this is an odd one.
         _tileQueue->dumpState(oss);
@@ -2228,6 +2573,15 @@ private:
 
     const unsigned _mobileAppDocId;
     bool _inputProcessingEnabled;
+    /// True when the Kit is kept to load another document after this one.
+    bool _recyclable;
+
+#if !MOBILEAPP
+    /// The save in progress in a forked snapshot of the Kit, if any.
+    BackgroundSave _backgroundSave;
+    /// The session that requested the background save.
+    std::string _backgroundSaveSessionId;
+#endif
 };
 
 #if !defined BUILDING_TESTS && !MOBILEAPP && !LIBFUZZER
@@ -2241,6 +2595,10 @@ static std::vector<std::string> traceEventRecords[2];
 
 static void flushTraceEventRecordings()
 {
+    // None while a recycled Kit waits for its next document, keep them for it.
+    if (singletonDocument == nullptr)
+        return;
+
     std::unique_lock<std::mutex> lock(traceEventLock);
 
     for (size_t n = 0; n < 2; ++n)
@@ -2329,6 +2687,8 @@ class KitSocketPoll final : public SocketPoll
 {
     std::chrono::steady_clock::time_point _pollEnd;
     std::shared_ptr<Document> _document;
+    /// Drops a recyclable document once its last session is gone.
+    std::function<void()> _recycleHandler;
 
     static KitSocketPoll* mainPoll;
 
@@ -2481,13 +2841,26 @@ public:
         drainQueue();
 
         if (_document)
+        {
+            _document->checkBackgroundSave();
             _document->trimAfterInactivity();
+        }
 
 #if !MOBILEAPP
         flushTraceEventRecordings();
 
         if (_document && _document->purgeSessions() == 0)
         {
+            if (_document->isRecyclable() && _recycleHandler)
+            {
+                LOG_INF("Last session discarded. Recycling the Kit for the next document");
+                // The handler is for this document only.
+                const std::function<void()> recycle = std::move(_recycleHandler);
+                _recycleHandler = nullptr;
+                recycle();
+                return eventsSignalled;
+            }
+
             LOG_INF("Last session discarded. Setting TerminationFlag");
             SigUtil::setTerminationFlag();
             return -1;
@@ -2499,6 +2872,8 @@ public:
 
     void setDocument(std::shared_ptr<Document> document) { _document = std::move(document); }
 
+    void setRecycleHandler(std::function<void()> handler) { _recycleHandler = std::move(handler); }
+
     // unusual LOK event from another thread, push into our loop to process.
     static bool pushToMainThread(LibreOfficeKitCallback callback, int type, const char* p,
                                  void* data)
@@ -2554,6 +2929,8 @@ class KitWebSocketHandler final : public WebSocketHandler
     std::shared_ptr<Document> _document;
     std::shared_ptr<KitSocketPoll> _ksPoll;
     const unsigned _mobileAppDocId;
+    /// The sessions of the next document, received before recycling the current one.
+    std::vector<std::vector<char>> _deferredSessions;
 
 public:
     KitWebSocketHandler(const std::string& socketName, const std::shared_ptr<lok::Office>& loKit, const std::string& jailId, std::shared_ptr<KitSocketPoll> ksPoll, unsigned mobileAppDocId) :
@@ -2608,6 +2985,21 @@ protected:
         }
         else if (tokens.equals(0, "session"))
         {
+            if (_document && tokens[2] != _docKey)
+            {
+                // A recycled Kit must unload the previous document before taking the next.
+                if (_document->isRecyclable())
+                {
+                    LOG_WRN("Deferring session of another document until [" << anonymizeUrl(_docKey)
+                                                                            << "] is unloaded");
+                    _deferredSessions.push_back(data);
+                }
+                else
+                    LOG_ERR("Rejecting session of another document while ["
+                            << anonymizeUrl(_docKey) << "] is loaded");
+                return;
+            }
+
             const std::string& sessionId = tokens[1];
             _docKey = tokens[2];
             const std::string& docId = tokens[3];
@@ -2627,6 +3019,21 @@ protected:
                     _mobileAppDocId);
                 _ksPoll->setDocument(_document);
 
+                // Converters are kept for the next conversion, if WSD asks for it.
+                const bool recyclable = tokens.equals(4, "recycle");
+                _document->setRecyclable(recyclable);
+                if (recyclable)
+                {
+                    std::weak_ptr<KitWebSocketHandler> weakThis =
+                        std::static_pointer_cast<KitWebSocketHandler>(shared_from_this());
+                    _ksPoll->setRecycleHandler(
+                        [weakThis]()
+                        {
+                            if (auto handler = weakThis.lock())
+                                handler->recycle();
+                        });
+                }
+
                 // We need to send the process name information to WSD if Trace Event recording is enabled (but
                 // not turned on) because it might be turned on later.
                 // We can do this only after creating the Document object.
@@ -2702,6 +3109,118 @@ protected:
         }
     }
 
+    /// Drops the document once its last session is gone, and cleans up
+    /// after it, so that nothing leaks into the next document we load.
+    void recycle()
+    {
+        LOG_INF("Recycling Kit of [" << anonymizeUrl(_docKey) << "] for the next document");
+
+        std::shared_ptr<Document> document = std::move(_document);
+        _ksPoll->setDocument(nullptr);
+
+        document->removeDocumentFiles();
+        document.reset();
+
+        _queue->clear();
+        _docKey.clear();
+        Util::clearAnonymized();
+        _loKit->trimMemory(4096);
+
+        // The next document may well be from another user.
+        if (!clearTmpDir())
+        {
+            LOG_ERR("Failed to clean up the jail after the document. Exiting instead of recycling");
+            SigUtil::setTerminationFlag();
+            return;
+        }
+
+        // Only now may WSD give us the next document.
+        const std::string recycled = "recycled";
+        sendTextMessage(recycled.data(), recycled.size(), /*flush=*/true);
+
+        std::vector<std::vector<char>> deferredSessions = std::move(_deferredSessions);
+        _deferredSessions.clear();
+        for (const std::vector<char>& session : deferredSessions)
+            handleMessage(session);
+    }
+
+    /// Removes what LO left in TMPDIR for the last document: its temporary
+    /// and backup files and the changes to the user profile. The device nodes
+    /// and the certificate database are set up once per jail and are kept, as
+    /// are the directories themselves, since LO and HOME keep using them.
+    static bool clearTmpDir()
+    {
+#if !MOBILEAPP
+        const char* tmpDir = std::getenv("TMPDIR");
+        if (tmpDir == nullptr || tmpDir[0] == '\0')
+            return true;
+
+        std::size_t removed = 0;
+        const auto clear = [&removed](const std::string& path)
+        {
+            if (!FileUtil::Stat(path).isDirectory())
+            {
+                FileUtil::removeFile(path);
+                ++removed;
+                return;
+            }
+
+            std::vector<std::string> entries;
+            Poco::File(path).list(entries);
+            for (const std::string& entry : entries)
+                FileUtil::removeFile(path + '/' + entry, /*recursive=*/true);
+            removed += entries.size();
+        };
+
+        try
+        {
+            std::vector<std::string> entries;
+            Poco::File(tmpDir).list(entries);
+            for (const std::string& entry : entries)
+            {
+                const std::string path = std::string(tmpDir) + '/' + entry;
+                if (entry == "dev" || entry == "certdb")
+                    continue;
+
+                if (entry != "user")
+                {
+                    clear(path);
+                    continue;
+                }
+
+                // The LO user installation: the profile loses the configuration
+                // changes and backups saved so far, and the rest (e.g. the
+                // document root) is emptied.
+                std::vector<std::string> userEntries;
+                Poco::File(path).list(userEntries);
+                for (const std::string& userEntry : userEntries)
+                {
+                    if (userEntry != "user")
+                    {
+                        clear(path + '/' + userEntry);
+                        continue;
+                    }
+
+                    for (const char* modified : { "registrymodifications.xcu", "backup" })
+                    {
+                        const std::string profilePath = path + "/user/" + modified;
+                        if (FileUtil::Stat(profilePath).exists())
+                            clear(profilePath);
+                    }
+                }
+            }
+        }
+        catch (const std::exception& exc)
+        {
+            LOG_ERR("Failed to clear [" << tmpDir << "]: " << exc.what());
+            return false;
+        }
+
+        LOG_DBG("Removed " << removed << " entries from " << tmpDir);
+#endif
+        return true;
+    }
+
     virtual void enableProcessInput(bool enable = true) override
     {
         WebSocketHandler::enableProcessInput(enable);
@@ -2842,9 +3361,136 @@ void copyCertificateDatabaseToTmp(Poco::Path const& jailPath)
         }
     }
 }
+
+/// Loads the trained tile dictionaries, named after the document type they
+/// are trained for, eg. text.zdict, spreadsheet.zdict, presentation.zdict.
+void loadTileDictionaries()
+{
+    if (!config::getBool("per_document.tile_dictionary[@enable]", false))
+        return;
+
+    const std::string path = config::getString("per_document.tile_dictionary.path", "");
+    if (path.empty())
+    {
+        LOG_WRN("Tile dictionaries are enabled but no path is configured");
+        return;
+    }
+
+    for (const char* docType : { "text", "spreadsheet", "presentation", "drawing" })
+    {
+        const std::string fileName = Poco::Path(path, std::string(docType) + ".zdict").toString();
+        if (!FileUtil::Stat(fileName).exists())
+            continue;
+
+        std::unique_ptr<std::vector<char>> data = FileUtil::readFile(fileName, 1024 * 1024);
+        if (!data || data->empty())
+        {
+            LOG_WRN("Failed to read tile dictionary [" << fileName << ']');
+            continue;
+        }
+
+        std::shared_ptr<const TileDictionary> dictionary =
+            DeltaGenerator::createDictionary(std::move(*data));
+        if (!dictionary->isValid())
+        {
+            LOG_WRN("Ignoring tile dictionary [" << fileName << "] without a valid header");
+            continue;
+        }
+
+        LOG_INF("Loaded tile dictionary [" << fileName << "] with id " << dictionary->getId()
+                                           << " of " << dictionary->getData().size() << " bytes");
+        TileDictionaries[docType] = std::move(dictionary);
+    }
+}
 #endif
 }
 
+#if !MOBILEAPP
+
+void initJailSetupStats()
+{
+    if (SharedJailSetupStats)
+        return;
+
+    void* memory = ::mmap(nullptr, sizeof(JailSetupStats), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        LOG_SYS("Failed to map the jail setup stats");
+        return;
+    }
+
+    SharedJailSetupStats = new (memory) JailSetupStats();
+}
+
+bool prepareJailTemplate(const std::string& childRoot, const std::string& sysTemplate,
+                         const std::string& loTemplate)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    const std::string templatePath = childRoot + '/' + JailUtil::JAIL_TEMPLATE_SUBPATH;
+    LOG_INF("Preparing jail template [" << templatePath << "] from " << sysTemplate << " and "
+                                        << loTemplate);
+
+    FileUtil::removeFile(templatePath, /*recursive=*/true);
+    JailUtil::createJailPath(templatePath);
+
+    const std::string linkablePath = childRoot + "/linkable";
+    const Poco::Path templateDir = Poco::Path::forDirectory(templatePath);
+    linkOrCopy(sysTemplate, templateDir, linkablePath, LinkOrCopyType::All);
+    const std::size_t fileCount = linkOrCopyFileCount;
+
+    Poco::Path templateLOInstallation(templateDir, JailUtil::LO_JAIL_SUBPATH);
+    templateLOInstallation.makeDirectory();
+    linkOrCopy(loTemplate, templateLOInstallation, linkablePath, LinkOrCopyType::LO);
+
+    if (!FileUtil::Stat(templateLOInstallation.toString() + "program").exists())
+    {
+        LOG_ERR("Failed to prepare jail template [" << templatePath
+                                                    << "], will link/copy each jail instead.");
+        FileUtil::removeFile(templatePath, /*recursive=*/true);
+        return false;
+    }
+
+    JailTemplatePath = templatePath;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    LOG_INF("Prepared jail template [" << JailTemplatePath << "] of "
+                                       << fileCount + linkOrCopyFileCount << " files in " << ms);
+    return true;
+}
+
+void dumpJailSetupStats(std::ostream& os)
+{
+    os << "  JailTemplate: " << (JailTemplatePath.empty() ? "<none>" : JailTemplatePath) << '\n';
+    if (!SharedJailSetupStats)
+        return;
+
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < JailSetupStats::MethodCount; ++i)
+    {
+        const std::uint64_t count = SharedJailSetupStats->_count[i];
+        if (!count)
+            continue;
+
+        total += count;
+
+        os << "  Jail setup (" << jailSetupMethodString(static_cast<JailSetupMethod>(i))
+           << "): " << count << " jails, avg "
+           << SharedJailSetupStats->_totalUs[i] / count / 1000. << " ms, max "
+           << SharedJailSetupStats->_maxUs[i] / 1000. << " ms\n";
+    }
+
+    if (total)
+        os << "  Last jail setup: " << SharedJailSetupStats->_lastUs / 1000. << " ms ("
+           << jailSetupMethodString(
+                  static_cast<JailSetupMethod>(SharedJailSetupStats->_lastMethod.load()))
+           << ")\n";
+}
+
+#endif // !MOBILEAPP
+
 void lokit_main(
 #if !MOBILEAPP
                 const std::string& childRoot,
@@ -2915,6 +3561,9 @@ void lokit_main(
 
     LOG_INF("Kit process for Jail [" << jailId << "] started.");
 
+    // Must be done before entering the jail.
+    loadTileDictionaries();
+
     std::string userdir_url;
     std::string instdir_path;
     int ProcSMapsFile = -1;
@@ -2995,6 +3644,7 @@ void lokit_main(
             };
 
             // Copy (link) LO installation and other necessary files into it from the template.
+            JailSetupMethod jailSetupMethod = JailSetupMethod::Mount;
             bool bindMount = JailUtil::isBindMountingEnabled();
             if (bindMount)
             {
@@ -3015,20 +3665,40 @@ void lokit_main(
 
             if (!bindMount)
             {
-                LOG_INF("Mounting is disabled, will link/copy " << sysTemplate << " -> "
-                                                                << jailPathStr);
-
                 // Make sure we have the jail directory.
                 JailUtil::createJailPath(jailPathStr);
 
                 // Create a file to mark this a copied jail.
                 JailUtil::markJailCopied(jailPathStr);
 
-                const std::string linkablePath = childRoot + "/linkable";
+                jailSetupMethod = JailSetupMethod::LinkOrCopy;
+                if (!JailTemplatePath.empty())
+                {
+                    LOG_INF("Mounting is disabled, will clone " << JailTemplatePath << " -> "
+                                                                << jailPathStr);
+                    if (cloneJailTemplate(JailTemplatePath, jailPathStr))
+                        jailSetupMethod = JailSetupMethod::Clone;
+                    else
+                    {
+                        LOG_ERR("Failed to clone the jail template [" << JailTemplatePath
+                                                                       << "], will link/copy.");
+                        FileUtil::removeFile(jailPathStr, /*recursive=*/true);
+                        JailUtil::createJailPath(jailPathStr);
+                        JailUtil::markJailCopied(jailPathStr);
+                    }
+                }
 
-                linkOrCopy(sysTemplate, jailPath, linkablePath, LinkOrCopyType::All);
+                if (jailSetupMethod == JailSetupMethod::LinkOrCopy)
+                {
+                    LOG_INF("Mounting is disabled, will link/copy " << sysTemplate << " -> "
+                                                                    << jailPathStr);
+
+                    const std::string linkablePath = childRoot + "/linkable";
 
-                linkOrCopy(loTemplate, loJailDestPath, linkablePath, LinkOrCopyType::LO);
+                    linkOrCopy(sysTemplate, jailPath, linkablePath, LinkOrCopyType::All);
+
+                    linkOrCopy(loTemplate, loJailDestPath, linkablePath, LinkOrCopyType::LO);
+                }
 
 #if CODE_COVERAGE
                 // Link the .gcda files.
@@ -3059,9 +3729,12 @@ void lokit_main(
             Poco::File(Poco::Path(jailPath, HomePathInJail)).createDirectories();
             ::setenv("HOME", HomePathInJail, 1);
 
-            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
                 std::chrono::steady_clock::now() - jailSetupStartTime);
-            LOG_DBG("Initialized jail files in " << ms);
+            recordJailSetup(jailSetupMethod, us);
+            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(us);
+            LOG_DBG("Initialized jail files by " << jailSetupMethodString(jailSetupMethod) << " in "
+                                                 << ms);
 
             // The bug is that rewinding and rereading /proc/self/smaps_rollup doubles the previous
             // values, so it only affects the case where we reuse the fd from opening smaps_rollup
@@ -3377,6 +4050,119 @@ void runKitLoopInAThread()
 
 #if !MOBILEAPP
 
+bool BackgroundSave::start(const std::shared_ptr<lok::Document>& document, const std::string& url,
+                           const std::string& format, const std::string& filterOptions)
+{
+    assert(!isRunning() && "Only one background save at a time");
+
+    reapAbandoned();
+
+    _startTime = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        LOG_SYS("Failed to fork for background save");
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // The child: our copy of the document is a frozen snapshot, save it and quit.
+        // Don't run any destructors or exit handlers, they'd tear down state
+        // (e.g. the sockets) that the parent is still using.
+
+        // We can't be killed by the Kit (seccomp denies kill), so don't outlive our
+        // Timeout: SIGALRM ends a deadlock, and SIGXCPU a runaway loop.
+        const rlim_t timeoutSecs = Timeout.count();
+        const struct rlimit limit = { timeoutSecs, timeoutSecs + 1 };
+        if (setrlimit(RLIMIT_CPU, &limit) != 0)
+            LOG_SYS("Failed to limit the CPU time of the background save");
+#ifdef __NR_alarm // Otherwise alarm() is emulated with setitimer, which seccomp denies.
+        signal(SIGALRM, SIG_DFL);
+        alarm(timeoutSecs);
+#endif
+
+        const bool success =
+            document->saveAs(url.c_str(), format.empty() ? nullptr : format.c_str(),
+                             filterOptions.empty() ? nullptr : filterOptions.c_str());
+        _exit(success ? EX_OK : EX_CANTCREAT);
+    }
+
+    LOG_INF("Started background save in child process #"
+            << pid << " to [" << anonymizeUrl(url) << "], Format: ["
+            << (format.empty() ? "(nullptr)" : format.c_str()) << ']');
+    _pid = pid;
+    return true;
+}
+
+BackgroundSave::Result BackgroundSave::check(bool wait)
+{
+    if (!isRunning())
+        return Result::Failed;
+
+    reapAbandoned();
+
+    // Give the child a moment past its Timeout to be killed by its alarm.
+    const auto deadline = _startTime + Timeout + std::chrono::seconds(1);
+
+    int status = 0;
+    pid_t ret;
+    for (;;)
+    {
+        while ((ret = waitpid(_pid, &status, WNOHANG)) < 0 && errno == EINTR)
+            ;
+
+        if (ret != 0)
+            break;
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            LOG_ERR("Background save in child process #" << _pid << " is still running after "
+                                                          << elapsed() << ", giving up on it");
+            _abandoned.push_back(_pid);
+            _pid = -1;
+            return Result::TimedOut;
+        }
+
+        if (!wait)
+            return Result::Running;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const pid_t pid = _pid;
+    _pid = -1;
+    if (ret < 0)
+    {
+        LOG_SYS("Failed to wait for background save child process #" << pid);
+        return Result::Failed;
+    }
+
+    const bool success = WIFEXITED(status) && WEXITSTATUS(status) == EX_OK;
+    LOG_INF("Background save in child process #" << pid << (success ? " succeeded" : " failed")
+                                                 << " in " << elapsed() << " (status: " << status
+                                                 << ')');
+    return success ? Result::Succeeded : Result::Failed;
+}
+
+void BackgroundSave::reapAbandoned()
+{
+    for (auto it = _abandoned.begin(); it != _abandoned.end();)
+    {
+        int status = 0;
+        const pid_t ret = waitpid(*it, &status, WNOHANG);
+        if (ret == 0 || (ret < 0 && errno == EINTR))
+        {
+            ++it;
+            continue;
+        }
+
+        LOG_DBG("Reaped abandoned background save child process #" << *it
+                                                                   << " (status: " << status << ')');
+        it = _abandoned.erase(it);
+    }
+}
+
 void consistencyCheckJail()
 {
     static bool warned = false;
@@ -12,8 +12,11 @@
 #pragma once
 
 #include <Poco/Util/XMLConfiguration.h>
+#include <chrono>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <common/Util.hpp>
 #include <wsd/TileDesc.hpp>
@@ -152,6 +155,20 @@ void forkLibreOfficeKit(const std::string& childRoot,
 /// main function of the forkit process or thread
 int forkit_main(int argc, char** argv);
 
+#if !MOBILEAPP
+/// Maps the jail setup timings, which forked kits record, into memory shared with them.
+void initJailSetupStats();
+
+/// Prepares a single template jail under @childRoot from @sysTemplate and @loTemplate,
+/// which kits then clone when the jail tree can't be mounted, rather than linking or
+/// copying each file from the templates. Returns false on failure.
+bool prepareJailTemplate(const std::string& childRoot, const std::string& sysTemplate,
+                         const std::string& loTemplate);
+
+/// Dumps the jail template and the time taken to set up the jails so far.
+void dumpJailSetupStats(std::ostream& os);
+#endif
+
 /// Anonymize the basename of filenames, preserving the path and extension.
 std::string anonymizeUrl(const std::string& url);
 
@@ -161,6 +178,56 @@ std::string anonymizeUsername(const std::string& username);
 /// Ensure there is no fatal system setup problem
 void consistencyCheckJail();
 
+#if !MOBILEAPP
+/// Saves a document in a forked, copy-on-write snapshot of the Kit process,
+/// so the Kit can keep serving its views while the document is serialized.
+class BackgroundSave
+{
+public:
+    enum class Result
+    {
+        Running,
+        Succeeded,
+        Failed,
+        TimedOut ///< Given up on, the caller should save in the foreground.
+    };
+
+    /// The longest we let a child save for, after which it's killed.
+    static constexpr std::chrono::seconds Timeout = std::chrono::seconds(120);
+
+    BackgroundSave()
+        : _pid(-1)
+    {
+    }
+
+    bool isRunning() const { return _pid > 0; }
+
+    /// Forks and saves @document to @url, as @format with @filterOptions, in the child process.
+    /// Returns false if we failed to fork, and the caller should save in the foreground.
+    bool start(const std::shared_ptr<lok::Document>& document, const std::string& url,
+               const std::string& format, const std::string& filterOptions);
+
+    /// Reaps the child process, if done, or waits for it when @wait is true.
+    /// Either way, a child still running past its Timeout is given up on.
+    Result check(bool wait = false);
+
+    /// The time since the save was started.
+    std::chrono::milliseconds elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - _startTime);
+    }
+
+private:
+    /// Reaps the children we gave up on, once they are finally gone.
+    void reapAbandoned();
+
+    pid_t _pid;
+    std::chrono::steady_clock::time_point _startTime;
+    std::vector<pid_t> _abandoned;
+};
+#endif // !MOBILEAPP
+
 /// Fetch the latest montonically incrementing wire-id
 TileWireId getCurrentWireId(bool increment = false);
 
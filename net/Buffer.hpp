@@ -12,43 +12,108 @@
 #pragma once
 
 #include <assert.h>
+#include <deque>
+#include <memory>
 #include <ostream>
+#include <sys/uio.h>
 #include <vector>
 
 #include <Util.hpp>
 
 // Blocks -> we can share from client -> server ... etc.
-// headers / and a 'writeV' etc. =)
 
 /**
  * Encapsulate data we need to write.
+ *
+ * Besides its own bytes, the buffer can reference large shared blobs, eg. a
+ * tile sent to many clients, which are then written with writev rather than
+ * copied for each recipient. The contiguous API (data, begin, operator[] ...)
+ * is only valid while no shared blob is referenced, as on input buffers.
  */
 class Buffer
 {
+    /// A shared blob, sent before _buffer[_pos].
+    struct Shared
+    {
+        std::size_t _pos;
+        std::shared_ptr<const void> _owner;
+        const char* _data;
+        std::size_t _size;
+    };
+
     std::size_t _offset;  /// offset into _buffer of data
     std::vector<char> _buffer;
+    std::deque<Shared> _shared; /// in sending order
+    std::size_t _sharedSize; /// total unsent bytes in _shared
 
 public:
-    Buffer() : _offset(0)
+    /// Smaller blobs are cheaper to copy than to write separately.
+    static constexpr std::size_t MinSharedSize = 4096;
+
+    Buffer() : _offset(0), _sharedSize(0)
     {
     }
 
     typedef std::vector<char>::iterator iterator;
     typedef std::vector<char>::const_iterator const_iterator;
 
-    std::size_t size() const { return _buffer.size() - _offset; }
-    bool empty() const { return _offset == _buffer.size(); }
+    std::size_t size() const { return _buffer.size() - _offset + _sharedSize; }
+    bool empty() const { return size() == 0; }
 
+    /// True iff we reference shared blobs, and so are not contiguous.
+    bool hasShared() const { return !_shared.empty(); }
+
+    /// The first contiguous block of data to send.
     const char *getBlock() const
     {
-        if (!empty())
+        if (!_shared.empty() && _shared.front()._pos == _offset)
+            return _shared.front()._data;
+        if (_offset < _buffer.size())
             return &_buffer[_offset];
         return nullptr;
     }
 
+    /// The size of the block returned by getBlock.
     std::size_t getBlockSize() const
     {
-        return size();
+        if (_shared.empty())
+            return _buffer.size() - _offset;
+        if (_shared.front()._pos == _offset)
+            return _shared.front()._size;
+        return _shared.front()._pos - _offset;
+    }
+
+    /// Fills up to @count entries of @iov with the blocks to send, in order,
+    /// up to a total of @maxBytes. Returns the number of entries filled.
+    int getIoVecs(iovec* iov, int count, std::size_t maxBytes) const
+    {
+        int filled = 0;
+        std::size_t pos = _offset;
+        auto addBlock = [&](const char* data, std::size_t len)
+        {
+            len = std::min(len, maxBytes);
+            if (len == 0 || filled >= count)
+                return false;
+            iov[filled].iov_base = const_cast<char*>(data);
+            iov[filled].iov_len = len;
+            ++filled;
+            maxBytes -= len;
+            return true;
+        };
+
+        for (const Shared& shared : _shared)
+        {
+            if (shared._pos > pos && !addBlock(&_buffer[pos], shared._pos - pos))
+                return filled;
+            pos = shared._pos;
+            if (!addBlock(shared._data, shared._size))
+                return filled;
+        }
+
+        if (pos < _buffer.size())
+            addBlock(&_buffer[pos], _buffer.size() - pos);
+
+        return filled;
     }
 
     void eraseFirst(std::size_t len)
@@ -56,25 +121,63 @@ public:
         if (len <= 0)
             return;
 
-        assert(_offset + len <= _buffer.size());
-        assert(_offset + size() == _buffer.size());
-
+        assert(len <= size());
         len = std::min(len, size()); // Avoid accidental damage.
 
+        while (len > 0 && !_shared.empty())
+        {
+            Shared& shared = _shared.front();
+            if (shared._pos == _offset)
+            {
+                const std::size_t consumed = std::min(len, shared._size);
+                shared._data += consumed;
+                shared._size -= consumed;
+                _sharedSize -= consumed;
+                len -= consumed;
+                if (shared._size == 0)
+                    _shared.pop_front();
+            }
+            else
+            {
+                const std::size_t consumed = std::min(len, shared._pos - _offset);
+                _offset += consumed;
+                len -= consumed;
+            }
+        }
+
+        _offset += len;
+        assert(_offset <= _buffer.size());
+
         // avoid regular shuffling down larger chunks of data
-        if (_buffer.size() > 16384 && // lots of queued data
-            len < size() &&           // not a complete erase
-            _offset < 16384 * 64 &&   // do cleanup a Mb at a time or so:
-            size() > 512)             // early cleanup if what remains is small.
+        if (_offset == 0 ||
+            (_buffer.size() > 16384 &&        // lots of queued data
+             _offset < _buffer.size() &&      // not a complete erase
+             _offset < 16384 * 64 &&          // do cleanup a Mb at a time or so:
+             _buffer.size() - _offset > 512)) // early cleanup if what remains is small.
         {
-            _offset += len;
             return;
         }
 
-        _buffer.erase(_buffer.begin(), _buffer.begin() + _offset + len);
+        _buffer.erase(_buffer.begin(), _buffer.begin() + _offset);
+        for (Shared& shared : _shared)
+            shared._pos -= _offset;
         _offset = 0;
     }
 
+    /// Appends @len bytes at @data, owned by @owner, without copying
+    /// them if large enough. @owner must not modify them until sent.
+    void append(const std::shared_ptr<const void>& owner, const char* data, std::size_t len)
+    {
+        if (len < MinSharedSize || !owner)
+        {
+            append(data, len);
+            return;
+        }
+
+        _shared.push_back(Shared{ _buffer.size(), owner, data, len });
+        _sharedSize += len;
+    }
+
     void append(const char *data, const int len)
     {
         _buffer.insert(_buffer.end(), data, data + len);
@@ -82,6 +185,23 @@ public:
 
     void append(const std::string& s) { append(s.c_str(), s.size()); }
 
+    /// Moves all of @other to our end, still referencing its shared blobs.
+    void append(Buffer&& other)
+    {
+        std::size_t pos = other._offset;
+        for (Shared& shared : other._shared)
+        {
+            append(other._buffer.data() + pos, shared._pos - pos);
+            pos = shared._pos;
+            _shared.push_back(
+                Shared{ _buffer.size(), std::move(shared._owner), shared._data, shared._size });
+            _sharedSize += shared._size;
+        }
+
+        append(other._buffer.data() + pos, other._buffer.size() - pos);
+        other.clear();
+    }
+
     /// Append a literal string, with compile-time size capturing.
     template <std::size_t N> void append(const char (&s)[N])
     {
@@ -93,6 +213,9 @@ public:
     {
         if (size() > 0 || _offset > 0)
             os << prefix << "Buffer size: " << size() << " offset: " << _offset << '\n';
+        if (!_shared.empty())
+            os << prefix << "Shared blobs: " << _shared.size() << " of " << _sharedSize
+               << " bytes\n";
         if (_buffer.size() > 0)
             Util::dumpHex(os, _buffer, legend, prefix);
     }
@@ -103,23 +226,25 @@ public:
     {
         _buffer.clear();
         _offset = 0;
+        _shared.clear();
+        _sharedSize = 0;
     }
 
-    iterator begin() { return _buffer.begin() + _offset; }
+    iterator begin() { assert(_shared.empty()); return _buffer.begin() + _offset; }
 
-    const_iterator begin() const { return _buffer.begin() + _offset; }
+    const_iterator begin() const { assert(_shared.empty()); return _buffer.begin() + _offset; }
 
-    iterator end() { return _buffer.end(); }
+    iterator end() { assert(_shared.empty()); return _buffer.end(); }
 
-    const_iterator end() const { return _buffer.end(); }
+    const_iterator end() const { assert(_shared.empty()); return _buffer.end(); }
 
-    char operator[](int index) const { return _buffer[_offset + index]; }
+    char operator[](int index) const { assert(_shared.empty()); return _buffer[_offset + index]; }
 
-    char& operator[](int index) { return _buffer[_offset + index]; }
+    char& operator[](int index) { assert(_shared.empty()); return _buffer[_offset + index]; }
 
-    const char* data() const { return _buffer.data() + _offset; }
+    const char* data() const { assert(_shared.empty()); return _buffer.data() + _offset; }
 
-    char* data() { return _buffer.data() + _offset; }
+    char* data() { assert(_shared.empty()); return _buffer.data() + _offset; }
 
     iterator erase(iterator first, iterator last)
     {
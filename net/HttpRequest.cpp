@@ -16,6 +16,8 @@
 #include <Poco/MemoryStream.h>
 #include <Poco/Net/HTTPResponse.h>
 
+#include <algorithm>
+#include <cctype>
 #include <cstdint>
 #include <memory>
 #include <stdexcept>
@@ -422,6 +424,192 @@ int64_t Request::readData(const char* p, const int64_t len)
     return len - available;
 }
 
+FieldParseState RequestHeaderParser::parse(const char* p, int64_t len)
+{
+    _data = p;
+    if (_state == FieldParseState::Valid || _state == FieldParseState::Invalid)
+        return _state;
+
+    // Empty lines before the request line are to be ignored.
+    const int64_t start = skipCRLF(p, 0, len);
+
+    // Resume looking for the blank line where we stopped,
+    // in case the CRLFCRLF straddles the previous end.
+    const std::string_view data(p, len);
+    const int64_t from = std::max(start, _scanned - 3);
+    const std::size_t blankLine = data.find("\r\n\r\n", from);
+    if (blankLine == std::string_view::npos)
+    {
+        _scanned = len;
+        if (len - start > Header::MaxHeaderLen)
+        {
+            LOG_ERR("RequestHeaderParser: header is too long, no end after " << len << " bytes");
+            _state = FieldParseState::Invalid;
+            return _state;
+        }
+
+        _state = FieldParseState::Incomplete;
+        return _state;
+    }
+
+    _headerSize = blankLine + 4;
+    _scanned = _headerSize;
+    if (_headerSize - start > Header::MaxHeaderLen)
+    {
+        LOG_ERR("RequestHeaderParser: header is too long: " << _headerSize << " bytes");
+        _state = FieldParseState::Invalid;
+        return _state;
+    }
+
+    int64_t off = start;
+    _state = parseRequestLine(off);
+
+    // The last CRLF is the blank line.
+    while (_state == FieldParseState::Valid && off < _headerSize - 2)
+        _state = parseField(off);
+
+    if (_state != FieldParseState::Valid)
+        return _state;
+
+    const std::string_view contentLength = get(Header::CONTENT_LENGTH);
+    if (!contentLength.empty())
+    {
+        // Only digits, and not so many as to overflow.
+        if (contentLength.size() > 18 ||
+            !std::all_of(contentLength.begin(), contentLength.end(),
+                         [](char ch) { return ch >= '0' && ch <= '9'; }))
+        {
+            LOG_ERR("RequestHeaderParser: invalid Content-Length [" << contentLength << ']');
+            _state = FieldParseState::Invalid;
+            return _state;
+        }
+
+        _contentLength = 0;
+        for (const char ch : contentLength)
+            _contentLength = _contentLength * 10 + (ch - '0');
+    }
+
+    const std::string_view transferEncoding = get(Header::TRANSFER_ENCODING);
+    _chunked = Util::iequal(transferEncoding.data(), transferEncoding.size(), "chunked",
+                            sizeof("chunked") - 1);
+
+    return _state;
+}
+
+FieldParseState RequestHeaderParser::parseRequestLine(int64_t& off)
+{
+    const int64_t end = findLineBreak(_data, off, _headerSize);
+    int64_t lineEnd = end;
+    if (lineEnd > off && _data[lineEnd - 1] == '\r')
+        --lineEnd;
+
+    // Verb.
+    int64_t tokenEnd = findEndOfToken(_data, off, lineEnd);
+    if (tokenEnd == off || tokenEnd - off > MaxVerbLen)
+    {
+        LOG_ERR("RequestHeaderParser: invalid HTTP verb");
+        return FieldParseState::Invalid;
+    }
+
+    _verb = { static_cast<uint32_t>(off), static_cast<uint32_t>(tokenEnd - off) };
+
+    // URL.
+    off = skipSpaceAndTab(_data, tokenEnd, lineEnd);
+    tokenEnd = findEndOfToken(_data, off, lineEnd);
+    if (tokenEnd == off || tokenEnd - off > MaxUrlLen)
+    {
+        LOG_ERR("RequestHeaderParser: invalid URL of " << tokenEnd - off << " bytes");
+        return FieldParseState::Invalid;
+    }
+
+    _url = { static_cast<uint32_t>(off), static_cast<uint32_t>(tokenEnd - off) };
+
+    // Version, which must end the line.
+    off = skipSpaceAndTab(_data, tokenEnd, lineEnd);
+    tokenEnd = findEndOfToken(_data, off, lineEnd);
+    const std::string_view version(_data + off, tokenEnd - off);
+    constexpr int VersionMajPos = sizeof("HTTP/") - 1;
+    if (version.size() != Request::VersionLen || version.substr(0, VersionMajPos) != "HTTP/" ||
+        !std::isdigit(static_cast<unsigned char>(version[VersionMajPos])) || version[VersionMajPos + 1] != '.' ||
+        !std::isdigit(static_cast<unsigned char>(version[VersionMajPos + 2])) ||
+        skipSpaceAndTab(_data, tokenEnd, lineEnd) != lineEnd)
+    {
+        LOG_ERR("RequestHeaderParser: invalid HTTP version [" << version << ']');
+        return FieldParseState::Invalid;
+    }
+
+    _version = { static_cast<uint32_t>(off), static_cast<uint32_t>(version.size()) };
+
+    off = end + 1; // Skip the LF character.
+    return FieldParseState::Valid;
+}
+
+FieldParseState RequestHeaderParser::parseField(int64_t& off)
+{
+    const int64_t end = findLineBreak(_data, off, _headerSize);
+    int64_t lineEnd = end;
+    if (lineEnd > off && _data[lineEnd - 1] == '\r')
+        --lineEnd;
+
+    // Folded values are obsolete and may be rejected (RFC 7230 section 3.2.4).
+    if (_data[off] == ' ' || _data[off] == '\t')
+    {
+        LOG_ERR("RequestHeaderParser: folded header fields are not supported");
+        return FieldParseState::Invalid;
+    }
+
+    if (_fieldCount >= _fields.size())
+    {
+        LOG_ERR("RequestHeaderParser: too many header fields");
+        return FieldParseState::Invalid;
+    }
+
+    // The name is a token, immediately followed by a colon.
+    int64_t colon = off;
+    while (colon < lineEnd && _data[colon] != ':' && !isWhitespace(_data[colon]))
+        ++colon;
+
+    if (colon == off || colon == lineEnd || _data[colon] != ':' ||
+        colon - off > Header::MaxNameLen)
+    {
+        LOG_ERR("RequestHeaderParser: invalid header field ["
+                << std::string_view(_data + off, std::min<int64_t>(lineEnd - off, 80)) << ']');
+        return FieldParseState::Invalid;
+    }
+
+    // The value, without leading or trailing whitespace.
+    const int64_t valueStart = skipSpaceAndTab(_data, colon + 1, lineEnd);
+    int64_t valueEnd = lineEnd;
+    while (valueEnd > valueStart && isWhitespace(_data[valueEnd - 1]))
+        --valueEnd;
+
+    if (valueEnd - valueStart > Header::MaxValueLen)
+    {
+        LOG_ERR("RequestHeaderParser: header field value is too long: " << valueEnd - valueStart);
+        return FieldParseState::Invalid;
+    }
+
+    Field& field = _fields[_fieldCount++];
+    field._name = { static_cast<uint32_t>(off), static_cast<uint32_t>(colon - off) };
+    field._value = { static_cast<uint32_t>(valueStart),
+                     static_cast<uint32_t>(valueEnd - valueStart) };
+
+    off = end + 1; // Skip the LF character.
+    return FieldParseState::Valid;
+}
+
+std::string_view RequestHeaderParser::get(std::string_view name) const
+{
+    for (std::size_t i = 0; i < _fieldCount; ++i)
+    {
+        const std::string_view fieldName = getFieldName(i);
+        if (Util::iequal(fieldName.data(), fieldName.size(), name.data(), name.size()))
+            return getFieldValue(i);
+    }
+
+    return std::string_view();
+}
+
 /// Handles incoming data.
 /// Returns the number of bytes consumed, or -1 for error
 /// and/or to interrupt transmission.
@@ -597,6 +785,8 @@ int64_t Response::readData(const char* p, int64_t len)
                     p += chunkLen;
                     _recvBodySize += chunkLen;
                     LOG_TRC("Wrote " << chunkLen << " bytes for a total of " << _recvBodySize);
+                    if (_onProgress)
+                        _onProgress(_recvBodySize, -1);
 
                     // Skip blank lines.
                     off = skipCRLF(p, 0, available);
@@ -631,6 +821,10 @@ int64_t Response::readData(const char* p, int64_t len)
             {
                 available -= wrote;
                 _recvBodySize += wrote;
+                if (_onProgress)
+                    _onProgress(_recvBodySize, _header.hasContentLength()
+                                                   ? _header.getContentLength()
+                                                   : -1);
                 if (_header.hasContentLength() && _recvBodySize >= _header.getContentLength())
                 {
                     LOG_TRC("Wrote all received content into the body-callback, finished.");
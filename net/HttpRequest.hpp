@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
@@ -25,6 +26,7 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <netdb.h>
 
 #include <Common.hpp>
@@ -691,6 +693,94 @@ private:
     Stage _stage;
 };
 
+/// Parses the header of an incoming HTTP request in place, without allocating.
+/// The parser can be given the same, growing, buffer repeatedly as more data
+/// arrives, and resumes looking for the end of the header where it stopped.
+/// The parsed fields are views into the buffer given to the last parse(),
+/// which are invalidated when the buffer is modified or moved.
+class RequestHeaderParser final
+{
+public:
+    static constexpr int64_t MaxVerbLen = 32;
+    static constexpr int64_t MaxUrlLen = 16 * 1024;
+
+    RequestHeaderParser() { reset(); }
+
+    /// Forget everything parsed so far, to parse a new request.
+    void reset()
+    {
+        _state = FieldParseState::Unknown;
+        _data = nullptr;
+        _scanned = 0;
+        _headerSize = 0;
+        _fieldCount = 0;
+        _contentLength = -1;
+        _chunked = false;
+    }
+
+    /// Parses the request line and the header fields in @p.
+    /// @p must start with the request and hold all the data received
+    /// so far, which must only have been appended to since the last call.
+    /// Returns Valid once the complete header is parsed,
+    /// Incomplete when more data is needed, and Invalid otherwise.
+    FieldParseState parse(const char* p, int64_t len);
+
+    FieldParseState state() const { return _state; }
+
+    /// The size of the header, including the request line and the blank line.
+    int64_t getHeaderSize() const { return _headerSize; }
+
+    std::string_view getVerb() const { return view(_verb); }
+    std::string_view getUrl() const { return view(_url); }
+    std::string_view getVersion() const { return view(_version); }
+
+    std::size_t getFieldCount() const { return _fieldCount; }
+    std::string_view getFieldName(std::size_t index) const { return view(_fields[index]._name); }
+    std::string_view getFieldValue(std::size_t index) const { return view(_fields[index]._value); }
+
+    /// Get the value of the first field named @name (case-insensitive), if any.
+    std::string_view get(std::string_view name) const;
+
+    /// The Content-Length, or -1 when missing.
+    int64_t getContentLength() const { return _contentLength; }
+
+    bool getChunkedTransferEncoding() const { return _chunked; }
+
+private:
+    /// A view into the data, which can move as it grows.
+    struct Span
+    {
+        uint32_t _offset;
+        uint32_t _length;
+    };
+
+    struct Field
+    {
+        Span _name;
+        Span _value;
+    };
+
+    std::string_view view(const Span& span) const
+    {
+        return std::string_view(_data + span._offset, span._length);
+    }
+
+    FieldParseState parseRequestLine(int64_t& off);
+    FieldParseState parseField(int64_t& off);
+
+    FieldParseState _state;
+    const char* _data; //< The data given to the last parse().
+    int64_t _scanned; //< How far we looked for the end of the header.
+    int64_t _headerSize;
+    Span _verb;
+    Span _url;
+    Span _version;
+    std::array<Field, Header::MaxNumberFields> _fields;
+    std::size_t _fieldCount;
+    int64_t _contentLength;
+    bool _chunked;
+};
+
 /// HTTP Status Line is the first line of a response sent by a server.
 class StatusLine
 {
@@ -792,6 +882,10 @@ class Response final
 public:
     using FinishedCallback = std::function<void()>;
 
+    /// Called as the body is received, with the size received so far
+    /// and the Content-Length, or -1 when it isn't known.
+    using ProgressCallback = std::function<void(int64_t received, int64_t total)>;
+
     /// A response received from a server.
     /// Used for parsing an incoming response.
     explicit Response(FinishedCallback finishedCallback, int fd = -1)
@@ -892,6 +986,9 @@ public:
     /// See IoWriteFunc documentation for the contract.
     void saveBodyToHandler(IoWriteFunc onBodyWriteCb) { _onBodyWriteCb = std::move(onBodyWriteCb); }
 
+    /// Set a callback to follow the progress of receiving the body.
+    void setProgressHandler(ProgressCallback onProgress) { _onProgress = std::move(onProgress); }
+
     /// The response body, if any, is stored in memory.
     /// Use getBody() to read it.
     void saveBodyToMemory()
@@ -994,6 +1091,7 @@ private:
     std::string _body; //< Used when _bodyHandling is InMemory.
     std::ofstream _bodyFile; //< Used when _bodyHandling is OnDisk.
     IoWriteFunc _onBodyWriteCb; //< Used to handling body receipt in all cases.
+    ProgressCallback _onProgress; //< Called as the body is received, if set.
     FinishedCallback _finishedCallback; //< Called when response is finished.
     int _fd; //< The socket file-descriptor.
 };
@@ -1138,8 +1236,10 @@ public:
     /// Note: when the server returns an error, the response body,
     /// if any, will be stored in memory and can be read via getBody().
     /// I.e. when statusLine().statusCategory() != StatusLine::StatusCodeClass::Successful.
+    /// The optional @onProgress is called as the body is received.
     const std::shared_ptr<const Response>
-    syncDownload(const Request& req, const std::string& saveToFilePath, SocketPoll& poller)
+    syncDownload(const Request& req, const std::string& saveToFilePath, SocketPoll& poller,
+                 Response::ProgressCallback onProgress = nullptr)
     {
         LOG_TRC_S("syncDownload: " << req.getVerb() << ' ' << host() << ':' << port() << ' '
                                    << req.getUrl());
@@ -1149,17 +1249,20 @@ public:
         if (!saveToFilePath.empty())
             _response->saveBodyToFile(saveToFilePath);
 
+        _response->setProgressHandler(std::move(onProgress));
+
         syncRequestImpl(poller);
         return _response;
     }
 
     /// Make a synchronous request to download a file to the given path.
-    const std::shared_ptr<const Response> syncDownload(const Request& req,
-                                                       const std::string& saveToFilePath)
+    const std::shared_ptr<const Response>
+    syncDownload(const Request& req, const std::string& saveToFilePath,
+                 Response::ProgressCallback onProgress = nullptr)
     {
         TerminatingPoll poller("HttpSynReqPoll");
         poller.runOnClientThread();
-        return syncDownload(req, saveToFilePath, poller);
+        return syncDownload(req, saveToFilePath, poller, std::move(onProgress));
     }
 
     /// Make a synchronous request.
@@ -55,6 +55,7 @@ constexpr std::chrono::microseconds WebSocketHandler::InitialPingDelayMicroS;
 constexpr std::chrono::microseconds WebSocketHandler::PingFrequencyMicroS;
 
 std::atomic<bool> SocketPoll::InhibitThreadChecks(false);
+std::atomic<bool> SocketPoll::UseEpoll(false);
 std::atomic<bool> Socket::InhibitThreadChecks(false);
 
 #define SOCKET_ABSTRACT_UNIX_NAME "0coolwsd-"
@@ -176,6 +177,11 @@ namespace {
 SocketPoll::SocketPoll(std::string threadName)
     : _name(std::move(threadName)),
       _pollStartIndex(0),
+#if HAVE_EPOLL
+      _useEpoll(UseEpoll),
+      _epollFd(-1),
+      _epollPid(0),
+#endif
       _stop(false),
       _threadStarted(0),
       _threadFinished(false),
@@ -219,6 +225,11 @@ SocketPoll::~SocketPoll()
     }
 
 #if !MOBILEAPP
+#if HAVE_EPOLL
+    if (_epollFd >= 0)
+        ::close(_epollFd);
+    _epollFd = -1;
+#endif
     ::close(_wakeup[0]);
     ::close(_wakeup[1]);
 #else
@@ -335,6 +346,13 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
     std::chrono::steady_clock::time_point now =
         std::chrono::steady_clock::now();
 
+#if HAVE_EPOLL
+    // Created by the polling thread, and again in a forked child, which
+    // would otherwise share (and modify) the interest set of its parent.
+    if (_useEpoll && _epollPid != getpid())
+        epollInit();
+#endif
+
     // The events to poll on change each spin of the loop.
     setupPollFds(now, timeoutMaxMicroS);
     const size_t size = _pollSockets.size();
@@ -342,6 +360,14 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
     int rc;
     do
     {
+#if HAVE_EPOLL
+        if (_epollFd >= 0)
+        {
+            LOG_TRC("epoll_wait start, timeoutMicroS: " << timeoutMaxMicroS << " size " << size);
+            rc = epollWait(timeoutMaxMicroS, size);
+            continue;
+        }
+#endif
 #if !MOBILEAPP
 #  if HAVE_PPOLL
         LOG_TRC("ppoll start, timeoutMicroS: " << timeoutMaxMicroS << " size " << size);
@@ -505,6 +531,10 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
                 LOG_TRC('#' << _pollFds[eraseIndex].fd << ": Removing socket (at " << eraseIndex
                             << " of " << _pollSockets.size() << ") from " << _name << " to have "
                             << _pollSockets.size() - 1 << " sockets");
+#if HAVE_EPOLL
+                if (_epollFd >= 0)
+                    epollRemove(_pollFds[eraseIndex].fd);
+#endif
                 _pollSockets.erase(_pollSockets.begin() + eraseIndex);
             }
         }
@@ -513,6 +543,121 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
     return rc;
 }
 
+#if HAVE_EPOLL
+void SocketPoll::epollInit()
+{
+    if (_epollFd >= 0)
+    {
+        // Inherited over fork: only drop our reference, the parent still uses it.
+        ::close(_epollFd);
+        _epollFd = -1;
+        _epollSockets.clear();
+    }
+
+    // Don't retry on failure, poll(2) will do.
+    _epollPid = getpid();
+
+    _epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFd < 0)
+    {
+        LOG_SYS("Failed to create epoll fd for SocketPoll [" << _name << "], using poll");
+        return;
+    }
+
+    // The wakeup pipe is always polled for input.
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = _wakeup[0];
+    if (::epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeup[0], &ev) < 0)
+    {
+        LOG_SYS("Failed to add wakeup pipe to epoll of SocketPoll [" << _name << "], using poll");
+        ::close(_epollFd);
+        _epollFd = -1;
+        return;
+    }
+
+    LOG_DBG("SocketPoll [" << _name << "] using epoll");
+}
+
+void SocketPoll::epollUpdate(int fd, size_t index, int events)
+{
+    // The poll(2) and epoll(2) event bits are identical on Linux.
+    static_assert(POLLIN == EPOLLIN && POLLOUT == EPOLLOUT && POLLPRI == EPOLLPRI &&
+                      POLLERR == EPOLLERR && POLLHUP == EPOLLHUP,
+                  "poll and epoll events must match");
+
+    const auto it = _epollSockets.find(fd);
+    if (it != _epollSockets.end())
+    {
+        it->second._index = index;
+        if (it->second._events == events)
+            return;
+    }
+
+    epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    const bool add = (it == _epollSockets.end());
+    int rc = ::epoll_ctl(_epollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+    if (rc < 0 && !add && errno == ENOENT)
+    {
+        // The kernel dropped it when its last fd was closed, yet the number is in use again.
+        LOG_TRC('#' << fd << ": No longer in the epoll set of " << _name << ", adding it again");
+        rc = ::epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    if (rc < 0)
+    {
+        LOG_SYS('#' << fd << ": Failed to " << (add ? "add" : "modify") << " epoll events 0x"
+                    << std::hex << events << std::dec << " in " << _name);
+        return;
+    }
+
+    if (add)
+        _epollSockets.emplace(fd, EpollEntry{ events, index });
+    else
+        it->second._events = events;
+}
+
+void SocketPoll::epollRemove(int fd)
+{
+    if (_epollSockets.erase(fd) == 0)
+        return;
+
+    // Never touch the interest set of our parent, which a forked child shares until it polls.
+    if (_epollPid != getpid())
+        return;
+
+    // Closed fds are removed by the kernel, but we may be handing a live socket over.
+    if (::epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr) < 0 && errno != ENOENT && errno != EBADF)
+        LOG_SYS('#' << fd << ": Failed to remove from epoll in " << _name);
+}
+
+int SocketPoll::epollWait(int64_t timeoutMaxMicroS, size_t size)
+{
+    _epollEvents.resize(size + 1);
+
+    // Round up, like the legacy poll, so we don't spin before the deadline.
+    const int timeoutMaxMs = (std::max<int64_t>(timeoutMaxMicroS, 0) + 999) / 1000;
+    const int rc = ::epoll_wait(_epollFd, _epollEvents.data(), _epollEvents.size(), timeoutMaxMs);
+    for (int i = 0; i < rc; ++i)
+    {
+        const epoll_event& ev = _epollEvents[i];
+        if (ev.data.fd == _wakeup[0])
+        {
+            _pollFds[size].revents = ev.events;
+            continue;
+        }
+
+        const auto it = _epollSockets.find(ev.data.fd);
+        if (it != _epollSockets.end() && it->second._index < size)
+            _pollFds[it->second._index].revents = ev.events;
+    }
+
+    return rc;
+}
+#endif
+
 void SocketPoll::wakeupWorld()
 {
     for (const auto& fd : getWakeupsArray())
@@ -533,6 +678,10 @@ void SocketPoll::removeSockets()
         LOG_DBG("Removing socket #" << socket->getFD() << " from " << _name);
         ASSERT_CORRECT_SOCKET_THREAD(socket);
         socket->resetThreadOwner();
+#if HAVE_EPOLL
+        if (_epollFd >= 0)
+            epollRemove(socket->getFD());
+#endif
 
         _pollSockets.pop_back();
     }
@@ -729,6 +878,8 @@ void WebSocketHandler::dumpState(std::ostream& os) const
     os << (_shuttingDown ? "shutd " : "alive ");
 #if !MOBILEAPP
     os << std::setw(5) << _pingTimeUs/1000. << "ms ";
+    if (_deflate)
+        _deflate->dumpState(os);
 #endif
     if (_wsPayload.size() > 0)
         Util::dumpHex(os, _wsPayload, "\t\tws queued payload:\n", "\t\t");
@@ -1123,36 +1274,50 @@ LocalServerSocket::~LocalServerSocket()
 #endif
 
 bool StreamSocket::parseHeader(const char *clientName,
+                               http::RequestHeaderParser& parser,
                                Poco::MemoryInputStream &message,
                                Poco::Net::HTTPRequest &request,
                                MessageMap& map)
 {
     assert(map._headerSize == 0 && map._messageSize == 0);
 
-    // Find the end of the header, if any.
-    static const std::string marker("\r\n\r\n");
-    auto itBody = std::search(_inBuffer.begin(), _inBuffer.end(),
-                              marker.begin(), marker.end());
-    if (itBody == _inBuffer.end())
+    // Parse the header in place, resuming where we stopped last time.
+    const http::FieldParseState state = parser.parse(_inBuffer.data(), _inBuffer.size());
+    if (state == http::FieldParseState::Invalid)
+    {
+        LOG_ERR(clientName << " sent an invalid HTTP request header, " << _inBuffer.size()
+                           << " bytes, closing");
+        static const char badRequest[] =
+            "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send(badRequest, sizeof(badRequest) - 1);
+        parser.reset();
+        ignoreInput();
+        shutdown();
+        return false;
+    }
+
+    if (state != http::FieldParseState::Valid)
     {
+        // Keep the progress, the rest of the header is appended to the same buffer.
         LOG_TRC(clientName << " doesn't have enough data for the header yet.");
         return false;
     }
 
-    // Skip the marker.
-    itBody += marker.size();
-    map._headerSize = static_cast<size_t>(itBody - _inBuffer.begin());
+    // The header is complete, so whatever the outcome, start afresh next time:
+    // with the next request, or with this one again once more of its body is here.
+    struct ParserReset
+    {
+        http::RequestHeaderParser& _parser;
+        ~ParserReset() { _parser.reset(); }
+    } parserReset{ parser };
+
+    auto itBody = _inBuffer.begin() + parser.getHeaderSize();
+    map._headerSize = parser.getHeaderSize();
     map._messageSize = map._headerSize;
 
     try
     {
-        request.read(message);
-
-        LOG_INF(clientName << " HTTP Request: " << request.getMethod() << ' ' << request.getURI()
-                           << ' ' << request.getVersion() << ' '
-                           << [&](auto& log) { Util::joinPair(log, request, " / "); });
-
-        const std::streamsize contentLength = request.getContentLength();
+        const std::streamsize contentLength = parser.getContentLength();
         const auto offset = itBody - _inBuffer.begin();
         const std::streamsize available = _inBuffer.size() - offset;
 
@@ -1164,8 +1329,9 @@ bool StreamSocket::parseHeader(const char *clientName,
         }
         map._messageSize += contentLength;
 
-        const std::string expect = request.get("Expect", "");
-        const bool getExpectContinue = Util::iequal(expect, "100-continue");
+        const std::string_view expect = parser.get("Expect");
+        const bool getExpectContinue =
+            Util::iequal(expect.data(), expect.size(), "100-continue", sizeof("100-continue") - 1);
         if (getExpectContinue && !_sentHTTPContinue)
         {
             LOG_TRC("Got Expect: 100-continue, sending Continue");
@@ -1175,13 +1341,14 @@ bool StreamSocket::parseHeader(const char *clientName,
             _sentHTTPContinue = true;
         }
 
-        if (request.getChunkedTransferEncoding())
+        if (parser.getChunkedTransferEncoding())
         {
             // keep the header
             map._spans.push_back(std::pair<size_t, size_t>(0, itBody - _inBuffer.begin()));
 
             int chunk = 0;
-            while (itBody != _inBuffer.end())
+            bool complete = false;
+            while (!complete && itBody != _inBuffer.end())
             {
                 auto chunkStart = itBody;
 
@@ -1215,7 +1382,8 @@ bool StreamSocket::parseHeader(const char *clientName,
                 if (chunkLen == 0) // we're complete.
                 {
                     map._messageSize = chunkOffset;
-                    return true;
+                    complete = true;
+                    break;
                 }
 
                 if (chunkLen > chunkAvailable + 2)
@@ -1243,9 +1411,27 @@ bool StreamSocket::parseHeader(const char *clientName,
                 itBody+=2;
                 chunk++;
             }
-            LOG_TRC("Not enough chunks yet, so far " << chunk << " chunks of total length " << (itBody - _inBuffer.begin()));
-            return false;
+
+            if (!complete)
+            {
+                LOG_TRC("Not enough chunks yet, so far " << chunk << " chunks of total length " << (itBody - _inBuffer.begin()));
+                return false;
+            }
         }
+
+        // We have the whole message, only now fill in the request.
+        request.setMethod(std::string(parser.getVerb()));
+        request.setURI(std::string(parser.getUrl()));
+        request.setVersion(std::string(parser.getVersion()));
+        for (std::size_t i = 0; i < parser.getFieldCount(); ++i)
+            request.add(std::string(parser.getFieldName(i)), std::string(parser.getFieldValue(i)));
+
+        // As if the header was read from the message.
+        message.seekg(map._headerSize, std::ios::beg);
+
+        LOG_INF(clientName << " HTTP Request: " << request.getMethod() << ' ' << request.getURI()
+                           << ' ' << request.getVersion() << ' '
+                           << [&](auto& log) { Util::joinPair(log, request, " / "); });
     }
     catch (const Poco::Exception& exc)
     {
@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
@@ -40,6 +41,12 @@
 #include "FakeSocket.hpp"
 #endif
 
+#if !MOBILEAPP && HAVE_SYS_EPOLL_H
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#include <unordered_map>
+#endif
+
 #ifdef __linux__
 #define HAVE_ABSTRACT_UNIX_SOCKETS
 #endif
@@ -53,6 +60,7 @@
 namespace http
 {
 class Request;
+class RequestHeaderParser;
 class Response;
 }
 namespace Poco
@@ -488,6 +496,16 @@ public:
     /// 0 for closed/invalid socket, and -1 for other errors.
     virtual int sendBinaryMessage(const char *data, const size_t len, bool flush = false) const = 0;
 
+    /// Sends a message whose data is kept alive by @owner, which allows
+    /// handlers to reference rather than copy it until it is written.
+    /// Returns as sendTextMessage and sendBinaryMessage.
+    virtual int sendSharedMessage(const std::shared_ptr<const void>& /* owner */,
+                                  const char* data, const size_t len, bool binary,
+                                  bool flush = false) const
+    {
+        return binary ? sendBinaryMessage(data, len, flush) : sendTextMessage(data, len, flush);
+    }
+
     /// Shutdown the socket and specify if the endpoint is going away or not (useful for WS).
     /// Optionally provide a message sent in the close frame (useful for WS).
     virtual void shutdown(bool goingAway = false,
@@ -495,6 +513,16 @@ public:
 
     virtual void getIOStats(uint64_t &sent, uint64_t &recv) = 0;
 
+    /// Get the bytes of the messages compressed or decompressed, before and after
+    /// compression, and the time it took.
+    virtual void getCompressionStats(uint64_t &raw, uint64_t &compressed,
+                                     std::chrono::microseconds &time)
+    {
+        raw = 0;
+        compressed = 0;
+        time = std::chrono::microseconds::zero();
+    }
+
     /// Append pretty printed internal state to a line
     virtual void dumpState(std::ostream& os) const { os << '\n'; }
 };
@@ -593,13 +621,13 @@ private:
 /// Handles non-blocking socket event polling.
 /// Only polls on N-Sockets and invokes callback and
 /// doesn't manage buffers or client data.
-/// Note: uses poll(2) since it has very good performance
+/// Note: uses poll(2) by default since it has very good performance
 /// compared to epoll up to a few hundred sockets and
-/// doesn't suffer select(2)'s poor API. Since this will
-/// be used per-document we don't expect to have several
-/// hundred users on same document to suffer poll(2)'s
-/// scalability limit. Meanwhile, epoll(2)'s high
-/// overhead to adding/removing sockets is not helpful.
+/// doesn't suffer select(2)'s poor API. Polls carrying many
+/// more connections, eg. the accept and prisoner polls of
+/// a busy server, can use epoll(2) instead (see UseEpoll),
+/// which keeps the interest set in the kernel and only
+/// updates it when the events of a socket change.
 class SocketPoll
 {
 public:
@@ -611,6 +639,20 @@ public:
     static constexpr std::chrono::microseconds DefaultPollTimeoutMicroS = std::chrono::seconds(5);
     static std::atomic<bool> InhibitThreadChecks;
 
+    /// Whether SocketPolls created from now on use epoll(2) rather than poll(2),
+    /// when available. The callback and wakeup semantics are identical.
+    static std::atomic<bool> UseEpoll;
+
+    /// True iff this poll uses epoll(2), which is only set up by the first poll().
+    bool isEpoll() const
+    {
+#if HAVE_EPOLL
+        return _epollFd >= 0;
+#else
+        return false;
+#endif
+    }
+
     /// Stop the polling thread.
     void stop()
     {
@@ -858,6 +900,10 @@ private:
             _pollFds[i].revents = 0;
             LOG_TRC('#' << _pollFds[i].fd << ": setupPollFds getPollEvents: 0x" << std::hex
                         << events << std::dec);
+#if HAVE_EPOLL
+            if (_epollFd >= 0)
+                epollUpdate(_pollFds[i].fd, i, events);
+#endif
         }
 
         // Add the read-end of the wake pipe.
@@ -866,6 +912,22 @@ private:
         _pollFds[size].revents = 0;
     }
 
+#if HAVE_EPOLL
+    /// Creates our epoll set, replacing any inherited from our parent process.
+    void epollInit();
+
+    /// Registers @fd at @index with the epoll set, or updates
+    /// its interest if @events changed since the last time.
+    void epollUpdate(int fd, size_t index, int events);
+
+    /// Unregisters @fd from the epoll set.
+    void epollRemove(int fd);
+
+    /// Waits for the registered sockets and fills in
+    /// the revents of _pollFds, like ppoll would.
+    int epollWait(int64_t timeoutMaxMicroS, size_t size);
+#endif
+
     /// The polling thread entry.
     /// Used to set the thread name and mark the thread as stopped when done.
     void pollingThreadEntry();
@@ -886,6 +948,25 @@ private:
     std::vector<CallbackFn> _newCallbacks;
     /// The fds to poll.
     std::vector<pollfd> _pollFds;
+#if HAVE_EPOLL
+    /// Whether to use epoll(2), per UseEpoll when we were created.
+    const bool _useEpoll;
+    /// The epoll fd, or -1 when using poll(2).
+    int _epollFd;
+    /// The process that created _epollFd.
+    pid_t _epollPid;
+    /// A registered socket: the events we are interested in,
+    /// and its index in _pollSockets for this iteration.
+    struct EpollEntry
+    {
+        int _events;
+        size_t _index;
+    };
+    /// The sockets registered with the epoll set, by fd.
+    std::unordered_map<int, EpollEntry> _epollSockets;
+    /// Receives the ready events.
+    std::vector<epoll_event> _epollEvents;
+#endif
 
     /// Flag the thread to stop.
     std::atomic<bool> _stop;
@@ -1248,8 +1329,13 @@ public:
     bool compactChunks(MessageMap& map);
 
     /// Detects if we have an HTTP header in the provided message and
-    /// populates a request for that.
+    /// populates a request for that, once the whole message is in.
+    /// The parser keeps its progress between calls while the header is
+    /// incomplete, so must be kept for as long as input is pending.
+    /// It is reset once the header is complete, whatever the outcome.
+    /// On success, message is positioned after the header.
     bool parseHeader(const char *clientLoggingName,
+                     http::RequestHeaderParser& parser,
                      Poco::MemoryInputStream &message,
                      Poco::Net::HTTPRequest &request,
                      MessageMap& map);
@@ -1431,12 +1517,26 @@ public:
         {
             do
             {
-                // Writing much more than we can absorb in the kernel causes wastage.
-                const int size = std::min((int)_outBuffer.getBlockSize(), getSendBufferSize());
-                if (size == 0)
-                    break;
+                if (_outBuffer.hasShared())
+                {
+                    // Gather our own data and the shared blobs it references.
+                    constexpr int MaxIoVecs = 64;
+                    iovec iov[MaxIoVecs];
+                    const int count = _outBuffer.getIoVecs(iov, MaxIoVecs, getSendBufferSize());
+                    if (count == 0)
+                        break;
+
+                    len = writeData(iov, count);
+                }
+                else
+                {
+                    // Writing much more than we can absorb in the kernel causes wastage.
+                    const int size = std::min((int)_outBuffer.getBlockSize(), getSendBufferSize());
+                    if (size == 0)
+                        break;
 
-                len = writeData(_outBuffer.getBlock(), size);
+                    len = writeData(_outBuffer.getBlock(), size);
+                }
                 if (len < 0)
                     last_errno = errno; // Save only on error.
 
@@ -1450,7 +1550,8 @@ public:
                 else // Success.
                     LOG_TRC("Wrote " << len << " bytes of " << _outBuffer.size() << " buffered data"
 #ifdef LOG_SOCKET_DATA
-                            << (len ? Util::dumpHex(std::string(_outBuffer.getBlock(), len), ":\n")
+                            << (len ? Util::dumpHex(std::string(_outBuffer.getBlock(),
+                                                                std::min<std::size_t>(len, _outBuffer.getBlockSize())), ":\n")
                                     : std::string())
 #endif
                     );
@@ -1566,6 +1667,22 @@ protected:
 #endif
     }
 
+    /// Override to handle writing scattered data to socket differently.
+    virtual int writeData(const iovec* iov, const int count)
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+#if !MOBILEAPP
+#if ENABLE_DEBUG
+        if (simulateSocketError(false))
+            return -1;
+#endif
+        return ::writev(getFD(), iov, count);
+#else
+        (void) count;
+        return fakeSocketWrite(getFD(), iov[0].iov_base, iov[0].iov_len);
+#endif
+    }
+
     void setShutdownSignalled()
     {
         _shutdownSignalled = true;
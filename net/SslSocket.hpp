@@ -178,6 +178,14 @@ public:
         return handleSslState(SSL_write(_ssl, buf, len), "write");
     }
 
+    /// TLS records can't be gathered, so write the first block only.
+    virtual int writeData(const iovec* iov, const int count) override
+    {
+        assert(count > 0);
+        (void) count;
+        return writeData(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len);
+    }
+
     int getPollEvents(std::chrono::steady_clock::time_point now,
                       int64_t & timeoutMaxMicroS) override
     {
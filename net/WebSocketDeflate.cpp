@@ -0,0 +1,382 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "WebSocketDeflate.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include <common/Log.hpp>
+
+bool WebSocketDeflate::Enabled = false;
+int WebSocketDeflate::MaxWindowBits = 15;
+int WebSocketDeflate::MemLevel = 8;
+bool WebSocketDeflate::ContextTakeover = true;
+std::size_t WebSocketDeflate::MinSize = 64;
+std::size_t WebSocketDeflate::MaxInflatedSize = 64 * 1024 * 1024;
+
+namespace
+{
+/// What a sync flush ends with, and RFC 7692 leaves out.
+constexpr char FlushMarker[] = { 0x00, 0x00, static_cast<char>(0xff), static_cast<char>(0xff) };
+
+/// zlib can't produce raw DEFLATE data with a window of 2^8 bytes.
+constexpr int MinDeflateWindowBits = 9;
+
+/// We always decompress with the largest window, which is fine for data
+/// compressed with any smaller one.
+constexpr int InflateWindowBits = 15;
+
+std::vector<std::string> split(const std::string& value, char delimiter)
+{
+    std::vector<std::string> tokens;
+    std::size_t start = 0;
+    for (;;)
+    {
+        const std::size_t end = value.find(delimiter, start);
+        std::string token = value.substr(start, end == std::string::npos ? end : end - start);
+
+        const std::size_t first = token.find_first_not_of(" \t");
+        const std::size_t last = token.find_last_not_of(" \t");
+        tokens.push_back(first == std::string::npos ? std::string()
+                                                    : token.substr(first, last - first + 1));
+
+        if (end == std::string::npos)
+            return tokens;
+        start = end + 1;
+    }
+}
+
+/// Parses an extension of the form: name; param; param=value; param="value".
+/// Returns false if it is malformed or repeats a parameter.
+bool parseExtension(const std::string& extension, std::string& name,
+                    std::map<std::string, std::string>& params)
+{
+    const std::vector<std::string> tokens = split(extension, ';');
+    name = tokens[0];
+    if (name.empty())
+        return false;
+
+    for (std::size_t i = 1; i < tokens.size(); ++i)
+    {
+        const std::size_t equals = tokens[i].find('=');
+        std::string key = tokens[i].substr(0, equals);
+        std::string value;
+        if (equals != std::string::npos)
+        {
+            value = tokens[i].substr(equals + 1);
+            key.erase(key.find_last_not_of(" \t") + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                value = value.substr(1, value.size() - 2);
+            if (value.empty())
+                return false;
+        }
+
+        if (key.empty() || !params.emplace(key, value).second)
+            return false;
+    }
+
+    return true;
+}
+
+/// Returns the window bits in @value, or 0 if invalid.
+int parseWindowBits(const std::string& value)
+{
+    if (value.empty() || value.size() > 2 ||
+        !std::all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        return 0;
+
+    const int bits = std::stoi(value);
+    return bits >= 8 && bits <= 15 ? bits : 0;
+}
+} // namespace
+
+WebSocketDeflate::WebSocketDeflate(int deflateWindowBits, bool deflateTakeover,
+                                   bool inflateTakeover)
+    : _deflateWindowBits(std::clamp(deflateWindowBits, MinDeflateWindowBits, 15))
+    , _deflateTakeover(deflateTakeover)
+    , _inflateTakeover(inflateTakeover)
+    , _deflateReady(false)
+    , _inflateReady(false)
+    , _rawBytes(0)
+    , _compressedBytes(0)
+    , _time(0)
+{
+    std::memset(&_deflate, 0, sizeof(_deflate));
+    std::memset(&_inflate, 0, sizeof(_inflate));
+
+    // Negative window bits for raw DEFLATE data, without a zlib header.
+    int result = deflateInit2(&_deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -_deflateWindowBits,
+                              std::clamp(MemLevel, 1, 9), Z_DEFAULT_STRATEGY);
+    if (result == Z_OK)
+        _deflateReady = true;
+    else
+        LOG_ERR("Failed to initialize websocket compression, result: " << result);
+
+    result = inflateInit2(&_inflate, -InflateWindowBits);
+    if (result == Z_OK)
+        _inflateReady = true;
+    else
+        LOG_ERR("Failed to initialize websocket decompression, result: " << result);
+}
+
+WebSocketDeflate::~WebSocketDeflate()
+{
+    if (_deflateReady)
+        deflateEnd(&_deflate);
+    if (_inflateReady)
+        inflateEnd(&_inflate);
+}
+
+std::unique_ptr<WebSocketDeflate> WebSocketDeflate::acceptOffer(const std::string& offers,
+                                                                std::string& response)
+{
+    for (const std::string& offer : split(offers, ','))
+    {
+        std::string name;
+        std::map<std::string, std::string> params;
+        if (!parseExtension(offer, name, params) || name != Name)
+            continue;
+
+        bool valid = true;
+        bool serverNoTakeover = false;
+        bool clientNoTakeover = false;
+        int serverWindowBits = 0;
+        bool clientWindowBitsOffered = false;
+        int clientWindowBits = 15;
+        for (const auto& pair : params)
+        {
+            if (pair.first == "server_no_context_takeover" && pair.second.empty())
+                serverNoTakeover = true;
+            else if (pair.first == "client_no_context_takeover" && pair.second.empty())
+                clientNoTakeover = true;
+            else if (pair.first == "server_max_window_bits")
+            {
+                serverWindowBits = parseWindowBits(pair.second);
+                valid = valid && serverWindowBits;
+            }
+            else if (pair.first == "client_max_window_bits")
+            {
+                clientWindowBitsOffered = true;
+                if (!pair.second.empty())
+                {
+                    clientWindowBits = parseWindowBits(pair.second);
+                    valid = valid && clientWindowBits;
+                }
+            }
+            else
+                valid = false;
+        }
+
+        const int deflateWindowBits =
+            serverWindowBits ? std::min(serverWindowBits, MaxWindowBits) : MaxWindowBits;
+        if (!valid || deflateWindowBits < MinDeflateWindowBits)
+        {
+            LOG_DBG("Declining websocket extension offer [" << offer << ']');
+            continue;
+        }
+
+        const bool deflateTakeover = ContextTakeover && !serverNoTakeover;
+
+        response = Name;
+        if (!deflateTakeover)
+            response += "; server_no_context_takeover";
+        if (clientNoTakeover)
+            response += "; client_no_context_takeover";
+        if (serverWindowBits)
+            response += "; server_max_window_bits=" + std::to_string(deflateWindowBits);
+        if (clientWindowBitsOffered)
+            response += "; client_max_window_bits=" +
+                        std::to_string(std::min(clientWindowBits, MaxWindowBits));
+
+        return std::make_unique<WebSocketDeflate>(deflateWindowBits, deflateTakeover,
+                                                  !clientNoTakeover);
+    }
+
+    return nullptr;
+}
+
+std::string WebSocketDeflate::makeOffer()
+{
+    std::string offer = std::string(Name) + "; client_max_window_bits";
+    if (!ContextTakeover)
+        offer += "; client_no_context_takeover";
+    return offer;
+}
+
+std::unique_ptr<WebSocketDeflate> WebSocketDeflate::acceptResponse(const std::string& response)
+{
+    std::string name;
+    std::map<std::string, std::string> params;
+    if (!parseExtension(response, name, params) || name != Name)
+        return nullptr;
+
+    bool serverNoTakeover = false;
+    bool clientNoTakeover = false;
+    int clientWindowBits = 15;
+    for (const auto& pair : params)
+    {
+        if (pair.first == "server_no_context_takeover" && pair.second.empty())
+            serverNoTakeover = true;
+        else if (pair.first == "client_no_context_takeover" && pair.second.empty())
+            clientNoTakeover = true;
+        else if (pair.first == "server_max_window_bits")
+        {
+            if (!parseWindowBits(pair.second))
+                return nullptr;
+        }
+        else if (pair.first == "client_max_window_bits")
+        {
+            clientWindowBits = parseWindowBits(pair.second);
+            if (!clientWindowBits)
+                return nullptr;
+        }
+        else
+            return nullptr;
+    }
+
+    const int deflateWindowBits = std::min(clientWindowBits, MaxWindowBits);
+    if (deflateWindowBits < MinDeflateWindowBits)
+        return nullptr;
+
+    return std::make_unique<WebSocketDeflate>(
+        deflateWindowBits, ContextTakeover && !clientNoTakeover, !serverNoTakeover);
+}
+
+bool WebSocketDeflate::compress(const char* data, std::size_t len, std::vector<char>& out)
+{
+    if (!_deflateReady)
+        return false;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const std::size_t offset = out.size();
+    std::size_t used = offset;
+    _deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    _deflate.avail_in = len;
+    do
+    {
+        // Room for what is left, and the sync flush.
+        out.resize(used + deflateBound(&_deflate, _deflate.avail_in) + 16);
+        _deflate.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+        _deflate.avail_out = out.size() - used;
+
+        const int result = deflate(&_deflate, Z_SYNC_FLUSH);
+        used = out.size() - _deflate.avail_out;
+        if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            LOG_ERR("Failed to compress websocket message, result: " << result);
+            out.resize(offset);
+            return false;
+        }
+    } while (_deflate.avail_out == 0);
+
+    if (used - offset < sizeof(FlushMarker) ||
+        std::memcmp(out.data() + used - sizeof(FlushMarker), FlushMarker, sizeof(FlushMarker)))
+    {
+        LOG_ERR("Compressed websocket message doesn't end with a sync flush");
+        out.resize(offset);
+        return false;
+    }
+
+    out.resize(used - sizeof(FlushMarker));
+
+    if (!_deflateTakeover)
+        deflateReset(&_deflate);
+
+    _rawBytes += len;
+    _compressedBytes += out.size() - offset;
+    _time += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    return true;
+}
+
+WebSocketDeflate::InflateResult WebSocketDeflate::decompress(std::vector<char>& payload,
+                                                             std::vector<char>& out)
+{
+    if (!_inflateReady)
+        return InflateResult::Invalid;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const std::size_t compressedSize = payload.size();
+    payload.insert(payload.end(), FlushMarker, FlushMarker + sizeof(FlushMarker));
+    _inflate.next_in = reinterpret_cast<Bytef*>(payload.data());
+    _inflate.avail_in = payload.size();
+
+    // A few KB of zeros can inflate to GBs, so don't grow past our limit,
+    // give or take the spare room we always leave.
+    const std::size_t maxSize = MaxInflatedSize + 1024;
+    out.resize(std::min(std::max<std::size_t>(4096, compressedSize * 4), maxSize));
+    std::size_t used = 0;
+    for (;;)
+    {
+        if (out.size() - used < 1024)
+            out.resize(std::min(out.size() * 2, maxSize));
+
+        _inflate.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+        _inflate.avail_out = out.size() - used;
+
+        const int result = inflate(&_inflate, Z_SYNC_FLUSH);
+        used = out.size() - _inflate.avail_out;
+        if (used > MaxInflatedSize)
+        {
+            LOG_ERR("Websocket message of " << compressedSize
+                                            << " compressed bytes decompresses to more than "
+                                            << MaxInflatedSize << " bytes");
+            out.clear();
+            return InflateResult::TooBig;
+        }
+
+        if (result == Z_STREAM_END)
+        {
+            // The peer ended the stream, its next message starts a new one.
+            inflateReset(&_inflate);
+            break;
+        }
+
+        // Having taken all the input and with room to spare, it's all out.
+        if (_inflate.avail_in == 0 && _inflate.avail_out != 0)
+            break;
+
+        if ((result != Z_OK && result != Z_BUF_ERROR) ||
+            (result == Z_BUF_ERROR && _inflate.avail_out != 0))
+        {
+            LOG_ERR("Failed to decompress websocket message, result: " << result);
+            return InflateResult::Invalid;
+        }
+    }
+
+    out.resize(used);
+
+    if (!_inflateTakeover)
+        inflateReset(&_inflate);
+
+    _rawBytes += used;
+    _compressedBytes += compressedSize;
+    _time += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    return InflateResult::Ok;
+}
+
+void WebSocketDeflate::dumpState(std::ostream& os) const
+{
+    os << Name << " window bits: " << _deflateWindowBits
+       << " takeover out/in: " << _deflateTakeover << '/' << _inflateTakeover
+       << " raw: " << _rawBytes << " compressed: " << _compressedBytes
+       << " time: " << _time.count() << "us ";
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
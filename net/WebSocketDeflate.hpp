@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+/// The permessage-deflate websocket extension (RFC 7692).
+/// Each compressed message is raw DEFLATE data ending in a sync flush, less
+/// the 00 00 ff ff that the flush always ends with. With context takeover,
+/// the window carries over from one message to the next, so the JSON keys
+/// and values that our messages repeat compress to back-references.
+/// Compressed messages are flagged with the RSV1 bit of their first frame.
+class WebSocketDeflate
+{
+public:
+    static constexpr const char* Name = "permessage-deflate";
+
+    /// Whether servers accept the extension when a client offers it.
+    static bool Enabled;
+    /// The largest LZ77 window we compress with, as a power of 2, from 9 to 15.
+    static int MaxWindowBits;
+    /// The zlib memory level we compress with, from 1 to 9.
+    static int MemLevel;
+    /// Whether to keep our compression window from one message to the next.
+    static bool ContextTakeover;
+    /// Shorter messages are sent as they are.
+    static std::size_t MinSize;
+    /// Received messages may not decompress to more than this many bytes.
+    static std::size_t MaxInflatedSize;
+
+    enum class InflateResult
+    {
+        Ok,
+        Invalid, ///< Not valid DEFLATE data.
+        TooBig ///< Decompresses to more than MaxInflatedSize.
+    };
+
+    /// We compress with a window of 2^@deflateWindowBits bytes.
+    /// Without @deflateTakeover, each message we send is compressed on its own,
+    /// without @inflateTakeover, each message we receive was.
+    WebSocketDeflate(int deflateWindowBits, bool deflateTakeover, bool inflateTakeover);
+    ~WebSocketDeflate();
+
+    WebSocketDeflate(const WebSocketDeflate&) = delete;
+    WebSocketDeflate& operator=(const WebSocketDeflate&) = delete;
+
+    /// As a server, accepts the first valid offer in the Sec-WebSocket-Extensions
+    /// header of an upgrade request, setting @response to the value to respond with.
+    /// Returns nullptr if there is none we can accept.
+    static std::unique_ptr<WebSocketDeflate> acceptOffer(const std::string& offers,
+                                                         std::string& response);
+
+    /// The Sec-WebSocket-Extensions value for a client to offer.
+    static std::string makeOffer();
+
+    /// As a client that sent makeOffer(), sets up the extension from the
+    /// Sec-WebSocket-Extensions value of the upgrade response.
+    /// Returns nullptr if it is not a valid acceptance, which fails the connection.
+    static std::unique_ptr<WebSocketDeflate> acceptResponse(const std::string& response);
+
+    /// Whether to compress a message of @len bytes.
+    static bool shouldCompress(std::size_t len) { return len >= MinSize; }
+
+    /// Appends the compressed @len bytes at @data to @out.
+    bool compress(const char* data, std::size_t len, std::vector<char>& out);
+
+    /// Decompresses the payload of a whole received message into @out.
+    /// Anything but Ok fails the connection.
+    InflateResult decompress(std::vector<char>& payload, std::vector<char>& out);
+
+    int getDeflateWindowBits() const { return _deflateWindowBits; }
+    bool hasDeflateTakeover() const { return _deflateTakeover; }
+    bool hasInflateTakeover() const { return _inflateTakeover; }
+
+    /// The bytes of the messages (de)compressed, before compression and after it.
+    uint64_t getRawBytes() const { return _rawBytes; }
+    uint64_t getCompressedBytes() const { return _compressedBytes; }
+
+    /// The time spent (de)compressing messages.
+    std::chrono::microseconds getTime() const { return _time; }
+
+    void dumpState(std::ostream& os) const;
+
+private:
+    const int _deflateWindowBits;
+    const bool _deflateTakeover;
+    const bool _inflateTakeover;
+
+    z_stream _deflate;
+    z_stream _inflate;
+    bool _deflateReady;
+    bool _inflateReady;
+
+    uint64_t _rawBytes;
+    uint64_t _compressedBytes;
+    std::chrono::microseconds _time;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -14,10 +14,14 @@
 #include "common/Protocol.hpp"
 #include "common/Common.hpp"
 #include "common/Log.hpp"
+#include "common/Simd.hpp"
 #include "common/Unit.hpp"
 #include "common/Util.hpp"
 #include "Socket.hpp"
 #include <net/HttpRequest.hpp>
+#if !MOBILEAPP
+#include <net/WebSocketDeflate.hpp>
+#endif
 
 #include <Poco/MemoryStream.h>
 #include <Poco/Net/HTTPRequest.h>
@@ -42,6 +46,10 @@ private:
     /// The security key. Meaningful only for clients.
     const std::string _key;
     unsigned char _lastFlags; //< The flags in the last frame.
+    /// The permessage-deflate extension, when negotiated.
+    std::unique_ptr<WebSocketDeflate> _deflate;
+    bool _offerDeflate; //< Whether to offer permessage-deflate, as a client.
+    bool _inflateMessage; //< Whether the message being received is compressed.
 #endif
 
     std::vector<char> _wsPayload;
@@ -58,6 +66,7 @@ protected:
     struct WSFrameMask
     {
         static constexpr unsigned char Fin = 0x80;
+        static constexpr unsigned char Rsv1 = 0x40; //< Compressed, with permessage-deflate.
         static constexpr unsigned char Mask = 0x80;
     };
 
@@ -81,6 +90,8 @@ public:
         , _inFragmentBlock(false)
         , _key(isClient ? PublicComputeAccept::generateKey() : std::string())
         , _lastFlags(0)
+        , _offerDeflate(false)
+        , _inflateMessage(false)
         ,
 #endif
         _shuttingDown(false)
@@ -137,6 +148,12 @@ public:
     /// Returns the flags of the last received WS frame.
     unsigned char lastFlags() const { return _lastFlags; }
 
+    /// Offer the permessage-deflate extension in wsRequest().
+    void setOfferDeflate(bool offer) { _offerDeflate = offer; }
+
+    /// Returns true if the permessage-deflate extension was negotiated.
+    bool isDeflateEnabled() const { return _deflate != nullptr; }
+
     /// Create a WebSocket connection to the given @host
     /// and @port and add the socket to @poll.
     bool wsRequest(http::Request& req, const std::string& host, const std::string& port,
@@ -162,6 +179,8 @@ public:
         req.set("Upgrade", "websocket");
         req.set("Sec-WebSocket-Version", "13");
         req.set("Sec-WebSocket-Key", getWebSocketKey());
+        if (_offerDeflate)
+            req.set("Sec-WebSocket-Extensions", WebSocketDeflate::makeOffer());
 
         if (socket->send(req))
         {
@@ -241,6 +260,21 @@ protected:
         }
     }
 
+#if !MOBILEAPP
+    void getCompressionStats(uint64_t &raw, uint64_t &compressed,
+                             std::chrono::microseconds &time) override
+    {
+        if (_deflate)
+        {
+            raw = _deflate->getRawBytes();
+            compressed = _deflate->getCompressedBytes();
+            time = _deflate->getTime();
+        }
+        else
+            ProtocolHandlerInterface::getCompressionStats(raw, compressed, time);
+    }
+#endif
+
 public:
     void shutdown(const StatusCodes statusCode = StatusCodes::NORMAL_CLOSE,
                   const std::string& statusMessage = std::string())
@@ -339,6 +373,18 @@ private:
             return true;
         }
 
+        // RSV1 flags the first frame of a compressed message, and is only
+        // valid once permessage-deflate was negotiated (RFC 7692 section 6).
+        if ((_lastFlags & WSFrameMask::Rsv1) &&
+            (!_deflate || isControlFrame(code) || code == WSOpCode::Continuation))
+        {
+            LOG_ERR("Unexpected RSV1 bit set on a WebSocket frame with code "
+                    << static_cast<unsigned>(code)
+                    << (_deflate ? "" : ", without permessage-deflate"));
+            shutdown(StatusCodes::PROTOCOL_ERROR);
+            return true;
+        }
+
         LOG_TRC("Incoming WebSocket data of "
                 << len << " bytes: "
                 << Util::stringifyHexLine(socket->getInBuffer(), 0, std::min((size_t)32, len)));
@@ -447,6 +493,10 @@ private:
             return true;
         }
 
+        // Only the first frame of a message tells whether it's compressed.
+        if (!_inFragmentBlock)
+            _inflateMessage = _lastFlags & WSFrameMask::Rsv1;
+
         //Process data frame
         readPayload(data, payloadLen, mask, _wsPayload);
 #else
@@ -472,6 +522,28 @@ private:
         {
             // If is final fragment then process the accumulated message.
 
+            if (_inflateMessage)
+            {
+                _inflateMessage = false;
+
+                std::vector<char> message;
+                const WebSocketDeflate::InflateResult result =
+                    _deflate->decompress(_wsPayload, message);
+                if (result != WebSocketDeflate::InflateResult::Ok)
+                {
+                    LOG_ERR("Failed to decompress WebSocket message of " << _wsPayload.size()
+                                                                         << " bytes");
+                    _wsPayload.clear();
+                    _inFragmentBlock = false;
+                    shutdown(result == WebSocketDeflate::InflateResult::TooBig
+                                 ? StatusCodes::PAYLOAD_TOO_BIG
+                                 : StatusCodes::PROTOCOL_ERROR);
+                    return true;
+                }
+
+                _wsPayload.swap(message);
+            }
+
             try
             {
                 handleMessage(_wsPayload);
@@ -670,10 +742,19 @@ public:
         return sendMessage(data, len, WSOpCode::Binary, flush);
     }
 
+    /// Implementation of the ProtocolHandlerInterface.
+    int sendSharedMessage(const std::shared_ptr<const void>& owner, const char* data,
+                          const size_t len, bool binary, bool flush = false) const override
+    {
+        return sendMessage(data, len, binary ? WSOpCode::Binary : WSOpCode::Text, flush, owner);
+    }
+
     /// Sends a WebSocket message of WPOpCode type.
+    /// When given, @owner keeps @data alive so it can be sent without a copy.
     /// Returns the number of bytes written (including frame overhead) on success,
     /// 0 for closed socket, and -1 for other errors.
-    int sendMessage(const char* data, const size_t len, const WSOpCode code, const bool flush) const
+    int sendMessage(const char* data, const size_t len, const WSOpCode code, const bool flush,
+                    const std::shared_ptr<const void>& owner = nullptr) const
     {
         if (UnitBase::isUnitTesting() && !Util::isFuzzing())
         {
@@ -685,15 +766,35 @@ public:
         //TODO: Support fragmented messages.
 
         std::shared_ptr<StreamSocket> socket = _socket.lock();
-        return sendFrame(socket, data, len, WSFrameMask::Fin | static_cast<unsigned char>(code), flush);
+
+#if !MOBILEAPP
+        // Binary frames are mostly tiles, which are compressed already.
+        if (_deflate && code == WSOpCode::Text && WebSocketDeflate::shouldCompress(len) &&
+            socket && !socket->isClosed())
+        {
+            std::vector<char> compressed;
+            if (!_deflate->compress(data, len, compressed))
+                return -1;
+
+            return sendFrame(socket, compressed.data(), compressed.size(),
+                             WSFrameMask::Fin | WSFrameMask::Rsv1 |
+                                 static_cast<unsigned char>(code),
+                             flush);
+        }
+#endif
+
+        return sendFrame(socket, data, len, WSFrameMask::Fin | static_cast<unsigned char>(code),
+                         flush, owner);
     }
 
 protected:
 
 #if !MOBILEAPP
     /// Builds a websocket frame based on data and flags received as parameters.
-    /// The frame is output in 'out' parameter
-    void buildFrame(const char* data, const uint64_t len, unsigned char flags, Buffer &out) const
+    /// The frame is output in 'out' parameter, referencing rather than
+    /// copying the data when @owner is given.
+    void buildFrame(const char* data, const uint64_t len, unsigned char flags, Buffer &out,
+                    const std::shared_ptr<const void>& owner = nullptr) const
     {
         int slen = 0;
         char scratch[16];
@@ -739,22 +840,21 @@ protected:
             out.append(mask, 4);
 
             // copy and mask the data
-            char copy[16384];
-            ssize_t i = 0, toSend;
-            while (true)
+            unsigned char copy[16384];
+            uint64_t i = 0;
+            while (i < len)
             {
-                toSend = std::min(sizeof(copy), len - i);
-                if (toSend == 0)
-                    break;
-                for (ssize_t j = 0; j < toSend; ++j, ++i)
-                    copy[j] = data[i] ^ mask[i%4];
-                out.append(copy, toSend);
+                const uint64_t toSend = std::min<uint64_t>(sizeof(copy), len - i);
+                simd::maskPayload(reinterpret_cast<const unsigned char*>(data + i), copy, toSend,
+                                  reinterpret_cast<const unsigned char*>(mask), i);
+                out.append(reinterpret_cast<const char*>(copy), toSend);
+                i += toSend;
             }
         }
         else
         {
-            // Copy the data.
-            out.append(data, len);
+            // Reference or copy the data.
+            out.append(owner, data, len);
         }
     }
 #endif
@@ -764,7 +864,8 @@ protected:
     /// 0 for closed/invalid socket, and -1 for other errors.
     int sendFrame(const std::shared_ptr<StreamSocket>& socket,
                   const char* data, const uint64_t len,
-                  unsigned char flags, bool flush = true) const
+                  unsigned char flags, bool flush = true,
+                  const std::shared_ptr<const void>& owner = nullptr) const
     {
         if (!socket || data == nullptr || len == 0)
             return -1;
@@ -783,7 +884,8 @@ protected:
                                              << " bytes buffered");
 
 #if ENABLE_DEBUG
-        if ((flags & 0xf) == (int)WSOpCode::Text) // utf8 validate
+        // utf8 validate, unless compressed
+        if ((flags & 0xf) == (int)WSOpCode::Text && !(flags & WSFrameMask::Rsv1))
         {
             size_t offset = Util::isValidUtf8((unsigned char*)data, len);
             if (offset < len)
@@ -825,12 +927,13 @@ protected:
 #if !MOBILEAPP
         const size_t oldSize = out.size();
 
-        buildFrame(data, len, flags, out);
+        buildFrame(data, len, flags, out, owner);
 
         // Return the number of bytes we wrote to the *buffer*.
         const size_t size = out.size() - oldSize;
 #else
         (void) flags;
+        (void) owner;
 
         // We ignore the flush parameter and always flush in the MOBILEAPP case because there is no
         // WebSocket framing, we put the messages as such into the FakeSocket queue.
@@ -898,12 +1001,8 @@ protected:
         {
             size_t end = payload.size();
             payload.resize(end + dataLen);
-            if (dataLen > 0)
-            {
-                char* wsData = &payload[end];
-                for (size_t i = 0; i < dataLen; ++i)
-                    *wsData++ = data[i] ^ mask[i % 4];
-            }
+            simd::maskPayload(data, reinterpret_cast<unsigned char*>(&payload[end]), dataLen,
+                              mask);
         }
         else
             payload.insert(payload.end(), data, data + dataLen);
@@ -916,6 +1015,16 @@ protected:
             _msgHandler->handleMessage(data);
     }
 
+    /// Takes over the payload of the message being handled, to avoid
+    /// copying it. Only valid from within handleMessage(), whose data
+    /// argument is left empty.
+    std::vector<char> takeMessagePayload()
+    {
+        std::vector<char> payload;
+        payload.swap(_wsPayload);
+        return payload;
+    }
+
     const std::weak_ptr<StreamSocket>& getSocket() const
     {
         return _socket;
@@ -970,6 +1079,17 @@ protected:
         httpResponse.set("Upgrade", "websocket");
         httpResponse.set("Connection", "Upgrade");
         httpResponse.set("Sec-WebSocket-Accept", PublicComputeAccept::doComputeAccept(wsKey));
+        if (WebSocketDeflate::Enabled)
+        {
+            std::string extensions;
+            _deflate =
+                WebSocketDeflate::acceptOffer(req.get("Sec-WebSocket-Extensions", ""), extensions);
+            if (_deflate)
+            {
+                LOG_DBG("Accepted WebSocket extension [" << extensions << ']');
+                httpResponse.set("Sec-WebSocket-Extensions", extensions);
+            }
+        }
         LOG_TRC("Sending WS Upgrade response: " << httpResponse.header().toString());
         socket->send(httpResponse);
 #else
@@ -1001,6 +1121,21 @@ protected:
                         PublicComputeAccept::doComputeAccept(_key))
                 {
                     LOG_TRC("Accepted incoming websocket response");
+
+                    const std::string extensions = response.get("Sec-WebSocket-Extensions", "");
+                    if (!extensions.empty())
+                    {
+                        if (_offerDeflate)
+                            _deflate = WebSocketDeflate::acceptResponse(extensions);
+                        if (!_deflate)
+                        {
+                            LOG_ERR("Server accepted a WebSocket extension we didn't offer: ["
+                                    << extensions << "]. Disconnecting");
+                            socket->shutdown();
+                            return;
+                        }
+                    }
+
                     setWebSocket(socket);
                 }
                 else
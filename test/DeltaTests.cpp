@@ -19,6 +19,9 @@
 
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <algorithm>
+#include <chrono>
+
 #define DEBUG_DELTA_TESTS 0
 
 /// Delta unit-tests.
@@ -32,6 +35,10 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testDeltaSequence);
     CPPUNIT_TEST(testRandomDeltas);
     CPPUNIT_TEST(testDeltaCopyOutOfBounds);
+    CPPUNIT_TEST(testDictionaryRoundTrip);
+    CPPUNIT_TEST(testScrollDeltaTiming);
+    CPPUNIT_TEST(testNeighbourDelta);
+    CPPUNIT_TEST(testNeighbourDeltaAcknowledged);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -41,6 +48,10 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
     void testDeltaSequence();
     void testRandomDeltas();
     void testDeltaCopyOutOfBounds();
+    void testDictionaryRoundTrip();
+    void testScrollDeltaTiming();
+    void testNeighbourDelta();
+    void testNeighbourDeltaAcknowledged();
 
     std::vector<char> loadPng(const char *relpath,
                               png_uint_32& height,
@@ -68,7 +79,10 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
         const std::vector<char> &pixmap,
         png_uint_32 width, png_uint_32 height,
         const std::vector<char> &delta,
-        const std::string& testname);
+        const std::string& testname,
+        const TileDictionary* dictionary = nullptr,
+        const std::vector<char>* above = nullptr,
+        const std::vector<char>* below = nullptr);
 
     void assertEqual(const std::vector<char> &a,
                      const std::vector<char> &b,
@@ -89,7 +103,7 @@ void checkzDelta(const std::vector<char> &zDelta, const char *legend)
 #endif
 
     LOK_ASSERT(zDelta.size() >= 4);
-    LOK_ASSERT(zDelta[0] == 'D');
+    LOK_ASSERT(zDelta[0] == 'D' || zDelta[0] == 'N');
 
     std::vector<char> delta;
     delta.resize(1024*1024*4); // lots of extra space.
@@ -120,6 +134,20 @@ void checkzDelta(const std::vector<char> &zDelta, const char *legend)
             i += 4;
             break;
         }
+        case 'C': // copy rows from a neighbour.
+        {
+            LOK_ASSERT(zDelta[0] == 'N');
+#if DEBUG_DELTA_TESTS
+            size_t count = static_cast<uint8_t>(delta[i+1]);
+            size_t srcRow = static_cast<uint8_t>(delta[i+2]);
+            size_t destRow = static_cast<uint8_t>(delta[i+3]);
+            bool below = delta[i+4];
+            std::cout << "C(opy row) from " << srcRow << " of the tile " << (below ? "below" : "above")
+                      << " to " << destRow << " number of rows: " << count << "\n";
+#endif
+            i += 9;
+            break;
+        }
         case 'd': // new run
         {
 #if DEBUG_DELTA_TESTS
@@ -159,19 +187,18 @@ std::vector<char> DeltaTests::applyDelta(
     const std::vector<char> &pixmap,
     png_uint_32 width, png_uint_32 height,
     const std::vector<char> &zDelta,
-    const std::string& testname)
+    const std::string& testname,
+    const TileDictionary* dictionary,
+    const std::vector<char>* above,
+    const std::vector<char>* below)
 {
     LOK_ASSERT(zDelta.size() >= 4);
-    LOK_ASSERT(zDelta[0] == 'D');
+    LOK_ASSERT(zDelta[0] == 'D' || zDelta[0] == 'N');
 
-    std::vector<char> delta;
-    delta.resize(1024*1024*4); // lots of extra space.
-
-    size_t compSize = ZSTD_decompress( delta.data(), delta.size(),
-                                       zDelta.data() + 1, zDelta.size() - 1);
-    LOK_ASSERT_EQUAL(ZSTD_isError(compSize), (unsigned)false);
-
-    delta.resize(compSize);
+    Blob zBlob = std::make_shared<BlobData>(zDelta.begin() + 1, zDelta.end());
+    Blob expanded = DeltaGenerator::expand(zBlob, dictionary);
+    LOK_ASSERT(expanded);
+    const std::vector<char>& delta = *expanded;
 
     // start with the same state.
     std::vector<char> output = pixmap;
@@ -202,6 +229,22 @@ std::vector<char> DeltaTests::applyDelta(
             i += 4;
             break;
         }
+        case 'C': // copy rows from a neighbour.
+        {
+            size_t count = static_cast<uint8_t>(delta[i+1]);
+            size_t srcRow = static_cast<uint8_t>(delta[i+2]);
+            size_t destRow = static_cast<uint8_t>(delta[i+3]);
+            const std::vector<char>* neighbour = delta[i+4] ? below : above;
+
+            LOK_ASSERT(neighbour);
+            LOK_ASSERT(srcRow + count <= height);
+
+            for (size_t cnt = 0; cnt < count; ++cnt)
+                std::memcpy(&output[width * (destRow + cnt) * 4],
+                            &(*neighbour)[width * (srcRow + cnt) * 4], width * 4);
+            i += 9;
+            break;
+        }
         case 'd': // new run
         {
             size_t destRow = static_cast<uint8_t>(delta[i+1]);
@@ -488,6 +531,269 @@ void DeltaTests::testDeltaCopyOutOfBounds()
     assertEqual(reText2, text2, width, height, testname);
 }
 
+void DeltaTests::testDictionaryRoundTrip()
+{
+    constexpr auto testname = __func__;
+
+    png_uint_32 height, width, rowBytes;
+    std::vector<std::vector<char>> images;
+    for (const char* name : { "/delta-text.png", "/delta-text2.png",
+                              "/delta-graphic.png", "/delta-graphic2.png" })
+    {
+        images.push_back(DeltaTests::loadPng((std::string(TDOC) + name).c_str(),
+                                             height, width, rowBytes));
+        LOK_ASSERT(height == 256 && width == 256 && rowBytes == 256*4);
+    }
+
+    // Train on the rows of all the images, as keyframes are compressed row by row.
+    std::vector<std::vector<char>> samples;
+    for (const auto& image : images)
+        for (size_t y = 0; y < height; ++y)
+            samples.emplace_back(image.begin() + y * rowBytes,
+                                 image.begin() + (y + 1) * rowBytes);
+
+    std::shared_ptr<const TileDictionary> dictionary =
+        DeltaGenerator::trainDictionary(samples, 16 * 1024);
+    LOK_ASSERT(dictionary);
+    LOK_ASSERT(dictionary->isValid());
+
+    std::vector<char>& text = images[0];
+    std::vector<char>& text2 = images[1];
+
+    DeltaGenerator plain;
+    DeltaGenerator gen;
+    gen.setDictionary(dictionary);
+
+    // A keyframe primed with the dictionary.
+    std::vector<char> keyframe;
+    LOK_ASSERT(gen.compressOrDelta(
+                   reinterpret_cast<unsigned char *>(&text[0]),
+                   0, 0, width, height, width, height,
+                   TileLocation(1, 2, 3, 0, 1), keyframe, 1, false, false, LOK_TILEMODE_RGBA) > 0);
+    LOK_ASSERT_EQUAL('Z', keyframe[0]);
+    LOK_ASSERT_EQUAL(dictionary->getId(),
+                     ZSTD_getDictID_fromFrame(keyframe.data() + 1, keyframe.size() - 1));
+
+    Blob zKeyframe = std::make_shared<BlobData>(keyframe.begin() + 1, keyframe.end());
+    Blob image = DeltaGenerator::expand(zKeyframe, dictionary.get());
+    LOK_ASSERT(image);
+    assertEqual(*image, text, width, height, testname);
+
+    // Frames using a dictionary can't be decoded without it.
+    LOK_ASSERT(!DeltaGenerator::expand(zKeyframe));
+
+    std::vector<char> plainKeyframe;
+    LOK_ASSERT(plain.compressOrDelta(
+                   reinterpret_cast<unsigned char *>(&text[0]),
+                   0, 0, width, height, width, height,
+                   TileLocation(1, 2, 3, 0, 1), plainKeyframe, 1, false, false, LOK_TILEMODE_RGBA) > 0);
+    TST_LOG("Keyframe of " << text.size() << " bytes compressed to " << plainKeyframe.size()
+                           << " bytes, " << keyframe.size() << " bytes with a dictionary");
+
+    // A delta primed with the same dictionary.
+    std::vector<char> delta;
+    LOK_ASSERT(gen.compressOrDelta(
+                   reinterpret_cast<unsigned char *>(&text2[0]),
+                   0, 0, width, height, width, height,
+                   TileLocation(1, 2, 3, 0, 1), delta, 2, false, false, LOK_TILEMODE_RGBA) > 0);
+    LOK_ASSERT_EQUAL('D', delta[0]);
+    LOK_ASSERT_EQUAL(dictionary->getId(),
+                     ZSTD_getDictID_fromFrame(delta.data() + 1, delta.size() - 1));
+
+    std::vector<char> reText2 = applyDelta(text, width, height, delta, testname, dictionary.get());
+    assertEqual(reText2, text2, width, height, testname);
+}
+
+void DeltaTests::testScrollDeltaTiming()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int width = 256;
+    constexpr int height = 256;
+    constexpr int scroll = 17;
+    constexpr int iterations = 200;
+
+    // A page of text-like rows, mostly white with dark runs, each row unique.
+    std::vector<uint32_t> page(width * (height + scroll), 0xffffffff);
+    for (int y = 0; y < height + scroll; ++y)
+        for (int x = (y * 7) % 13; x < width; x += 5 + (x + y) % 11)
+            page[y * width + x] = 0xff000000 | (y << 8) | x;
+    unsigned char* pixmap = reinterpret_cast<unsigned char*>(page.data());
+
+    // The tile before and after scrolling down.
+    DeltaGenerator::DeltaData before(1, pixmap, 0, 0, width, height,
+                                     TileLocation(1, 2, 3, 0, 1), width, height + scroll);
+    DeltaGenerator::DeltaData after(2, pixmap, 0, scroll, width, height,
+                                    TileLocation(1, 2, 3, 0, 1), width, height + scroll);
+
+    DeltaGenerator gen;
+    std::vector<char> delta;
+    LOK_ASSERT(gen.makeDelta(before, after, delta, LOK_TILEMODE_RGBA));
+    checkzDelta(delta, "scroll");
+
+    const std::vector<char> beforePixels(pixmap, pixmap + width * height * 4);
+    const std::vector<char> afterPixels(pixmap + width * scroll * 4,
+                                        pixmap + width * (height + scroll) * 4);
+    assertEqual(applyDelta(beforePixels, width, height, delta, testname), afterPixels, width,
+                height, testname);
+
+    // Most of the tile should be a single copy of the rows that moved up.
+    LOK_ASSERT(delta.size() < beforePixels.size() / 8);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        delta.clear();
+        gen.makeDelta(before, after, delta, LOK_TILEMODE_RGBA);
+    }
+    const auto indexedTime = std::chrono::steady_clock::now() - start;
+
+    // What hunting for the moved rows one by one costs.
+    const auto startBrute = std::chrono::steady_clock::now();
+    int matches = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            for (int yn = 0; yn < height; ++yn)
+            {
+                if (before.getRow((y + yn) % height).identical(after.getRow(y)))
+                {
+                    ++matches;
+                    break;
+                }
+            }
+        }
+    }
+    const auto bruteTime = std::chrono::steady_clock::now() - startBrute;
+    LOK_ASSERT_EQUAL((height - scroll) * iterations, matches);
+
+    TST_LOG("Scroll delta of " << scroll << " rows made " << iterations << " times in "
+                               << std::chrono::duration_cast<std::chrono::microseconds>(indexedTime)
+                               << ", row matching alone took "
+                               << std::chrono::duration_cast<std::chrono::microseconds>(bruteTime)
+                               << " without the row index");
+}
+
+void DeltaTests::testNeighbourDelta()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int width = 256;
+    constexpr int height = 256;
+    constexpr int scroll = 17;
+    constexpr int tileTwips = 3840;
+
+    // Two pages worth of unique text-like rows, for a column of two tiles.
+    std::vector<uint32_t> page(width * height * 2, 0xffffffff);
+    for (int y = 0; y < height * 2; ++y)
+        for (int x = (y * 7) % 13; x < width; x += 5 + (x + y) % 11)
+            page[y * width + x] = 0xff000000 | (y << 8) | x;
+    unsigned char* pixmap = reinterpret_cast<unsigned char*>(page.data());
+    const size_t tileBytes = width * height * 4;
+
+    const TileLocation top(0, 0, tileTwips, 0, 1);
+    const TileLocation bottom(0, tileTwips, tileTwips, 0, 1);
+
+    DeltaGenerator gen;
+    std::vector<char> output;
+    LOK_ASSERT(!gen.createDelta(pixmap, 0, 0, width, height, width, height * 2, top, output, 1,
+                                false, LOK_TILEMODE_RGBA));
+    LOK_ASSERT(!gen.createDelta(pixmap, 0, height, width, height, width, height * 2, bottom,
+                                output, 2, false, LOK_TILEMODE_RGBA));
+    LOK_ASSERT(output.empty());
+
+    // Scroll the top tile down the page: its last rows come from the tile below.
+    LOK_ASSERT(gen.createDelta(pixmap, 0, scroll, width, height, width, height * 2, top, output,
+                               3, false, LOK_TILEMODE_RGBA, 0, 2));
+    LOK_ASSERT_EQUAL('N', output[0]);
+    checkzDelta(output, "scroll from below");
+
+    const std::vector<char> topPixels(pixmap, pixmap + tileBytes);
+    const std::vector<char> bottomPixels(pixmap + tileBytes, pixmap + tileBytes * 2);
+    const std::vector<char> scrolledPixels(pixmap + width * scroll * 4,
+                                           pixmap + width * scroll * 4 + tileBytes);
+    assertEqual(applyDelta(topPixels, width, height, output, testname, nullptr, nullptr,
+                           &bottomPixels),
+                scrolledPixels, width, height, testname);
+
+    // No new pixels: everything is copied.
+    LOK_ASSERT(output.size() < 64);
+
+    // The copy names the version of the tile below it was made from.
+    Blob zBlob = std::make_shared<BlobData>(output.begin() + 1, output.end());
+    Blob expanded = DeltaGenerator::expand(zBlob);
+    LOK_ASSERT(expanded);
+    const auto it = std::find(expanded->begin(), expanded->end(), 'C');
+    LOK_ASSERT(it != expanded->end());
+    LOK_ASSERT_EQUAL(scroll, static_cast<int>(static_cast<uint8_t>(it[1])));
+    LOK_ASSERT_EQUAL(0, static_cast<int>(static_cast<uint8_t>(it[2])));
+    LOK_ASSERT_EQUAL(height - scroll, static_cast<int>(static_cast<uint8_t>(it[3])));
+    LOK_ASSERT_EQUAL(1, static_cast<int>(it[4]));
+    LOK_ASSERT_EQUAL(2, static_cast<int>(it[5]));
+
+    // A keyframe for the tile below doesn't look at its neighbours.
+    output.clear();
+    LOK_ASSERT(!gen.createDelta(pixmap, 0, height, width, height, width, height * 2, bottom,
+                                output, 4, true, LOK_TILEMODE_RGBA, 3, 0));
+}
+
+void DeltaTests::testNeighbourDeltaAcknowledged()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int width = 256;
+    constexpr int height = 256;
+    constexpr int scroll = 17;
+    constexpr int tileTwips = 3840;
+
+    std::vector<uint32_t> page(width * height * 2, 0xffffffff);
+    for (int y = 0; y < height * 2; ++y)
+        for (int x = (y * 7) % 13; x < width; x += 5 + (x + y) % 11)
+            page[y * width + x] = 0xff000000 | (y << 8) | x;
+    unsigned char* pixmap = reinterpret_cast<unsigned char*>(page.data());
+
+    const TileLocation top(0, 0, tileTwips, 0, 1);
+    const TileLocation bottom(0, tileTwips, tileTwips, 0, 1);
+
+    // Scrolls the top tile, the client having version belowWid of the tile below.
+    const auto scrollDelta = [&](bool cachedBelow, TileWireId belowWid)
+    {
+        DeltaGenerator gen;
+        std::vector<char> output;
+        LOK_ASSERT(!gen.createDelta(pixmap, 0, 0, width, height, width, height * 2, top, output,
+                                    1, false, LOK_TILEMODE_RGBA));
+        if (cachedBelow)
+            LOK_ASSERT(!gen.createDelta(pixmap, 0, height, width, height, width, height * 2,
+                                        bottom, output, 2, false, LOK_TILEMODE_RGBA));
+        LOK_ASSERT(gen.createDelta(pixmap, 0, scroll, width, height, width, height * 2, top,
+                                   output, 3, false, LOK_TILEMODE_RGBA, 0, belowWid));
+        return output;
+    };
+
+    // Without the tile below, the scrolled in rows are new pixels.
+    const std::vector<char> plain = scrollDelta(false, 0);
+    LOK_ASSERT_EQUAL('D', plain[0]);
+
+    // The client has the version of the tile below that we have.
+    const std::vector<char> acknowledged = scrollDelta(true, 2);
+    LOK_ASSERT_EQUAL('N', acknowledged[0]);
+    LOK_ASSERT(acknowledged.size() * 10 < plain.size());
+
+    // The client has another version of it, or didn't tell: no copies,
+    // but no more bytes than without the tile below either.
+    const std::vector<char> stale = scrollDelta(true, 1);
+    LOK_ASSERT_EQUAL('D', stale[0]);
+    LOK_ASSERT_EQUAL(plain.size(), stale.size());
+
+    const std::vector<char> unknown = scrollDelta(true, 0);
+    LOK_ASSERT_EQUAL('D', unknown[0]);
+    LOK_ASSERT_EQUAL(plain.size(), unknown.size());
+
+    TST_LOG("Scrolled tile delta: " << plain.size() << " bytes without copies, "
+                                    << acknowledged.size() << " bytes with copies");
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(DeltaTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
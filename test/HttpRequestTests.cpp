@@ -35,6 +35,7 @@
 #include <net/ServerSocket.hpp>
 #include <net/DelaySocket.hpp>
 #include <net/HttpRequest.hpp>
+#include <wsd/StorageConnectionPool.hpp>
 #include <FileUtil.hpp>
 #include <Util.hpp>
 #include <helpers.hpp>
@@ -58,6 +59,7 @@ class HttpRequestTests final : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testSimpleGet);
     CPPUNIT_TEST(testSimpleGetSync);
     CPPUNIT_TEST(testChunkedGetSync);
+    CPPUNIT_TEST(testStorageConnectionPool);
     CPPUNIT_TEST(test500GetStatuses); // Slow.
 #ifdef ENABLE_EXTERNAL_REGRESSION_CHECK
     CPPUNIT_TEST(testChunkedGetSync_External);
@@ -76,6 +78,7 @@ class HttpRequestTests final : public CPPUNIT_NS::TestFixture
     void testSimpleGet();
     void testSimpleGetSync();
     void testChunkedGetSync();
+    void testStorageConnectionPool();
     void test500GetStatuses();
     void testChunkedGetSync_External();
     void testSimplePost_External();
@@ -404,6 +407,39 @@ void HttpRequestTests::testChunkedGetSync()
     }
 }
 
+void HttpRequestTests::testStorageConnectionPool()
+{
+    constexpr auto testname = __func__;
+
+    StorageConnectionPool pool(1, std::chrono::seconds(30));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        TST_LOG("Request #" << i);
+
+        // The storage makes a new session for each request, the pool swaps in its idle one.
+        auto httpSession = http::Session::create(_localUri);
+        httpSession->setTimeout(DefTimeoutSeconds);
+
+        const std::string body = "pooled" + std::to_string(i);
+        const std::shared_ptr<const http::Response> httpResponse
+            = pool.syncRequest(httpSession, http::Request("/echo/" + body), std::string());
+        LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+        LOK_ASSERT_EQUAL(http::StatusCode::OK, httpResponse->statusLine().statusCode());
+        LOK_ASSERT_EQUAL(body, httpResponse->getBody());
+    }
+
+    // A single connection served all the requests and is kept for the next one.
+    LOK_ASSERT_EQUAL(std::size_t(1), pool.getNewCount());
+    LOK_ASSERT_EQUAL(std::size_t(2), pool.getReuseCount());
+    LOK_ASSERT_EQUAL(std::size_t(0), pool.getStaleCount());
+    LOK_ASSERT_EQUAL(std::size_t(1), pool.getIdleCount());
+
+    // Until it's idle for too long.
+    pool.trim(StorageConnectionPool::Clock::now() + std::chrono::seconds(31));
+    LOK_ASSERT_EQUAL(std::size_t(0), pool.getIdleCount());
+}
+
 void HttpRequestTests::testChunkedGetSync_External()
 {
     constexpr auto testname = "chunkedGetSync_External";
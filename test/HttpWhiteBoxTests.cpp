@@ -12,6 +12,7 @@
 #include <config.h>
 
 #include <string>
+#include <vector>
 
 #include <net/HttpRequest.hpp>
 
@@ -37,6 +38,9 @@ class HttpWhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testRequestParserValidComplete);
     CPPUNIT_TEST(testRequestParserValidIncomplete);
 
+    CPPUNIT_TEST(testRequestHeaderParser);
+    CPPUNIT_TEST(testRequestHeaderParserInvalid);
+
     CPPUNIT_TEST_SUITE_END();
 
     void testStatusLineParserValidComplete();
@@ -46,6 +50,8 @@ class HttpWhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testHeader();
     void testRequestParserValidComplete();
     void testRequestParserValidIncomplete();
+    void testRequestHeaderParser();
+    void testRequestHeaderParserInvalid();
 };
 
 void HttpWhiteBoxTests::testStatusLineParserValidComplete()
@@ -226,6 +232,77 @@ void HttpWhiteBoxTests::testRequestParserValidIncomplete()
     LOK_ASSERT_EQUAL(expHost, req.header().get("Host"));
 }
 
+void HttpWhiteBoxTests::testRequestHeaderParser()
+{
+    constexpr auto testname = __func__;
+
+    const std::string header = "\r\nPOST /cool/convert-to/pdf HTTP/1.1\r\n"
+                               "Host: localhost.com\r\n"
+                               "EmptyKey:\r\n"
+                               "Content-Length:  5 \r\n"
+                               "expect: 100-continue\r\n\r\n";
+    const std::string data = header + "hello";
+
+    http::RequestHeaderParser parser;
+
+    // Feed the data as it would arrive, one byte at a time.
+    for (std::size_t i = 0; i < header.size(); ++i)
+    {
+        LOK_ASSERT_EQUAL_MESSAGE("i = " << i << " of " << header.size(),
+                                 http::FieldParseState::Incomplete,
+                                 parser.parse(data.c_str(), i));
+    }
+
+    LOK_ASSERT_EQUAL(http::FieldParseState::Valid, parser.parse(data.c_str(), data.size()));
+    LOK_ASSERT_EQUAL(static_cast<int64_t>(header.size()), parser.getHeaderSize());
+    LOK_ASSERT_EQUAL(std::string("POST"), std::string(parser.getVerb()));
+    LOK_ASSERT_EQUAL(std::string("/cool/convert-to/pdf"), std::string(parser.getUrl()));
+    LOK_ASSERT_EQUAL(std::string("HTTP/1.1"), std::string(parser.getVersion()));
+    LOK_ASSERT_EQUAL(std::size_t(4), parser.getFieldCount());
+    LOK_ASSERT_EQUAL(std::string("localhost.com"), std::string(parser.get("host")));
+    LOK_ASSERT_EQUAL(std::string(), std::string(parser.get("EmptyKey")));
+    LOK_ASSERT_EQUAL(std::string("100-continue"), std::string(parser.get("Expect")));
+    LOK_ASSERT_EQUAL(static_cast<int64_t>(5), parser.getContentLength());
+    LOK_ASSERT(!parser.getChunkedTransferEncoding());
+
+    // The views follow the data when it moves.
+    const std::string copy = data;
+    LOK_ASSERT_EQUAL(http::FieldParseState::Valid, parser.parse(copy.c_str(), copy.size()));
+    LOK_ASSERT(parser.getUrl().data() > copy.c_str());
+    LOK_ASSERT(parser.getUrl().data() < copy.c_str() + copy.size());
+
+    // Ready for the next request.
+    parser.reset();
+    const std::string chunked = "GET / HTTP/1.0\r\nTransfer-Encoding: Chunked\r\n\r\n";
+    LOK_ASSERT_EQUAL(http::FieldParseState::Valid, parser.parse(chunked.c_str(), chunked.size()));
+    LOK_ASSERT_EQUAL(std::string("/"), std::string(parser.getUrl()));
+    LOK_ASSERT_EQUAL(static_cast<int64_t>(-1), parser.getContentLength());
+    LOK_ASSERT(parser.getChunkedTransferEncoding());
+}
+
+void HttpWhiteBoxTests::testRequestHeaderParserInvalid()
+{
+    constexpr auto testname = __func__;
+
+    const std::vector<std::string> requests = {
+        "GET /\r\n\r\n",
+        "GET / HTTP/1.1 extra\r\n\r\n",
+        "GET / HTTPS/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+        "GET / HTTP/1.1\r\nBad Name: value\r\n\r\n",
+        "GET / HTTP/1.1\r\nFolded: value\r\n continued\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n",
+    };
+
+    for (const std::string& request : requests)
+    {
+        http::RequestHeaderParser parser;
+        LOK_ASSERT_EQUAL_MESSAGE(request, http::FieldParseState::Invalid,
+                                 parser.parse(request.c_str(), request.size()));
+    }
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(HttpWhiteBoxTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -32,6 +32,7 @@
 #include <helpers.hpp>
 #include <test.hpp>
 #include <sstream>
+#include <limits>
 #include <random>
 
 using namespace helpers;
@@ -68,6 +69,8 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testSimpleCombine);
     CPPUNIT_TEST(testTileSubscription);
     CPPUNIT_TEST(testSize);
+    CPPUNIT_TEST(testEvictLeastRecentlyUsed);
+    CPPUNIT_TEST(testInvalidateScaling);
     CPPUNIT_TEST(testDisconnectMultiView);
     CPPUNIT_TEST(testUnresponsiveClient);
     CPPUNIT_TEST(testImpressTiles);
@@ -106,6 +109,8 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
     void testSimpleCombine();
     void testTileSubscription();
     void testSize();
+    void testEvictLeastRecentlyUsed();
+    void testInvalidateScaling();
     void testDisconnectMultiView();
     void testUnresponsiveClient();
     void testImpressTiles();
@@ -442,6 +447,123 @@ void TileCacheTests::testSize()
     LOK_ASSERT_MESSAGE("tile cache too big", tc.getMemorySize() < maxSize);
 }
 
+void TileCacheTests::testEvictLeastRecentlyUsed()
+{
+    constexpr auto testname = __func__;
+
+    if (isStandalone())
+    {
+        if (!UnitWSD::init(UnitWSD::UnitType::Wsd, ""))
+            throw std::runtime_error("Failed to load wsd unit test library.");
+    }
+
+    TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+
+    constexpr int tileSize = 3840;
+    std::vector<char> data = genRandomData(4096);
+    data[0] = 'Z'; // compressed pixels.
+
+    const size_t maxSize = (data.size() + sizeof(TileDesc)) * 10;
+    tc.setMaxCacheSize(maxSize);
+
+    const TileDesc first(0, 0, 0, 256, 256, 0, 0, tileSize, tileSize, -1, 0, -1);
+    const uint64_t evictedBefore = TileCache::EvictedTileCount;
+
+    TileWireId id = 0;
+    for (int tilePosY = 0; tilePosY < 20; tilePosY++)
+    {
+        TileDesc tile(0, 0, 0, 256, 256, 0, tilePosY * tileSize, tileSize, tileSize, -1, 0, -1);
+        tile.setWireId(++id);
+        tc.saveTileAndNotify(tile, data.data(), data.size());
+
+        // Keep the first tile hot, it must survive every eviction.
+        LOK_ASSERT_MESSAGE("recently used tile evicted", tc.lookupTile(first));
+    }
+
+    LOK_ASSERT_MESSAGE("tile cache too big", tc.getMemorySize() < maxSize);
+    LOK_ASSERT_MESSAGE("no evictions counted", TileCache::EvictedTileCount > evictedBefore);
+
+    const TileDesc second(0, 0, 0, 256, 256, 0, tileSize, tileSize, tileSize, -1, 0, -1);
+    LOK_ASSERT_MESSAGE("cold tile not evicted", !tc.lookupTile(second));
+}
+
+void TileCacheTests::testInvalidateScaling()
+{
+    constexpr auto testname = __func__;
+
+    if (isStandalone())
+    {
+        if (!UnitWSD::init(UnitWSD::UnitType::Wsd, ""))
+            throw std::runtime_error("Failed to load wsd unit test library.");
+    }
+
+    constexpr int views = 4;
+    constexpr int columns = 50;
+    constexpr int tileSize = 3840;
+    constexpr int invalidations = 1000;
+
+    std::vector<char> data = genRandomData(64);
+    data[0] = 'Z'; // compressed pixels.
+
+    // Invalidation cost should track the invalidated area, not the cache size.
+    for (const int rows : { 5, 50, 250 })
+    {
+        TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+        tc.setMaxCacheSize(std::numeric_limits<size_t>::max());
+
+        TileWireId id = 0;
+        for (int nviewid = 0; nviewid < views; ++nviewid)
+        {
+            for (int row = 0; row < rows; ++row)
+            {
+                for (int col = 0; col < columns; ++col)
+                {
+                    TileDesc tile(nviewid, 0, 0, 256, 256, col * tileSize, row * tileSize,
+                                  tileSize, tileSize, -1, 0, -1);
+                    tile.setWireId(++id);
+                    tc.saveTileAndNotify(tile, data.data(), data.size());
+                }
+            }
+        }
+
+        // A keystroke-sized rectangle well inside the second tile of the first row.
+        std::ostringstream oss;
+        oss << "invalidatetiles: part=0 x=" << tileSize + 100 << " y=100 width=200 height=100"
+            << " wid=" << id;
+        const std::string message = oss.str();
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < invalidations; ++i)
+            tc.invalidateTiles(message, 0);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        const int cached = views * rows * columns;
+        TST_LOG("Invalidating " << invalidations << " times with " << cached << " tiles cached took "
+                                << elapsed << " (" << elapsed.count() * 1000 / invalidations
+                                << " ns per invalidation)");
+
+        TileDesc hit(0, 0, 0, 256, 256, tileSize, 0, tileSize, tileSize, -1, 0, -1);
+        Tile tileData = tc.lookupTile(hit);
+        LOK_ASSERT_MESSAGE("intersecting tile not invalidated", tileData && !tileData->isValid());
+
+        TileDesc miss(0, 0, 0, 256, 256, 3 * tileSize, 0, tileSize, tileSize, -1, 0, -1);
+        tileData = tc.lookupTile(miss);
+        LOK_ASSERT_MESSAGE("distant tile invalidated", tileData && tileData->isValid());
+
+        TileDesc otherView(1, 0, 0, 256, 256, tileSize, 0, tileSize, tileSize, -1, 0, -1);
+        tileData = tc.lookupTile(otherView);
+        LOK_ASSERT_MESSAGE("other view's tile invalidated", tileData && tileData->isValid());
+
+        // EMPTY still reaches every tile of the view.
+        tc.invalidateTiles("invalidatetiles: EMPTY", 0);
+        TileDesc last(0, 0, 0, 256, 256, (columns - 1) * tileSize, (rows - 1) * tileSize,
+                      tileSize, tileSize, -1, 0, -1);
+        tileData = tc.lookupTile(last);
+        LOK_ASSERT_MESSAGE("tile not invalidated by EMPTY", tileData && !tileData->isValid());
+    }
+}
+
 
 void TileCacheTests::testDisconnectMultiView()
 {
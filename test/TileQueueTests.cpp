@@ -30,11 +30,14 @@ class TileQueueTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testTileQueuePriority);
     CPPUNIT_TEST(testTileCombinedRendering);
     CPPUNIT_TEST(testTileRecombining);
+    CPPUNIT_TEST(testTileQueueThroughput);
     CPPUNIT_TEST(testViewOrder);
     CPPUNIT_TEST(testPreviewsDeprioritization);
     CPPUNIT_TEST(testSenderQueue);
     CPPUNIT_TEST(testSenderQueueTileDeduplication);
     CPPUNIT_TEST(testInvalidateViewCursorDeduplication);
+    CPPUNIT_TEST(testSenderQueueFloodSlowSession);
+    CPPUNIT_TEST(testSenderQueueSlowReader);
     CPPUNIT_TEST(testCallbackModifiedStatusIsSkipped);
     CPPUNIT_TEST(testCallbackInvalidation);
     CPPUNIT_TEST(testCallbackIndicatorValue);
@@ -45,11 +48,14 @@ class TileQueueTests : public CPPUNIT_NS::TestFixture
     void testTileQueuePriority();
     void testTileCombinedRendering();
     void testTileRecombining();
+    void testTileQueueThroughput();
     void testViewOrder();
     void testPreviewsDeprioritization();
     void testSenderQueue();
     void testSenderQueueTileDeduplication();
     void testInvalidateViewCursorDeduplication();
+    void testSenderQueueFloodSlowSession();
+    void testSenderQueueSlowReader();
     void testCallbackModifiedStatusIsSkipped();
     void testCallbackInvalidation();
     void testCallbackIndicatorValue();
@@ -160,6 +166,72 @@ void TileQueueTests::testTileRecombining()
     LOK_ASSERT_EQUAL(0, static_cast<int>(queue.getQueue().size()));
 }
 
+void TileQueueTests::testTileQueueThroughput()
+{
+    constexpr auto testname = __func__;
+
+    // Rapid scrolling: the view moves down a row at a time, and each time
+    // the whole visible area is requested while most of it is still queued.
+    constexpr int Columns = 16;
+    constexpr int VisibleRows = 32;
+    constexpr int Scrolls = 128;
+    constexpr int Tiles = Columns * (VisibleRows + Scrolls - 1);
+
+    TileQueue queue;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int scroll = 0; scroll < Scrolls; ++scroll)
+    {
+        for (int row = scroll; row < scroll + VisibleRows; ++row)
+        {
+            std::string tileposx;
+            std::string tileposy;
+            for (int column = 0; column < Columns; ++column)
+            {
+                const char* separator = (column ? "," : "");
+                tileposx += separator + std::to_string(column * 3840);
+                tileposy += separator + std::to_string(row * 3840);
+            }
+
+            queue.put("tilecombine nviewid=0 part=0 width=256 height=256 tileposx=" + tileposx +
+                      " tileposy=" + tileposy + " tilewidth=3840 tileheight=3840");
+        }
+    }
+    const auto queued = std::chrono::steady_clock::now();
+
+    // Each tile is queued only once.
+    LOK_ASSERT_EQUAL(static_cast<size_t>(Tiles), queue.getQueue().size());
+
+    // Move the cursor to the middle, so we prioritize while draining.
+    queue.updateCursorPosition(0, 0, 0, (Tiles / Columns / 2) * 3840, 10, 100);
+
+    int received = 0;
+    int messages = 0;
+    while (!queue.isEmpty())
+    {
+        const TileQueue::Payload payload = queue.get();
+        const std::string msg(payload.data(), payload.size());
+        if (COOLProtocol::matchPrefix("tilecombine", msg))
+            received += TileCombined::parse(msg).getTiles().size();
+        else
+        {
+            LOK_ASSERT(COOLProtocol::matchPrefix("tile", msg));
+            ++received;
+        }
+        ++messages;
+    }
+    const auto drained = std::chrono::steady_clock::now();
+
+    const auto putTime = std::chrono::duration_cast<std::chrono::microseconds>(queued - start);
+    const auto getTime = std::chrono::duration_cast<std::chrono::microseconds>(drained - queued);
+    TST_LOG("Queued " << Scrolls * VisibleRows * Columns << " tile requests in " << putTime << ", "
+                      << putTime.count() * 1000 / (Scrolls * VisibleRows * Columns)
+                      << " ns/tile; drained " << Tiles << " tiles as " << messages
+                      << " messages in " << getTime);
+
+    LOK_ASSERT_EQUAL(Tiles, received);
+}
+
 void TileQueueTests::testViewOrder()
 {
     constexpr auto testname = __func__;
@@ -481,6 +553,121 @@ void TileQueueTests::testCallbackPageSize()
     LOK_ASSERT_EQUAL_STR("callback all 13 12474, 205748", queue.get());
 }
 
+void TileQueueTests::testSenderQueueFloodSlowSession()
+{
+    constexpr auto testname = __func__;
+
+    // A slow client on a document with many active viewers:
+    // the queue is never drained while it is flooded.
+    constexpr int Viewers = 64;
+    constexpr int Tiles = 512;
+    constexpr int Rounds = 20;
+
+    SenderQueue<std::shared_ptr<Message>> queue;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < Rounds; ++round)
+    {
+        for (int i = 0; i < Tiles; ++i)
+        {
+            const std::string tile = "tile: nviewid=0 part=0 width=256 height=256 tileposx=" +
+                                     std::to_string((i % 16) * 3840) + " tileposy=" +
+                                     std::to_string((i / 16) * 3840) +
+                                     " tilewidth=3840 tileheight=3840 ver=" + std::to_string(round);
+            queue.enqueue(std::make_shared<Message>(tile, Message::Dir::Out));
+
+            const int viewId = i % Viewers;
+            const std::string cursor = "invalidateviewcursor: { \"viewId\": \"" +
+                                       std::to_string(viewId) + "\", \"rectangle\": \"" +
+                                       std::to_string(round * 100 + i) +
+                                       ", 1418, 0, 298\", \"part\": \"0\" }";
+            queue.enqueue(std::make_shared<Message>(cursor, Message::Dir::Out));
+
+            queue.enqueue(std::make_shared<Message>("statusindicatorsetvalue: " + std::to_string(i),
+                                                    Message::Dir::Out));
+        }
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    TST_LOG("Enqueued " << Rounds * Tiles * 3 << " messages in " << elapsed << ", "
+                        << elapsed.count() * 1000 / (Rounds * Tiles * 3) << " ns/message");
+
+    // Only the latest of each tile, view cursor and status indicator remain.
+    LOK_ASSERT_EQUAL(static_cast<size_t>(Tiles + Viewers + 1), queue.size());
+
+    std::shared_ptr<Message> item;
+    size_t count = 0;
+    while (queue.dequeue(item))
+    {
+        LOK_ASSERT(item);
+        if (item->firstTokenMatches("tile:"))
+            LOK_ASSERT(Util::endsWith(item->firstLine(), "ver=" + std::to_string(Rounds - 1)));
+        ++count;
+    }
+
+    LOK_ASSERT_EQUAL(static_cast<size_t>(Tiles + Viewers + 1), count);
+    LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.size());
+}
+
+void TileQueueTests::testSenderQueueSlowReader()
+{
+    constexpr auto testname = __func__;
+
+    // A reader taking one message for every hundred superseding ones.
+    constexpr int Tiles = 16;
+    constexpr int Messages = 100000;
+
+    SenderQueue<std::shared_ptr<Message>> queue;
+
+    std::vector<int> lastVersion(Tiles, -1);
+    std::shared_ptr<Message> item;
+    for (int i = 0; i < Messages; ++i)
+    {
+        const int tile = i % Tiles;
+        queue.enqueue(std::make_shared<Message>(
+            "tile: nviewid=0 part=0 width=256 height=256 tileposx=" + std::to_string(tile * 3840) +
+                " tileposy=0 tilewidth=3840 tileheight=3840 ver=" + std::to_string(i),
+            Message::Dir::Out));
+        queue.enqueue(std::make_shared<Message>("invalidatecursor: " + std::to_string(i),
+                                                Message::Dir::Out));
+
+        if (i % 100 == 0)
+        {
+            LOK_ASSERT(queue.dequeue(item));
+            if (item->firstTokenMatches("tile:"))
+            {
+                // Each tile comes out at most once per version, newest first.
+                const TileDesc desc = TileDesc::parse(item->firstLine());
+                const int version = std::stoi(item->firstLine().substr(
+                    item->firstLine().rfind("ver=") + 4));
+                const int index = desc.getTilePosX() / 3840;
+                LOK_ASSERT(version > lastVersion[index]);
+                lastVersion[index] = version;
+            }
+        }
+
+        // The superseded entries don't pile up.
+        LOK_ASSERT(queue.getEntryCount() <= 2 * queue.size() + 64);
+    }
+
+    TST_LOG("Queued " << queue.size() << " messages in " << queue.getEntryCount() << " entries");
+
+    // What is left is the latest of each tile and cursor, in order.
+    LOK_ASSERT(queue.size() <= static_cast<size_t>(Tiles + 1));
+    std::size_t count = 0;
+    while (queue.dequeue(item))
+    {
+        if (item->firstTokenMatches("invalidatecursor:"))
+            LOK_ASSERT_EQUAL(std::string("invalidatecursor: ") + std::to_string(Messages - 1),
+                             item->firstLine());
+        ++count;
+    }
+
+    LOK_ASSERT_EQUAL(queue.size(), static_cast<size_t>(0));
+    LOK_ASSERT(count > 0);
+}
+
 void TileQueueTests::testCallbackModifiedStatusIsSkipped()
 {
     constexpr auto testname = __func__;
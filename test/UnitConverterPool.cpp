@@ -0,0 +1,202 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Common.hpp>
+#include <FileUtil.hpp>
+#include <Unit.hpp>
+#include <Util.hpp>
+#include <helpers.hpp>
+#include <lokassert.hpp>
+#include <wsd/COOLWSD.hpp>
+#include <wsd/DocumentBroker.hpp>
+
+#include <Poco/File.h>
+#include <Poco/Net/HTMLForm.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Net/StringPartSource.h>
+#include <Poco/Path.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/Util/LayeredConfiguration.h>
+
+/// Converts two documents back to back, the second one in the Kit recycled
+/// after the first. Checks that the second conversion is correct, and that
+/// nothing of the first document is left in the jail for it.
+class UnitConverterPool : public UnitWSD
+{
+    bool _workerStarted;
+    std::thread _worker;
+
+    static constexpr auto FirstFilename = "first-conversion.txt";
+    static constexpr auto FirstContent = "The content of the first conversion";
+    static constexpr auto SecondFilename = "second-conversion.txt";
+    static constexpr auto SecondContent = "The content of the second conversion";
+
+public:
+    UnitConverterPool()
+        : UnitWSD("UnitConverterPool")
+        , _workerStarted(false)
+    {
+        setTimeout(std::chrono::minutes(2));
+    }
+
+    ~UnitConverterPool()
+    {
+        LOG_INF("Joining test worker thread");
+        if (_worker.joinable())
+            _worker.join();
+    }
+
+    void configure(Poco::Util::LayeredConfiguration& config) override
+    {
+        UnitWSD::configure(config);
+
+        config.setBool("ssl.enable", true);
+        config.setInt("per_document.limit_load_secs", 30);
+        config.setBool("storage.filesystem[@allow]", false);
+        config.setBool("per_document.converter_pool[@enable]", true);
+    }
+
+    /// Converts @content, sent as the text file @filename, to text.
+    static std::string convert(const std::string& filename, const std::string& content)
+    {
+        std::unique_ptr<Poco::Net::HTTPClientSession> session(
+            helpers::createSession(Poco::URI(helpers::getTestServerURI())));
+        session->setTimeout(Poco::Timespan(30, 0)); // 30 seconds.
+
+        Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST, "/cool/convert-to/txt");
+        Poco::Net::HTMLForm form;
+        form.setEncoding(Poco::Net::HTMLForm::ENCODING_MULTIPART);
+        form.addPart("data", new Poco::Net::StringPartSource(content, "text/plain", filename));
+        form.prepareSubmit(request);
+        form.write(session->sendRequest(request));
+
+        Poco::Net::HTTPResponse response;
+        std::istream& responseStream = session->receiveResponse(response);
+        LOK_ASSERT_EQUAL(Poco::Net::HTTPResponse::HTTP_OK, response.getStatus());
+
+        std::string converted;
+        Poco::StreamCopier::copyToString(responseStream, converted);
+        return converted;
+    }
+
+    /// Waits for a Kit to be recycled into the pool.
+    static bool waitForIdleConverter()
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            if (ConverterPool::getIdleCount() > 0)
+                return true;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        return false;
+    }
+
+    /// Returns true iff a file under @dir has @text in its name or contents.
+    static bool containsText(const std::string& dir, const std::string& text)
+    {
+        std::vector<std::string> entries;
+        Poco::File(dir).list(entries);
+        for (const std::string& entry : entries)
+        {
+            const std::string path = Poco::Path(dir, entry).toString();
+            if (entry.find(text) != std::string::npos)
+            {
+                LOG_TST("Found [" << text << "] in the name of " << path);
+                return true;
+            }
+
+            // Don't follow links, nor read the device nodes.
+            const FileUtil::Stat stat(path, /*link=*/true);
+            if (stat.isDirectory())
+            {
+                if (entry != "dev" && containsText(path, text))
+                    return true;
+            }
+            else if (stat.isFile())
+            {
+                const std::unique_ptr<std::vector<char>> data =
+                    FileUtil::readFile(path, 64 * 1024 * 1024);
+                if (data && std::string(data->begin(), data->end()).find(text) != std::string::npos)
+                {
+                    LOG_TST("Found [" << text << "] in " << path);
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    /// Returns true iff the temporary directory of any jail has @text.
+    static bool jailsContainText(const std::string& text)
+    {
+        std::vector<std::string> jails;
+        Poco::File(COOLWSD::ChildRoot).list(jails);
+        for (const std::string& jail : jails)
+        {
+            const std::string tmpPath = Poco::Path(COOLWSD::ChildRoot, jail + "/tmp").toString();
+            if (FileUtil::Stat(tmpPath).isDirectory() && containsText(tmpPath, text))
+                return true;
+        }
+
+        return false;
+    }
+
+    void invokeWSDTest() override
+    {
+        if (_workerStarted)
+            return;
+
+        _workerStarted = true;
+        _worker = std::thread(
+            [this]
+            {
+                LOG_TST("Converting the first document");
+                const std::string first = convert(FirstFilename, FirstContent);
+                LOK_ASSERT_MESSAGE("Expected the first document converted",
+                                   first.find(FirstContent) != std::string::npos);
+
+                LOK_ASSERT_MESSAGE("Expected the Kit to be recycled", waitForIdleConverter());
+                LOK_ASSERT_MESSAGE("Expected nothing of the first document left in the jail",
+                                   !jailsContainText(FirstContent));
+                LOK_ASSERT_MESSAGE("Expected no trace of the first document name in the jail",
+                                   !jailsContainText("first-conversion"));
+
+                const std::size_t reuseCount = ConverterPool::getReuseCount();
+
+                LOG_TST("Converting the second document");
+                const std::string second = convert(SecondFilename, SecondContent);
+                LOK_ASSERT_EQUAL_MESSAGE("Expected the second conversion by the recycled Kit",
+                                         reuseCount + 1, ConverterPool::getReuseCount());
+                LOK_ASSERT_MESSAGE("Expected the second document converted",
+                                   second.find(SecondContent) != std::string::npos);
+                LOK_ASSERT_MESSAGE("Expected nothing of the first document in the second",
+                                   second.find(FirstContent) == std::string::npos);
+
+                passTest("Converted twice with the same Kit");
+            });
+    }
+};
+
+UnitBase* unit_create_wsd(void) { return new UnitConverterPool(); }
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,7 +11,10 @@
 
 #include <config.h>
 
+#include <atomic>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include "HttpRequest.hpp"
 #include "Util.hpp"
@@ -23,7 +26,9 @@
 #include <UnitHTTP.hpp>
 #include <cstddef>
 #include <helpers.hpp>
+#include <wsd/COOLWSD.hpp>
 #include <Poco/Net/HTTPRequest.h>
+#include <Poco/URI.h>
 #include <Poco/Util/LayeredConfiguration.h>
 
 /// Test slow saving/uploading.
@@ -264,9 +269,157 @@ public:
     }
 };
 
+/// Test the progress of a slow download.
+/// GetFile sends the document in chunks, one at a time,
+/// and we expect several increasing progress values to
+/// reach the client while the download is still going,
+/// and before the load finishes.
+class UnitWOPISlowGetFile : public WopiTestServer
+{
+    STATE_ENUM(Phase, Load, WaitGetFile, WaitDownload, WaitLoadStatus, Done) _phase;
+
+    /// The number of chunks to send the document in.
+    static constexpr std::size_t ChunkCount = 5;
+
+    /// The GetFile socket, while we are sending the document.
+    std::shared_ptr<StreamSocket> _getFileSocket;
+    std::size_t _sentBytes; //< The bytes of the document sent so far.
+    std::atomic<bool> _downloaded; //< True once the last chunk is sent.
+
+    /// The progress values the client got before the download finished.
+    std::vector<int> _progress;
+
+public:
+    UnitWOPISlowGetFile()
+        : WopiTestServer("UnitWOPISlowGetFile")
+        , _phase(Phase::Load)
+        , _sentBytes(0)
+        , _downloaded(false)
+    {
+    }
+
+    bool handleGetFileRequest(const Poco::Net::HTTPRequest& request,
+                              std::shared_ptr<StreamSocket>& socket) override
+    {
+        LOG_TST("GetFile: " << Poco::URI(request.getURI()).getPath() << ", sending "
+                            << getFileContent().size() << " bytes in " << ChunkCount
+                            << " chunks");
+        LOK_ASSERT_MESSAGE("Expected to be in Phase::WaitGetFile", _phase == Phase::WaitGetFile);
+
+        // Only send the header now, the body is sent in invokeWSDTest().
+        http::Response httpResponse(http::StatusCode::OK);
+        httpResponse.set("Last-Modified", Util::getHttpTime(getFileLastModifiedTime()));
+        httpResponse.setContentType("application/octet-stream");
+        httpResponse.setContentLength(getFileContent().size());
+        httpResponse.set("Connection", "close");
+        socket->send(httpResponse);
+
+        _getFileSocket = socket;
+        TRANSITION_STATE(_phase, Phase::WaitDownload);
+        return true;
+    }
+
+    bool onFilterSendWebSocketMessage(const char* data, const std::size_t len,
+                                      const WSOpCode /* code */, const bool flush,
+                                      int& /*unitReturn*/) override
+    {
+        const std::string message(data, len);
+        if (Util::startsWith(message, "statusindicatorsetvalue:") && !_downloaded)
+        {
+            LOG_TST("Download progress: [" << message << ']');
+
+            // Queued messages would only be written after the download.
+            LOK_ASSERT_MESSAGE("Expected the progress to be flushed", flush);
+
+            const int percent = std::stoi(message.substr(sizeof("statusindicatorsetvalue:")));
+            if (!_progress.empty())
+                LOK_ASSERT_MESSAGE("Expected increasing progress", percent > _progress.back());
+            _progress.push_back(percent);
+        }
+        else if (Util::startsWith(message, "statusindicatorfinish:"))
+        {
+            LOG_TST("Load finished with " << _progress.size() << " progress values");
+            LOK_ASSERT_MESSAGE("Expected several progress values during the download",
+                               _progress.size() >= 2);
+        }
+
+        return false;
+    }
+
+    bool onDocumentLoaded(const std::string& message) override
+    {
+        LOG_TST("Doc (" << toString(_phase) << "): [" << message << ']');
+        LOK_ASSERT_MESSAGE("Expected to be in Phase::WaitLoadStatus",
+                           _phase == Phase::WaitLoadStatus);
+        LOK_ASSERT_MESSAGE("Expected several progress values during the download",
+                           _progress.size() >= 2);
+
+        TRANSITION_STATE(_phase, Phase::Done);
+        passTest("Got " + std::to_string(_progress.size()) +
+                 " progress values while downloading");
+        return true;
+    }
+
+    void invokeWSDTest() override
+    {
+        switch (_phase)
+        {
+            case Phase::Load:
+            {
+                TRANSITION_STATE(_phase, Phase::WaitGetFile);
+
+                LOG_TST("Load: initWebsocket.");
+                initWebsocket("/wopi/files/" + getTestname() + "?access_token=anything");
+
+                WSD_CMD("load url=" + getWopiSrc());
+                break;
+            }
+            case Phase::WaitGetFile:
+                break;
+            case Phase::WaitDownload:
+            {
+                // Send one chunk per invocation, to have a slow download.
+                const std::string& content = getFileContent();
+                const std::size_t chunkSize = (content.size() + ChunkCount - 1) / ChunkCount;
+                std::string chunk = content.substr(_sentBytes, chunkSize);
+                _sentBytes += chunk.size();
+
+                const bool last = _sentBytes >= content.size();
+                LOG_TST("Sending " << chunk.size() << " bytes, " << _sentBytes << " of "
+                                   << content.size());
+
+                std::shared_ptr<StreamSocket> socket = _getFileSocket;
+                if (last)
+                {
+                    _getFileSocket.reset();
+                    TRANSITION_STATE(_phase, Phase::WaitLoadStatus);
+                }
+
+                // The socket belongs to the web-server poll.
+                COOLWSD::getWebServerPoll()->addCallback(
+                    [this, socket, chunk = std::move(chunk), last]()
+                    {
+                        if (last)
+                            _downloaded = true;
+
+                        socket->send(chunk);
+                        if (last)
+                            socket->shutdown();
+                    });
+                break;
+            }
+            case Phase::WaitLoadStatus:
+                break;
+            case Phase::Done:
+                break;
+        }
+    }
+};
+
 UnitBase** unit_create_wsd_multi(void)
 {
-    return new UnitBase* [3] { new UnitWOPISlow(), new UnitSuperfluousSaves(), nullptr };
+    return new UnitBase* [4] { new UnitWOPISlow(), new UnitSuperfluousSaves(),
+                                new UnitWOPISlowGetFile(), nullptr };
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
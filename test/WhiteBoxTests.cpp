@@ -18,21 +18,34 @@
 #include <Auth.hpp>
 #include <ChildSession.hpp>
 #include <Common.hpp>
+#include <DummyLibreOfficeKit.hpp>
 #include <FileUtil.hpp>
 #include <Kit.hpp>
 #include <MessageQueue.hpp>
 #include <Protocol.hpp>
+#include <RenderTiles.hpp>
+#include <Simd.hpp>
 #include <TileDesc.hpp>
 #include <Util.hpp>
 #include <JsonUtil.hpp>
 
 #include <common/Message.hpp>
+#include <wsd/ConvertCache.hpp>
 #include <wsd/FileServer.hpp>
+#include <wsd/PrespawnController.hpp>
+#include <wsd/ProxyProtocol.hpp>
+#include <wsd/TileCache.hpp>
 #include <net/Buffer.hpp>
 #include <net/NetUtil.hpp>
+#include <net/Socket.hpp>
+#include <net/WebSocketDeflate.hpp>
+#include <net/WebSocketHandler.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <sys/resource.h>
+#include <thread>
 
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -43,6 +56,7 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testCOOLProtocolFunctions);
     CPPUNIT_TEST(testSplitting);
     CPPUNIT_TEST(testMessage);
+    CPPUNIT_TEST(testMessageAdopt);
     CPPUNIT_TEST(testPathPrefixTrimming);
     CPPUNIT_TEST(testMessageAbbreviation);
     CPPUNIT_TEST(testReplace);
@@ -50,14 +64,24 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testRegexListMatcher);
     CPPUNIT_TEST(testRegexListMatcher_Init);
     CPPUNIT_TEST(testEmptyCellCursor);
+    CPPUNIT_TEST(testBackgroundSave);
+    CPPUNIT_TEST(testConvertCache);
+    CPPUNIT_TEST(testPrespawnController);
     CPPUNIT_TEST(testTileDesc);
     CPPUNIT_TEST(testTileData);
+    CPPUNIT_TEST(testNeighbourDeltaInvalidation);
+    CPPUNIT_TEST(testSharedTileMessages);
     CPPUNIT_TEST(testRectanglesIntersect);
     CPPUNIT_TEST(testJson);
     CPPUNIT_TEST(testAnonymization);
     CPPUNIT_TEST(testIso8601Time);
     CPPUNIT_TEST(testClockAsString);
     CPPUNIT_TEST(testBufferClass);
+    CPPUNIT_TEST(testBufferShared);
+    CPPUNIT_TEST(testWebSocketMask);
+    CPPUNIT_TEST(testWebSocketDeflate);
+    CPPUNIT_TEST(testProxyFraming);
+    CPPUNIT_TEST(testProxyThroughput);
     CPPUNIT_TEST(testHexify);
     CPPUNIT_TEST(testStat);
     CPPUNIT_TEST(testStringCompare);
@@ -71,11 +95,14 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testUtf8);
 #endif
     CPPUNIT_TEST(testFindInVector);
+    CPPUNIT_TEST(testSocketPollBackends);
+    CPPUNIT_TEST(testThreadPoolBatches);
     CPPUNIT_TEST_SUITE_END();
 
     void testCOOLProtocolFunctions();
     void testSplitting();
     void testMessage();
+    void testMessageAdopt();
     void testPathPrefixTrimming();
     void testMessageAbbreviation();
     void testReplace();
@@ -83,14 +110,24 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testRegexListMatcher();
     void testRegexListMatcher_Init();
     void testEmptyCellCursor();
+    void testBackgroundSave();
+    void testConvertCache();
+    void testPrespawnController();
     void testTileDesc();
     void testTileData();
+    void testNeighbourDeltaInvalidation();
+    void testSharedTileMessages();
     void testRectanglesIntersect();
     void testJson();
     void testAnonymization();
     void testIso8601Time();
     void testClockAsString();
     void testBufferClass();
+    void testBufferShared();
+    void testWebSocketMask();
+    void testWebSocketDeflate();
+    void testProxyFraming();
+    void testProxyThroughput();
     void testHexify();
     void testStat();
     void testStringCompare();
@@ -102,6 +139,8 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testJsonUtilEscapeJSONValue();
     void testUtf8();
     void testFindInVector();
+    void testSocketPollBackends();
+    void testThreadPoolBatches();
 };
 
 void WhiteBoxTests::testCOOLProtocolFunctions()
@@ -363,6 +402,74 @@ void WhiteBoxTests::testMessage()
     free(big);
 }
 
+void WhiteBoxTests::testMessageAdopt()
+{
+    constexpr auto testname = __func__;
+
+    // A tilecombine response from the Kit, as large as a full row of tiles.
+    constexpr int TileCount = 16;
+    constexpr std::size_t TileSize = 16 * 1024;
+    std::string tilecombine = "tilecombine: nviewid=0 part=0 width=256 height=256 tileposx=";
+    for (int i = 0; i < TileCount; ++i)
+        tilecombine += (i ? "," : "") + std::to_string(i * 3840);
+    tilecombine += " tileposy=0 tilewidth=3840 tileheight=3840 imgsize=";
+    for (int i = 0; i < TileCount; ++i)
+        tilecombine += (i ? "," : "") + std::to_string(TileSize);
+    const std::size_t firstLineSize = tilecombine.size();
+    tilecombine += '\n';
+    tilecombine.append(TileCount * TileSize, 'Z');
+
+    // The payload is taken over as-is, and only the first line is tokenized.
+    std::vector<char> payload(tilecombine.begin(), tilecombine.end());
+    const char* const buffer = payload.data();
+    Message message(std::move(payload), Message::Dir::Out);
+    LOK_ASSERT(message.data().data() == buffer);
+    LOK_ASSERT(message.isBinary());
+    LOK_ASSERT(message.firstTokenMatches("tilecombine:"));
+    LOK_ASSERT_EQUAL(std::size_t(10), message.tokens().size());
+    LOK_ASSERT_EQUAL(firstLineSize, message.firstLine().size());
+
+    // Forwarded messages lose their forward token, as when copied.
+    const std::string forwarded = "client-0002 statechanged: .uno:Bold=true";
+    Message adopted(std::vector<char>(forwarded.begin(), forwarded.end()), Message::Dir::Out);
+    Message copied(forwarded.data(), forwarded.size(), Message::Dir::Out);
+    LOK_ASSERT_EQUAL(std::string("client-0002"), adopted.forwardToken());
+    LOK_ASSERT_EQUAL(Util::toString(copied.data()), Util::toString(adopted.data()));
+    LOK_ASSERT_EQUAL(copied.firstToken(), adopted.firstToken());
+    LOK_ASSERT_EQUAL(copied.tokens().size(), adopted.tokens().size());
+
+    // Compare with copying the payload into the Message, as done before.
+    // The websocket payload is filled from the socket in both cases.
+    constexpr int Iterations = 200;
+    const auto copyStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < Iterations; ++i)
+    {
+        const std::vector<char> data(tilecombine.begin(), tilecombine.end());
+        Message copy(data.data(), data.size(), Message::Dir::Out);
+        LOK_ASSERT(copy.firstTokenMatches("tilecombine:"));
+    }
+    const auto copyElapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - copyStart);
+
+    const auto adoptStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < Iterations; ++i)
+    {
+        std::vector<char> data(tilecombine.begin(), tilecombine.end());
+        const char* const original = data.data();
+        Message adopt(std::move(data), Message::Dir::Out);
+        LOK_ASSERT(adopt.firstTokenMatches("tilecombine:"));
+        // The payload must not have been reallocated.
+        LOK_ASSERT(adopt.data().data() == original);
+        LOK_ASSERT_EQUAL(tilecombine.size(), adopt.size());
+    }
+    const auto adoptElapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - adoptStart);
+
+    TST_LOG("Copying " << Iterations << " Messages of " << tilecombine.size() << " bytes took "
+                       << copyElapsed.count() << " us, adopting them took "
+                       << adoptElapsed.count() << " us");
+}
+
 void WhiteBoxTests::testPathPrefixTrimming()
 {
     constexpr auto testname = __func__;
@@ -660,6 +767,17 @@ public:
     void updateActivityHeader() const override
     {
     }
+
+    bool startBackgroundSave(const std::string& /*sessionId*/, const std::string& /*url*/,
+                             const std::string& /*format*/,
+                             const std::string& /*filterOptions*/) override
+    {
+        return false;
+    }
+
+    void joinBackgroundSave() override
+    {
+    }
 };
 
 void WhiteBoxTests::testEmptyCellCursor()
@@ -670,6 +788,155 @@ void WhiteBoxTests::testEmptyCellCursor()
     documentViewCallback(LOK_CALLBACK_CELL_CURSOR, "EMPTY", &callbackDescriptor);
 }
 
+void WhiteBoxTests::testBackgroundSave()
+{
+    constexpr auto testname = __func__;
+
+    lok::Office office(dummy_lok_init_2(nullptr, nullptr));
+    std::shared_ptr<lok::Document> document(office.documentLoad("private:factory/swriter"));
+    LOK_ASSERT(document);
+
+    const std::string path = FileUtil::getSysTempDirectoryPath() + "/test_background_save.odt";
+    FileUtil::removeFile(path);
+
+    BackgroundSave backgroundSave;
+    LOK_ASSERT(!backgroundSave.isRunning());
+    LOK_ASSERT(backgroundSave.start(document, "file://" + path));
+    LOK_ASSERT(backgroundSave.isRunning());
+
+    // The parent is free to carry on, while the child saves.
+    BackgroundSave::Result result;
+    while ((result = backgroundSave.check()) == BackgroundSave::Result::Running)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    TST_LOG("Background save finished in " << backgroundSave.elapsed());
+    LOK_ASSERT_EQUAL(static_cast<int>(BackgroundSave::Result::Succeeded),
+                     static_cast<int>(result));
+    LOK_ASSERT(!backgroundSave.isRunning());
+    LOK_ASSERT(FileUtil::Stat(path).isFile());
+    FileUtil::removeFile(path);
+
+    // A failed save in the child is reported as such.
+    LOK_ASSERT(backgroundSave.start(document, "file:///missing/directory/file.odt"));
+    LOK_ASSERT_EQUAL(static_cast<int>(BackgroundSave::Result::Failed),
+                     static_cast<int>(backgroundSave.check(/*wait=*/true)));
+    LOK_ASSERT(!backgroundSave.isRunning());
+}
+
+void WhiteBoxTests::testConvertCache()
+{
+    constexpr auto testname = __func__;
+
+    const std::string root = FileUtil::getSysTempDirectoryPath() + "/test_convert_cache/";
+    const std::string input = FileUtil::getSysTempDirectoryPath() + "/test_convert_cache.odt";
+    const std::string output = FileUtil::getSysTempDirectoryPath() + "/test_convert_cache.pdf";
+    {
+        std::ofstream(input) << "Hello, World!";
+        std::ofstream(output) << std::string(8192, 'x');
+    }
+
+    // The key depends on the contents, the extension and the parameters only.
+    const std::string key = ConvertCache::makeKey(input, { "convert-to", "pdf" });
+    LOK_ASSERT_EQUAL(std::size_t(32), key.size());
+    LOK_ASSERT_EQUAL(key, ConvertCache::makeKey(input, { "convert-to", "pdf" }));
+    LOK_ASSERT(key != ConvertCache::makeKey(input, { "convert-to", "png" }));
+    LOK_ASSERT(ConvertCache::makeKey(input, { "convert-to", "pdf", "" }) !=
+               ConvertCache::makeKey(input, { "convert-to", "", "pdf" }));
+    LOK_ASSERT(ConvertCache::makeKey(input + ".missing", { "convert-to", "pdf" }).empty());
+
+    const std::string inputTxt = FileUtil::getSysTempDirectoryPath() + "/test_convert_cache.txt";
+    FileUtil::copyFileTo(input, inputTxt);
+    LOK_ASSERT(key != ConvertCache::makeKey(inputTxt, { "convert-to", "pdf" }));
+    FileUtil::removeFile(inputTxt);
+
+    // Room for two results of 8 KB, only the small ones in memory.
+    ConvertCache cache(root, 20 * 1024, 1024 * 1024, 4096, std::chrono::seconds(3600));
+
+    ConvertCache::Result result;
+    LOK_ASSERT(!cache.lookup(key, result));
+
+    cache.addFile(key, output, "application/pdf");
+    LOK_ASSERT(FileUtil::Stat(output).isFile());
+    LOK_ASSERT(cache.lookup(key, result));
+    LOK_ASSERT_EQUAL(std::size_t(8192), result._size);
+    LOK_ASSERT_EQUAL(std::string("application/pdf"), result._contentType);
+    LOK_ASSERT_EQUAL(std::string(8192, 'x'), std::string(result._data, result._size));
+
+    cache.addData("thumbnail", "PNG", "image/png");
+    LOK_ASSERT(cache.lookup("thumbnail", result));
+    LOK_ASSERT_EQUAL(std::string("PNG"), std::string(result._data, result._size));
+
+    // Adding a third large result evicts the least recently used one.
+    cache.addData("second", std::string(8192, 'y'), "application/pdf");
+    LOK_ASSERT(cache.lookup(key, result));
+    cache.addData("third", std::string(8192, 'z'), "application/pdf");
+    LOK_ASSERT(cache.lookup(key, result));
+    LOK_ASSERT(!cache.lookup("second", result));
+    LOK_ASSERT(cache.lookup("third", result));
+
+    // Results being sent outlive their eviction.
+    ConvertCache::Result kept;
+    LOK_ASSERT(cache.lookup("third", kept));
+    LOK_ASSERT(cache.lookup(key, result));
+    cache.addData("fourth", std::string(8192, 'w'), "application/pdf");
+    LOK_ASSERT(!cache.lookup("third", result));
+    LOK_ASSERT_EQUAL(std::string(8192, 'z'), std::string(kept._data, kept._size));
+
+    TST_LOG("Hits: " << cache.getHitCount() << ", misses: " << cache.getMissCount());
+    LOK_ASSERT_EQUAL(std::size_t(3), cache.getMissCount());
+
+    // Expired results are misses.
+    ConvertCache expiring(root, 20 * 1024, 1024 * 1024, 4096, std::chrono::seconds(0));
+    expiring.addData(key, "PDF", "application/pdf");
+    LOK_ASSERT(!expiring.lookup(key, result));
+
+    FileUtil::removeFile(input);
+    FileUtil::removeFile(output);
+}
+
+void WhiteBoxTests::testPrespawnController()
+{
+    constexpr auto testname = __func__;
+
+    LOK_ASSERT_EQUAL(0u, PrespawnController::poissonQuantile(0, 0.05));
+    LOK_ASSERT_EQUAL(1u, PrespawnController::poissonQuantile(1, 0.5));
+    LOK_ASSERT_EQUAL(3u, PrespawnController::poissonQuantile(1, 0.05));
+
+    // Starting at midnight, with no minimum to keep and room for 8.
+    const auto start = PrespawnController::Clock::now();
+    PrespawnController controller(0, 8, 0.05, 50 * 1024, start, std::chrono::seconds(0));
+    LOK_ASSERT_EQUAL(0u, controller.getTarget(start, 0));
+
+    controller.noteForkRequest(start, 1);
+    controller.noteNewChild(start + std::chrono::seconds(2));
+    LOK_ASSERT_EQUAL(2000L, static_cast<long>(controller.getForkLatency().count()));
+
+    // A storm of 60 loads in 10 seconds, at close to one a second,
+    // needs 4 spares to make waiting for a 2 second fork unlikely.
+    for (int i = 0; i < 60; ++i)
+        controller.noteChildRequest(start + std::chrono::milliseconds(i * 10000 / 60), i > 50);
+    const auto storm = start + std::chrono::seconds(10);
+    TST_LOG("Storm: " << controller.getState(storm));
+    LOK_ASSERT_EQUAL(4u, controller.getTarget(storm, 1));
+
+    // But no more than fit in the memory available.
+    controller.setMemoryHeadroomKb(50 * 1024);
+    LOK_ASSERT_EQUAL(2u, controller.getTarget(storm, 1));
+    controller.setMemoryHeadroomKb(1024 * 1024);
+
+    // Once idle, the spares are retired, slowly.
+    const auto idle = start + std::chrono::hours(1);
+    LOK_ASSERT_EQUAL(0u, controller.getTarget(idle, 3));
+    LOK_ASSERT(controller.shouldRetire(idle, 3));
+    LOK_ASSERT(!controller.shouldRetire(idle, 2));
+
+    // The next day, the pool grows ahead of the time of the storm.
+    const auto nextDay = start + std::chrono::hours(24) - std::chrono::minutes(10);
+    TST_LOG("Next day: " << controller.getState(nextDay));
+    LOK_ASSERT(controller.getDailyRate(nextDay) > 0);
+    LOK_ASSERT_EQUAL(1u, controller.getTarget(nextDay, 0));
+}
+
 void WhiteBoxTests::testTileDesc()
 {
     // simulate a previous overflow
@@ -737,6 +1004,108 @@ void WhiteBoxTests::testTileData()
     LOK_ASSERT_EQUAL(data.size(), size_t(9));
     LOK_ASSERT_EQUAL(data._wids.size(), size_t(4));
     LOK_ASSERT_EQUAL(data._wids.back(), unsigned(54));
+
+    // a delta copying rows from neighbouring tiles is kept until the next keyframe
+    LOK_ASSERT_EQUAL(data.hasNeighbourDeltas(), false);
+    data.appendBlob(55, "Nbar", 4);
+    LOK_ASSERT_EQUAL(data.size(), size_t(12));
+    LOK_ASSERT_EQUAL(data.hasNeighbourDeltas(), true);
+    data.appendBlob(56, "Dbat", 4);
+    LOK_ASSERT_EQUAL(data.hasNeighbourDeltas(), true);
+    data.appendBlob(57, "Zfoo", 4);
+    LOK_ASSERT_EQUAL(data.hasNeighbourDeltas(), false);
+}
+
+void WhiteBoxTests::testNeighbourDeltaInvalidation()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int width = 256;
+    constexpr int height = 256;
+    constexpr int scroll = 17;
+    constexpr int tileTwips = 3840;
+
+    // Two pages worth of unique text-like rows, for a column of two tiles.
+    std::vector<uint32_t> page(width * height * 2, 0xffffffff);
+    for (int y = 0; y < height * 2; ++y)
+        for (int x = (y * 7) % 13; x < width; x += 5 + (x + y) % 11)
+            page[y * width + x] = 0xff000000 | (y << 8) | x;
+    unsigned char* pixmap = reinterpret_cast<unsigned char*>(page.data());
+
+    // The kit renders both tiles, and the session sends them to its client.
+    const TileLocation top(0, 0, tileTwips, 0, 1);
+    const TileLocation bottom(0, tileTwips, tileTwips, 0, 1);
+    DeltaGenerator gen;
+    std::vector<char> output;
+    LOK_ASSERT(!gen.createDelta(pixmap, 0, 0, width, height, width, height * 2, top, output, 1,
+                                false, LOK_TILEMODE_RGBA));
+    LOK_ASSERT(!gen.createDelta(pixmap, 0, height, width, height, width, height * 2, bottom,
+                                output, 2, false, LOK_TILEMODE_RGBA));
+
+    ClientDeltaTracker tracker;
+    std::vector<TileDesc> tiles;
+    for (const TileLocation& loc : { top, bottom })
+        tiles.emplace_back(1, 0, 0, width, height, loc._left, loc._top, tileTwips, tileTwips,
+                           -1, 0, -1);
+    tiles[0].setWireId(1);
+    tiles[1].setWireId(2);
+    for (const TileDesc& tile : tiles)
+        tracker.updateTileSeq(tile);
+
+    // Lines inserted above shift the content of both down: as on
+    // invalidation, request them with the versions last sent.
+    for (TileDesc& tile : tiles)
+    {
+        const TileWireId lastSentId = tracker.getTileSeq(tile);
+        tile.setOldWireId(lastSentId ? lastSentId : 1);
+        tile.setWireId(0);
+    }
+    const TileCombined combined =
+        TileCombined::parse(TileCombined::create(tiles).serialize("tilecombine"));
+    const TileWireId belowWireId =
+        RenderTiles::getOldWireId(combined.getTiles(), 0, tileTwips);
+    LOK_ASSERT_EQUAL(TileWireId(2), belowWireId);
+    LOK_ASSERT_EQUAL(TileWireId(0), RenderTiles::getOldWireId(combined.getTiles(), 0, -tileTwips));
+
+    // The top tile's new rows are copied from the tile below the client has.
+    LOK_ASSERT(gen.createDelta(pixmap, 0, scroll, width, height, width, height * 2, top, output,
+                               3, false, LOK_TILEMODE_RGBA, 0, belowWireId));
+    LOK_ASSERT_EQUAL('N', output[0]);
+    LOK_ASSERT(output.size() < 64);
+}
+
+void WhiteBoxTests::testSharedTileMessages()
+{
+    constexpr auto testname = __func__;
+
+    auto tile = std::make_shared<TileData>(42, "Zfoo", 4);
+    tile->appendBlob(44, "Dbaa", 4);
+
+    TileDesc desc = TileDesc::parse("tile nviewid=0 part=0 width=256 height=256 tileposx=0 "
+                                    "tileposy=0 tilewidth=3840 tileheight=3840");
+    desc.setWireId(44);
+
+    SharedTileMessages messages(desc, tile);
+
+    // New viewers, or ones with a stale tile, all share the keyframe.
+    const std::shared_ptr<Message> keyframe = messages.get(0);
+    LOK_ASSERT_EQUAL(std::string("tile:"), keyframe->firstToken());
+    LOK_ASSERT(keyframe == messages.get(0));
+    LOK_ASSERT(keyframe == messages.get(7));
+    LOK_ASSERT_EQUAL(std::size_t(1), messages.getEncodedCount());
+
+    const std::string keyframeData = Util::toString(keyframe->data());
+    LOK_ASSERT(keyframeData.find("\nfoobaa") != std::string::npos);
+
+    // Viewers which have the keyframe share the delta.
+    const std::shared_ptr<Message> delta = messages.get(42);
+    LOK_ASSERT_EQUAL(std::string("delta:"), delta->firstToken());
+    LOK_ASSERT(delta == messages.get(42));
+    LOK_ASSERT_EQUAL(std::size_t(2), messages.getEncodedCount());
+
+    const std::string deltaData = Util::toString(delta->data());
+    LOK_ASSERT(deltaData.find("\nbaa") != std::string::npos);
+    LOK_ASSERT(deltaData.find("foo") == std::string::npos);
 }
 
 void WhiteBoxTests::testRectanglesIntersect()
@@ -1060,6 +1429,434 @@ void WhiteBoxTests::testBufferClass()
 }
 
 
+namespace
+{
+/// The data a Buffer would write with writev.
+std::string gatherBuffer(const Buffer& buf)
+{
+    iovec iov[16];
+    const int count = buf.getIoVecs(iov, 16, buf.size());
+    std::string out;
+    for (int i = 0; i < count; ++i)
+        out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    return out;
+}
+} // namespace
+
+void WhiteBoxTests::testBufferShared()
+{
+    constexpr auto testname = __func__;
+
+    const auto large = std::make_shared<std::vector<char>>(2 * Buffer::MinSharedSize, 'L');
+    const auto other = std::make_shared<std::vector<char>>(Buffer::MinSharedSize + 1, 'O');
+
+    Buffer buf;
+    buf.append("h1", 2);
+    buf.append(large, large->data(), large->size());
+    buf.append("h2", 2);
+    buf.append(other, other->data(), other->size());
+    buf.append(other, other->data(), 10); // Small, so copied.
+    LOK_ASSERT(buf.hasShared());
+
+    const std::string expected = "h1" + std::string(large->size(), 'L') + "h2" +
+                                 std::string(other->size(), 'O') + std::string(10, 'O');
+    LOK_ASSERT_EQUAL(expected.size(), buf.size());
+    LOK_ASSERT_EQUAL(expected, gatherBuffer(buf));
+
+    // The blobs are referenced, not copied.
+    LOK_ASSERT_EQUAL(std::size_t(2), buf.getBlockSize());
+    buf.eraseFirst(2);
+    LOK_ASSERT(buf.getBlock() == large->data());
+
+    // Limited gathering.
+    iovec iov[4];
+    LOK_ASSERT_EQUAL(1, buf.getIoVecs(iov, 4, 100));
+    LOK_ASSERT_EQUAL(std::size_t(100), iov[0].iov_len);
+
+    // Consume in growing, unaligned chunks.
+    std::size_t consumed = 2;
+    std::size_t step = 1;
+    while (!buf.empty())
+    {
+        LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), expected.data() + consumed, buf.getBlockSize()));
+        LOK_ASSERT_EQUAL(expected.substr(consumed), gatherBuffer(buf));
+
+        const std::size_t len = std::min(step, buf.size());
+        buf.eraseFirst(len);
+        consumed += len;
+        step = step * 3 + 1;
+    }
+
+    LOK_ASSERT_EQUAL(expected.size(), consumed);
+    LOK_ASSERT(!buf.hasShared());
+    LOK_ASSERT(buf.getBlock() == nullptr);
+}
+
+void WhiteBoxTests::testWebSocketMask()
+{
+    constexpr auto testname = __func__;
+
+    const unsigned char mask[4] = { 0x81, 0x76, 0x3c, 0xe5 };
+
+    std::vector<unsigned char> data(4096 + 3);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<unsigned char>(i * 131 + (i >> 5));
+
+    // Compare the kernels with the byte-wise version, for each alignment of
+    // the data and position in the mask, with and without AVX2.
+    const bool hasAVX2 = simd::init();
+    for (const bool useAVX2 : { false, hasAVX2 })
+    {
+        simd::HasAVX2 = useAVX2;
+        for (std::size_t len : { 0, 1, 3, 4, 7, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 4096 })
+        {
+            for (std::size_t align = 0; align < 4; ++align)
+            {
+                for (std::size_t offset = 0; offset < 4; ++offset)
+                {
+                    std::vector<unsigned char> expected(len);
+                    simd::maskPayloadScalar(data.data() + align, expected.data(), len, mask,
+                                            offset);
+
+                    std::vector<unsigned char> actual(len + 1, 0xaa);
+                    simd::maskPayload(data.data() + align, actual.data(), len, mask, offset);
+                    LOK_ASSERT_EQUAL(0xaa, static_cast<int>(actual[len]));
+                    actual.resize(len);
+                    LOK_ASSERT(expected == actual);
+
+                    // In place, as when unmasking the received payload.
+                    std::vector<unsigned char> inPlace(data.begin() + align,
+                                                       data.begin() + align + len);
+                    simd::maskPayload(inPlace.data(), inPlace.data(), len, mask, offset);
+                    LOK_ASSERT(expected == inPlace);
+                }
+            }
+        }
+    }
+
+    // Masking twice gives back the data, also when done in pieces.
+    std::vector<unsigned char> masked(data.size());
+    simd::maskPayload(data.data(), masked.data(), data.size(), mask);
+    std::vector<unsigned char> unmasked(data.size());
+    simd::maskPayload(masked.data(), unmasked.data(), 1001, mask);
+    simd::maskPayload(masked.data() + 1001, unmasked.data() + 1001, data.size() - 1001, mask,
+                      1001);
+    LOK_ASSERT(data == unmasked);
+
+    // Throughput, on a payload the size of a large paste.
+    constexpr std::size_t size = 1024 * 1024;
+    constexpr int iterations = 64;
+    std::vector<unsigned char> payload(size, 'x');
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        simd::maskPayload(payload.data(), payload.data(), size, mask, i);
+    const auto vectorTime = std::chrono::steady_clock::now() - start;
+
+    const auto startScalar = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        simd::maskPayloadScalar(payload.data(), payload.data(), size, mask, i);
+    const auto scalarTime = std::chrono::steady_clock::now() - startScalar;
+
+    // Each offset was used an even number of times, so the masks cancel out.
+    LOK_ASSERT(std::all_of(payload.begin(), payload.end(),
+                           [](unsigned char c) { return c == 'x'; }));
+
+    const auto toMBps = [](std::chrono::steady_clock::duration duration)
+    {
+        const double seconds = std::chrono::duration<double>(duration).count();
+        return seconds > 0 ? size * iterations / seconds / (1024 * 1024) : 0;
+    };
+    TST_LOG("Masked at " << toMBps(vectorTime) << " MB/s (AVX2: " << hasAVX2
+                         << ") against " << toMBps(scalarTime) << " MB/s byte-wise");
+}
+
+void WhiteBoxTests::testWebSocketDeflate()
+{
+    constexpr auto testname = __func__;
+
+    std::string response;
+
+    // Declined offers and unknown extensions are skipped.
+    std::unique_ptr<WebSocketDeflate> server = WebSocketDeflate::acceptOffer(
+        "x-webkit-deflate-frame, permessage-deflate; unknown, "
+        "permessage-deflate; server_max_window_bits=8, "
+        "permessage-deflate; server_max_window_bits=\"10\"; client_max_window_bits",
+        response);
+    LOK_ASSERT(server);
+    LOK_ASSERT_EQUAL(std::string("permessage-deflate; server_max_window_bits=10; "
+                                 "client_max_window_bits=15"),
+                     response);
+    LOK_ASSERT_EQUAL(10, server->getDeflateWindowBits());
+    LOK_ASSERT(server->hasDeflateTakeover());
+
+    LOK_ASSERT(!WebSocketDeflate::acceptOffer("permessage-deflate; server_no_context_takeover; "
+                                              "server_no_context_takeover",
+                                              response));
+    LOK_ASSERT(!WebSocketDeflate::acceptOffer("permessage-deflate; client_max_window_bits=16",
+                                              response));
+    LOK_ASSERT(!WebSocketDeflate::acceptResponse("permessage-deflate; unknown"));
+    LOK_ASSERT(!WebSocketDeflate::acceptResponse("x-webkit-deflate-frame"));
+
+    // What the client asked for is what both ends do.
+    server = WebSocketDeflate::acceptOffer(
+        "permessage-deflate; server_no_context_takeover; client_max_window_bits", response);
+    LOK_ASSERT(server);
+    LOK_ASSERT_EQUAL(std::string("permessage-deflate; server_no_context_takeover; "
+                                 "client_max_window_bits=15"),
+                     response);
+    LOK_ASSERT(!server->hasDeflateTakeover());
+    LOK_ASSERT(server->hasInflateTakeover());
+
+    std::unique_ptr<WebSocketDeflate> client = WebSocketDeflate::acceptResponse(response);
+    LOK_ASSERT(client);
+    LOK_ASSERT(client->hasDeflateTakeover());
+    LOK_ASSERT(!client->hasInflateTakeover());
+
+    // Round-trip the same kind of JSON repeatedly, both ways.
+    std::vector<std::size_t> serverSizes;
+    std::vector<std::size_t> clientSizes;
+    for (int i = 0; i < 3; ++i)
+    {
+        const std::string message = "statechanged: { \"commandName\": \".uno:Bold\", "
+                                    "\"state\": \"" + std::string(i % 2 ? "true" : "false") +
+                                    "\", \"viewId\": 1 }";
+
+        std::vector<char> compressed;
+        LOK_ASSERT(server->compress(message.data(), message.size(), compressed));
+        serverSizes.push_back(compressed.size());
+        std::vector<char> decompressed;
+        LOK_ASSERT(client->decompress(compressed, decompressed) ==
+                   WebSocketDeflate::InflateResult::Ok);
+        LOK_ASSERT_EQUAL(message, std::string(decompressed.begin(), decompressed.end()));
+
+        compressed.clear();
+        LOK_ASSERT(client->compress(message.data(), message.size(), compressed));
+        clientSizes.push_back(compressed.size());
+        decompressed.clear();
+        LOK_ASSERT(server->decompress(compressed, decompressed) ==
+                   WebSocketDeflate::InflateResult::Ok);
+        LOK_ASSERT_EQUAL(message, std::string(decompressed.begin(), decompressed.end()));
+    }
+
+    // Without context takeover, each message compresses on its own,
+    // with it, the repeats are mostly back-references.
+    LOK_ASSERT(serverSizes[2] >= serverSizes[0] - 1);
+    LOK_ASSERT(clientSizes[2] < clientSizes[0] / 2);
+
+    LOK_ASSERT(server->getRawBytes() > server->getCompressedBytes());
+
+    // Garbage fails.
+    std::vector<char> garbage = { 0x07, 0x06, 0x05, 0x04, 0x03 };
+    std::vector<char> out;
+    LOK_ASSERT(client->decompress(garbage, out) == WebSocketDeflate::InflateResult::Invalid);
+
+    // As does a message inflating past the limit, however well it compresses.
+    const std::size_t maxInflatedSize = WebSocketDeflate::MaxInflatedSize;
+    WebSocketDeflate::MaxInflatedSize = 64 * 1024;
+    const std::string zeros(1024 * 1024, '\0');
+    std::vector<char> bomb;
+    LOK_ASSERT(server->compress(zeros.data(), zeros.size(), bomb));
+    LOK_ASSERT(bomb.size() < 2048);
+    LOK_ASSERT(client->decompress(bomb, out) == WebSocketDeflate::InflateResult::TooBig);
+    LOK_ASSERT(out.size() <= WebSocketDeflate::MaxInflatedSize);
+    WebSocketDeflate::MaxInflatedSize = maxInflatedSize;
+}
+
+namespace
+{
+/// How ProxyProtocolHandler framed each message before writing them straight to a Buffer.
+std::shared_ptr<std::vector<char>> legacyProxyFrame(const char* msg, std::size_t len, bool text,
+                                                    uint64_t serial)
+{
+    auto frame = std::make_shared<std::vector<char>>();
+    frame->push_back(text ? 'T' : 'B');
+    std::ostringstream os;
+    os << std::hex << "0x" << serial << "\n0x" << len << '\n';
+    const std::string str = os.str();
+    frame->insert(frame->end(), str.begin(), str.end());
+    frame->insert(frame->end(), msg, msg + len);
+    frame->push_back('\n');
+    return frame;
+}
+
+/// Writes all of @buf to @sink, as writev would, emptying it.
+void drainBuffer(Buffer& buf, std::vector<char>& sink)
+{
+    while (!buf.empty())
+    {
+        iovec iov[64];
+        const int count = buf.getIoVecs(iov, 64, buf.size());
+        std::size_t len = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const char* data = static_cast<const char*>(iov[i].iov_base);
+            sink.insert(sink.end(), data, data + iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+        buf.eraseFirst(len);
+    }
+}
+
+/// Exposes the framing of server websockets.
+class WebSocketFramer : public WebSocketHandler
+{
+public:
+    WebSocketFramer()
+        : WebSocketHandler(/*isClient=*/false, /*isMasking=*/false)
+    {
+    }
+
+    void frame(const char* data, std::size_t len, bool text, Buffer& out,
+               const std::shared_ptr<const void>& owner) const
+    {
+        buildFrame(data, len,
+                   WSFrameMask::Fin |
+                       static_cast<unsigned char>(text ? WSOpCode::Text : WSOpCode::Binary),
+                   out, owner);
+    }
+};
+} // namespace
+
+void WhiteBoxTests::testProxyFraming()
+{
+    constexpr auto testname = __func__;
+
+    const auto tile = std::make_shared<std::vector<char>>(3 * Buffer::MinSharedSize, 'P');
+    const std::string status = "statechanged: {\"commandName\":\".uno:Bold\",\"state\":\"true\"}";
+
+    // Text framing is as it always was.
+    for (const uint64_t serial : { 0UL, 9UL, 0xabcUL, 0xffffffffffUL })
+    {
+        Buffer buf;
+        ProxyProtocolHandler::appendFrame(buf, status.data(), status.size(), true, serial, false);
+        const auto legacy = legacyProxyFrame(status.data(), status.size(), true, serial);
+        LOK_ASSERT_EQUAL(std::string(legacy->begin(), legacy->end()), gatherBuffer(buf));
+    }
+
+    // Binary framing: type, serial and length, then the content as is.
+    Buffer buf;
+    ProxyProtocolHandler::appendFrame(buf, status.data(), status.size(), true, 0x01020304, true);
+    const std::string expected =
+        std::string("t\x01\x02\x03\x04\x00\x00\x00", 8) + char(status.size()) + status;
+    LOK_ASSERT_EQUAL(expected, gatherBuffer(buf));
+
+    // Large payloads stay referenced when queued and when moved to the socket.
+    Buffer queue;
+    ProxyProtocolHandler::appendFrame(queue, status.data(), status.size(), true, 1, true);
+    ProxyProtocolHandler::appendFrame(queue, tile->data(), tile->size(), false, 2, true, tile);
+    ProxyProtocolHandler::appendFrame(queue, status.data(), status.size(), true, 3, true);
+    LOK_ASSERT(queue.hasShared());
+    const std::string body = gatherBuffer(queue);
+    LOK_ASSERT_EQUAL(3 * (9 + status.size()) + tile->size() - status.size(), body.size());
+
+    Buffer out;
+    out.append("HTTP/1.1 200 OK\r\n\r\n");
+    out.append(std::move(queue));
+    LOK_ASSERT(queue.empty());
+    LOK_ASSERT(!queue.hasShared());
+    LOK_ASSERT(out.hasShared());
+    LOK_ASSERT_EQUAL("HTTP/1.1 200 OK\r\n\r\n" + body, gatherBuffer(out));
+
+    // Header, status and the tile's frame header, then the tile itself.
+    iovec iov[4];
+    LOK_ASSERT_EQUAL(3, out.getIoVecs(iov, 4, out.size()));
+    LOK_ASSERT(iov[1].iov_base == tile->data());
+}
+
+void WhiteBoxTests::testProxyThroughput()
+{
+    constexpr auto testname = __func__;
+
+    // A typical mix: mostly small JSON and status messages, with some tiles.
+    std::vector<std::shared_ptr<std::vector<char>>> messages;
+    std::size_t payloadSize = 0;
+    for (int i = 0; i < 256; ++i)
+    {
+        const std::size_t size = (i % 4 == 3) ? 24 * 1024 : 80 + (i * 37) % 200;
+        messages.push_back(std::make_shared<std::vector<char>>(size, char('a' + i % 26)));
+        payloadSize += size;
+    }
+    const auto isText = [](std::size_t i) { return i % 4 != 3; };
+
+    constexpr int rounds = 64;
+    std::vector<char> sink;
+    sink.reserve(2 * payloadSize);
+
+    const auto toMBps = [payloadSize](std::chrono::steady_clock::duration duration)
+    {
+        const double seconds = std::chrono::duration<double>(duration).count();
+        return seconds > 0 ? payloadSize * rounds / seconds / (1024 * 1024) : 0;
+    };
+
+    // Each round queues all the messages, and writes them out in one go.
+    uint64_t serial = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        std::vector<std::shared_ptr<std::vector<char>>> queue;
+        for (std::size_t i = 0; i < messages.size(); ++i)
+            queue.push_back(legacyProxyFrame(messages[i]->data(), messages[i]->size(), isText(i),
+                                             serial++));
+
+        Buffer out;
+        for (const auto& frame : queue)
+            out.append(frame->data(), frame->size());
+
+        sink.clear();
+        drainBuffer(out, sink);
+    }
+    const auto legacyTime = std::chrono::steady_clock::now() - start;
+    const std::vector<char> legacyBody = sink;
+
+    double batchedMBps[2];
+    for (const bool binaryFraming : { false, true })
+    {
+        serial = 0;
+        start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; ++round)
+        {
+            Buffer queue;
+            for (std::size_t i = 0; i < messages.size(); ++i)
+                ProxyProtocolHandler::appendFrame(queue, messages[i]->data(), messages[i]->size(),
+                                                  isText(i), serial++, binaryFraming, messages[i]);
+
+            Buffer out;
+            out.append(std::move(queue));
+
+            sink.clear();
+            drainBuffer(out, sink);
+        }
+        batchedMBps[binaryFraming] = toMBps(std::chrono::steady_clock::now() - start);
+
+        // Text framing sends the very same bytes, binary framing has
+        // fixed 9 byte headers and no trailing newline.
+        if (binaryFraming)
+            LOK_ASSERT_EQUAL(payloadSize + 9 * messages.size(), sink.size());
+        else
+            LOK_ASSERT(sink == legacyBody);
+    }
+
+    const WebSocketFramer framer;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        Buffer out;
+        for (std::size_t i = 0; i < messages.size(); ++i)
+            framer.frame(messages[i]->data(), messages[i]->size(), isText(i), out, messages[i]);
+
+        sink.clear();
+        drainBuffer(out, sink);
+    }
+    const auto webSocketTime = std::chrono::steady_clock::now() - start;
+    LOK_ASSERT(sink.size() > payloadSize);
+
+    TST_LOG("Proxy framing at " << toMBps(legacyTime) << " MB/s per message, "
+                                << batchedMBps[0] << " MB/s batched, " << batchedMBps[1]
+                                << " MB/s batched binary, against " << toMBps(webSocketTime)
+                                << " MB/s over websockets");
+}
+
 void WhiteBoxTests::testHexify()
 {
     constexpr auto testname = __func__;
@@ -1412,6 +2209,143 @@ void WhiteBoxTests::testFindInVector()
     LOK_ASSERT_EQUAL(expected, ret);
 }
 
+namespace
+{
+/// One end of a socketpair, draining whatever is written to the other end.
+class PairedSocket final : public Socket
+{
+public:
+    PairedSocket(int fd, std::size_t& handled)
+        : Socket(fd, Socket::Type::Unix)
+        , _handled(handled)
+    {
+    }
+
+    int getPollEvents(std::chrono::steady_clock::time_point, int64_t&) override { return POLLIN; }
+
+    void handlePoll(SocketDisposition&, std::chrono::steady_clock::time_point, int events) override
+    {
+        if (events & POLLIN)
+        {
+            char buf[64];
+            while (::read(getFD(), buf, sizeof(buf)) > 0)
+                ;
+            ++_handled;
+        }
+    }
+
+private:
+    std::size_t& _handled;
+};
+
+/// Polls @count mostly idle sockets, with a single one becoming
+/// readable per iteration. Returns the average time per iteration.
+std::chrono::nanoseconds timePollLoop(bool useEpoll, std::size_t count, std::size_t iterations)
+{
+    constexpr auto testname = "testSocketPollBackends";
+
+    SocketPoll::UseEpoll = useEpoll;
+    SocketPoll poll("bench_poll");
+    SocketPoll::UseEpoll = false;
+    poll.runOnClientThread();
+
+    std::size_t handled = 0;
+    std::vector<int> peers;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        int fds[2];
+        LOK_ASSERT_EQUAL(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds));
+        poll.insertNewSocket(std::make_shared<PairedSocket>(fds[0], handled));
+        peers.push_back(fds[1]);
+    }
+
+    // Take in the new sockets.
+    poll.poll(std::chrono::microseconds(0));
+    LOK_ASSERT_EQUAL(count, poll.getSocketCount());
+#if HAVE_EPOLL
+    // Or we'd be timing poll(2) twice.
+    LOK_ASSERT_EQUAL(useEpoll, poll.isEpoll());
+#endif
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        LOK_ASSERT_EQUAL(ssize_t(1), ::write(peers[(i * 7919) % count], "x", 1));
+        poll.poll(std::chrono::microseconds(0));
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    LOK_ASSERT_EQUAL(iterations, handled);
+
+    poll.removeSockets();
+    for (const int fd : peers)
+        ::close(fd);
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed) / iterations;
+}
+} // namespace
+
+void WhiteBoxTests::testSocketPollBackends()
+{
+    constexpr auto testname = __func__;
+
+    rlimit limit;
+    LOK_ASSERT_EQUAL(0, ::getrlimit(RLIMIT_NOFILE, &limit));
+
+    constexpr std::size_t Iterations = 2000;
+    for (const std::size_t count : { 10, 100, 1000 })
+    {
+        // Each socket needs a pair of fds.
+        if (limit.rlim_cur != RLIM_INFINITY && 2 * count + 64 > limit.rlim_cur)
+        {
+            TST_LOG("Skipping " << count << " sockets, only " << limit.rlim_cur << " fds allowed");
+            continue;
+        }
+
+        const auto pollTime = timePollLoop(false, count, Iterations);
+        const auto epollTime = timePollLoop(true, count, Iterations);
+        TST_LOG("Poll loop with " << count << " sockets: poll " << pollTime.count()
+                                  << " ns/iteration, epoll " << epollTime.count()
+                                  << " ns/iteration");
+    }
+}
+
+void WhiteBoxTests::testThreadPoolBatches()
+{
+    constexpr auto testname = __func__;
+
+    // Several threads, even with fewer cpus, to make the races likelier.
+    ThreadPool pool(8);
+
+    // Many small batches back to back, so threads woken late for one
+    // batch run into the next: every task must run exactly once.
+    constexpr int Batches = 20000;
+    std::vector<std::atomic<int>> runs(64);
+    std::size_t wrongRuns = 0;
+    for (int batch = 0; batch < Batches; ++batch)
+    {
+        const std::size_t count = 1 + batch % runs.size();
+        for (std::size_t i = 0; i < count; ++i)
+            runs[i] = 0;
+
+        pool.run(count, [&runs](std::size_t index)
+                 {
+                     if (index % 7 == 0)
+                         std::this_thread::yield();
+                     ++runs[index];
+                 });
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (runs[i] != 1)
+                ++wrongRuns;
+        }
+    }
+
+    LOK_ASSERT_EQUAL(std::size_t(0), wrongRuns);
+    TST_LOG("Ran " << Batches << " batches");
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(WhiteBoxTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
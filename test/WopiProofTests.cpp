@@ -16,6 +16,8 @@
 
 #include <test/lokassert.hpp>
 
+#include <chrono>
+
 #include <ProofKey.hpp>
 #include <Poco/Crypto/RSAKey.h>
 #include <Poco/Crypto/DigestEngine.h>
@@ -36,12 +38,14 @@ class WopiProofTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testCapiBlob);
     CPPUNIT_TEST(testExistingProof);
     CPPUNIT_TEST(testOurProof);
+    CPPUNIT_TEST(testProofCache);
 
     CPPUNIT_TEST_SUITE_END();
 
     void testCapiBlob();
     void testExistingProof();
     void testOurProof();
+    void testProofCache();
 
     BIGNUM *Base64ToNum(const std::string &str)
     {
@@ -180,6 +184,74 @@ void WopiProofTests::testOurProof()
     verifySignature(access_token, uri, ticks, modulus, exponent, proofOld, testname);
 }
 
+void WopiProofTests::testProofCache()
+{
+    constexpr auto testname = __func__;
+
+    Proof gen(Proof::Type::CreateKey);
+
+    const VecOfStringPairs& discovery = gen.GetProofKeyAttributes();
+    LOK_ASSERT_EQUAL(std::size_t(6), discovery.size());
+    const std::string modulus = discovery[1].second;
+    const std::string exponent = discovery[2].second;
+
+    const std::string access_token = "cached-token";
+    const std::string uri = "https://short.com:12345/wopi/files/1?access_token=cached-token";
+
+    // The start of a 10-minute bucket.
+    const auto start = std::chrono::system_clock::from_time_t(1700000400);
+
+    const VecOfStringPairs pairs = gen.GetProofHeaders(access_token, uri, start);
+    LOK_ASSERT_EQUAL(std::size_t(3), pairs.size());
+    const int64_t ticks = std::stoll(pairs[0].second, nullptr, 10);
+    verifySignature(access_token, uri, ticks, modulus, exponent, pairs[1].second, testname);
+
+    // Reused, with the original timestamp, within the bucket.
+    const VecOfStringPairs reused
+        = gen.GetProofHeaders(access_token, uri, start + std::chrono::minutes(9));
+    LOK_ASSERT(pairs == reused);
+
+    // But not for another token or uri.
+    const VecOfStringPairs otherToken
+        = gen.GetProofHeaders("other-token", uri, start + std::chrono::minutes(1));
+    LOK_ASSERT(pairs[1].second != otherToken[1].second);
+    const VecOfStringPairs otherUri
+        = gen.GetProofHeaders(access_token, uri + "&x=1", start + std::chrono::minutes(1));
+    LOK_ASSERT(pairs[1].second != otherUri[1].second);
+
+    // Signed anew in the next bucket.
+    const VecOfStringPairs renewed
+        = gen.GetProofHeaders(access_token, uri, start + std::chrono::minutes(10));
+    LOK_ASSERT(pairs[0].second != renewed[0].second);
+    const int64_t renewedTicks = std::stoll(renewed[0].second, nullptr, 10);
+    verifySignature(access_token, uri, renewedTicks, modulus, exponent, renewed[1].second,
+                    testname);
+
+    // Signatures per second, when signing each request and when reusing.
+    constexpr int Iterations = 200;
+    const auto now = std::chrono::system_clock::now();
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < Iterations; ++i)
+        gen.GetProofHeaders(access_token, uri + "&n=" + std::to_string(i), now);
+    const auto signTime = std::chrono::steady_clock::now() - begin;
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < Iterations; ++i)
+        gen.GetProofHeaders(access_token, uri + "&n=" + std::to_string(i % 10), now);
+    const auto cachedTime = std::chrono::steady_clock::now() - begin;
+
+    const auto perSecond = [](std::chrono::steady_clock::duration duration)
+    {
+        const double seconds = std::chrono::duration<double>(duration).count();
+        return seconds > 0 ? Iterations / seconds : 0;
+    };
+
+    TST_LOG("Proof headers per second: " << perSecond(signTime) << " signed, "
+                                         << perSecond(cachedTime) << " cached");
+    LOK_ASSERT(cachedTime < signTime);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(WopiProofTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmarks tile rendering and encoding as done in the Kit: renders rows of
+ * tiles of a synthetic document from the DummyLibreOfficeKit through
+ * RenderTiles::doRender, and reports the throughput.
+ *
+ * Usage: coolrenderbench [renders] [tiles per render] [threads]
+ */
+
+#include <config.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <sysexits.h>
+
+#define LOK_USE_UNSTABLE_API
+#include <LibreOfficeKit/LibreOfficeKit.hxx>
+
+#include <DummyLibreOfficeKit.hpp>
+#include <Log.hpp>
+#include <RenderTiles.hpp>
+
+namespace
+{
+/// A tilecombine for a row of @count tiles, as sent by the client.
+std::string makeTileCombine(int row, int count, TileWireId oldWireId)
+{
+    std::string tilePosX;
+    std::string tilePosY;
+    std::string oldWid;
+    for (int i = 0; i < count; ++i)
+    {
+        const char* separator = (i ? "," : "");
+        tilePosX += separator + std::to_string(i * 3840);
+        tilePosY += separator + std::to_string(row * 3840);
+        oldWid += separator + std::to_string(oldWireId);
+    }
+
+    return "tilecombine nviewid=0 part=0 width=256 height=256 tileposx=" + tilePosX +
+           " tileposy=" + tilePosY + " oldwid=" + oldWid + " tilewidth=3840 tileheight=3840";
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const int renders = (argc > 1 ? std::atoi(argv[1]) : 500);
+    const int tilesPerRender = (argc > 2 ? std::atoi(argv[2]) : 16);
+    if (renders <= 0 || tilesPerRender <= 0 || tilesPerRender > 16)
+    {
+        std::cerr << "Usage: " << argv[0] << " [renders] [tiles per render (1-16)] [threads]\n";
+        return EX_USAGE;
+    }
+
+    if (argc > 3)
+        setenv("MAX_CONCURRENCY", argv[3], 1);
+
+    Log::initialize("renderbench", "warning", false, false, std::map<std::string, std::string>());
+
+    lok::Office office(dummy_lok_init_2(nullptr, nullptr));
+    std::shared_ptr<lok::Document> document(office.documentLoad("private:factory/swriter"));
+    if (!document)
+    {
+        std::cerr << "Failed to load the dummy document.\n";
+        return EX_SOFTWARE;
+    }
+
+    DeltaGenerator deltaGen;
+    ThreadPool pool;
+
+    // Scroll down a screen of rows, then back again, so that we
+    // encode both keyframes and deltas against what was sent before.
+    constexpr int Rows = 32;
+
+    std::size_t tiles = 0;
+    std::size_t bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < renders; ++i)
+    {
+        const int row = i % Rows;
+        const TileWireId oldWireId = (i < Rows ? 0 : RenderTiles::getCurrentWireId());
+        TileCombined tileCombined =
+            TileCombined::parse(makeTileCombine(row, tilesPerRender, oldWireId));
+
+        RenderTiles::doRender(
+            document, deltaGen, tileCombined, pool,
+            [](unsigned char*, int, int, size_t, size_t, int, int, LibreOfficeKitTileMode) {},
+            [&](const char*, size_t length) { bytes += length; },
+            /*mobileAppDocId=*/0, /*canonicalViewId=*/0, /*dumpTiles=*/false);
+
+        tiles += tilesPerRender;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    const double seconds = elapsed.count() / 1e6;
+    const double megaPixels = tiles * 256.0 * 256 / 1e6;
+    std::cout << "Threads:         " << ThreadPool::getDefaultConcurrency() << '\n'
+              << "Renders:         " << renders << " of " << tilesPerRender << " tiles\n"
+              << "Time:            " << seconds << " s\n"
+              << "Tiles/s:         " << tiles / seconds << '\n'
+              << "MP/s:            " << megaPixels / seconds << '\n'
+              << "Encoded bytes:   " << bytes << " (" << bytes / tiles << " per tile)\n";
+
+    pool.dumpState(std::cout);
+    pool.stop();
+
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
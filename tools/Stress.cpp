@@ -16,6 +16,8 @@
 #include <Poco/Util/Option.h>
 #include <Poco/Util/OptionSet.h>
 
+#include <common/Simd.hpp>
+
 #include "Replay.hpp"
 // #include <test/helpers.hpp>
 
@@ -74,6 +76,9 @@ int Stress::main(const std::vector<std::string>& args)
         return EX_NOINPUT;
     }
 
+    // We mask every message we send, so use the fastest kernel.
+    simd::init();
+
     TerminatingPoll poll("stress replay");
 
     if (!UnitWSD::init(UnitWSD::UnitType::Tool, ""))
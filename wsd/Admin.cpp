@@ -23,6 +23,8 @@
 #include "Admin.hpp"
 #include "AdminModel.hpp"
 #include "Auth.hpp"
+#include "DocumentBroker.hpp"
+#include "PrespawnController.hpp"
 #include <Common.hpp>
 #include <Log.hpp>
 #include <Protocol.hpp>
@@ -166,6 +168,17 @@ void AdminSocketHandler::handleMessage(const std::vector<char> &payload)
     else if (tokens.equals(0, "uptime"))
         sendTextFrame("uptime " + std::to_string(model.getServerUptimeSecs()));
 
+    else if (tokens.equals(0, "conversion_rate"))
+        sendTextFrame("conversion_rate " + std::to_string(_admin->getConversionRate()));
+
+    else if (tokens.equals(0, "prespawn_state"))
+    {
+        const PrespawnController* controller = PrespawnController::get();
+        sendTextFrame("prespawn_state " +
+                      (controller ? controller->getState(std::chrono::steady_clock::now())
+                                  : std::string("disabled")));
+    }
+
     else if (tokens.equals(0, "log_lines"))
         sendTextFrame("log_lines " + _admin->getLogLines());
 
@@ -510,6 +523,8 @@ Admin::Admin()
     , _lastJiffies(0)
     , _lastSentCount(0)
     , _lastRecvCount(0)
+    , _lastConversionCount(0)
+    , _conversionRate(0)
     , _cpuStatsTaskIntervalMs(DefStatsIntervalMs)
     , _memStatsTaskIntervalMs(DefStatsIntervalMs * 2)
     , _netStatsTaskIntervalMs(DefStatsIntervalMs * 2)
@@ -620,6 +635,10 @@ void Admin::pollingThread()
             const size_t totalMem = getTotalMemoryUsage();
             _model.addMemStats(totalMem);
 
+            if (PrespawnController* prespawn = PrespawnController::get())
+                prespawn->setMemoryHeadroomKb(
+                    _totalAvailMemKb > totalMem ? _totalAvailMemKb - totalMem : 0);
+
             if (totalMem != _lastTotalMemory)
             {
                 // If our total memory consumption is above limit, cleanup
@@ -651,6 +670,13 @@ void Admin::pollingThread()
                 _lastSentCount = sentCount;
             }
 
+            const std::size_t conversionCount = ConvertToBroker::getCompletedCount();
+            const auto elapsedMs =
+                std::chrono::duration_cast<std::chrono::milliseconds>(now - lastNet).count();
+            if (elapsedMs > 0)
+                _conversionRate = 60 * 1000 * (conversionCount - _lastConversionCount) / elapsedMs;
+            _lastConversionCount = conversionCount;
+
             netWait += _netStatsTaskIntervalMs;
             lastNet = now;
         }
@@ -880,11 +906,25 @@ void Admin::setViewLoadDuration(const std::string& docKey, const std::string& se
     addCallback([this, docKey, sessionId, viewLoadDuration]{ _model.setViewLoadDuration(docKey, sessionId, viewLoadDuration); });
 }
 
+void Admin::setViewCompressionStats(const std::string& docKey, const std::string& sessionId,
+                                    uint64_t rawBytes, uint64_t compressedBytes,
+                                    std::chrono::microseconds time)
+{
+    addCallback([this, docKey, sessionId, rawBytes, compressedBytes, time]
+                { _model.setViewCompressionStats(docKey, sessionId, rawBytes, compressedBytes, time); });
+}
+
 void Admin::setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration)
 {
     addCallback([this, docKey, wopiDownloadDuration]{ _model.setDocWopiDownloadDuration(docKey, wopiDownloadDuration); });
 }
 
+void Admin::setDocLoadPhaseDurations(const std::string& docKey, std::chrono::milliseconds jailDuration,
+                                     std::chrono::milliseconds kitLoadDuration)
+{
+    addCallback([this, docKey, jailDuration, kitLoadDuration]{ _model.setDocLoadPhaseDurations(docKey, jailDuration, kitLoadDuration); });
+}
+
 void Admin::setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds uploadDuration)
 {
     addCallback([this, docKey, uploadDuration]{ _model.setDocWopiUploadDuration(docKey, uploadDuration); });
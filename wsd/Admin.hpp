@@ -102,6 +102,8 @@ public:
     /// available to us.
     size_t getTotalAvailableMemory() { return _totalAvailMemKb; }
     size_t getTotalCpuUsage();
+    /// Conversions completed per minute, over the last net stats interval.
+    size_t getConversionRate() const { return _conversionRate; }
 
     void modificationAlert(const std::string& dockey, pid_t pid, bool value);
 
@@ -165,7 +167,12 @@ public:
     void sendMetrics(const std::shared_ptr<StreamSocket>& socket, const std::shared_ptr<Poco::Net::HTTPResponse>& response);
 
     void setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
+    void setViewCompressionStats(const std::string& docKey, const std::string& sessionId,
+                                 uint64_t rawBytes, uint64_t compressedBytes,
+                                 std::chrono::microseconds time);
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
+    void setDocLoadPhaseDurations(const std::string& docKey, std::chrono::milliseconds jailDuration,
+                                  std::chrono::milliseconds kitLoadDuration);
     void setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds uploadDuration);
     void addSegFaultCount(unsigned segFaultCount);
     void addLostKitsTerminated(unsigned lostKitsTerminated);
@@ -219,6 +226,8 @@ private:
     size_t _lastJiffies;
     uint64_t _lastSentCount;
     uint64_t _lastRecvCount;
+    size_t _lastConversionCount;
+    size_t _conversionRate;
     std::string _forkitLogLevel;
 
     struct MonitorConnectRecord
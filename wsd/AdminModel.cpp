@@ -26,7 +26,11 @@
 #include <Unit.hpp>
 #include <Util.hpp>
 #include <wsd/COOLWSD.hpp>
+#include <wsd/ConvertCache.hpp>
+#include <wsd/DocumentBroker.hpp>
 #include <wsd/Exceptions.hpp>
+#include <wsd/StorageConnectionPool.hpp>
+#include <wsd/TileCache.hpp>
 
 #include <fnmatch.h>
 #include <dirent.h>
@@ -68,6 +72,14 @@ void Document::setViewLoadDuration(const std::string& sessionId, std::chrono::mi
         it->second.setLoadDuration(viewLoadDuration);
 }
 
+void Document::setViewCompressionStats(const std::string& sessionId, uint64_t rawBytes,
+                                       uint64_t compressedBytes, std::chrono::microseconds time)
+{
+    std::map<std::string, View>::iterator it = _views.find(sessionId);
+    if (it != _views.end())
+        it->second.setCompressionStats(rawBytes, compressedBytes, time);
+}
+
 std::pair<std::time_t, std::string> Document::getSnapshot() const
 {
     std::time_t ct = std::time(nullptr);
@@ -862,6 +874,15 @@ void AdminModel::setViewLoadDuration(const std::string& docKey, const std::strin
         it->second->setViewLoadDuration(sessionId, viewLoadDuration);
 }
 
+void AdminModel::setViewCompressionStats(const std::string& docKey, const std::string& sessionId,
+                                         uint64_t rawBytes, uint64_t compressedBytes,
+                                         std::chrono::microseconds time)
+{
+    auto it = _documents.find(docKey);
+    if (it != _documents.end())
+        it->second->setViewCompressionStats(sessionId, rawBytes, compressedBytes, time);
+}
+
 void AdminModel::setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration)
 {
     auto it = _documents.find(docKey);
@@ -869,6 +890,15 @@ void AdminModel::setDocWopiDownloadDuration(const std::string& docKey, std::chro
         it->second->setWopiDownloadDuration(wopiDownloadDuration);
 }
 
+void AdminModel::setDocLoadPhaseDurations(const std::string& docKey,
+                                          std::chrono::milliseconds jailDuration,
+                                          std::chrono::milliseconds kitLoadDuration)
+{
+    auto it = _documents.find(docKey);
+    if (it != _documents.end())
+        it->second->setLoadPhaseDurations(jailDuration, kitLoadDuration);
+}
+
 void AdminModel::setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds wopiUploadDuration)
 {
     auto it = _documents.find(docKey);
@@ -1041,11 +1071,24 @@ struct DocumentAggregateStats
         _bytesRecvFromClients.Update(d.getRecvBytes(), active);
         _wopiDownloadDuration.Update(d.getWopiDownloadDuration().count(), active);
         _wopiUploadDuration.Update(d.getWopiUploadDuration().count(), active);
+        _jailDuration.Update(d.getJailDuration().count(), active);
+        _kitLoadDuration.Update(d.getKitLoadDuration().count(), active);
 
         //View load duration
         for (const auto& v : d.getViews())
             _viewLoadDuration.Update(v.second.getLoadDuration().count(), active);
 
+        // Websocket compression, of the views that negotiated it.
+        for (const auto& v : d.getViews())
+        {
+            if (v.second.getDeflateRawBytes() == 0)
+                continue;
+
+            _viewDeflateRawBytes.Update(v.second.getDeflateRawBytes(), active);
+            _viewDeflateCompressedBytes.Update(v.second.getDeflateCompressedBytes(), active);
+            _viewDeflateTime.Update(v.second.getDeflateTime().count(), active);
+        }
+
         if (d.getBadBehaviorDetectionTime())
         {
             if (active)
@@ -1069,7 +1112,12 @@ struct DocumentAggregateStats
     ActiveExpiredStats _bytesRecvFromClients;
     ActiveExpiredStats _wopiDownloadDuration;
     ActiveExpiredStats _wopiUploadDuration;
+    ActiveExpiredStats _jailDuration;
+    ActiveExpiredStats _kitLoadDuration;
     ActiveExpiredStats _viewLoadDuration;
+    ActiveExpiredStats _viewDeflateRawBytes;
+    ActiveExpiredStats _viewDeflateCompressedBytes;
+    ActiveExpiredStats _viewDeflateTime;
 
     int _resConsCount;
     int _resConsAbortCount;
@@ -1146,6 +1194,10 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << "kit_assigned_count " << kitStats.assignedCount << std::endl;
     oss << "kit_segfault_count " << _segFaultCount << std::endl;
     oss << "kit_lost_terminated_count " << _lostKitsTerminatedCount << std::endl;
+    oss << "kit_converter_idle_count " << ConverterPool::getIdleCount() << std::endl;
+    oss << "kit_converter_reuse_count " << ConverterPool::getReuseCount() << std::endl;
+    if (ConvertCache::get())
+        ConvertCache::get()->getMetrics(oss);
     PrintKitAggregateMetrics(oss, "thread_count", "", kitStats._threadCount);
     PrintKitAggregateMetrics(oss, "memory_used", "bytes", docStats._kitUsedMemory._active);
     PrintKitAggregateMetrics(oss, "cpu_time", "seconds", kitStats._cpuTime);
@@ -1171,7 +1223,18 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << std::endl;
     PrintDocActExpMetrics(oss, "wopi_download_duration", "milliseconds", docStats._wopiDownloadDuration);
     oss << std::endl;
+    PrintDocActExpMetrics(oss, "jail_duration", "milliseconds", docStats._jailDuration);
+    oss << std::endl;
+    PrintDocActExpMetrics(oss, "kit_load_duration", "milliseconds", docStats._kitLoadDuration);
+    oss << std::endl;
     PrintDocActExpMetrics(oss, "view_load_duration", "milliseconds", docStats._viewLoadDuration);
+    oss << std::endl;
+    PrintDocActExpMetrics(oss, "view_deflate_raw", "bytes", docStats._viewDeflateRawBytes);
+    oss << std::endl;
+    PrintDocActExpMetrics(oss, "view_deflate_compressed", "bytes",
+                          docStats._viewDeflateCompressedBytes);
+    oss << std::endl;
+    PrintDocActExpMetrics(oss, "view_deflate_time", "microseconds", docStats._viewDeflateTime);
 
     oss << std::endl;
     oss << "error_storage_space_low " << StorageSpaceLowException::count << "\n";
@@ -1183,6 +1246,16 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << "error_parse_error " << ParseError::count << "\n";
     oss << std::endl;
 
+    if (StorageConnectionPool::get())
+    {
+        StorageConnectionPool::get()->getMetrics(oss);
+        oss << std::endl;
+    }
+
+    oss << "tile_cache_evicted_count " << TileCache::EvictedTileCount << "\n";
+    oss << "tile_cache_evicted_bytes " << TileCache::EvictedTileBytes << "\n";
+    oss << std::endl;
+
     int tick_per_sec = sysconf(_SC_CLK_TCK);
     // dump document data
     for (const auto& it : _documents)
@@ -1207,6 +1280,8 @@ void AdminModel::getMetrics(std::ostringstream &oss)
         oss << "doc_idle_time_seconds" << suffix << doc.getIdleTime() << "\n";
         oss << "doc_download_time_seconds" << suffix << ((double)doc.getWopiDownloadDuration().count() / 1000) << "\n";
         oss << "doc_upload_time_seconds" << suffix << ((double)doc.getWopiUploadDuration().count() / 1000) << "\n";
+        oss << "doc_jail_time_seconds" << suffix << ((double)doc.getJailDuration().count() / 1000) << "\n";
+        oss << "doc_load_time_seconds" << suffix << ((double)doc.getKitLoadDuration().count() / 1000) << "\n";
         oss << std::endl;
     }
 }
@@ -36,6 +36,9 @@ public:
         , _start(std::time(nullptr))
         , _loadDuration(0)
         , _readOnly(readOnly)
+        , _deflateRawBytes(0)
+        , _deflateCompressedBytes(0)
+        , _deflateTime(0)
     {
     }
 
@@ -48,6 +51,19 @@ public:
     void setLoadDuration(std::chrono::milliseconds loadDuration) { _loadDuration = loadDuration; }
     bool isReadOnly() const { return _readOnly; }
 
+    /// The websocket compression of this view, if any: the bytes of the messages
+    /// before and after compression, and the time spent (de)compressing them.
+    void setCompressionStats(uint64_t rawBytes, uint64_t compressedBytes,
+                             std::chrono::microseconds time)
+    {
+        _deflateRawBytes = rawBytes;
+        _deflateCompressedBytes = compressedBytes;
+        _deflateTime = time;
+    }
+    uint64_t getDeflateRawBytes() const { return _deflateRawBytes; }
+    uint64_t getDeflateCompressedBytes() const { return _deflateCompressedBytes; }
+    std::chrono::microseconds getDeflateTime() const { return _deflateTime; }
+
 private:
     const std::string _sessionId;
     const std::string _userName;
@@ -56,6 +72,9 @@ private:
     std::time_t _end = 0;
     std::chrono::milliseconds _loadDuration;
     bool _readOnly = false;
+    uint64_t _deflateRawBytes;
+    uint64_t _deflateCompressedBytes;
+    std::chrono::microseconds _deflateTime;
 };
 
 struct DocCleanupSettings
@@ -177,6 +196,8 @@ public:
         , _recvBytes(0)
         , _wopiDownloadDuration(0)
         , _wopiUploadDuration(0)
+        , _jailDuration(0)
+        , _kitLoadDuration(0)
         , _procSMaps(nullptr)
         , _lastTimeSMapsRead(0)
         , _isModified(false)
@@ -245,10 +266,20 @@ public:
     uint64_t getSentBytes() const { return _sentBytes; }
     uint64_t getRecvBytes() const { return _recvBytes; }
     void setViewLoadDuration(const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
+    void setViewCompressionStats(const std::string& sessionId, uint64_t rawBytes,
+                                 uint64_t compressedBytes, std::chrono::microseconds time);
     void setWopiDownloadDuration(std::chrono::milliseconds wopiDownloadDuration) { _wopiDownloadDuration = wopiDownloadDuration; }
     std::chrono::milliseconds getWopiDownloadDuration() const { return _wopiDownloadDuration; }
     void setWopiUploadDuration(const std::chrono::milliseconds wopiUploadDuration) { _wopiUploadDuration = wopiUploadDuration; }
     std::chrono::milliseconds getWopiUploadDuration() const { return _wopiUploadDuration; }
+    void setLoadPhaseDurations(std::chrono::milliseconds jailDuration,
+                               std::chrono::milliseconds kitLoadDuration)
+    {
+        _jailDuration = jailDuration;
+        _kitLoadDuration = kitLoadDuration;
+    }
+    std::chrono::milliseconds getJailDuration() const { return _jailDuration; }
+    std::chrono::milliseconds getKitLoadDuration() const { return _kitLoadDuration; }
     void setProcSMapsFD(const int smapsFD) { _procSMaps = fdopen(smapsFD, "r"); }
     bool hasMemDirtyChanged() const { return _hasMemDirtyChanged; }
     void setMemDirtyChanged(bool changeStatus) { _hasMemDirtyChanged = changeStatus; }
@@ -289,6 +320,10 @@ private:
     std::chrono::milliseconds _wopiDownloadDuration;
     std::chrono::milliseconds _wopiUploadDuration;
 
+    //Time to get a Kit in its jail, and for it to load the downloaded document
+    std::chrono::milliseconds _jailDuration;
+    std::chrono::milliseconds _kitLoadDuration;
+
     FILE* _procSMaps;
     std::time_t _lastTimeSMapsRead;
 
@@ -410,7 +445,12 @@ public:
     void cleanupResourceConsumingDocs();
 
     void setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
+    void setViewCompressionStats(const std::string& docKey, const std::string& sessionId,
+                                 uint64_t rawBytes, uint64_t compressedBytes,
+                                 std::chrono::microseconds time);
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
+    void setDocLoadPhaseDurations(const std::string& docKey, std::chrono::milliseconds jailDuration,
+                                  std::chrono::milliseconds kitLoadDuration);
     void setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds wopiUploadDuration);
     void addSegFaultCount(unsigned segFaultCount);
     void setForKitPid(pid_t pid) { _forKitPid = pid; }
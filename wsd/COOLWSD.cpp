@@ -86,6 +86,7 @@
 #include <Poco/Net/PartHandler.h>
 #include <Poco/Net/SocketAddress.h>
 #include <net/HttpHelper.hpp>
+#include <net/WebSocketDeflate.hpp>
 #include <Poco/Net/AcceptCertificateHandler.h>
 #include <Poco/Net/Context.h>
 #include <Poco/Net/KeyConsoleHandler.h>
@@ -127,6 +128,7 @@ using Poco::Net::PartHandler;
 #include "Admin.hpp"
 #include "Auth.hpp"
 #include "ClientSession.hpp"
+#include "ConvertCache.hpp"
 #include <Common.hpp>
 #include <Clipboard.hpp>
 #include <Crypto.hpp>
@@ -134,7 +136,10 @@ using Poco::Net::PartHandler;
 #include "DocumentBroker.hpp"
 #include "Exceptions.hpp"
 #include "FileServer.hpp"
+#include "PrespawnController.hpp"
+#include "ProxyProtocol.hpp"
 #include "ProxyRequestHandler.hpp"
+#include "StorageConnectionPool.hpp"
 #include <common/JsonUtil.hpp>
 #include <common/FileUtil.hpp>
 #include <common/JailUtil.hpp>
@@ -154,6 +159,7 @@ using Poco::Net::PartHandler;
 #include "UserMessages.hpp"
 #include <Util.hpp>
 #include <common/ConfigUtil.hpp>
+#include <common/Simd.hpp>
 #include <common/TraceEvent.hpp>
 
 #include <common/SigUtil.hpp>
@@ -537,6 +543,8 @@ static int forkChildren(const int number)
         COOLWSD::sendMessageToForKit(aMessage);
         OutstandingForks += number;
         LastForkRequestTime = std::chrono::steady_clock::now();
+        if (PrespawnController* controller = PrespawnController::get())
+            controller->noteForkRequest(LastForkRequestTime, number);
         return number;
     }
 
@@ -588,6 +596,8 @@ static int rebalanceChildren(int balance)
         LOG_WRN("ForKit not responsive for " << durationMs << " forking " << OutstandingForks
                                              << " children. Resetting.");
         OutstandingForks = 0;
+        if (PrespawnController* controller = PrespawnController::get())
+            controller->resetForkRequests();
     }
 
     balance -= available;
@@ -605,6 +615,36 @@ static int rebalanceChildren(int balance)
     return 0;
 }
 
+/// The number of spare children to keep, as sized
+/// by the PrespawnController, when enabled.
+static int getPrespawnTarget()
+{
+    Util::assertIsLocked(NewChildrenMutex);
+
+    if (PrespawnController* controller = PrespawnController::get())
+        return controller->getTarget(std::chrono::steady_clock::now(), NewChildren.size());
+
+    return COOLWSD::NumPreSpawnedChildren;
+}
+
+/// Terminates the oldest spare child when we have more than
+/// the PrespawnController wants, so the pool shrinks when idle.
+static void retireSpareChildren()
+{
+    Util::assertIsLocked(NewChildrenMutex);
+
+    PrespawnController* controller = PrespawnController::get();
+    if (!controller || NewChildren.empty() || OutstandingForks != 0 ||
+        !controller->shouldRetire(std::chrono::steady_clock::now(), NewChildren.size()))
+        return;
+
+    std::shared_ptr<ChildProcess> child = NewChildren.front();
+    NewChildren.erase(NewChildren.begin());
+    LOG_INF("Retiring spare child [" << child->getPid() << "], have " << NewChildren.size()
+                                     << " spare left.");
+    child->terminate();
+}
+
 /// Proactively spawn children processes
 /// to load documents with alacrity.
 /// Returns true only if at least one child was requested to spawn.
@@ -612,7 +652,11 @@ static bool prespawnChildren()
 {
     // Rebalance if not forking already.
     std::unique_lock<std::mutex> lock(NewChildrenMutex, std::defer_lock);
-    return lock.try_lock() && (rebalanceChildren(COOLWSD::NumPreSpawnedChildren) > 0);
+    if (!lock.try_lock())
+        return false;
+
+    retireSpareChildren();
+    return rebalanceChildren(getPrespawnTarget()) > 0;
 }
 
 #endif
@@ -629,6 +673,11 @@ static size_t addNewChild(std::shared_ptr<ChildProcess> child)
     if (OutstandingForks < 0)
         ++OutstandingForks;
 
+#if !MOBILEAPP
+    if (PrespawnController* controller = PrespawnController::get())
+        controller->noteNewChild(std::chrono::steady_clock::now());
+#endif
+
     if (COOLWSD::IsBindMountingEnabled)
     {
         // Reset the child-spawn timeout to the default, now that we're set.
@@ -655,6 +704,17 @@ std::mutex COOLWSD::lokit_main_mutex;
 #endif
 #endif
 
+void noteNewChildRequest()
+{
+#if !MOBILEAPP
+    if (PrespawnController* controller = PrespawnController::get())
+    {
+        std::unique_lock<std::mutex> lock(NewChildrenMutex);
+        controller->noteChildRequest(std::chrono::steady_clock::now(), NewChildren.empty());
+    }
+#endif
+}
+
 std::shared_ptr<ChildProcess> getNewChild_Blocks(unsigned mobileAppDocId)
 {
     (void)mobileAppDocId;
@@ -665,7 +725,7 @@ std::shared_ptr<ChildProcess> getNewChild_Blocks(unsigned mobileAppDocId)
 #if !MOBILEAPP
     assert(mobileAppDocId == 0 && "Unexpected to have mobileAppDocId in the non-mobile build");
 
-    int numPreSpawn = COOLWSD::NumPreSpawnedChildren;
+    int numPreSpawn = getPrespawnTarget();
     ++numPreSpawn; // Replace the one we'll dispatch just now.
     LOG_DBG("getNewChild: Rebalancing children to " << numPreSpawn);
     if (rebalanceChildren(numPreSpawn) < 0)
@@ -2129,6 +2189,9 @@ void COOLWSD::innerInitialize(Application& self)
 
     Util::setApplicationPath(Poco::Path(Application::instance().commandPath()).parent().toString());
 
+    // Websocket (un)masking picks its kernel by the CPU.
+    simd::init();
+
     StartTime = std::chrono::steady_clock::now();
 
     LayeredConfiguration& conf = config();
@@ -2177,6 +2240,7 @@ void COOLWSD::innerInitialize(Application& self)
         { "logging.userstats", "false" },
         { "browser_logging", "false" },
         { "mount_jail_tree", "true" },
+        { "clone_jail_template", "true" },
         { "net.connection_timeout_secs", "30" },
         { "net.listen", "any" },
         { "net.proto", "all" },
@@ -2184,9 +2248,18 @@ void COOLWSD::innerInitialize(Application& self)
         { "net.proxy_prefix", "false" },
         { "net.content_security_policy", "" },
         { "net.frame_ancestors", "" },
+        { "net.use_epoll", "false" },
+        { "net.proxy_binary_framing", "true" },
+        { "net.ws_deflate[@enable]", "false" },
+        { "net.ws_deflate.window_bits", "15" },
+        { "net.ws_deflate.mem_level", "8" },
+        { "net.ws_deflate.context_takeover", "true" },
+        { "net.ws_deflate.min_size", "64" },
+        { "net.ws_deflate.max_inflated_size_mb", "64" },
         { "num_prespawn_children", "1" },
         { "per_document.always_save_on_exit", "false" },
         { "per_document.autosave_duration_secs", "300" },
+        { "per_document.background_autosave", "false" },
         { "per_document.cleanup.cleanup_interval_ms", "10000" },
         { "per_document.cleanup.bad_behavior_period_secs", "60" },
         { "per_document.cleanup.idle_time_secs", "300" },
@@ -2194,6 +2267,10 @@ void COOLWSD::innerInitialize(Application& self)
         { "per_document.cleanup.limit_cpu_per", "85" },
         { "per_document.cleanup.lost_kit_grace_period_secs", "120" },
         { "per_document.cleanup[@enable]", "false" },
+        { "per_document.converter_pool.max_documents", "100" },
+        { "per_document.converter_pool.max_idle", "4" },
+        { "per_document.converter_pool.max_rss_mb", "1024" },
+        { "per_document.converter_pool[@enable]", "false" },
         { "per_document.idle_timeout_secs", "3600" },
         { "per_document.idlesave_duration_secs", "30" },
         { "per_document.limit_file_size_mb", "0" },
@@ -2209,10 +2286,16 @@ void COOLWSD::innerInitialize(Application& self)
         { "per_document.batch_priority", "5" },
         { "per_document.pdf_resolution_dpi", "96" },
         { "per_document.redlining_as_comments", "false" },
+        { "per_document.tile_dictionary[@enable]", "false" },
+        { "per_document.tile_dictionary.path", "" },
         { "per_view.group_download_as", "true" },
         { "per_view.idle_timeout_secs", "900" },
         { "per_view.out_of_focus_timeout_secs", "120" },
         { "per_view.custom_os_info", "" },
+        { "prespawn_pool[@enable]", "false" },
+        { "prespawn_pool.max_children", "10" },
+        { "prespawn_pool.cold_start_probability", "0.05" },
+        { "prespawn_pool.spare_child_memory_mb", "50" },
         { "security.capabilities", "true" },
         { "security.seccomp", "true" },
         { "security.jwt_expiry_secs", "1800" },
@@ -2233,6 +2316,9 @@ void COOLWSD::innerInitialize(Application& self)
         { "stop_on_config_change", "false" },
         { "storage.filesystem[@allow]", "false" },
         // "storage.ssl.enable" - deliberately not set; for back-compat
+        { "storage.wopi.connection_pool[@enable]", "false" },
+        { "storage.wopi.connection_pool.idle_timeout_secs", "30" },
+        { "storage.wopi.connection_pool.max_idle_per_host", "4" },
         { "storage.wopi.max_file_size", "0" },
         { "storage.wopi[@allow]", "true" },
         { "storage.wopi.locking.refresh", "900" },
@@ -2267,6 +2353,11 @@ void COOLWSD::innerInitialize(Application& self)
 #endif
         { "user_interface.mode", "default" },
         { "user_interface.use_integration_theme", "true" },
+        { "convert_cache[@enable]", "false" },
+        { "convert_cache.max_size_mb", "512" },
+        { "convert_cache.max_memory_mb", "64" },
+        { "convert_cache.max_memory_entry_kb", "256" },
+        { "convert_cache.ttl_secs", "3600" },
         { "quarantine_files[@enable]", "false" },
         { "quarantine_files.limit_dir_size_mb", "250" },
         { "quarantine_files.max_versions_to_maintain", "2" },
@@ -2594,6 +2685,30 @@ void COOLWSD::innerInitialize(Application& self)
 
     IsProxyPrefixEnabled = getConfigValue<bool>(conf, "net.proxy_prefix", false);
 
+    SocketPoll::UseEpoll = getConfigValue<bool>(conf, "net.use_epoll", false);
+
+#if !MOBILEAPP
+    ProxyProtocolHandler::BinaryFraming =
+        getConfigValue<bool>(conf, "net.proxy_binary_framing", true);
+
+    WebSocketDeflate::Enabled = getConfigValue<bool>(conf, "net.ws_deflate[@enable]", false);
+    WebSocketDeflate::MaxWindowBits =
+        std::clamp(getConfigValue<int>(conf, "net.ws_deflate.window_bits", 15), 9, 15);
+    WebSocketDeflate::MemLevel =
+        std::clamp(getConfigValue<int>(conf, "net.ws_deflate.mem_level", 8), 1, 9);
+    WebSocketDeflate::ContextTakeover =
+        getConfigValue<bool>(conf, "net.ws_deflate.context_takeover", true);
+    WebSocketDeflate::MinSize = getConfigValue<unsigned>(conf, "net.ws_deflate.min_size", 64);
+    WebSocketDeflate::MaxInflatedSize =
+        std::size_t(getConfigValue<unsigned>(conf, "net.ws_deflate.max_inflated_size_mb", 64)) *
+        1024 * 1024;
+    if (WebSocketDeflate::Enabled)
+        LOG_INF("WebSocket compression enabled with a window of 2^"
+                << WebSocketDeflate::MaxWindowBits << " bytes, memory level "
+                << WebSocketDeflate::MemLevel << ", and context takeover "
+                << (WebSocketDeflate::ContextTakeover ? "enabled" : "disabled"));
+#endif
+
 #if ENABLE_SSL
     COOLWSD::SSLEnabled.set(getConfigValue<bool>(conf, "ssl.enable", true));
     COOLWSD::SSLTermination.set(getConfigValue<bool>(conf, "ssl.termination", true));
@@ -2765,6 +2880,10 @@ void COOLWSD::innerInitialize(Application& self)
         LOG_INF("Quarantine is disabled in config");
     }
 
+    // In WSD's scratch area under the child root, which is in no jail, so no Kit can
+    // reach it, and is removed along with the jails, even when we didn't exit cleanly.
+    ConvertCache::initialize(ChildRoot + "tmp/convert-cache/");
+
     NumPreSpawnedChildren = getConfigValue<int>(conf, "num_prespawn_children", 1);
     if (NumPreSpawnedChildren < 1)
     {
@@ -2773,9 +2892,12 @@ void COOLWSD::innerInitialize(Application& self)
     }
     LOG_INF("NumPreSpawnedChildren set to " << NumPreSpawnedChildren << '.');
 
+    PrespawnController::initialize(NumPreSpawnedChildren);
+
     FileUtil::registerFileSystemForDiskSpaceChecks(ChildRoot);
 
-    int nThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    // Take the affinity mask and any cgroup CPU quota into account.
+    int nThreads = Util::getAvailableCpus();
     int maxConcurrency = getConfigValue<int>(conf, "per_document.max_concurrency", 4);
 
     if (maxConcurrency > 16)
@@ -4021,7 +4143,8 @@ private:
         if (UnitWSD::isUnitTesting() && UnitWSD::get().filterChildMessage(data))
             return;
 
-        auto message = std::make_shared<Message>(data.data(), data.size(), Message::Dir::Out);
+        // Take over the payload rather than copying it, tile data can be large.
+        auto message = std::make_shared<Message>(takeMessagePayload(), Message::Dir::Out);
         std::shared_ptr<StreamSocket> socket = getSocket().lock();
         if (socket)
         {
@@ -4246,7 +4369,7 @@ private:
         Poco::Net::HTTPRequest request;
 
         StreamSocket::MessageMap map;
-        if (!socket->parseHeader("Client", startmessage, request, map))
+        if (!socket->parseHeader("Client", _requestParser, startmessage, request, map))
             return;
 
         LOG_DBG("Handling request: " << request.getURI());
@@ -5058,12 +5181,32 @@ private:
                 std::string lang = (form.has("lang") ? form.get("lang") : std::string());
                 std::string target = (form.has("target") ? form.get("target") : std::string());
 
+                // Identical requests can be served without converting again.
+                std::string cacheKey;
+                if (ConvertCache* cache = ConvertCache::get())
+                {
+                    cacheKey = ConvertCache::makeKey(
+                        fromPath, { requestDetails[1], format, options, lang, target });
+
+                    std::string fileName;
+                    if (requestDetails.equals(1, "convert-to"))
+                        fileName = Poco::Path(uriPublic.getPath()).setExtension(format).getFileName();
+
+                    if (!cacheKey.empty() && cache->sendCached(cacheKey, socket, fileName))
+                    {
+                        LOG_INF("Served conversion of [" << fromPath << "] from the cache");
+                        socket->ignoreInput();
+                        return;
+                    }
+                }
+
                 // This lock could become a bottleneck.
                 // In that case, we can use a pool and index by publicPath.
                 std::unique_lock<std::mutex> docBrokersLock(DocBrokersMutex);
 
                 LOG_DBG("New DocumentBroker for docKey [" << docKey << "].");
                 auto docBroker = getConvertToBrokerImplementation(requestDetails[1], fromPath, uriPublic, docKey, format, options, lang, target);
+                docBroker->setCacheKey(cacheKey);
                 handler.takeFile();
 
                 cleanupDocBrokers();
@@ -5289,7 +5432,12 @@ private:
         }
 
         LOG_INF("URL [" << COOLWSD::anonymizeUrl(url) << "] is " << (isReadOnly ? "readonly" : "writable") << '.');
-        (void)request; (void)message; (void)disposition;
+        (void)message; (void)disposition;
+
+        // Only used when opening the session.
+        const bool binaryFraming =
+            ProxyProtocolHandler::BinaryFraming &&
+            request.get(ProxyProtocolHandler::FramingHeader, std::string()) == "binary";
 
         std::shared_ptr<ProtocolHandlerInterface> none;
         // Request a kit process for this doc.
@@ -5299,7 +5447,7 @@ private:
         {
             // need to move into the DocumentBroker context before doing session lookup / creation etc.
             docBroker->setupTransfer(disposition, [docBroker, id = _id, uriPublic,
-                                     isReadOnly, requestDetails]
+                                     isReadOnly, binaryFraming, requestDetails]
                                     (const std::shared_ptr<Socket> &moveSocket)
                 {
                     // Now inside the document broker thread ...
@@ -5310,7 +5458,7 @@ private:
                     try
                     {
                         docBroker->handleProxyRequest(
-                            id, uriPublic, isReadOnly,
+                            id, uriPublic, isReadOnly, binaryFraming,
                             requestDetails, streamSocket);
                         return;
                     }
@@ -5651,6 +5799,9 @@ private:
     std::weak_ptr<StreamSocket> _socket;
     std::string _id;
 
+    /// Parses the incoming request header, keeping progress while it arrives.
+    http::RequestHeaderParser _requestParser;
+
     /// WASM document request handler. Used only when WASM is enabled.
     std::unique_ptr<WopiProxy> _wopiProxy;
 
@@ -5853,6 +6004,15 @@ public:
 
 #if !MOBILEAPP
         os << "Converter count: " << ConvertToBroker::getInstanceCount() << '\n';
+
+        if (ConvertCache::get())
+            ConvertCache::get()->dumpState(os);
+
+        if (PrespawnController::get())
+            PrespawnController::get()->dumpState(os);
+
+        if (StorageConnectionPool::get())
+            StorageConnectionPool::get()->dumpState(os);
 #endif
 
         Socket::InhibitThreadChecks = false;
@@ -6413,6 +6573,8 @@ int COOLWSD::innerMain()
     NewChildren.clear();
 
 #if !MOBILEAPP
+    ConverterPool::clear();
+
     if (!Util::isKitInProcess())
     {
         // Wait for forkit process finish.
@@ -42,6 +42,9 @@ class FileServerRequestHandler;
 
 std::shared_ptr<ChildProcess> getNewChild_Blocks(unsigned mobileAppDocId);
 
+/// Records a document asking for a kit, once, however many times it retries.
+void noteNewChildRequest();
+
 // A WSProcess object in the WSD process represents a descendant process, either the direct child
 // process ForKit or a grandchild Kit process, with which the WSD process communicates through a
 // WebSocket.
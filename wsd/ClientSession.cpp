@@ -14,6 +14,7 @@
 #include "ClientSession.hpp"
 
 #include <ios>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -27,6 +28,7 @@
 #include <Poco/JSON/Object.h>
 
 #include "DocumentBroker.hpp"
+#include "ConvertCache.hpp"
 #include "COOLWSD.hpp"
 #include <common/Common.hpp>
 #include <common/JsonUtil.hpp>
@@ -1265,6 +1267,11 @@ bool ClientSession::loadDocument(const char* /*buffer*/, int /*length*/,
             oss << " accessibilityState=" << std::boolalpha << getAccessibilityState();
         }
 
+        if (getTileDictionary())
+        {
+            oss << " tileDictionary=true";
+        }
+
         if (!getDocOptions().empty())
         {
             oss << " options=" << getDocOptions();
@@ -1570,18 +1577,11 @@ void ClientSession::writeQueuedMessages(std::size_t capacity)
         // Drain the queue, for efficient communication.
         while (capacity > wrote && _senderQueue.dequeue(item) && item)
         {
-            const std::vector<char>& data = item->data();
-            const auto size = data.size();
+            const auto size = item->size();
             assert(size && "Zero-sized messages must never be queued for sending.");
 
-            if (item->isBinary())
-            {
-                Session::sendBinaryFrame(data.data(), size);
-            }
-            else
-            {
-                Session::sendTextFrame(data.data(), size);
-            }
+            // Messages are often shared by several sessions: avoid copying them.
+            Session::sendMessageFrame(item);
 
             wrote += size;
             LOG_TRC("wrote " << size << ", total " << wrote << " bytes");
@@ -1849,6 +1849,10 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
                     response.set("Content-Disposition", "attachment; filename=\"" + fileName + '"');
                 response.setContentType("application/octet-stream");
 
+                if (!_convertCacheKey.empty() && ConvertCache::get())
+                    ConvertCache::get()->addFile(_convertCacheKey, resultURL.getPath(),
+                                                 "application/octet-stream");
+
                 HttpHelper::sendFileAndShutdown(_saveAsSocket, resultURL.getPath(), response);
             }
 
@@ -2274,6 +2278,11 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
             {
                 const std::string stringJSON = payload->jsonString();
 
+#if !MOBILEAPP
+                if (!_convertCacheKey.empty() && ConvertCache::get())
+                    ConvertCache::get()->addData(_convertCacheKey, stringJSON, "application/json");
+#endif
+
                 http::Response httpResponse(http::StatusCode::OK);
                 httpResponse.set("Last-Modified", Util::getHttpTimeNow());
                 httpResponse.set("X-Content-Type-Options", "nosniff");
@@ -2302,6 +2311,11 @@ bool ClientSession::handleKitToClientMessage(const std::shared_ptr<Message>& pay
                     int firstLineSize = firstLine.size() + 1;
                     std::string thumbnail(payload->data().data() + firstLineSize, payload->data().size() - firstLineSize);
 
+#if !MOBILEAPP
+                    if (!_convertCacheKey.empty() && ConvertCache::get())
+                        ConvertCache::get()->addData(_convertCacheKey, thumbnail, "image/png");
+#endif
+
                     http::Response httpResponse(http::StatusCode::OK);
                     httpResponse.set("Last-Modified", Util::getHttpTimeNow());
                     httpResponse.set("X-Content-Type-Options", "nosniff");
@@ -2372,6 +2386,23 @@ void ClientSession::enqueueSendMessage(const std::shared_ptr<Message>& data)
         addTileOnFly(tile->getWireId());
 }
 
+bool ClientSession::sendTextFrameNow(const std::string& text)
+{
+    if (isCloseFrame())
+    {
+        LOG_TRC("Connection closed, dropping message [" << text << ']');
+        return false;
+    }
+
+    const std::shared_ptr<DocumentBroker> docBroker = _docBroker.lock();
+    LOG_CHECK_RET(docBroker && "Null DocumentBroker instance", false);
+    docBroker->ASSERT_CORRECT_THREAD();
+
+    // Keep the order with what was queued before.
+    writeQueuedMessages(std::numeric_limits<std::size_t>::max());
+    return sendTextFrameAndFlush(text);
+}
+
 void ClientSession::addTileOnFly(TileWireId wireId)
 {
     _tilesOnFly.emplace_back(wireId, std::chrono::steady_clock::now());
@@ -2530,6 +2561,13 @@ void ClientSession::dumpState(std::ostream& os)
         uint64_t sent = 0, recv = 0;
         _protocol->getIOStats(sent, recv);
         os << "\n\t\tsent/keystroke: " << (double)sent/_keyEvents << " bytes";
+
+        uint64_t raw = 0, compressed = 0;
+        std::chrono::microseconds time;
+        _protocol->getCompressionStats(raw, compressed, time);
+        if (raw > 0)
+            os << "\n\t\tdeflate: " << raw << " bytes to " << compressed << " bytes in "
+               << time.count() << "us";
     }
 
     os << "\n\t\tonFlyUpperLimit: " << getTilesOnFlyUpperLimit();
@@ -2647,7 +2685,10 @@ void ClientSession::handleTileInvalidation(const std::string& message,
                         {
                             invalidTiles.push_back(desc);
 
-                            TileWireId makeDelta = 1;
+                            // What we last sent, so the deltas of its neighbours
+                            // can copy rows from it; or just allow a delta.
+                            const TileWireId lastSentId = _tracker.getTileSeq(desc);
+                            TileWireId makeDelta = lastSentId ? lastSentId : 1;
                             // FIXME: mobile with no TileCache & flushed kit cache
                             // FIXME: out of (a)sync kit vs. TileCache re: keyframes ?
                             if (getDocumentBroker()->hasTileCache() &&
@@ -107,24 +107,20 @@ public:
 
     bool sendTileNow(const TileDesc &desc, const Tile &tile)
     {
-        TileWireId lastSentId = _tracker.updateTileSeq(desc);
-
-        std::string header;
-        if (tile->needsKeyframe(lastSentId) || tile->isPng())
-            header = desc.serialize("tile:", "\n");
-        else
-            header = desc.serialize("delta:", "\n");
-
-        // FIXME: performance - optimize away this copy ...
-        std::vector<char> output;
+        SharedTileMessages messages(desc, tile);
+        return sendTileNow(messages);
+    }
 
-        // copy in the header
-        output.resize(header.size());
-        std::memcpy(output.data(), header.data(), header.size());
+    /// Sends the message matching what we last sent of this tile,
+    /// sharing it with any other session that is at the same point.
+    bool sendTileNow(SharedTileMessages& messages)
+    {
+        const TileWireId lastSentId = _tracker.updateTileSeq(messages.getDesc());
+        if (isCloseFrame())
+            return false;
 
-        bool hasContent = tile->appendChangesSince(output, tile->isPng() ? 0 : lastSentId);
-        LOG_TRC("Sending tile message: " << header << " lastSendId " << lastSentId << " content " << hasContent);
-        return sendBinaryFrame(output.data(), output.size());
+        enqueueSendMessage(messages.get(lastSentId));
+        return true;
     }
 
     bool sendBlob(const std::string &header, const Blob &blob)
@@ -152,6 +148,11 @@ public:
 
     void enqueueSendMessage(const std::shared_ptr<Message>& data);
 
+    /// Writes @text out to the client now, after anything already queued, and
+    /// without the de-duplication of the queue. For use while our poll is
+    /// blocked and can't write, i.e. to report the progress of the download.
+    bool sendTextFrameNow(const std::string& text);
+
     /// Set the save-as socket which is used to send convert-to results.
     void setSaveAsSocket(const std::shared_ptr<StreamSocket>& socket)
     {
@@ -225,6 +226,9 @@ public:
 
     bool thumbnailSession() { return _thumbnailSession; }
 
+    /// The ConvertCache key under which to store the result we send to _saveAsSocket.
+    void setConvertCacheKey(const std::string& key) { _convertCacheKey = key; }
+
     /// Do we recognize this clipboard ?
     bool matchesClipboardKeys(const std::string &viewId, const std::string &tag);
 
@@ -339,6 +343,9 @@ private:
     /// The socket to which the converted (saveas) doc is sent.
     std::shared_ptr<StreamSocket> _saveAsSocket;
 
+    /// The ConvertCache key of the conversion, if it is to be cached.
+    std::string _convertCacheKey;
+
     /// The phase of our lifecycle that we're in.
     SessionState _state;
 
@@ -0,0 +1,426 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "ConvertCache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include "COOLWSD.hpp"
+#include <common/FileUtil.hpp>
+#include <common/Log.hpp>
+#include <common/SpookyV2.h>
+#include <common/Util.hpp>
+#include <net/HttpRequest.hpp>
+#include <net/Socket.hpp>
+
+namespace
+{
+/// Maps the file at @path of @size bytes, returning the owner of the mapping.
+std::shared_ptr<const void> mapFile(const std::string& path, std::size_t size, const char*& data)
+{
+    if (size == 0)
+    {
+        static const char empty = '\0';
+        data = &empty;
+        return std::make_shared<std::string>();
+    }
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return nullptr;
+
+    data = static_cast<const char*>(addr);
+    return std::shared_ptr<const void>(addr, [size](const void* p)
+                                       { ::munmap(const_cast<void*>(p), size); });
+}
+} // namespace
+
+std::unique_ptr<ConvertCache> ConvertCache::Instance;
+
+ConvertCache::ConvertCache(const std::string& path, std::size_t maxDiskBytes,
+                           std::size_t maxMemoryBytes, std::size_t maxMemoryEntryBytes,
+                           std::chrono::seconds ttl)
+    : _path(path.empty() || path.back() == '/' ? path : path + '/')
+    , _maxDiskBytes(maxDiskBytes)
+    , _maxMemoryBytes(maxMemoryBytes)
+    , _maxMemoryEntryBytes(maxMemoryEntryBytes)
+    , _ttl(ttl)
+    , _diskBytes(0)
+    , _memoryBytes(0)
+    , _hits(0)
+    , _misses(0)
+    , _evictions(0)
+{
+    // Nothing survives a restart, as we only index what we cached ourselves.
+    FileUtil::removeFile(_path, /*recursive=*/true);
+    Poco::File(_path).createDirectories();
+
+    LOG_INF("ConvertCache at [" << _path << "] with up to " << _maxDiskBytes / 1024
+                                << " KB on disk and " << _maxMemoryBytes / 1024
+                                << " KB in memory, for " << _ttl.count() << " secs");
+}
+
+ConvertCache::~ConvertCache() { FileUtil::removeFile(_path, /*recursive=*/true); }
+
+void ConvertCache::initialize(const std::string& path)
+{
+    if (!COOLWSD::getConfigValue<bool>("convert_cache[@enable]", false))
+    {
+        LOG_INF("ConvertCache is disabled in config");
+        return;
+    }
+
+    constexpr std::size_t MB = 1024 * 1024;
+    const std::size_t maxDiskBytes =
+        COOLWSD::getConfigValue<std::size_t>("convert_cache.max_size_mb", 512) * MB;
+    const std::size_t maxMemoryBytes =
+        COOLWSD::getConfigValue<std::size_t>("convert_cache.max_memory_mb", 64) * MB;
+    const std::size_t maxMemoryEntryBytes =
+        COOLWSD::getConfigValue<std::size_t>("convert_cache.max_memory_entry_kb", 256) * 1024;
+    const std::chrono::seconds ttl(
+        COOLWSD::getConfigValue<std::size_t>("convert_cache.ttl_secs", 3600));
+
+    try
+    {
+        Instance = std::make_unique<ConvertCache>(path, maxDiskBytes, maxMemoryBytes,
+                                                  maxMemoryEntryBytes, ttl);
+    }
+    catch (const std::exception& ex)
+    {
+        LOG_ERR("Failed to create the ConvertCache at [" << path << "]: " << ex.what()
+                                                         << ". Disabling it");
+    }
+}
+
+std::string ConvertCache::makeKey(const std::string& inputPath,
+                                  const std::vector<std::string>& params)
+{
+    const int fd = ::open(inputPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_WRN("Failed to open [" << inputPath << "] to hash: " << strerror(errno));
+        return std::string();
+    }
+
+    SpookyHash hash;
+    hash.Init(0, 0);
+
+    char buffer[64 * 1024];
+    ssize_t size;
+    while ((size = ::read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (size < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LOG_WRN("Failed to read [" << inputPath << "] to hash: " << strerror(errno));
+            ::close(fd);
+            return std::string();
+        }
+
+        hash.Update(buffer, size);
+    }
+
+    ::close(fd);
+
+    // The same bytes convert differently by extension, e.g. as .csv or .txt.
+    const std::string extension = Poco::Path(inputPath).getExtension();
+    hash.Update(extension.c_str(), extension.size() + 1);
+
+    // Include the separators, so parameters can't bleed into each other.
+    for (const std::string& param : params)
+        hash.Update(param.c_str(), param.size() + 1);
+
+    uint64 hash1 = 0;
+    uint64 hash2 = 0;
+    hash.Final(&hash1, &hash2);
+
+    return Util::encodeId(hash1, 16) + Util::encodeId(hash2, 16);
+}
+
+bool ConvertCache::lookup(const std::string& key, Result& result)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(key);
+    if (it != _entries.end() && it->second._expiry <= now)
+    {
+        LOG_TRC("ConvertCache entry [" << key << "] has expired");
+        removeEntry(it);
+        it = _entries.end();
+    }
+
+    if (it == _entries.end())
+    {
+        ++_misses;
+        return false;
+    }
+
+    Entry& entry = it->second;
+    if (entry._data)
+    {
+        result._owner = entry._data;
+        result._data = entry._data->data();
+    }
+    else
+    {
+        result._owner = mapFile(entry._path, entry._size, result._data);
+        if (!result._owner)
+        {
+            LOG_WRN("Failed to map cached result [" << entry._path << "]: " << strerror(errno));
+            removeEntry(it);
+            ++_misses;
+            return false;
+        }
+    }
+
+    result._size = entry._size;
+    result._contentType = entry._contentType;
+
+    _lru.splice(_lru.begin(), _lru, entry._lruIt);
+    ++_hits;
+    return true;
+}
+
+bool ConvertCache::sendCached(const std::string& key, const std::shared_ptr<StreamSocket>& socket,
+                              const std::string& fileName)
+{
+    Result result;
+    if (!lookup(key, result))
+        return false;
+
+    LOG_DBG("Sending cached conversion result [" << key << "] of " << result._size << " bytes");
+
+    http::Response response(http::StatusCode::OK);
+    if (!fileName.empty())
+        response.set("Content-Disposition", "attachment; filename=\"" + fileName + '"');
+    response.set("Last-Modified", Util::getHttpTimeNow());
+    response.set("X-Content-Type-Options", "nosniff");
+    response.set("Connection", "close");
+    response.setContentType(result._contentType);
+    response.setContentLength(result._size);
+    if (!socket->send(response))
+        return true;
+
+    // Referenced, not copied, by the socket until written.
+    socket->getOutBuffer().append(result._owner, result._data, result._size);
+    socket->flush();
+    socket->shutdown();
+    return true;
+}
+
+void ConvertCache::addFile(const std::string& key, const std::string& path,
+                           const std::string& contentType)
+{
+    // Only ever cache regular files, not what a symlink in the jail points to.
+    const FileUtil::Stat srcSt(path, /*link=*/true);
+    if (srcSt.bad() || !srcSt.isFile() || srcSt.size() > _maxDiskBytes)
+        return;
+
+    // Always copy: a hard-link would share the inode with the jail, which the
+    // Kit could still modify, and so poison what we serve to other requests.
+    // Don't hold the lock while copying, and replace any existing file atomically.
+    const std::string tmpPath = getPath(key) + ".tmp" + Util::rng::getHexString(8);
+    if (!FileUtil::copy(path, tmpPath, /*log=*/false, /*throw_on_error=*/false))
+    {
+        LOG_WRN("Failed to cache conversion result [" << path << ']');
+        FileUtil::removeFile(tmpPath);
+        return;
+    }
+
+    // The size of what we did copy, in case the source changed since.
+    const FileUtil::Stat st(tmpPath);
+    if (st.bad() || st.size() > _maxDiskBytes)
+    {
+        FileUtil::removeFile(tmpPath);
+        return;
+    }
+
+    std::shared_ptr<const std::string> data;
+    if (st.size() <= _maxMemoryEntryBytes)
+    {
+        std::unique_ptr<std::vector<char>> contents =
+            FileUtil::readFile(tmpPath, _maxMemoryEntryBytes);
+        if (contents)
+            data = std::make_shared<const std::string>(contents->begin(), contents->end());
+    }
+
+    addEntry(key, tmpPath, st.size(), std::move(data), contentType);
+}
+
+void ConvertCache::addData(const std::string& key, const std::string& data,
+                           const std::string& contentType)
+{
+    if (data.size() > _maxDiskBytes)
+        return;
+
+    const std::string tmpPath = getPath(key) + ".tmp" + Util::rng::getHexString(8);
+    std::ofstream file(tmpPath, std::ios::binary);
+    file.write(data.data(), data.size());
+    file.close();
+    if (!file)
+    {
+        LOG_WRN("Failed to cache conversion result [" << key << ']');
+        FileUtil::removeFile(tmpPath);
+        return;
+    }
+
+    std::shared_ptr<const std::string> copy;
+    if (data.size() <= _maxMemoryEntryBytes)
+        copy = std::make_shared<const std::string>(data);
+
+    addEntry(key, tmpPath, data.size(), std::move(copy), contentType);
+}
+
+void ConvertCache::addEntry(const std::string& key, const std::string& path, std::size_t size,
+                            std::shared_ptr<const std::string> data,
+                            const std::string& contentType)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto existing = _entries.find(key);
+    if (existing != _entries.end())
+        removeEntry(existing);
+
+    const std::string entryPath = getPath(key);
+    if (::rename(path.c_str(), entryPath.c_str()) != 0)
+    {
+        LOG_WRN("Failed to rename [" << path << "] to [" << entryPath << "]: " << strerror(errno));
+        FileUtil::removeFile(path);
+        return;
+    }
+
+    _lru.push_front(key);
+
+    Entry& entry = _entries[key];
+    entry._path = entryPath;
+    entry._contentType = contentType;
+    entry._size = size;
+    entry._data = std::move(data);
+    entry._expiry = now + _ttl;
+    entry._lruIt = _lru.begin();
+
+    _diskBytes += size;
+    if (entry._data)
+        _memoryBytes += size;
+
+    LOG_DBG("ConvertCache added [" << key << "] of " << size << " bytes"
+                                   << (entry._data ? " (in memory)" : "") << ", have "
+                                   << _entries.size() << " entries of " << _diskBytes << " bytes");
+
+    trim(now);
+}
+
+void ConvertCache::removeEntry(std::unordered_map<std::string, Entry>::iterator it)
+{
+    Entry& entry = it->second;
+
+    _diskBytes -= entry._size;
+    if (entry._data)
+        _memoryBytes -= entry._size;
+
+    FileUtil::removeFile(entry._path);
+    _lru.erase(entry._lruIt);
+    _entries.erase(it);
+}
+
+void ConvertCache::trim(std::chrono::steady_clock::time_point now)
+{
+    for (auto it = _entries.begin(); it != _entries.end();)
+    {
+        if (it->second._expiry <= now)
+        {
+            auto expired = it++;
+            removeEntry(expired);
+        }
+        else
+            ++it;
+    }
+
+    while (_diskBytes > _maxDiskBytes && !_lru.empty())
+    {
+        LOG_TRC("ConvertCache evicting [" << _lru.back() << ']');
+        removeEntry(_entries.find(_lru.back()));
+        ++_evictions;
+    }
+
+    // Keep only the most recently used results in memory, the rest are still on disk.
+    for (auto it = _lru.rbegin(); _memoryBytes > _maxMemoryBytes && it != _lru.rend(); ++it)
+    {
+        Entry& entry = _entries.find(*it)->second;
+        if (entry._data)
+        {
+            entry._data.reset();
+            _memoryBytes -= entry._size;
+        }
+    }
+}
+
+std::size_t ConvertCache::getHitCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+}
+
+std::size_t ConvertCache::getMissCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+}
+
+void ConvertCache::getMetrics(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    os << "convert_cache_hit_count " << _hits << '\n';
+    os << "convert_cache_miss_count " << _misses << '\n';
+    os << "convert_cache_eviction_count " << _evictions << '\n';
+    os << "convert_cache_entry_count " << _entries.size() << '\n';
+    os << "convert_cache_disk_bytes " << _diskBytes << '\n';
+    os << "convert_cache_memory_bytes " << _memoryBytes << '\n';
+}
+
+void ConvertCache::dumpState(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    os << "\n  ConvertCache:"
+       << "\n    path: " << _path
+       << "\n    entries: " << _entries.size()
+       << "\n    disk bytes: " << _diskBytes << " of " << _maxDiskBytes
+       << "\n    memory bytes: " << _memoryBytes << " of " << _maxMemoryBytes
+       << "\n    hits: " << _hits
+       << "\n    misses: " << _misses
+       << "\n    evictions: " << _evictions
+       << '\n';
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class StreamSocket;
+
+/// Caches the results of convert-to, get-thumbnail and extract-link-targets
+/// requests, keyed by a hash of the input document and the request parameters,
+/// so integrations converting the same files over and over only pay once.
+/// Results are kept on disk, and the small ones in memory too.
+class ConvertCache
+{
+public:
+    /// A cached result, valid for as long as @_owner is held.
+    struct Result
+    {
+        std::shared_ptr<const void> _owner;
+        const char* _data = nullptr;
+        std::size_t _size = 0;
+        std::string _contentType;
+    };
+
+    /// Results are stored under @path, which is created if necessary and emptied.
+    /// @maxDiskBytes and @maxMemoryBytes bound the total size of the results on disk
+    /// and in memory, and results larger than @maxMemoryEntryBytes are only on disk.
+    ConvertCache(const std::string& path, std::size_t maxDiskBytes, std::size_t maxMemoryBytes,
+                 std::size_t maxMemoryEntryBytes, std::chrono::seconds ttl);
+    ~ConvertCache();
+
+    /// Sets up the instance per the convert_cache config, under @path.
+    static void initialize(const std::string& path);
+
+    /// The instance, or nullptr when disabled.
+    static ConvertCache* get() { return Instance.get(); }
+
+    /// Hashes the contents and extension of the file at @inputPath with the request @params.
+    /// Returns an empty key if the file can't be read.
+    static std::string makeKey(const std::string& inputPath,
+                               const std::vector<std::string>& params);
+
+    /// Finds the unexpired result for @key, and counts the hit or miss.
+    bool lookup(const std::string& key, Result& result);
+
+    /// Sends the result for @key as the response on @socket and shuts it down.
+    /// The result is sent as an attachment named @fileName, unless empty.
+    /// Returns false, without sending anything, on a miss.
+    bool sendCached(const std::string& key, const std::shared_ptr<StreamSocket>& socket,
+                    const std::string& fileName);
+
+    /// Caches a copy of the converted file at @path.
+    void addFile(const std::string& key, const std::string& path, const std::string& contentType);
+
+    /// Caches the result @data.
+    void addData(const std::string& key, const std::string& data, const std::string& contentType);
+
+    std::size_t getHitCount() const;
+    std::size_t getMissCount() const;
+
+    void getMetrics(std::ostream& os) const;
+
+    void dumpState(std::ostream& os) const;
+
+private:
+    struct Entry
+    {
+        std::string _path;
+        std::string _contentType;
+        std::size_t _size;
+        /// The in-memory copy, if any.
+        std::shared_ptr<const std::string> _data;
+        std::chrono::steady_clock::time_point _expiry;
+        /// Our position in _lru.
+        std::list<std::string>::iterator _lruIt;
+    };
+
+    /// Adds an entry for the file just stored at @path.
+    void addEntry(const std::string& key, const std::string& path, std::size_t size,
+                  std::shared_ptr<const std::string> data, const std::string& contentType);
+
+    /// Removes the entry @it points to. Expects _mutex to be held.
+    void removeEntry(std::unordered_map<std::string, Entry>::iterator it);
+
+    /// Removes expired entries, and least recently used ones until we are within
+    /// our limits. Expects _mutex to be held.
+    void trim(std::chrono::steady_clock::time_point now);
+
+    std::string getPath(const std::string& key) const { return _path + key; }
+
+private:
+    static std::unique_ptr<ConvertCache> Instance;
+
+    const std::string _path;
+    const std::size_t _maxDiskBytes;
+    const std::size_t _maxMemoryBytes;
+    const std::size_t _maxMemoryEntryBytes;
+    const std::chrono::seconds _ttl;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, Entry> _entries;
+    /// Keys, most recently used first.
+    std::list<std::string> _lru;
+    std::size_t _diskBytes;
+    std::size_t _memoryBytes;
+    std::size_t _hits;
+    std::size_t _misses;
+    std::size_t _evictions;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -91,6 +91,7 @@ void ChildProcess::setDocumentBroker(const std::shared_ptr<DocumentBroker>& docB
 {
     assert(docBroker && "Invalid DocumentBroker instance.");
     _docBroker = docBroker;
+    ++_documentCount;
 
     // Add the prisoner socket to the docBroker poll.
     docBroker->addSocketToPoll(getSocket());
@@ -155,6 +156,7 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
     , _docId(Util::encodeId(DocBrokerId++, 3))
     , _documentChangedInStorage(false)
     , _isViewFileExtension(false)
+    , _childRecycled(false)
     , _saveManager(std::chrono::seconds(std::getenv("COOL_NO_AUTOSAVE") != nullptr
                                             ? 0
                                             : COOLWSD::getConfigValueNonZero<int>(
@@ -180,8 +182,12 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
     , _debugRenderedTileCount(0)
     , _loadDuration(0)
     , _wopiDownloadDuration(0)
+    , _jailDuration(0)
+    , _kitLoadDuration(0)
     , _mobileAppDocId(mobileAppDocId)
     , _alwaysSaveOnExit(COOLWSD::getConfigValue<bool>("per_document.always_save_on_exit", false))
+    , _backgroundAutosave(COOLWSD::getConfigValue<bool>("per_document.background_autosave", false))
+    , _lastSaveInBackground(false)
 #if !MOBILEAPP
     , _admin(Admin::instance())
 #endif
@@ -199,7 +205,8 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
 
     LOG_INF("DocumentBroker [" << COOLWSD::anonymizeUrl(_uriPublic.toString())
                                << "] created with docKey [" << _docKey
-                               << "], always_save_on_exit: " << _alwaysSaveOnExit);
+                               << "], always_save_on_exit: " << _alwaysSaveOnExit
+                               << ", background_autosave: " << _backgroundAutosave);
 
     if (_unitWsd)
     {
@@ -251,20 +258,39 @@ void DocumentBroker::pollThread()
 
     LOG_INF("Starting docBroker polling thread for docKey [" << _docKey << ']');
 
+#if !MOBILEAPP
+    // Conversions can reuse the Kit of a previous one.
+    if (_type == ChildType::Batch && ConverterPool::isEnabled())
+        _childProcess = ConverterPool::take();
+#endif
+
     // Request a kit process for this doc.
-    do
-    {
-        static constexpr std::chrono::milliseconds timeoutMs(COMMAND_TIMEOUT_MS * 5);
-        _childProcess = getNewChild_Blocks(_mobileAppDocId);
-        if (_childProcess
-            || std::chrono::duration_cast<std::chrono::milliseconds>(
-                   std::chrono::steady_clock::now() - _threadStart)
-                   > timeoutMs)
-            break;
+    {
+        ProfileZone profileZone("DocumentBroker::getNewChild", { { "docKey", _docKey } });
+
+        if (!_childProcess)
+            noteNewChildRequest();
+
+        while (!_childProcess)
+        {
+            static constexpr std::chrono::milliseconds timeoutMs(COMMAND_TIMEOUT_MS * 5);
+            _childProcess = getNewChild_Blocks(_mobileAppDocId);
+            if (_childProcess
+                || std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - _threadStart)
+                       > timeoutMs)
+                break;
+
+            // Nominal time between retries, lest we busy-loop. getNewChild could also wait, so don't double that here.
+            std::this_thread::sleep_for(std::chrono::milliseconds(CHILD_REBALANCE_INTERVAL_MS / 10));
+
+            if (_stop || !_poll->continuePolling() || SigUtil::getShutdownRequestFlag())
+                break;
+        }
+    }
 
-        // Nominal time between retries, lest we busy-loop. getNewChild could also wait, so don't double that here.
-        std::this_thread::sleep_for(std::chrono::milliseconds(CHILD_REBALANCE_INTERVAL_MS / 10));
-    } while (!_stop && _poll->continuePolling() && !SigUtil::getShutdownRequestFlag());
+    _jailDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - _threadStart);
 
     if (!_childProcess)
     {
@@ -426,6 +452,17 @@ void DocumentBroker::pollThread()
 
             // send change since last notification.
             _admin.addBytes(getDocKey(), deltaSent, deltaRecv);
+
+            // And how the sessions that compress their messages fare.
+            for (const auto& sessionIt : _sessions)
+            {
+                uint64_t raw = 0, compressed = 0;
+                std::chrono::microseconds time;
+                sessionIt.second->getCompressionStats(raw, compressed, time);
+                if (raw > 0)
+                    _admin.setViewCompressionStats(getDocKey(), sessionIt.second->getId(), raw,
+                                                   compressed, time);
+            }
         }
 
         if (_storage && _lockCtx->needsRefresh(now))
@@ -574,7 +611,17 @@ void DocumentBroker::pollThread()
             << ", ShutdownRequestFlag: " << SigUtil::getShutdownRequestFlag()
             << ", TerminationFlag: " << SigUtil::getTerminationFlag());
 
-    if (_childProcess && _sessions.empty())
+#if !MOBILEAPP
+    // A Kit that finished a conversion cleanly can serve the next one.
+    const bool recycleChild = _childProcess && _type == ChildType::Batch && isLoaded() &&
+                              _docState.disconnected() == DocumentState::Disconnected::No &&
+                              ConverterPool::isEnabled() &&
+                              ConverterPool::canRecycle(_childProcess);
+#else
+    constexpr bool recycleChild = false;
+#endif
+
+    if (_childProcess && _sessions.empty() && !recycleChild)
     {
         LOG_INF("Requesting termination of child [" << getPid() << "] for doc [" << _docKey
                                                     << "] as there are no sessions");
@@ -649,9 +696,41 @@ void DocumentBroker::pollThread()
         LOG_INF("Finished flushing socket for doc [" << _docKey << ']');
     }
 
-    // Terminate properly while we can.
-    LOG_DBG("Terminating child with reason: [" << _closeReason << ']');
-    terminateChild(_closeReason);
+#if !MOBILEAPP
+    if (recycleChild)
+    {
+        // Disconnecting the last session unloads the document in the Kit, but only once the
+        // Kit gets to it: until it tells us so, it could still serve the document to the next.
+        LOG_DBG("Recycling child [" << getPid() << "] with reason: [" << _closeReason << ']');
+        shutdownClients(_closeReason);
+
+        constexpr auto recycleTimeout = std::chrono::seconds(5);
+        const auto recycleStartTime = std::chrono::steady_clock::now();
+        while (!_childRecycled && _childProcess->isAlive() &&
+               std::chrono::steady_clock::now() - recycleStartTime < recycleTimeout)
+        {
+            _poll->poll(std::chrono::microseconds(POLL_TIMEOUT_MICRO_S / 5));
+        }
+
+        if (!_childRecycled)
+            LOG_WRN("Child [" << getPid() << "] didn't recycle in time, terminating it");
+    }
+
+    if (recycleChild && _childRecycled)
+    {
+        // The Kit's sockets must leave our poll before anyone else polls them.
+        _poll->removeSockets();
+        ConverterPool::add(_childProcess);
+        _childProcess.reset();
+        stop(_closeReason);
+    }
+    else
+#endif
+    {
+        // Terminate properly while we can.
+        LOG_DBG("Terminating child with reason: [" << _closeReason << ']');
+        terminateChild(_closeReason);
+    }
 
     // Stop to mark it done and cleanup.
     _poll->stop();
@@ -1088,9 +1167,31 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session,
     if (!_storage->isDownloaded())
     {
         LOG_DBG("Download file for docKey [" << _docKey << ']');
+
+        // Show the progress of large downloads. We don't poll the client socket
+        // meanwhile, so each value is written out directly, not queued.
+        std::weak_ptr<ClientSession> weakSession = session;
+        int lastPercent = -1;
+        _storage->setDownloadProgressCallback(
+            [weakSession, lastPercent](int64_t received, int64_t total) mutable
+            {
+                if (total <= 0)
+                    return;
+
+                const int percent = static_cast<int>(std::min<int64_t>(100, received * 100 / total));
+                if (percent == lastPercent)
+                    return;
+
+                lastPercent = percent;
+                if (std::shared_ptr<ClientSession> downloadingSession = weakSession.lock())
+                    downloadingSession->sendTextFrameNow("statusindicatorsetvalue: " +
+                                                         std::to_string(percent));
+            });
+
         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         std::string localPath = _storage->downloadStorageFileToLocal(session->getAuthorization(),
                                                                      *_lockCtx, templateSource);
+        _storage->setDownloadProgressCallback(nullptr);
         if (localPath.empty())
         {
             throw std::runtime_error("Failed to retrieve document from storage");
@@ -1184,13 +1285,17 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session,
 #endif
 
         const std::string localFilePath = Poco::Path(getJailRoot(), localPath).toString();
-        std::ifstream istr(localFilePath, std::ios::binary);
-        Poco::SHA1Engine sha1;
-        Poco::DigestOutputStream dos(sha1);
-        Poco::StreamCopier::copyStream(istr, dos);
-        dos.close();
-        LOG_INF("SHA1 for DocKey [" << _docKey << "] of [" << COOLWSD::anonymizeUrl(localPath) << "]: " <<
-                Poco::DigestEngine::digestToHex(sha1.digest()));
+        if (Log::infoEnabled())
+        {
+            // Reading the whole document again is costly, only do it to log.
+            std::ifstream istr(localFilePath, std::ios::binary);
+            Poco::SHA1Engine sha1;
+            Poco::DigestOutputStream dos(sha1);
+            Poco::StreamCopier::copyStream(istr, dos);
+            dos.close();
+            LOG_INF("SHA1 for DocKey [" << _docKey << "] of [" << COOLWSD::anonymizeUrl(localPath) << "]: " <<
+                    Poco::DigestEngine::digestToHex(sha1.digest()));
+        }
 
         std::string localPathEncoded;
         Poco::URI::encode(localPath, "#?", localPathEncoded);
@@ -1227,6 +1332,9 @@ bool DocumentBroker::download(const std::shared_ptr<ClientSession>& session,
         _tileCache = std::make_unique<TileCache>(_storage->getUri().toString(),
                                                  _saveManager.getLastModifiedTime(), dontUseCache);
         _tileCache->setThreadOwner(std::this_thread::get_id());
+
+        // The Kit takes it from here.
+        _kitLoadStart = std::chrono::steady_clock::now();
     }
 
 #if !MOBILEAPP
@@ -2195,6 +2303,23 @@ void DocumentBroker::setLoaded()
             std::max(std::chrono::seconds(minTimeoutSecs), std::chrono::seconds(5)));
         LOG_DBG("Document loaded in " << _loadDuration << ", saving-timeout set to "
                                       << _saveManager.getSavingTimeout());
+
+        if (_kitLoadStart != std::chrono::steady_clock::time_point())
+            _kitLoadDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - _kitLoadStart);
+
+        LOG_INF("Document [" << _docKey << "] load phases: jail " << _jailDuration
+                             << ", download " << _wopiDownloadDuration << ", load "
+                             << _kitLoadDuration);
+
+        TraceEvent::emitInstantEvent("DocumentBroker::loaded",
+                                     { { "jail_ms", std::to_string(_jailDuration.count()) },
+                                       { "download_ms",
+                                         std::to_string(_wopiDownloadDuration.count()) },
+                                       { "load_ms", std::to_string(_kitLoadDuration.count()) } });
+#if !MOBILEAPP
+        _admin.setDocLoadPhaseDurations(_docKey, _jailDuration, _kitLoadDuration);
+#endif
     }
 }
 
@@ -2378,6 +2503,15 @@ bool DocumentBroker::autoSave(const bool force, const bool dontSaveIfUnmodified)
     }
     else if (isModified())
     {
+        if (_lastSaveInBackground && _saveManager.lastSaveSuccessful() &&
+            !haveModifyActivityAfterSaveRequest())
+        {
+            // Only the forked snapshot of the Kit had saved, so Core still
+            // flags the document as modified. But there is nothing new to save.
+            LOG_TRC("DocKey [" << _docKey << "] has no modifications since the background save");
+            return false;
+        }
+
         const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
         const std::chrono::milliseconds inactivityTime
             = std::chrono::duration_cast<std::chrono::milliseconds>(now - _lastActivityTime);
@@ -2621,9 +2755,14 @@ bool DocumentBroker::sendUnoSave(const std::shared_ptr<ClientSession>& session,
 
     const std::string saveArgs = oss.str();
     LOG_TRC(".uno:Save arguments: " << saveArgs);
-    const auto command = "uno .uno:Save " + saveArgs;
+
+    // Timed autosaves can be done by the Kit in a forked snapshot of the document, so
+    // editing isn't blocked. The result comes back as any .uno:Save's, in unocommandresult.
+    const bool inBackground = isAutosave && _backgroundAutosave;
+    const auto command = (inBackground ? "backgroundsave " : "uno .uno:Save ") + saveArgs;
     if (forwardToChild(session, command))
     {
+        _lastSaveInBackground = inBackground;
         _saveManager.markLastSaveRequestTime();
         if (_docState.activity() == DocumentState::Activity::None)
         {
@@ -2703,7 +2842,12 @@ DocumentBroker::addSessionInternal(const std::shared_ptr<ClientSession>& session
     const std::string id = session->getId();
 
     // Request a new session from the child kit.
-    const std::string aMessage = "session " + id + ' ' + _docKey + ' ' + _docId;
+    std::string aMessage = "session " + id + ' ' + _docKey + ' ' + _docId;
+#if !MOBILEAPP
+    // Keep the Kit alive after the conversion, in case we recycle it.
+    if (_type == ChildType::Batch && ConverterPool::isEnabled())
+        aMessage += " recycle";
+#endif
     _childProcess->sendTextFrame(aMessage);
 
 #if !MOBILEAPP
@@ -3122,6 +3266,17 @@ bool DocumentBroker::handleInput(const std::shared_ptr<Message>& message)
 
             _registeredDownloadLinks[downloadid] = url;
         }
+        else if (message->firstTokenMatches("droptiles"))
+        {
+            // The Kit changed how it encodes tiles, so the cached ones are of no use.
+            if (_tileCache)
+                _tileCache->clear();
+        }
+        else if (message->firstTokenMatches("recycled"))
+        {
+            LOG_DBG("Child [" << getPid() << "] unloaded the document, ready for the next");
+            _childRecycled = true;
+        }
         else if (message->firstTokenMatches("traceevent:"))
         {
             LOG_CHECK_RET(message->tokens().size() == 1, false);
@@ -3188,7 +3343,13 @@ void DocumentBroker::handleTileRequest(const StringVector &tokens, bool forceKey
     }
 
     Tile cachedTile = _tileCache->lookupTile(tile);
-    if (cachedTile && cachedTile->isValid())
+    if (forceKeyframe && cachedTile && cachedTile->hasNeighbourDeltas())
+    {
+        LOG_TRC("rendering a keyframe for a tile with neighbour deltas");
+        cachedTile->invalidate();
+        tile.forceKeyframe();
+    }
+    else if (cachedTile && cachedTile->isValid())
     {
         session->sendTileNow(tile, cachedTile);
         return;
@@ -3241,7 +3402,8 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined, bool
         tile.setVersion(++_tileVersion);
 
         // client can force keyframe with an oldWid == 0 on tile
-        if (forceKeyframe && tile.getOldWireId() == 0)
+        const bool startOver = forceKeyframe && tile.getOldWireId() == 0;
+        if (startOver)
         {
             // combinedtiles requests direct from the browser get flagged.
             // The browser may have dropped / cleaned its cache, so we can't
@@ -3255,6 +3417,15 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined, bool
         }
 
         Tile cachedTile = _tileCache->lookupTile(tile);
+        if (startOver && cachedTile && cachedTile->hasNeighbourDeltas())
+        {
+            // The client can't apply those deltas without the neighbours
+            // they were made against, so replace them with a keyframe.
+            LOG_TRC("rendering a keyframe for a tile with neighbour deltas");
+            cachedTile->invalidate();
+            tile.forceKeyframe();
+        }
+
         if(!cachedTile || !cachedTile->isValid())
         {
             if (!cachedTile)
@@ -3526,7 +3697,7 @@ void DocumentBroker::sendRequestedTiles(const std::shared_ptr<ClientSession>& se
 
 void DocumentBroker::handleTileResponse(const std::shared_ptr<Message>& message)
 {
-    const std::string firstLine = message->firstLine();
+    const std::string& firstLine = message->firstLine();
     LOG_DBG("Handling tile: " << firstLine);
 
     try
@@ -3556,7 +3727,7 @@ void DocumentBroker::handleTileResponse(const std::shared_ptr<Message>& message)
 
 void DocumentBroker::handleTileCombinedResponse(const std::shared_ptr<Message>& message)
 {
-    const std::string firstLine = message->firstLine();
+    const std::string& firstLine = message->firstLine();
     LOG_DBG("Handling tile combined: " << firstLine);
 
     try
@@ -3565,6 +3736,8 @@ void DocumentBroker::handleTileCombinedResponse(const std::shared_ptr<Message>&
         if (firstLine.size() <= static_cast<std::string::size_type>(length) - 1)
         {
             const TileCombined tileCombined = TileCombined::parse(firstLine);
+
+            // The tiles are cached straight from the payload taken over from the Kit.
             const char* buffer = message->data().data();
             std::size_t offset = firstLine.size() + 1;
 
@@ -3905,13 +4078,107 @@ void StatelessBatchBroker::removeFile(const std::string &uriOrig)
         FileUtil::removeFile(dir);
 }
 
+std::mutex ConverterPool::Mutex;
+std::vector<std::shared_ptr<ChildProcess>> ConverterPool::IdleChildren;
+std::atomic<std::size_t> ConverterPool::ReuseCount;
+
+bool ConverterPool::isEnabled()
+{
+    static const bool enabled =
+        COOLWSD::getConfigValue<bool>("per_document.converter_pool[@enable]", false);
+    return enabled;
+}
+
+std::shared_ptr<ChildProcess> ConverterPool::take()
+{
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    while (!IdleChildren.empty())
+    {
+        std::shared_ptr<ChildProcess> child = std::move(IdleChildren.back());
+        IdleChildren.pop_back();
+        if (child->isAlive())
+        {
+            ++ReuseCount;
+            LOG_DBG("ConverterPool: reusing child [" << child->getPid() << "] for its document #"
+                                                     << child->getDocumentCount() + 1 << ", "
+                                                     << IdleChildren.size() << " left idle");
+            return child;
+        }
+
+        LOG_WRN("ConverterPool: dropping dead child [" << child->getPid() << ']');
+    }
+
+    return nullptr;
+}
+
+bool ConverterPool::canRecycle(const std::shared_ptr<ChildProcess>& child)
+{
+    static const std::size_t maxIdle =
+        COOLWSD::getConfigValue<int>("per_document.converter_pool.max_idle", 4);
+    static const unsigned maxDocuments =
+        COOLWSD::getConfigValue<int>("per_document.converter_pool.max_documents", 100);
+    static const std::size_t maxRssKb =
+        COOLWSD::getConfigValue<int>("per_document.converter_pool.max_rss_mb", 1024) * 1024;
+
+    if (!child->isAlive())
+        return false;
+
+    if (maxDocuments > 0 && child->getDocumentCount() >= maxDocuments)
+    {
+        LOG_DBG("ConverterPool: retiring child [" << child->getPid() << "] after "
+                                                  << child->getDocumentCount() << " documents");
+        return false;
+    }
+
+    const std::size_t rssKb = Util::getMemoryUsageRSS(child->getPid());
+    if (maxRssKb > 0 && rssKb > maxRssKb)
+    {
+        LOG_DBG("ConverterPool: retiring child [" << child->getPid() << "] with RSS of "
+                                                  << rssKb << " KB");
+        return false;
+    }
+
+    return getIdleCount() < maxIdle;
+}
+
+void ConverterPool::add(const std::shared_ptr<ChildProcess>& child)
+{
+    std::unique_lock<std::mutex> lock(Mutex);
+    IdleChildren.push_back(child);
+    LOG_DBG("ConverterPool: child [" << child->getPid() << "] is idle after "
+                                     << child->getDocumentCount() << " documents, have "
+                                     << IdleChildren.size() << " idle");
+}
+
+void ConverterPool::clear()
+{
+    std::unique_lock<std::mutex> lock(Mutex);
+    for (const auto& child : IdleChildren)
+        child->terminate();
+
+    IdleChildren.clear();
+}
+
+std::size_t ConverterPool::getIdleCount()
+{
+    std::unique_lock<std::mutex> lock(Mutex);
+    return IdleChildren.size();
+}
+
 static std::atomic<std::size_t> gConvertToBrokerInstanceCouter;
+static std::atomic<std::size_t> gConvertToBrokerCompletedCount;
 
 std::size_t ConvertToBroker::getInstanceCount()
 {
     return gConvertToBrokerInstanceCouter;
 }
 
+std::size_t ConvertToBroker::getCompletedCount()
+{
+    return gConvertToBrokerCompletedCount;
+}
+
 ConvertToBroker::ConvertToBroker(const std::string& uri,
                                  const Poco::URI& uriPublic,
                                  const std::string& docKey,
@@ -3948,6 +4215,7 @@ bool ConvertToBroker::startConversion(SocketDisposition &disposition, const std:
     RequestDetails requestDetails("convert-to");
     _clientSession = std::make_shared<ClientSession>(nullPtr, id, docBroker, getPublicUri(), isReadOnly, requestDetails);
     _clientSession->construct();
+    _clientSession->setConvertCacheKey(_cacheKey);
 
     docBroker->setupTransfer(disposition, [docBroker] (const std::shared_ptr<Socket> &moveSocket)
         {
@@ -4001,6 +4269,9 @@ void ConvertToBroker::dispose()
 {
     if (!_uriOrig.empty())
     {
+        if (isLoaded())
+            ++gConvertToBrokerCompletedCount;
+
         gConvertToBrokerInstanceCouter--;
         removeFile(_uriOrig);
         _uriOrig.clear();
@@ -4171,7 +4442,8 @@ void DocumentBroker::dumpState(std::ostream& os)
     else
         os << " has live sessions";
     if (isLoaded())
-        os << "\n  loaded in: " << _loadDuration;
+        os << "\n  loaded in: " << _loadDuration << " (jail: " << _jailDuration
+           << ", download: " << _wopiDownloadDuration << ", load: " << _kitLoadDuration << ')';
     else
         os << "\n  still loading... "
            << std::chrono::duration_cast<std::chrono::seconds>(now - _threadStart);
@@ -20,6 +20,7 @@
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <Poco/URI.h>
 
@@ -85,6 +86,7 @@ public:
                     std::make_shared<WebSocketHandler>(socket, request))
         , _jailId(jailId)
         , _smapsFD(-1)
+        , _documentCount(0)
     {
         int urpFromKitFD = socket->getIncomingFD(URPFromKit);
         int urpToKitFD = socket->getIncomingFD(URPToKit);
@@ -131,13 +133,52 @@ public:
     void setSMapsFD(int smapsFD) { _smapsFD = smapsFD;}
     int getSMapsFD(){ return _smapsFD; }
 
+    /// The number of documents this process was given, more than one when recycled.
+    unsigned getDocumentCount() const { return _documentCount; }
+
 private:
     const std::string _jailId;
     std::weak_ptr<DocumentBroker> _docBroker;
     std::shared_ptr<StreamSocket> _urpFromKit;
     std::shared_ptr<StreamSocket> _urpToKit;
     int _smapsFD;
+    unsigned _documentCount;
+};
+
+#if !MOBILEAPP
+/// Keeps the Kit processes that finished a conversion (convert-to, thumbnails,
+/// link targets, etc.) to reuse them for the following ones, saving the
+/// process and jail setup for each conversion. Thread-safe.
+class ConverterPool
+{
+public:
+    /// True iff per_document.converter_pool is enabled.
+    static bool isEnabled();
+
+    /// Returns a live idle converter, if we have any.
+    static std::shared_ptr<ChildProcess> take();
+
+    /// True if @child is healthy and within the limits to take another
+    /// conversion, and there is room for it in the pool.
+    static bool canRecycle(const std::shared_ptr<ChildProcess>& child);
+
+    /// Adds the recycled @child, which mustn't be polled by anyone, to the idle ones.
+    static void add(const std::shared_ptr<ChildProcess>& child);
+
+    /// Terminates all idle converters.
+    static void clear();
+
+    static std::size_t getIdleCount();
+
+    /// The number of conversions served by recycled converters.
+    static std::size_t getReuseCount() { return ReuseCount; }
+
+private:
+    static std::mutex Mutex;
+    static std::vector<std::shared_ptr<ChildProcess>> IdleChildren;
+    static std::atomic<std::size_t> ReuseCount;
 };
+#endif // !MOBILEAPP
 
 class RequestDetails;
 class ClientSession;
@@ -324,11 +365,13 @@ public:
         const bool isReadOnly,
         const RequestDetails &requestDetails);
 
-    /// Find or create a new client session for the PHP proxy
+    /// Find or create a new client session for the PHP proxy,
+    /// which frames our messages in binary if @binaryFraming.
     void handleProxyRequest(
         const std::string& id,
         const Poco::URI& uriPublic,
         const bool isReadOnly,
+        const bool binaryFraming,
         const RequestDetails &requestDetails,
         const std::shared_ptr<StreamSocket> &socket);
 
@@ -1502,6 +1545,9 @@ private:
     /// These files, such as PDF, don't have a reliable ModifiedStatus.
     bool _isViewFileExtension;
 
+    /// True once the Kit told us that it unloaded our document, to take the next one.
+    bool _childRecycled;
+
     /// Manage saving in Core.
     SaveManager _saveManager;
 
@@ -1566,6 +1612,12 @@ private:
     std::chrono::milliseconds _loadDuration;
     std::chrono::milliseconds _wopiDownloadDuration;
 
+    /// The phases of loading, besides the download: getting a Kit in
+    /// its jail, and the Kit loading the document once downloaded.
+    std::chrono::milliseconds _jailDuration;
+    std::chrono::milliseconds _kitLoadDuration;
+    std::chrono::steady_clock::time_point _kitLoadStart;
+
     /// Unique DocBroker ID for tracing and debugging.
     static std::atomic<unsigned> DocBrokerId;
 
@@ -1581,6 +1633,12 @@ private:
     /// True iff the config per_document.always_save_on_exit is true.
     const bool _alwaysSaveOnExit;
 
+    /// True iff the config per_document.background_autosave is true.
+    const bool _backgroundAutosave;
+
+    /// True if the last save request was done in the background by the Kit.
+    bool _lastSaveInBackground;
+
 #if !MOBILEAPP
     Admin& _admin;
 #endif
@@ -1617,6 +1675,8 @@ class ConvertToBroker : public StatelessBatchBroker
     const std::string _format;
     const std::string _sOptions;
     const std::string _lang;
+    /// The ConvertCache key for our result, if we are to cache it.
+    std::string _cacheKey;
 
 public:
     /// Construct DocumentBroker with URI and docKey
@@ -1631,6 +1691,8 @@ public:
     /// _lang accessors
     const std::string& getLang() { return _lang; }
 
+    void setCacheKey(const std::string& cacheKey) { _cacheKey = cacheKey; }
+
     /// Move socket to this broker for response & do conversion
     bool startConversion(SocketDisposition &disposition, const std::string &id);
 
@@ -1643,6 +1705,9 @@ public:
     /// How many live conversions are running.
     static std::size_t getInstanceCount();
 
+    /// How many conversions have loaded their document since we started.
+    static std::size_t getCompletedCount();
+
 protected:
     bool isConvertTo() const override { return true; }
 
@@ -0,0 +1,318 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "PrespawnController.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <sstream>
+
+#include "COOLWSD.hpp"
+#include <common/Log.hpp>
+
+namespace
+{
+/// How quickly the recent load rate forgets older loads.
+constexpr std::chrono::seconds RateTimeConstant(60);
+
+/// How much each day's measurement of a time-of-day slot counts.
+constexpr double DailyRateWeight = 0.3;
+
+/// How much each new fork latency sample counts.
+constexpr double ForkLatencyWeight = 0.2;
+
+/// Assumed until forkit has spawned a kit for us.
+constexpr std::chrono::seconds DefaultForkLatency(1);
+
+/// Don't retire spare kits faster than this.
+constexpr std::chrono::seconds RetireInterval(60);
+
+/// More outstanding forks than this must have been lost.
+constexpr std::size_t MaxForkRequests = 256;
+
+double toSeconds(PrespawnController::Clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+}
+} // namespace
+
+constexpr std::chrono::minutes PrespawnController::SlotDuration;
+constexpr std::size_t PrespawnController::SlotCount;
+
+std::unique_ptr<PrespawnController> PrespawnController::Instance;
+
+PrespawnController::PrespawnController(unsigned minChildren, unsigned maxChildren,
+                                       double coldStartProbability, std::size_t spareKitMemoryKb,
+                                       Clock::time_point start, std::chrono::seconds dayOffset)
+    : _minChildren(minChildren)
+    , _maxChildren(std::max(minChildren, maxChildren))
+    , _coldStartProbability(coldStartProbability)
+    , _spareKitMemoryKb(spareKitMemoryKb)
+    , _start(start)
+    , _dayOffset(dayOffset)
+    , _rate(0)
+    , _lastUpdate(start)
+    , _slot(getSlot(start))
+    , _slotStart(start - dayOffset % SlotDuration)
+    , _slotLoads(0)
+    , _forkLatency(DefaultForkLatency)
+    , _haveForkLatency(false)
+    , _memoryHeadroomKb(std::numeric_limits<std::size_t>::max())
+    , _lastRetire(start)
+    , _requests(0)
+    , _coldStarts(0)
+    , _retired(0)
+    , _lastTarget(minChildren)
+    , _lastSpareCount(0)
+{
+    _dailyRate.fill(-1);
+}
+
+void PrespawnController::initialize(unsigned minChildren)
+{
+    if (!COOLWSD::getConfigValue<bool>("prespawn_pool[@enable]", false))
+    {
+        Instance.reset();
+        return;
+    }
+
+    const unsigned maxChildren =
+        COOLWSD::getConfigValue<unsigned>("prespawn_pool.max_children", 10);
+    const double coldStartProbability =
+        COOLWSD::getConfigValue<double>("prespawn_pool.cold_start_probability", 0.05);
+    const std::size_t spareKitMemoryKb =
+        COOLWSD::getConfigValue<unsigned>("prespawn_pool.spare_child_memory_mb", 50) * 1024;
+
+    // Time of day, to learn the daily load pattern.
+    const std::time_t now = std::time(nullptr);
+    std::tm local;
+    localtime_r(&now, &local);
+    const std::chrono::seconds dayOffset(local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec);
+
+    Instance = std::make_unique<PrespawnController>(
+        minChildren, maxChildren, std::clamp(coldStartProbability, 0.001, 1.0), spareKitMemoryKb,
+        Clock::now(), dayOffset);
+
+    LOG_INF("Adaptive prespawn pool enabled with " << minChildren << " to " << maxChildren
+                                                   << " children, cold-start probability of "
+                                                   << coldStartProbability);
+}
+
+unsigned PrespawnController::poissonQuantile(double mean, double probability)
+{
+    if (mean <= 0)
+        return 0;
+
+    // Accumulate P(X <= n) until the tail beyond n is small enough.
+    constexpr unsigned MaxQuantile = 1000;
+    double pmf = std::exp(-mean);
+    double cdf = pmf;
+    unsigned n = 0;
+    while (1 - cdf > probability && n < MaxQuantile)
+    {
+        ++n;
+        pmf *= mean / n;
+        cdf += pmf;
+    }
+
+    return n;
+}
+
+std::size_t PrespawnController::getSlot(Clock::time_point now) const
+{
+    const auto sinceMidnight =
+        _dayOffset + std::chrono::duration_cast<std::chrono::seconds>(now - _start);
+    return (sinceMidnight / SlotDuration) % SlotCount;
+}
+
+void PrespawnController::update(Clock::time_point now)
+{
+    _rate = getRateLocked(now);
+    _lastUpdate = std::max(_lastUpdate, now);
+
+    // Learn the rates of the slots that have passed, including the idle ones.
+    for (std::size_t i = 0; now - _slotStart >= SlotDuration; ++i)
+    {
+        if (i < SlotCount)
+        {
+            const double observed = _slotLoads / toSeconds(SlotDuration);
+            double& learned = _dailyRate[_slot];
+            learned = (learned < 0 ? observed
+                                   : (1 - DailyRateWeight) * learned + DailyRateWeight * observed);
+        }
+
+        _slot = (_slot + 1) % SlotCount;
+        _slotStart += SlotDuration;
+        _slotLoads = 0;
+    }
+}
+
+double PrespawnController::getRateLocked(Clock::time_point now) const
+{
+    if (now <= _lastUpdate)
+        return _rate;
+
+    return _rate * std::exp(-toSeconds(now - _lastUpdate) / toSeconds(RateTimeConstant));
+}
+
+double PrespawnController::getDailyRateLocked(Clock::time_point now) const
+{
+    // Look at the next slot too, to grow the pool ahead of a daily peak.
+    const std::size_t slot = getSlot(now);
+    return std::max({ 0., _dailyRate[slot], _dailyRate[(slot + 1) % SlotCount] });
+}
+
+unsigned PrespawnController::getTargetLocked(Clock::time_point now, std::size_t spareCount) const
+{
+    const double rate = std::max(getRateLocked(now), getDailyRateLocked(now));
+    const double mean = rate * toSeconds(_forkLatency);
+    unsigned target = std::clamp(poissonQuantile(mean, _coldStartProbability), _minChildren,
+                                 _maxChildren);
+
+    const std::size_t headroomKb = _memoryHeadroomKb;
+    if (_spareKitMemoryKb > 0 && headroomKb != std::numeric_limits<std::size_t>::max())
+    {
+        const std::size_t fit = spareCount + headroomKb / _spareKitMemoryKb;
+        if (fit < target)
+            target = std::max<std::size_t>(fit, _minChildren);
+    }
+
+    return target;
+}
+
+void PrespawnController::noteChildRequest(Clock::time_point now, bool cold)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    update(now);
+    _rate += 1 / toSeconds(RateTimeConstant);
+    ++_slotLoads;
+    ++_requests;
+    if (cold)
+        ++_coldStarts;
+}
+
+void PrespawnController::noteForkRequest(Clock::time_point now, int count)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (int i = 0; i < count; ++i)
+        _forkRequests.push_back(now);
+
+    while (_forkRequests.size() > MaxForkRequests)
+        _forkRequests.pop_front();
+}
+
+void PrespawnController::noteNewChild(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_forkRequests.empty())
+        return;
+
+    const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - _forkRequests.front());
+    _forkRequests.pop_front();
+
+    if (_haveForkLatency)
+    {
+        _forkLatency = std::chrono::microseconds(static_cast<std::int64_t>(
+            (1 - ForkLatencyWeight) * _forkLatency.count() + ForkLatencyWeight * latency.count()));
+    }
+    else
+    {
+        _forkLatency = latency;
+        _haveForkLatency = true;
+    }
+}
+
+void PrespawnController::resetForkRequests()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _forkRequests.clear();
+}
+
+unsigned PrespawnController::getTarget(Clock::time_point now, std::size_t spareCount)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    update(now);
+    const unsigned target = getTargetLocked(now, spareCount);
+    if (target != _lastTarget)
+    {
+        LOG_DBG("Prespawn target changes from " << _lastTarget << " to " << target
+                                                << " children at a rate of "
+                                                << getRateLocked(now) << " loads/s");
+    }
+
+    _lastTarget = target;
+    _lastSpareCount = spareCount;
+    return target;
+}
+
+bool PrespawnController::shouldRetire(Clock::time_point now, std::size_t spareCount)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    update(now);
+    if (spareCount <= getTargetLocked(now, spareCount) || now - _lastRetire < RetireInterval)
+        return false;
+
+    _lastRetire = now;
+    ++_retired;
+    return true;
+}
+
+double PrespawnController::getRate(Clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return getRateLocked(now);
+}
+
+double PrespawnController::getDailyRate(Clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return getDailyRateLocked(now);
+}
+
+std::chrono::milliseconds PrespawnController::getForkLatency() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(_forkLatency);
+}
+
+std::string PrespawnController::getState(Clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const std::size_t headroomKb = _memoryHeadroomKb;
+    std::ostringstream oss;
+    oss << "target=" << _lastTarget << " spare=" << _lastSpareCount << " min=" << _minChildren
+        << " max=" << _maxChildren << " rate=" << getRateLocked(now)
+        << " daily_rate=" << getDailyRateLocked(now) << " fork_latency_ms="
+        << std::chrono::duration_cast<std::chrono::milliseconds>(_forkLatency).count()
+        << " outstanding=" << _forkRequests.size() << " cold_start_target=" << _coldStartProbability
+        << " requests=" << _requests << " cold_starts=" << _coldStarts << " retired=" << _retired
+        << " memory_headroom_kb="
+        << (headroomKb == std::numeric_limits<std::size_t>::max() ? 0 : headroomKb);
+    return oss.str();
+}
+
+void PrespawnController::dumpState(std::ostream& os) const
+{
+    os << "\n  PrespawnController: " << getState(Clock::now()) << '\n';
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/// Sizes the pool of pre-spawned kits from the rate at which documents take
+/// kits and the time forkit takes to spawn one, so that a document load has
+/// to wait for a fresh kit with no more than the target probability.
+/// The rate is both measured as it goes and remembered per time of day, so
+/// that the pool grows ahead of the daily peaks and shrinks again when idle.
+class PrespawnController
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// The time of day is tracked in slots of this length.
+    static constexpr std::chrono::minutes SlotDuration = std::chrono::minutes(15);
+    static constexpr std::size_t SlotCount = 24 * 60 / 15;
+
+    /// Keeps between @minChildren and @maxChildren spare kits, and, when
+    /// the memory headroom is known, no more than fit in it at @spareKitMemoryKb
+    /// each. @dayOffset is the time of day at @start.
+    PrespawnController(unsigned minChildren, unsigned maxChildren, double coldStartProbability,
+                       std::size_t spareKitMemoryKb, Clock::time_point start,
+                       std::chrono::seconds dayOffset);
+
+    /// Sets up the instance per the prespawn_pool config, with
+    /// num_prespawn_children as the minimum pool size.
+    static void initialize(unsigned minChildren);
+
+    /// The instance, or nullptr when disabled.
+    static PrespawnController* get() { return Instance.get(); }
+
+    /// Returns the smallest n for which a Poisson variable of @mean exceeds n
+    /// with a probability of no more than @probability.
+    static unsigned poissonQuantile(double mean, double probability);
+
+    /// A document took a kit. @cold is true if there was no spare one.
+    void noteChildRequest(Clock::time_point now, bool cold);
+
+    /// Forkit was asked to spawn @count kits.
+    void noteForkRequest(Clock::time_point now, int count);
+
+    /// A kit that forkit spawned has connected.
+    void noteNewChild(Clock::time_point now);
+
+    /// Forgets the outstanding forks, when forkit is restarted or unresponsive.
+    void resetForkRequests();
+
+    /// Sets the memory available to us beyond what we are using.
+    void setMemoryHeadroomKb(std::size_t headroomKb) { _memoryHeadroomKb = headroomKb; }
+
+    /// Returns the number of spare kits to have, given that we have @spareCount.
+    /// This is the smallest pool that, at the expected load rate, runs dry while
+    /// a kit is being spawned with at most the target cold-start probability.
+    unsigned getTarget(Clock::time_point now, std::size_t spareCount);
+
+    /// Returns true if a spare kit beyond the target should be retired now.
+    /// This is rate-limited, so the pool shrinks slowly.
+    bool shouldRetire(Clock::time_point now, std::size_t spareCount);
+
+    /// The load rate, in documents per second, measured recently.
+    double getRate(Clock::time_point now) const;
+
+    /// The load rate, in documents per second, learned for the time of day at @now.
+    double getDailyRate(Clock::time_point now) const;
+
+    /// The estimated time forkit takes to spawn a kit.
+    std::chrono::milliseconds getForkLatency() const;
+
+    /// The state as space-separated key=value pairs, for the admin console.
+    std::string getState(Clock::time_point now) const;
+
+    void dumpState(std::ostream& os) const;
+
+private:
+    /// Returns the time-of-day slot of @now.
+    std::size_t getSlot(Clock::time_point now) const;
+
+    /// Decays the recent rate to @now, and rolls over the daily slots. Expects _mutex held.
+    void update(Clock::time_point now);
+
+    /// Expects _mutex held.
+    double getRateLocked(Clock::time_point now) const;
+
+    /// Expects _mutex held.
+    double getDailyRateLocked(Clock::time_point now) const;
+
+    /// Expects _mutex held.
+    unsigned getTargetLocked(Clock::time_point now, std::size_t spareCount) const;
+
+private:
+    static std::unique_ptr<PrespawnController> Instance;
+
+    const unsigned _minChildren;
+    const unsigned _maxChildren;
+    const double _coldStartProbability;
+    const std::size_t _spareKitMemoryKb;
+    const Clock::time_point _start;
+    const std::chrono::seconds _dayOffset;
+
+    mutable std::mutex _mutex;
+
+    /// The exponentially-decayed load rate, as of _lastUpdate.
+    double _rate;
+    Clock::time_point _lastUpdate;
+
+    /// The load rate learned per time-of-day slot, negative if not yet known.
+    std::array<double, SlotCount> _dailyRate;
+    /// The slot being measured, and the loads seen in it so far.
+    std::size_t _slot;
+    Clock::time_point _slotStart;
+    std::size_t _slotLoads;
+
+    /// When each outstanding fork was requested.
+    std::deque<Clock::time_point> _forkRequests;
+    /// The exponentially-weighted average fork latency.
+    std::chrono::microseconds _forkLatency;
+    bool _haveForkLatency;
+
+    std::atomic<std::size_t> _memoryHeadroomKb;
+    Clock::time_point _lastRetire;
+
+    std::size_t _requests;
+    std::size_t _coldStarts;
+    std::size_t _retired;
+    unsigned _lastTarget;
+    std::size_t _lastSpareCount;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
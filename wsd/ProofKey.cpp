@@ -16,7 +16,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
+#include <iterator>
 #include <vector>
 
 #include <Poco/Base64Decoder.h>
@@ -72,6 +74,13 @@ std::vector<unsigned char> ToNetworkOrderBytes(const T& x)
     return getBytesBE(reinterpret_cast<const unsigned char*>(&x), sizeof(x));
 }
 
+// WOPI hosts accept proofs up to 20 minutes old. Reuse a signature for
+// at most half of that (in .Net ticks), to leave room for clock skew.
+constexpr int64_t ProofReuseTicks = INT64_C(10) * 60 * 10000000;
+
+// Bounds the memory used by the cached signatures.
+constexpr std::size_t MaxCachedProofs = 16384;
+
 } // namespace
 
 std::string Proof::BytesToBase64(const std::vector<unsigned char>& bytes)
@@ -256,16 +265,57 @@ std::string Proof::SignProof(const std::vector<unsigned char>& proof) const
 }
 
 VecOfStringPairs Proof::GetProofHeaders(const std::string& access_token, const std::string& uri) const
+{
+    return GetProofHeaders(access_token, uri, std::chrono::system_clock::now());
+}
+
+VecOfStringPairs Proof::GetProofHeaders(const std::string& access_token, const std::string& uri,
+                                        const std::chrono::system_clock::time_point& utc) const
 {
     VecOfStringPairs vec;
     if (m_pKey)
     {
-        int64_t ticks = DotNetTicks(std::chrono::system_clock::now());
-        vec.emplace_back("X-WOPI-TimeStamp", std::to_string(ticks));
-        const auto sProof = SignProof(GetProof(access_token, uri, ticks));
-        vec.emplace_back("X-WOPI-Proof", sProof);
+        const int64_t ticks = DotNetTicks(utc);
+        const int64_t bucket = ticks / ProofReuseTicks;
+        std::string key = access_token;
+        key += '\n';
+        key += uri;
+
+        CachedProof cached;
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lock(m_aProofCacheMutex);
+            const auto it = m_aProofCache.find(key);
+            if (it != m_aProofCache.end() && it->second.m_nBucket == bucket)
+            {
+                cached = it->second;
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            cached.m_nBucket = bucket;
+            cached.m_sTimeStamp = std::to_string(ticks);
+            cached.m_sProof = SignProof(GetProof(access_token, uri, ticks));
+
+            std::lock_guard<std::mutex> lock(m_aProofCacheMutex);
+            if (m_aProofCache.size() >= MaxCachedProofs)
+            {
+                // Drop the stale signatures, or everything if they are all fresh.
+                for (auto it = m_aProofCache.begin(); it != m_aProofCache.end();)
+                    it = (it->second.m_nBucket != bucket ? m_aProofCache.erase(it) : std::next(it));
+                if (m_aProofCache.size() >= MaxCachedProofs)
+                    m_aProofCache.clear();
+            }
+
+            m_aProofCache[std::move(key)] = cached;
+        }
+
+        vec.emplace_back("X-WOPI-TimeStamp", cached.m_sTimeStamp);
+        vec.emplace_back("X-WOPI-Proof", cached.m_sProof);
         // TODO: implement proper rotation; for now, just duplicate X-WOPI-Proof to X-WOPI-ProofOld
-        vec.emplace_back("X-WOPI-ProofOld", sProof);
+        vec.emplace_back("X-WOPI-ProofOld", cached.m_sProof);
     }
     return vec;
 }
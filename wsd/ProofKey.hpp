@@ -18,6 +18,8 @@
 #include <vector>
 #include <chrono>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 
 typedef std::vector<std::pair<std::string, std::string>> VecOfStringPairs;
 
@@ -44,6 +46,11 @@ public:
     VecOfStringPairs GetProofHeaders(const std::string& access_token, const std::string& uri) const;
     const VecOfStringPairs& GetProofKeyAttributes() const { return m_aAttribs; }
 private:
+    // As above, at the given time. The signature for a given access_token and uri
+    // is reused, with its original timestamp, until the time moves to the next bucket.
+    VecOfStringPairs GetProofHeaders(const std::string& access_token, const std::string& uri,
+                                     const std::chrono::system_clock::time_point& utc) const;
+
     static std::string ProofKeyPath();
 
     static std::string BytesToBase64(const std::vector<unsigned char>& bytes);
@@ -65,6 +72,18 @@ private:
 
     std::unique_ptr<const Poco::Crypto::RSAKey> m_pKey;
     VecOfStringPairs m_aAttribs;
+
+    struct CachedProof
+    {
+        int64_t m_nBucket = 0;
+        std::string m_sTimeStamp;
+        std::string m_sProof;
+    };
+
+    // Signing is costly, and storage requests for a document repeat the same
+    // access_token and uri, so keep the signatures while they are fresh.
+    mutable std::mutex m_aProofCacheMutex;
+    mutable std::unordered_map<std::string, CachedProof> m_aProofCache;
 };
 
 
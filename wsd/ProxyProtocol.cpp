@@ -30,10 +30,13 @@
 #include <atomic>
 #include <cassert>
 
+bool ProxyProtocolHandler::BinaryFraming = true;
+
 void DocumentBroker::handleProxyRequest(
     const std::string& id,
     const Poco::URI& uriPublic,
     const bool isReadOnly,
+    const bool binaryFraming,
     const RequestDetails &requestDetails,
     const std::shared_ptr<StreamSocket> &socket)
 {
@@ -45,9 +48,10 @@ void DocumentBroker::handleProxyRequest(
         if (!isLocal)
             throw BadRequestException("invalid host - only connect from localhost");
 
-        LOG_TRC("proxy: Create session for " << _docKey);
+        LOG_TRC("proxy: Create session for " << _docKey << " with "
+                << (binaryFraming ? "binary" : "text") << " framing");
         clientSession = createNewClientSession(
-                std::make_shared<ProxyProtocolHandler>(),
+                std::make_shared<ProxyProtocolHandler>(binaryFraming),
                 id, uriPublic, isReadOnly, requestDetails);
         addSession(clientSession);
         COOLWSD::checkDiskSpaceAndWarnClients(true);
@@ -242,9 +246,11 @@ void ProxyProtocolHandler::notifyDisconnected()
         _msgHandler->onDisconnect();
 }
 
-int ProxyProtocolHandler::sendMessage(const char *msg, const size_t len, bool text, bool flush)
+int ProxyProtocolHandler::sendMessage(const char *msg, const size_t len, bool text, bool flush,
+                                      const std::shared_ptr<const void>& owner)
 {
-    _writeQueue.push_back(std::make_shared<Message>(msg, len, text, _outSerial++));
+    appendFrame(_writeQueue, msg, len, text, _outSerial++, _binaryFraming, owner);
+    ++_queuedMessages;
     if (flush)
     {
         auto sock = popOutSocket();
@@ -270,6 +276,14 @@ int ProxyProtocolHandler::sendBinaryMessage(const char *data, const size_t len,
     return const_cast<ProxyProtocolHandler *>(this)->sendMessage(data, len, false, flush);
 }
 
+int ProxyProtocolHandler::sendSharedMessage(const std::shared_ptr<const void>& owner,
+                                            const char* data, const size_t len, bool binary,
+                                            bool flush) const
+{
+    LOG_TRC("ProxyHack - send shared msg len " << len);
+    return const_cast<ProxyProtocolHandler *>(this)->sendMessage(data, len, !binary, flush, owner);
+}
+
 void ProxyProtocolHandler::shutdown(bool goingAway, const std::string &statusMessage)
 {
     LOG_TRC("ProxyHack - shutdown " << goingAway << ": " << statusMessage);
@@ -282,7 +296,8 @@ void ProxyProtocolHandler::getIOStats(uint64_t &sent, uint64_t &recv)
 
 void ProxyProtocolHandler::dumpProxyState(std::ostream& os)
 {
-    os << "proxy protocol sockets: " << _outSockets.size() << " writeQueue: " << _writeQueue.size() << ":\n";
+    os << "proxy protocol sockets: " << _outSockets.size() << " writeQueue: " << _queuedMessages
+       << " messages framed as " << (_binaryFraming ? "binary" : "text") << ":\n";
     os << '\t';
     for (auto &it : _outSockets)
     {
@@ -290,8 +305,7 @@ void ProxyProtocolHandler::dumpProxyState(std::ostream& os)
         os << '#' << (sock ? sock->getFD() : -2) << ' ';
     }
     os << '\n';
-    for (const auto& it : _writeQueue)
-        Util::dumpHex(os, *it, "\twrite queue entry:", "\t\t");
+    _writeQueue.dumpHex(os, "\twrite queue:", "\t\t");
     if (_msgHandler)
         _msgHandler->dumpState(os);
 }
@@ -311,7 +325,7 @@ bool ProxyProtocolHandler::slurpHasMessages(std::size_t capacity)
     if (_msgHandler)
         _msgHandler->writeQueuedMessages(capacity);
 
-    return _writeQueue.size() > 0;
+    return !_writeQueue.empty();
 }
 
 void ProxyProtocolHandler::performWrites(std::size_t capacity)
@@ -333,14 +347,12 @@ bool ProxyProtocolHandler::flushQueueTo(const std::shared_ptr<StreamSocket> &soc
     if (!slurpHasMessages(socket->getSendBufferCapacity()))
         return false;
 
-    size_t totalSize = 0;
-    for (const auto& it : _writeQueue)
-        totalSize += it->size();
-
+    const size_t totalSize = _writeQueue.size();
     if (!totalSize)
         return false;
 
-    LOG_TRC("proxy: flushQueue of size " << totalSize << " to socket #" << socket->getFD() << " & close");
+    LOG_TRC("proxy: flushQueue of " << _queuedMessages << " messages, size " << totalSize
+            << " to socket #" << socket->getFD() << " & close");
 
     std::ostringstream oss;
     oss << "HTTP/1.1 200 OK\r\n"
@@ -350,11 +362,12 @@ bool ProxyProtocolHandler::flushQueueTo(const std::shared_ptr<StreamSocket> &soc
         "Content-Type: application/json; charset=utf-8\r\n"
         "X-Content-Type-Options: nosniff\r\n"
         "\r\n";
-    socket->send(oss.str());
+    socket->send(oss.str(), false);
 
-    for (const auto& it : _writeQueue)
-        socket->send(it->data(), it->size(), false);
-    _writeQueue.clear();
+    // One body for all, written together with the header: large payloads stay
+    // referenced, to be written with writev.
+    socket->getOutBuffer().append(std::move(_writeQueue));
+    _queuedMessages = 0;
 
     return true;
 }
@@ -11,7 +11,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <net/Buffer.hpp>
 #include <net/Socket.hpp>
 
 /**
@@ -19,13 +21,26 @@
  * individual proxied HTTP requests back to back.
  *
  * we use a trivial framing: [T(ext)|B(inary)]<hex-serial->\n<hex-length>\n<content>\n
+ *
+ * Clients that send 'X-COOL-Proxy-Framing: binary' when opening the session
+ * get the messages we send framed as: [t|b]<serial><length><content>, with
+ * the low 32 bits of the serial and the length as big-endian integers.
+ * Either way, all the messages queued are sent in the body of one response.
  */
 class ProxyProtocolHandler : public ProtocolHandlerInterface
 {
 public:
-    ProxyProtocolHandler() :
+    /// Whether to use binary framing for the clients that ask for it.
+    static bool BinaryFraming;
+
+    /// The request header with which clients ask for binary framing.
+    static constexpr const char* FramingHeader = "X-COOL-Proxy-Framing";
+
+    explicit ProxyProtocolHandler(bool binaryFraming = false) :
+        _binaryFraming(binaryFraming),
         _inSerial(0),
-        _outSerial(0)
+        _outSerial(0),
+        _queuedMessages(0)
     {
     }
 
@@ -57,6 +72,8 @@ public:
 
     int sendTextMessage(const char *msg, const size_t len, bool flush = false) const override;
     int sendBinaryMessage(const char *data, const size_t len, bool flush = false) const override;
+    int sendSharedMessage(const std::shared_ptr<const void>& owner, const char* data,
+                          const size_t len, bool binary, bool flush = false) const override;
     void shutdown(bool goingAway = false, const std::string &statusMessage = "") override;
     void getIOStats(uint64_t &sent, uint64_t &recv) override;
     // don't duplicate ourselves for every socket
@@ -70,33 +87,75 @@ public:
     /// tell our handler we've received a close.
     void notifyDisconnected();
 
+    /// Appends the frame of a message of @len bytes at @data to @out,
+    /// referencing rather than copying them when @owner is given.
+    static void appendFrame(Buffer& out, const char* data, std::size_t len, bool text,
+                            uint64_t serial, bool binaryFraming,
+                            const std::shared_ptr<const void>& owner = nullptr)
+    {
+        char header[40];
+        char* pos = header;
+        if (binaryFraming)
+        {
+            *pos++ = text ? 't' : 'b';
+            pos = writeBigEndian32(pos, serial);
+            pos = writeBigEndian32(pos, len);
+        }
+        else
+        {
+            *pos++ = text ? 'T' : 'B';
+            pos = writeHex(pos, serial);
+            pos = writeHex(pos, len);
+        }
+
+        out.append(header, pos - header);
+        out.append(owner, data, len);
+        if (!binaryFraming)
+            out.append("\n");
+    }
+
 private:
     std::shared_ptr<StreamSocket> popOutSocket();
     /// can we find anything to send back if we try ?
     bool slurpHasMessages(std::size_t capacity);
-    int sendMessage(const char *msg, const size_t len, bool text, bool flush);
+    int sendMessage(const char *msg, const size_t len, bool text, bool flush,
+                    const std::shared_ptr<const void>& owner = nullptr);
     bool flushQueueTo(const std::shared_ptr<StreamSocket> &socket);
 
-    struct Message : public std::vector<char>
+    /// Writes 0x<hex>\n.
+    static char* writeHex(char* pos, uint64_t value)
     {
-        Message(const char *msg, const std::size_t len, bool text, uint64_t serial)
+        constexpr const char* digits = "0123456789abcdef";
+        char reversed[16];
+        int count = 0;
+        do
         {
-            const char *type = text ? "T" : "B";
-            insert(end(), type, type + 1);
-            std::ostringstream os;
-            os << std::hex << "0x" << serial << "\n0x" << len << '\n';
-            const std::string str = os.str();
-            insert(end(), str.c_str(), str.c_str() + str.size());
-            insert(end(), msg, msg + len);
-            constexpr const char *terminator = "\n";
-            insert(end(), terminator, terminator + 1);
-        }
-    };
-    /// queue things when we have no socket to hand.
-    std::vector<std::shared_ptr<Message>> _writeQueue;
+            reversed[count++] = digits[value & 0xf];
+            value >>= 4;
+        } while (value);
+
+        *pos++ = '0';
+        *pos++ = 'x';
+        while (count)
+            *pos++ = reversed[--count];
+        *pos++ = '\n';
+        return pos;
+    }
+
+    static char* writeBigEndian32(char* pos, uint64_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            *pos++ = static_cast<char>((value >> shift) & 0xff);
+        return pos;
+    }
+
+    /// queue things when we have no socket to hand: the frames, ready to send.
+    Buffer _writeQueue;
     std::vector<std::weak_ptr<StreamSocket>> _outSockets;
+    const bool _binaryFraming;
     uint64_t _inSerial;
     uint64_t _outSerial;
+    std::size_t _queuedMessages;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
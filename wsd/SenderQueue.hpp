@@ -22,14 +22,21 @@
 
 #include <deque>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 
 /// A queue of data to send to certain Session's WS.
+/// Superseded items are only marked as removed in place,
+/// so they can be found through an index rather than a scan,
+/// and dropped in bulk once they outnumber the queued ones.
 template <typename Item>
 class SenderQueue final
 {
 public:
 
     SenderQueue()
+        : _frontSeq(0)
+        , _count(0)
     {
     }
 
@@ -37,10 +44,19 @@ public:
     {
         std::unique_lock<std::mutex> lock(_mutex);
 
-        if (!SigUtil::getTerminationFlag() && deduplicate(item))
-            _queue.push_back(item);
+        if (!SigUtil::getTerminationFlag())
+        {
+            std::string key = deduplicate(item);
+            if (!key.empty())
+                _index[key] = _frontSeq + _queue.size();
 
-        return _queue.size();
+            _queue.push_back(Entry(item, std::move(key)));
+            ++_count;
+
+            compact();
+        }
+
+        return _count;
     }
 
     /// Dequeue an item if we have one - @returns true if we do, else false.
@@ -55,17 +71,36 @@ public:
 
         std::unique_lock<std::mutex> lock(_mutex);
 
-        if (!_queue.empty())
+        while (!_queue.empty())
         {
-            item = _queue.front();
+            Entry& entry = _queue.front();
+            const bool removed = !entry._item;
+            if (!removed)
+            {
+                item = std::move(entry._item);
+                if (!entry._key.empty())
+                    _index.erase(entry._key);
+                --_count;
+            }
+
             _queue.pop_front();
-            return true;
+            ++_frontSeq;
+
+            if (!removed)
+                return true;
         }
 
         return false;
     }
 
     size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _count;
+    }
+
+    /// The number of entries held, including the removed ones not dropped yet.
+    size_t getEntryCount() const
     {
         std::lock_guard<std::mutex> lock(_mutex);
         return _queue.size();
@@ -73,36 +108,62 @@ public:
 
     void dumpState(std::ostream& os)
     {
-        os << "\n\t\tqueue size " << _queue.size() << '\n';
         std::lock_guard<std::mutex> lock(_mutex);
-        for (const Item &item : _queue)
+        os << "\n\t\tqueue size " << _count << " (" << _queue.size() - _count << " removed)\n";
+        for (const Entry& entry : _queue)
         {
+            const Item& item = entry._item;
+            if (!item)
+                continue;
+
             os << "\t\t\ttype: " << (item->isBinary() ? "binary\n" : "text\n");
             os << "\t\t\t" << item->abbr() << '\n';
         }
     }
 
 private:
-    /// Deduplicate messages based on the new one.
-    /// Returns true if the new message should be
-    /// enqueued, otherwise false.
-    bool deduplicate(const Item& item)
+    /// A queued item along with its deduplication key, if any.
+    /// The item is reset when superseded by a newer one.
+    struct Entry
+    {
+        Entry(const Item& item, std::string key)
+            : _item(item)
+            , _key(std::move(key))
+        {
+        }
+
+        Item _item;
+        std::string _key;
+    };
+
+    /// The key identifying the tile, ignoring its version.
+    static std::string tileKey(const TileDesc& tile)
+    {
+        std::string key = "tile:";
+        for (const int value : { tile.getPart(), tile.getWidth(), tile.getHeight(),
+                                 tile.getTilePosX(), tile.getTilePosY(), tile.getTileWidth(),
+                                 tile.getTileHeight(), tile.getId(), tile.getNormalizedViewId(),
+                                 tile.getEditMode() })
+        {
+            key += ' ';
+            key += std::to_string(value);
+        }
+
+        return key;
+    }
+
+    /// Deduplicate messages based on the new one, removing
+    /// any queued message it supersedes. Returns the key
+    /// to index the new message with, if any.
+    std::string deduplicate(const Item& item)
     {
         // Deduplicate messages based on the incoming one.
+        std::string key;
         const std::string command = item->firstToken();
         if (command == "tile:")
         {
             // Remove previous identical tile, if any, and use most recent (incoming).
-            const TileDesc newTile = TileDesc::parse(item->firstLine());
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [&newTile](const queue_item_t& cur)
-                {
-                    return cur->firstTokenMatches("tile:") &&
-                           newTile == TileDesc::parse(cur->firstLine());
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            key = tileKey(TileDesc::parse(item->firstLine()));
         }
         else if (command == "statusindicatorsetvalue:" ||
                  command == "invalidatecursor:" ||
@@ -110,14 +171,7 @@ private:
         {
             // Remove previous identical entries of this command,
             // if any, and use most recent (incoming).
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [&command](const queue_item_t& cur)
-                {
-                    return cur->firstTokenMatches(command);
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            key = command;
         }
         else if (command == "invalidateviewcursor:")
         {
@@ -127,33 +181,64 @@ private:
             Poco::JSON::Parser newParser;
             const Poco::Dynamic::Var newResult = newParser.parse(newMsg);
             const auto& newJson = newResult.extract<Poco::JSON::Object::Ptr>();
-            const std::string viewId = newJson->get("viewId").toString();
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [command, viewId](const queue_item_t& cur)
-                {
-                    if (cur->firstTokenMatches(command))
-                    {
-                        const std::string msg = cur->jsonString();
-                        Poco::JSON::Parser parser;
-                        const Poco::Dynamic::Var result = parser.parse(msg);
-                        const auto& json = result.extract<Poco::JSON::Object::Ptr>();
-                        return viewId == json->get("viewId").toString();
-                    }
-
-                    return false;
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            key = command + newJson->get("viewId").toString();
+        }
+
+        if (!key.empty())
+        {
+            const auto it = _index.find(key);
+            if (it != _index.end())
+            {
+                Entry& entry = _queue[it->second - _frontSeq];
+                entry._item = Item();
+                entry._key.clear();
+                --_count;
+            }
+        }
+
+        return key;
+    }
+
+    /// Drops the removed entries, unless there are few of them compared to the
+    /// queued ones, lest they pile up with a slow reader. Amortized O(1).
+    void compact()
+    {
+        // The cheap case: those a reader would have to skip first.
+        while (!_queue.empty() && !_queue.front()._item)
+        {
+            _queue.pop_front();
+            ++_frontSeq;
+        }
+
+        constexpr size_t MinRemoved = 64;
+        const size_t removed = _queue.size() - _count;
+        if (removed < MinRemoved || removed < _count)
+            return;
+
+        LOG_TRC("SenderQueue dropping " << removed << " removed entries, keeping " << _count);
+        std::deque<Entry> queue;
+        for (Entry& entry : _queue)
+        {
+            if (!entry._item)
+                continue;
+
+            if (!entry._key.empty())
+                _index[entry._key] = _frontSeq + queue.size();
+            queue.push_back(std::move(entry));
         }
 
-        return true;
+        _queue.swap(queue);
     }
 
 private:
     mutable std::mutex _mutex;
-    std::deque<Item> _queue;
-    typedef typename std::deque<Item>::value_type queue_item_t;
+    std::deque<Entry> _queue;
+    /// The sequence number of the front entry of the queue.
+    uint64_t _frontSeq;
+    /// The number of entries that are not removed.
+    size_t _count;
+    /// The sequence number of the queued entry by its deduplication key.
+    std::unordered_map<std::string, uint64_t> _index;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
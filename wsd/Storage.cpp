@@ -58,6 +58,7 @@
 #include <NetUtil.hpp>
 #include <CommandControl.hpp>
 #include "HostUtil.hpp"
+#include "StorageConnectionPool.hpp"
 
 #ifdef IOS
 #include <ios.h>
@@ -110,6 +111,14 @@ void StorageBase::initialize()
 
     HostUtil::parseAliases(app.config());
 
+    if (COOLWSD::getConfigValue<bool>("storage.wopi.connection_pool[@enable]", false))
+    {
+        StorageConnectionPool::initialize(
+            COOLWSD::getConfigValue<unsigned>("storage.wopi.connection_pool.max_idle_per_host", 4),
+            std::chrono::seconds(COOLWSD::getConfigValue<unsigned>(
+                "storage.wopi.connection_pool.idle_timeout_secs", 30)));
+    }
+
 #if ENABLE_SSL
     // FIXME: should use our own SSL socket implementation here.
     Poco::Crypto::initializeCrypto();
@@ -533,6 +542,24 @@ std::shared_ptr<http::Session> StorageBase::getHttpSession(const Poco::URI& uri)
 namespace
 {
 
+/// Makes a synchronous request to the storage, over a pooled keep-alive
+/// connection when enabled. The response body is saved to @saveToFilePath, unless empty,
+/// and @onProgress, if set, is called as it is received.
+std::shared_ptr<const http::Response>
+syncStorageRequest(const std::shared_ptr<http::Session>& httpSession,
+                   const http::Request& httpRequest,
+                   const std::string& saveToFilePath = std::string(),
+                   const http::Response::ProgressCallback& onProgress = nullptr)
+{
+    if (StorageConnectionPool* pool = StorageConnectionPool::get())
+        return pool->syncRequest(httpSession, httpRequest, saveToFilePath, onProgress);
+
+    if (saveToFilePath.empty())
+        return httpSession->syncRequest(httpRequest);
+
+    return httpSession->syncDownload(httpRequest, saveToFilePath, onProgress);
+}
+
 static void addStorageDebugCookie(Poco::Net::HTTPRequest& request)
 {
     (void) request;
@@ -560,14 +587,6 @@ void addWopiProof(Poco::Net::HTTPRequest& request, const Poco::URI& uri,
         request.set(header.first, header.second);
 }
 
-std::map<std::string, std::string> GetQueryParams(const Poco::URI& uri)
-{
-    std::map<std::string, std::string> result;
-    for (const auto& param : uri.getQueryParameters())
-        result.emplace(param);
-    return result;
-}
-
 } // anonymous namespace
 
 #endif // !MOBILEAPP
@@ -615,10 +634,15 @@ void WopiStorage::initHttpRequest(Poco::Net::HTTPRequest& request, const Poco::U
     addStorageDebugCookie(request);
 
     // TODO: Avoid repeated parsing.
-    std::map<std::string, std::string> params = GetQueryParams(uri);
-    const auto it = params.find("access_token");
-    if (it != params.end())
-        addWopiProof(request, uri, it->second);
+    // Only the access_token is needed, don't collect the rest.
+    for (const auto& param : uri.getQueryParameters())
+    {
+        if (param.first == "access_token")
+        {
+            addWopiProof(request, uri, param.second);
+            break;
+        }
+    }
 
     // Helps wrt. debugging cluster cases from the logs
     request.set("X-COOL-WOPI-ServerId", Util::getProcessIdentifier());
@@ -666,7 +690,7 @@ WopiStorage::getWOPIFileInfoForUri(Poco::URI uriObject, const Authorization& aut
                                                                << httpRequest.header());
 
         const std::shared_ptr<const http::Response> httpResponse
-            = httpSession->syncRequest(httpRequest);
+            = syncStorageRequest(httpSession, httpRequest);
 
         callDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::steady_clock::now() - startTime);
@@ -947,36 +971,34 @@ StorageBase::LockUpdateResult WopiStorage::updateLockState(const Authorization&
 
     try
     {
-        std::unique_ptr<Poco::Net::HTTPClientSession> psession(getHTTPClientSession(uriObject));
+        std::shared_ptr<http::Session> httpSession = getHttpSession(uriObject);
 
-        Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST,
-                                       uriObject.getPathAndQuery(),
-                                       Poco::Net::HTTPMessage::HTTP_1_1);
-        initHttpRequest(request, uriObject, auth);
+        http::Request httpRequest = initHttpRequest(uriObject, auth);
+        httpRequest.setVerb(http::Request::VERB_POST);
 
-        request.set("X-WOPI-Override", lock ? "LOCK" : "UNLOCK");
-        request.set("X-WOPI-Lock", lockCtx._lockToken);
+        http::Header& httpHeader = httpRequest.header();
+        httpHeader.set("X-WOPI-Override", lock ? "LOCK" : "UNLOCK");
+        httpHeader.set("X-WOPI-Lock", lockCtx._lockToken);
         if (!attribs.getExtendedData().empty())
         {
-            request.set("X-COOL-WOPI-ExtendedData", attribs.getExtendedData());
-            request.set("X-LOOL-WOPI-ExtendedData", attribs.getExtendedData());
+            httpHeader.set("X-COOL-WOPI-ExtendedData", attribs.getExtendedData());
+            httpHeader.set("X-LOOL-WOPI-ExtendedData", attribs.getExtendedData());
         }
 
         // IIS requires content-length for POST requests: see https://forums.iis.net/t/1119456.aspx
-        request.setContentLength(0);
+        httpRequest.setBody(std::string());
 
-        psession->sendRequest(request);
-        Poco::Net::HTTPResponse response;
-        std::istream& rs = psession->receiveResponse(response);
+        const std::shared_ptr<const http::Response> httpResponse
+            = syncStorageRequest(httpSession, httpRequest);
+        if (httpResponse->state() != http::Response::State::Complete)
+            throw StorageConnectionException(wopiLog + " request failed");
 
-        std::ostringstream oss;
-        Poco::StreamCopier::copyStream(rs, oss);
-        std::string responseString = oss.str();
+        const std::string responseString = httpResponse->getBody();
+        const http::StatusCode statusCode = httpResponse->statusLine().statusCode();
 
-        LOG_INF(wopiLog << " response: " << responseString <<
-                " status " << response.getStatus());
+        LOG_INF(wopiLog << " response: " << responseString << " status " << statusCode);
 
-        if (response.getStatus() == Poco::Net::HTTPResponse::HTTP_OK)
+        if (statusCode == http::StatusCode::OK)
         {
             lockCtx._isLocked = lock;
             lockCtx.bumpTimer();
@@ -984,25 +1006,25 @@ StorageBase::LockUpdateResult WopiStorage::updateLockState(const Authorization&
         }
         else
         {
-            std::string sMoreInfo = response.get("X-WOPI-LockFailureReason", "");
+            std::string sMoreInfo = httpResponse->get("X-WOPI-LockFailureReason", "");
             if (!sMoreInfo.empty())
             {
                 lockCtx._lockFailureReason = sMoreInfo;
                 sMoreInfo = ", failure reason: \"" + sMoreInfo + "\"";
             }
 
-            if (response.getStatus() == Poco::Net::HTTPResponse::HTTP_UNAUTHORIZED ||
-                response.getStatus() == Poco::Net::HTTPResponse::HTTP_FORBIDDEN ||
-                response.getStatus() == Poco::Net::HTTPResponse::HTTP_NOT_FOUND)
+            if (statusCode == http::StatusCode::Unauthorized ||
+                statusCode == http::StatusCode::Forbidden ||
+                statusCode == http::StatusCode::NotFound)
             {
                 LOG_ERR("Un-successful " << wopiLog << " with expired token, HTTP status "
-                                         << response.getStatus() << sMoreInfo
+                                         << statusCode << sMoreInfo
                                          << " and response: " << responseString);
 
                 return LockUpdateResult::UNAUTHORIZED;
             }
 
-            LOG_ERR("Un-successful " << wopiLog << " with HTTP status " << response.getStatus()
+            LOG_ERR("Un-successful " << wopiLog << " with HTTP status " << statusCode
                                      << sMoreInfo << " and response: " << responseString);
             return LockUpdateResult::FAILED;
         }
@@ -1016,6 +1038,10 @@ StorageBase::LockUpdateResult WopiStorage::updateLockState(const Authorization&
     {
         LOG_ERR("Cannot " << wopiLog << " uri [" << uriAnonym << "]. Error: " << exc.what());
     }
+    catch (const StorageConnectionException& exc)
+    {
+        LOG_ERR("Cannot " << wopiLog << " uri [" << uriAnonym << "]. Error: " << exc.what());
+    }
 
     lockCtx._lockFailureReason = "Request failed";
     return LockUpdateResult::FAILED;
@@ -1111,7 +1137,8 @@ std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std:
     LOG_TRC("Downloading from [" << uriAnonym << "] to [" << getRootFilePath()
                                  << "]: " << httpRequest.header());
     const std::shared_ptr<const http::Response> httpResponse
-        = httpSession->syncDownload(httpRequest, getRootFilePath());
+        = syncStorageRequest(httpSession, httpRequest, getRootFilePath(),
+                             getDownloadProgressCallback());
 
     const std::chrono::milliseconds diff = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::steady_clock::now() - startTime);
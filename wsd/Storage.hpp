@@ -390,6 +390,16 @@ public:
     virtual std::string downloadStorageFileToLocal(const Authorization& auth, LockContext& lockCtx,
                                                    const std::string& templateUri) = 0;
 
+    /// The download progress callback function, called with the bytes
+    /// received so far and the size of the file, or -1 if not known.
+    using DownloadProgressCallback = http::Response::ProgressCallback;
+
+    /// Sets the callback to follow the progress of downloadStorageFileToLocal, where supported.
+    void setDownloadProgressCallback(DownloadProgressCallback downloadProgressCallback)
+    {
+        _downloadProgressCallback = std::move(downloadProgressCallback);
+    }
+
     /// The asynchronous upload completion callback function.
     using AsyncUploadCallback = std::function<void(const AsyncUpload&)>;
 
@@ -470,6 +480,11 @@ protected:
     /// Returns the root path of the jail directory of docs.
     std::string getLocalRootPath() const;
 
+    const DownloadProgressCallback& getDownloadProgressCallback() const
+    {
+        return _downloadProgressCallback;
+    }
+
 private:
     Poco::URI _uri;
     const std::string _localStorePath;
@@ -477,6 +492,7 @@ private:
     std::string _jailedFilePath;
     std::string _jailedFilePathAnonym;
     FileInfo _fileInfo;
+    DownloadProgressCallback _downloadProgressCallback;
     bool _isDownloaded;
 
     static bool FilesystemEnabled;
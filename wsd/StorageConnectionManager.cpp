@@ -71,14 +71,6 @@ void addWopiProof(Poco::Net::HTTPRequest& request, const Poco::URI& uri,
         request.set(header.first, header.second);
 }
 
-std::map<std::string, std::string> GetQueryParams(const Poco::URI& uri)
-{
-    std::map<std::string, std::string> result;
-    for (const auto& param : uri.getQueryParameters())
-        result.emplace(param);
-    return result;
-}
-
 void initHttpRequest(Poco::Net::HTTPRequest& request, const Poco::URI& uri,
                      const Authorization& auth)
 {
@@ -89,10 +81,15 @@ void initHttpRequest(Poco::Net::HTTPRequest& request, const Poco::URI& uri,
     // addStorageDebugCookie(request);
 
     // TODO: Avoid repeated parsing.
-    std::map<std::string, std::string> params = GetQueryParams(uri);
-    const auto it = params.find("access_token");
-    if (it != params.end())
-        addWopiProof(request, uri, it->second);
+    // Only the access_token is needed, don't collect the rest.
+    for (const auto& param : uri.getQueryParameters())
+    {
+        if (param.first == "access_token")
+        {
+            addWopiProof(request, uri, param.second);
+            break;
+        }
+    }
 
     // Helps wrt. debugging cluster cases from the logs
     request.set("X-COOL-WOPI-ServerId", Util::getProcessIdentifier());
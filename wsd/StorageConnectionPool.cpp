@@ -0,0 +1,242 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "StorageConnectionPool.hpp"
+
+#include <algorithm>
+
+#include <common/Log.hpp>
+#include <net/Socket.hpp>
+
+std::unique_ptr<StorageConnectionPool> StorageConnectionPool::Instance;
+
+StorageConnectionPool::StorageConnectionPool(std::size_t maxIdlePerHost,
+                                             std::chrono::seconds idleTimeout)
+    : _maxIdlePerHost(maxIdlePerHost)
+    , _idleTimeout(idleTimeout)
+    , _newCount(0)
+    , _reuseCount(0)
+    , _staleCount(0)
+{
+}
+
+void StorageConnectionPool::initialize(std::size_t maxIdlePerHost,
+                                       std::chrono::seconds idleTimeout)
+{
+    if (maxIdlePerHost == 0)
+    {
+        Instance.reset();
+        return;
+    }
+
+    Instance = std::make_unique<StorageConnectionPool>(maxIdlePerHost, idleTimeout);
+    LOG_INF("Storage connection pool enabled with up to "
+            << maxIdlePerHost << " idle connections per host for " << idleTimeout.count()
+            << " seconds");
+}
+
+std::string StorageConnectionPool::getKey(const http::Session& session)
+{
+    return std::string(session.getProtocolScheme()) + "://" + session.host() + ':' +
+           session.port();
+}
+
+std::shared_ptr<const http::Response>
+StorageConnectionPool::syncRequest(const std::shared_ptr<http::Session>& session,
+                                   const http::Request& request,
+                                   const std::string& saveToFilePath,
+                                   const http::Response::ProgressCallback& onProgress)
+{
+    const std::string key = getKey(*session);
+
+    const auto newConnection = [this, &session]()
+    {
+        // The poll is destroyed by whichever thread drops the connection last.
+        Connection connection;
+        connection._session = session;
+        connection._poll = std::shared_ptr<TerminatingPoll>(
+            new TerminatingPoll("StorageConnPoll"),
+            [](TerminatingPoll* poll)
+            {
+                poll->checkAndReThread();
+                delete poll;
+            });
+        connection._poll->runOnClientThread();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_newCount;
+        return connection;
+    };
+
+    const auto makeRequest = [&request, &saveToFilePath, &onProgress](const Connection& connection)
+    {
+        if (saveToFilePath.empty())
+            return connection._session->syncRequest(request, *connection._poll);
+
+        return connection._session->syncDownload(request, saveToFilePath, *connection._poll,
+                                                 onProgress);
+    };
+
+    Connection connection;
+    const bool reused = acquire(key, connection);
+    if (reused)
+        connection._session->setTimeout(session->getTimeout());
+    else
+        connection = newConnection();
+
+    std::shared_ptr<const http::Response> response = makeRequest(connection);
+
+    // The host may have closed the idle connection just as we sent the request.
+    // Repeat those requests that are safe to repeat over a new connection.
+    if (reused && response->state() == http::Response::State::Error &&
+        request.getVerb() == http::Request::VERB_GET)
+    {
+        LOG_DBG("Reused storage connection to " << key << " failed, retrying on a new one");
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_staleCount;
+        }
+
+        connection = newConnection();
+        response = makeRequest(connection);
+    }
+
+    release(key, std::move(connection), response);
+    return response;
+}
+
+bool StorageConnectionPool::acquire(const std::string& key, Connection& connection)
+{
+    for (;;)
+    {
+        Connection candidate;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            trimLocked(Clock::now());
+            const auto it = _idle.find(key);
+            if (it == _idle.end())
+                return false;
+
+            candidate = std::move(it->second.back());
+            it->second.pop_back();
+            if (it->second.empty())
+                _idle.erase(it);
+        }
+
+        // Catch up with the host having closed the connection while it was idle.
+        candidate._poll->poll(std::chrono::microseconds::zero());
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (candidate._session->isConnected())
+        {
+            ++_reuseCount;
+            connection = std::move(candidate);
+            return true;
+        }
+
+        LOG_DBG("Discarding the storage connection to " << key << " closed by the host");
+        ++_staleCount;
+    }
+}
+
+void StorageConnectionPool::release(const std::string& key, Connection connection,
+                                    const std::shared_ptr<const http::Response>& response)
+{
+    // Failed requests and 'Connection: close' responses leave nothing to reuse.
+    if (response->state() != http::Response::State::Complete ||
+        !connection._session->isConnected())
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const Clock::time_point now = Clock::now();
+    trimLocked(now);
+
+    connection._lastUsed = now;
+    std::vector<Connection>& idle = _idle[key];
+    idle.push_back(std::move(connection));
+    if (idle.size() > _maxIdlePerHost)
+        idle.erase(idle.begin());
+}
+
+void StorageConnectionPool::trim(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    trimLocked(now);
+}
+
+void StorageConnectionPool::trimLocked(Clock::time_point now)
+{
+    for (auto it = _idle.begin(); it != _idle.end();)
+    {
+        std::vector<Connection>& idle = it->second;
+        idle.erase(std::remove_if(idle.begin(), idle.end(),
+                                  [this, now](const Connection& connection)
+                                  { return now - connection._lastUsed > _idleTimeout; }),
+                   idle.end());
+
+        if (idle.empty())
+            it = _idle.erase(it);
+        else
+            ++it;
+    }
+}
+
+std::size_t StorageConnectionPool::getNewCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _newCount;
+}
+
+std::size_t StorageConnectionPool::getReuseCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _reuseCount;
+}
+
+std::size_t StorageConnectionPool::getStaleCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _staleCount;
+}
+
+std::size_t StorageConnectionPool::getIdleCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::size_t count = 0;
+    for (const auto& pair : _idle)
+        count += pair.second.size();
+
+    return count;
+}
+
+void StorageConnectionPool::getMetrics(std::ostream& os) const
+{
+    os << "storage_connection_new_count " << getNewCount() << '\n';
+    os << "storage_connection_reuse_count " << getReuseCount() << '\n';
+    os << "storage_connection_stale_count " << getStaleCount() << '\n';
+    os << "storage_connection_idle_count " << getIdleCount() << '\n';
+}
+
+void StorageConnectionPool::dumpState(std::ostream& os) const
+{
+    os << "\n  StorageConnectionPool:"
+       << "\n    max idle per host: " << _maxIdlePerHost
+       << "\n    idle timeout: " << _idleTimeout.count() << "s"
+       << "\n    idle: " << getIdleCount() << "\n    new: " << getNewCount()
+       << "\n    reused: " << getReuseCount() << "\n    stale: " << getStaleCount() << '\n';
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
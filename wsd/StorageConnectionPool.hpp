@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <net/HttpRequest.hpp>
+
+class TerminatingPoll;
+
+/// Keeps the connections to the storage hosts alive between the synchronous
+/// requests of all documents, so that CheckFileInfo, GetFile and the locking
+/// requests don't each pay for a new TCP and TLS handshake.
+/// A pooled http::Session is only ever used with the poll that owns its socket,
+/// and by one request at a time.
+class StorageConnectionPool
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Keeps up to @maxIdlePerHost idle connections to each host, closing
+    /// those that have been idle for longer than @idleTimeout.
+    StorageConnectionPool(std::size_t maxIdlePerHost, std::chrono::seconds idleTimeout);
+
+    /// Sets up the instance, or disables pooling when @maxIdlePerHost is 0.
+    static void initialize(std::size_t maxIdlePerHost, std::chrono::seconds idleTimeout);
+
+    /// The instance, or nullptr when disabled.
+    static StorageConnectionPool* get() { return Instance.get(); }
+
+    /// Makes the synchronous @request to the host of @session, over an idle
+    /// connection to it if there is one and over @session otherwise.
+    /// The timeout of @session applies either way.
+    /// The response body is saved to @saveToFilePath, unless empty, and
+    /// @onProgress, if set, is called as it is received.
+    std::shared_ptr<const http::Response>
+    syncRequest(const std::shared_ptr<http::Session>& session, const http::Request& request,
+                const std::string& saveToFilePath,
+                const http::Response::ProgressCallback& onProgress = nullptr);
+
+    /// Closes the connections idle for too long.
+    void trim(Clock::time_point now);
+
+    std::size_t getNewCount() const;
+    std::size_t getReuseCount() const;
+    std::size_t getStaleCount() const;
+    std::size_t getIdleCount() const;
+
+    void getMetrics(std::ostream& os) const;
+
+    void dumpState(std::ostream& os) const;
+
+private:
+    struct Connection
+    {
+        std::shared_ptr<http::Session> _session;
+        std::shared_ptr<TerminatingPoll> _poll;
+        Clock::time_point _lastUsed;
+    };
+
+    /// Takes the most recently used idle connection to @key that is still
+    /// alive, if any.
+    bool acquire(const std::string& key, Connection& connection);
+
+    /// Returns @connection to the pool, unless it can't be reused.
+    void release(const std::string& key, Connection connection,
+                 const std::shared_ptr<const http::Response>& response);
+
+    /// Expects _mutex to be held.
+    void trimLocked(Clock::time_point now);
+
+    static std::string getKey(const http::Session& session);
+
+private:
+    static std::unique_ptr<StorageConnectionPool> Instance;
+
+    const std::size_t _maxIdlePerHost;
+    const std::chrono::seconds _idleTimeout;
+
+    mutable std::mutex _mutex;
+    /// The idle connections per scheme, host and port, most recently used last.
+    std::map<std::string, std::vector<Connection>> _idle;
+    std::size_t _newCount;
+    std::size_t _reuseCount;
+    std::size_t _staleCount;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -13,9 +13,11 @@
 
 #include "TileCache.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <iomanip>
 #include <iostream>
@@ -27,6 +29,7 @@
 
 #include "ClientSession.hpp"
 #include <Common.hpp>
+#include <Message.hpp>
 #include <Protocol.hpp>
 #include <StringVector.hpp>
 #include <Unit.hpp>
@@ -35,6 +38,9 @@
 
 using namespace COOLProtocol;
 
+std::atomic<uint64_t> TileCache::EvictedTileCount;
+std::atomic<uint64_t> TileCache::EvictedTileBytes;
+
 TileCache::TileCache(std::string docURL, const std::chrono::system_clock::time_point& modifiedTime,
                      bool dontCache)
     : _docURL(std::move(docURL))
@@ -61,6 +67,8 @@ TileCache::~TileCache()
 void TileCache::clear()
 {
     _cache.clear();
+    _lru.clear();
+    _tileIndex.clear();
     _cacheSize = 0;
     for (std::map<std::string, Blob>& i : _streamCache)
         i.clear();
@@ -206,13 +214,19 @@ void TileCache::saveTileAndNotify(const TileDesc& desc, const char *data, const
         // sendTile also does enqueueSendMessage underneath ...
         if (tile && subscriberCount > 0)
         {
+            // Encode once per distinct wire-id, not once per subscriber.
+            SharedTileMessages messages(desc, tile);
             for (size_t i = 0; i < subscriberCount; ++i)
             {
                 auto& subscriber = tileBeingRendered->getSubscribers()[i];
                 std::shared_ptr<ClientSession> session = subscriber.lock();
                 if (session)
-                    session->sendTileNow(desc, tile);
+                    session->sendTileNow(messages);
             }
+
+            LOG_TRC("Sent tile " << cacheFileName(desc) << " to " << subscriberCount
+                                 << " subscribers as " << messages.getEncodedCount()
+                                 << " distinct messages");
         }
         else if (subscriberCount == 0)
             LOG_DBG("No subscribers for: " << cacheFileName(desc));
@@ -227,6 +241,33 @@ void TileCache::saveTileAndNotify(const TileDesc& desc, const char *data, const
         LOG_DBG("No subscribers for: " << cacheFileName(desc));
 }
 
+std::shared_ptr<Message> SharedTileMessages::get(TileWireId lastSentId)
+{
+    // A keyframe doesn't depend on what the client had before.
+    const bool keyframe = _tile->needsKeyframe(lastSentId) || _tile->isPng();
+    const TileWireId since = (keyframe ? 0 : lastSentId);
+
+    for (const Encoded& encoded : _messages)
+    {
+        if (encoded._keyframe == keyframe && encoded._since == since)
+            return encoded._message;
+    }
+
+    const std::string header = _desc.serialize(keyframe ? "tile:" : "delta:", "\n");
+
+    std::vector<char> output;
+    output.reserve(header.size() + _tile->size());
+    output.insert(output.end(), header.begin(), header.end());
+
+    const bool hasContent = _tile->appendChangesSince(output, since);
+    LOG_TRC("Encoded tile message: " << header << " lastSentId " << lastSentId << " content "
+                                     << hasContent);
+
+    auto message = std::make_shared<Message>(std::move(output), Message::Dir::Out);
+    _messages.push_back({ keyframe, since, message });
+    return message;
+}
+
 bool TileCache::getTextStream(StreamType type, const std::string& fileName, std::string& content)
 {
     Blob textStream = lookupCachedStream(type, fileName);
@@ -287,28 +328,61 @@ void TileCache::invalidateTiles(int part, int mode, int x, int y, int width, int
 
     ASSERT_CORRECT_THREAD_OWNER(_owner);
 
-    for (auto it = _cache.begin(); it != _cache.end();)
+    // A tile intersects when it overlaps or touches the rectangle (see intersectsTile),
+    // ie. tilePos in [pos - tileSize, pos + size]; EMPTY invalidations use INT_MAX sizes.
+    const auto toInt = [](int64_t value)
+    { return static_cast<int>(std::max<int64_t>(INT_MIN, std::min<int64_t>(INT_MAX, value))); };
+    const int right = toInt(static_cast<int64_t>(x) + width);
+    const int bottom = toInt(static_cast<int64_t>(y) + height);
+
+    for (auto& group : _tileIndex)
     {
-        if (intersectsTile(it->first, part, mode, x, y, width, height, normalizedViewId))
-        {
-            // FIXME: only want to keep as invalid keyframes in the view area(s)
-            it->second->invalidate();
-            ++it;
-        }
-#if 0
-        {
-            LOG_TRC("Removing tile: " << it->first.serialize());
-            _cacheSize -= itemCacheSize(it->second);
-            it = _cache.erase(it);
-        }
-#endif
-        else
+        const TileGroupKey& key = group.first;
+        if ((part != -1 && key._part != part) || key._mode != mode ||
+            key._normalizedViewId != normalizedViewId)
+            continue;
+
+        TileGrid& grid = group.second;
+        const auto rowEnd = grid.upper_bound(bottom);
+        for (auto row = grid.lower_bound(toInt(static_cast<int64_t>(y) - key._tileHeight));
+             row != rowEnd; ++row)
         {
-            ++it;
+            const auto colEnd = row->second.upper_bound(right);
+            for (auto col = row->second.lower_bound(toInt(static_cast<int64_t>(x) - key._tileWidth));
+                 col != colEnd; ++col)
+            {
+                // FIXME: only want to keep as invalid keyframes in the view area(s)
+                col->second->invalidate();
+            }
         }
     }
 }
 
+void TileCache::indexTile(const TileDesc& desc, const Tile& tile)
+{
+    _tileIndex[TileGroupKey(desc)][desc.getTilePosY()][desc.getTilePosX()] = tile;
+}
+
+void TileCache::unindexTile(const TileDesc& desc)
+{
+    const auto group = _tileIndex.find(TileGroupKey(desc));
+    if (group == _tileIndex.end())
+        return;
+
+    TileGrid& grid = group->second;
+    const auto row = grid.find(desc.getTilePosY());
+    if (row == grid.end())
+        return;
+
+    row->second.erase(desc.getTilePosX());
+    if (row->second.empty())
+    {
+        grid.erase(row);
+        if (grid.empty())
+            _tileIndex.erase(group);
+    }
+}
+
 void TileCache::invalidateTiles(const std::string& tiles, int normalizedViewId)
 {
     int part = 0, mode = 0;
@@ -481,8 +555,9 @@ Tile TileCache::findTile(const TileDesc &desc)
     const auto it = _cache.find(desc);
     if (it != _cache.end() && it->first.getNormalizedViewId() == desc.getNormalizedViewId())
     {
-        LOG_TRC("Found cache tile: " << desc.serialize() << " of size " << it->second);
-        return it->second;
+        LOG_TRC("Found cache tile: " << desc.serialize() << " of size " << it->second._tile);
+        touchTile(it->second);
+        return it->second._tile;
     }
 
     return Tile();
@@ -495,8 +570,9 @@ Tile TileCache::saveDataToCache(const TileDesc &desc, const char *data, const si
 
     ensureCacheSize();
 
-    Tile tile = _cache[desc];
-    if (!tile)
+    Tile tile;
+    const auto it = _cache.find(desc);
+    if (it == _cache.end())
     {
         if (!TileData::isKeyframe(data, size))
         {
@@ -505,21 +581,25 @@ Tile TileCache::saveDataToCache(const TileDesc &desc, const char *data, const si
             // underlying keyframe.
             LOG_TRC("rare race between canceltiles and delta rendering - "
                     "discarding delta for " << desc.serialize());
-            _cache.erase(desc);
             return Tile();
         }
         else
         {
             LOG_TRC("new tile for " << desc.serialize() << " of size " << size);
             tile = std::make_shared<TileData>(desc.getWireId(), data, size);
-            _cache[desc] = tile;
+            const auto inserted = _cache.emplace(desc, CacheEntry{ tile, _lru.end() }).first;
+            _lru.push_front(&inserted->first);
+            inserted->second._lruPos = _lru.begin();
+            indexTile(desc, tile);
             _cacheSize += itemCacheSize(tile);
         }
     }
     else
     {
         LOG_TRC("append blob to " << desc.serialize() << " of size " << size);
+        tile = it->second._tile;
         _cacheSize += tile->appendBlob(desc.getWireId(), data, size);
+        touchTile(it->second);
     }
 
     return tile;
@@ -536,9 +616,16 @@ void TileCache::assertCacheSize()
     size_t recalcSize = 0;
     for (const auto& it : _cache)
     {
-        recalcSize += itemCacheSize(it.second);
+        recalcSize += itemCacheSize(it.second._tile);
     }
     assert(recalcSize == _cacheSize);
+    assert(_lru.size() == _cache.size());
+
+    size_t indexed = 0;
+    for (const auto& group : _tileIndex)
+        for (const auto& row : group.second)
+            indexed += row.second.size();
+    assert(indexed == _cache.size());
 #endif
 }
 
@@ -552,69 +639,43 @@ void TileCache::ensureCacheSize()
     LOG_TRC("Cleaning tile cache of size " << _cacheSize << " vs. " << _maxCacheSize <<
             " with " << _cache.size() << " entries");
 
-    struct WidSize {
-        TileWireId _wid;
-        size_t     _size;
-        WidSize(TileWireId w, size_t s) : _wid(w), _size(s) {}
-    };
-    std::vector<WidSize> wids;
-    for (const auto& it : _cache)
-        wids.emplace_back(it.first.getWireId(), itemCacheSize(it.second));
-
-    std::sort(wids.begin(), wids.end(),
-              [](const WidSize &a, const WidSize &b) { return a._wid < b._wid; });
-
-    // FIXME: should we just take a wid 25% into the list ?
-    TileWireId maxToRemove = wids.front()._wid;
-
-    // do we have (the very rare) WID wrap-around
-    if (wids.back()._wid - wids.front()._wid > 256 * 256 * 256)
-    {
-        maxToRemove = wids.back()._wid;
-        LOG_TRC("Rare wid wrap-around detected, clear tile cache");
-    }
-    else
+    // Evict the least recently used tiles until a quarter of the budget is free.
+    // Each entry is visited at most once, so this is bounded by the number of
+    // tiles being rendered we have to skip rather than by the cache size.
+    const size_t targetSize = _maxCacheSize - _maxCacheSize / 4;
+    size_t toVisit = _lru.size();
+    uint64_t evictedCount = 0;
+    uint64_t evictedBytes = 0;
+    while (_cacheSize > targetSize && toVisit-- > 0)
     {
-        // calculate which wid to start at.
-        size_t total = 0;
-        for (const auto &it : wids)
-        {
-            total += it._size;
-            maxToRemove = it._wid;
-            if (total > _maxCacheSize / 4)
-                break;
-        }
-    }
-    LOG_TRC("cleaning up to wid " << maxToRemove << " between " <<
-            wids.front()._wid << " and " << wids.back()._wid);
+        const auto it = _cache.find(*_lru.back());
+        assert(it != _cache.end());
 
-    for (auto it = _cache.begin(); it != _cache.end();)
-    {
-        if (it->first.getWireId() <= maxToRemove)
+        auto rit = _tilesBeingRendered.find(it->first);
+        if (rit != _tilesBeingRendered.end())
         {
-            auto rit = _tilesBeingRendered.find(it->first);
-            if (rit != _tilesBeingRendered.end())
-            {
-                // avoid getting a delta instead of a keyframe at the bottom.
-                LOG_TRC("skip cleaning tile we are waiting on: " << it->first.serialize() <<
-                        " which has " << rit->second->getSubscribers().size() << " waiting");
-                ++it;
-            }
-            else
-            {
-                LOG_TRC("cleaned out tile: " << it->first.serialize());
-                _cacheSize -= itemCacheSize(it->second);
-                it = _cache.erase(it);
-            }
-        }
-        else
-        {
-            ++it;
+            // avoid getting a delta instead of a keyframe at the bottom.
+            LOG_TRC("skip cleaning tile we are waiting on: " << it->first.serialize() <<
+                    " which has " << rit->second->getSubscribers().size() << " waiting");
+            touchTile(it->second);
+            continue;
         }
+
+        LOG_TRC("cleaned out tile: " << it->first.serialize());
+        const size_t size = itemCacheSize(it->second._tile);
+        _cacheSize -= size;
+        ++evictedCount;
+        evictedBytes += size;
+        unindexTile(it->first);
+        _lru.pop_back();
+        _cache.erase(it);
     }
 
+    EvictedTileCount += evictedCount;
+    EvictedTileBytes += evictedBytes;
+
     LOG_TRC("Cache is now of size " << _cacheSize << " and " <<
-            _cache.size() << " entries after cleaning");
+            _cache.size() << " entries after cleaning " << evictedCount << " tiles");
 
     assertCacheSize();
 }
@@ -657,9 +718,9 @@ void TileCache::dumpState(std::ostream& os)
     for (const auto& it : _cache)
     {
         os << "    " << std::setw(4) << it.first.getWireId()
-           << '\t' << std::setw(6) << it.second->size() << " bytes"
+           << '\t' << std::setw(6) << it.second._tile->size() << " bytes"
            << "\t'" << it.first.serialize() << " ";
-        it.second->dumpState(os);
+        it.second._tile->dumpState(os);
         os << "\n";
     }
 
@@ -11,7 +11,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <iosfwd>
+#include <list>
+#include <map>
 #include <memory>
 #include <string>
 #include <thread>
@@ -66,6 +69,7 @@ struct TileDescCacheHasher final
 struct TileData
 {
     TileData(TileWireId start, const char *data, const size_t size)
+        : _neighbourDeltas(false)
     {
         appendBlob(start, data, size);
     }
@@ -75,13 +79,19 @@ struct TileData
     {
         size_t oldCacheSize = size();
 
-        assert (dataSize >= 1); // kit provides us a 'Z' or a 'D' or a png
+        assert (dataSize >= 1); // kit provides us a 'Z' or a 'D' / 'N' or a png
         if (isKeyframe(data, dataSize))
         {
             LOG_TRC("received key-frame - clearing tile");
             _wids.clear();
             _offsets.clear();
             _deltas.clear();
+            _neighbourDeltas = false;
+        }
+        else if (data[0] == 'N')
+        {
+            LOG_TRC("received delta copying rows from neighbouring tiles");
+            _neighbourDeltas = true;
         }
         else
         {
@@ -138,7 +148,13 @@ struct TileData
     bool isValid() const { return _valid; }
     void invalidate() { _valid = false; }
 
+    /// Whether any of the deltas since the keyframe copy rows from
+    /// neighbouring tiles, so they only apply on top of what the client
+    /// had of those at the time: a client starting over needs a keyframe.
+    bool hasNeighbourDeltas() const { return _neighbourDeltas; }
+
     bool _valid; // not true - waiting for a new tile if in view.
+    bool _neighbourDeltas;
     std::vector<TileWireId> _wids;
     std::vector<size_t> _offsets; // offset of the start of data
     BlobData _deltas; // first item is a key-frame, followed by deltas at _offsets
@@ -191,6 +207,8 @@ struct TileData
 
     void dumpState(std::ostream& os)
     {
+        if (_neighbourDeltas)
+            os << "neighbour ";
         if (_wids.size() < 2)
             os << "keyframe";
         else {
@@ -204,6 +222,41 @@ struct TileData
 };
 using Tile = std::shared_ptr<TileData>;
 
+class Message;
+
+/// The encoded tile: and delta: messages of one rendered tile, shared by all
+/// the sessions it is sent to. Sessions that last received the same wire-id
+/// get the very same message, so it is encoded and queued only once.
+class SharedTileMessages final
+{
+public:
+    SharedTileMessages(const TileDesc& desc, const Tile& tile)
+        : _desc(desc)
+        , _tile(tile)
+    {
+    }
+
+    const TileDesc& getDesc() const { return _desc; }
+
+    /// The message for a session which last received @lastSentId of this tile.
+    std::shared_ptr<Message> get(TileWireId lastSentId);
+
+    /// The number of distinct messages encoded so far.
+    std::size_t getEncodedCount() const { return _messages.size(); }
+
+private:
+    struct Encoded
+    {
+        bool _keyframe;
+        TileWireId _since;
+        std::shared_ptr<Message> _message;
+    };
+
+    const TileDesc _desc;
+    const Tile _tile;
+    std::vector<Encoded> _messages;
+};
+
 /// Handles the caching of tiles of one document.
 class TileCache
 {
@@ -281,6 +334,11 @@ public:
     /// Get the current memory use.
     size_t getMemorySize() const { return _cacheSize; }
 
+    /// Number of tiles evicted by all tile caches, for the metrics.
+    static std::atomic<uint64_t> EvictedTileCount;
+    /// Size of the tiles evicted by all tile caches, for the metrics.
+    static std::atomic<uint64_t> EvictedTileBytes;
+
     // Debugging bits ...
     void dumpState(std::ostream& os);
     void setThreadOwner(const std::thread::id& id) { _owner = id; }
@@ -292,6 +350,74 @@ private:
 
     void invalidateTiles(int part, int mode, int x, int y, int width, int height, int normalizedViewId);
 
+    /// The properties of a tile that are independent of its position;
+    /// tiles sharing them only differ by location and can be indexed spatially.
+    struct TileGroupKey final
+    {
+        explicit TileGroupKey(const TileDesc& desc)
+            : _part(desc.getPart())
+            , _mode(desc.getEditMode())
+            , _width(desc.getWidth())
+            , _height(desc.getHeight())
+            , _tileWidth(desc.getTileWidth())
+            , _tileHeight(desc.getTileHeight())
+            , _normalizedViewId(desc.getNormalizedViewId())
+        {
+        }
+
+        bool operator==(const TileGroupKey& other) const
+        {
+            return _part == other._part && _mode == other._mode && _width == other._width &&
+                   _height == other._height && _tileWidth == other._tileWidth &&
+                   _tileHeight == other._tileHeight &&
+                   _normalizedViewId == other._normalizedViewId;
+        }
+
+        int _part;
+        int _mode;
+        int _width;
+        int _height;
+        int _tileWidth;
+        int _tileHeight;
+        int _normalizedViewId;
+    };
+
+    struct TileGroupKeyHasher final
+    {
+        inline size_t operator()(const TileGroupKey& k) const
+        {
+            size_t hash = k._part;
+
+            hash = (hash << 5) + hash + k._mode;
+            hash = (hash << 5) + hash + k._width;
+            hash = (hash << 5) + hash + k._height;
+            hash = (hash << 5) + hash + k._tileWidth;
+            hash = (hash << 5) + hash + k._tileHeight;
+            hash = (hash << 5) + hash + k._normalizedViewId;
+
+            return hash;
+        }
+    };
+
+    /// Tiles of one group ordered by tilePosY, then tilePosX.
+    using TileGrid = std::map<int, std::map<int, Tile>>;
+
+    /// Add a freshly cached tile to the spatial index.
+    void indexTile(const TileDesc& desc, const Tile& tile);
+
+    /// Remove an evicted tile from the spatial index.
+    void unindexTile(const TileDesc& desc);
+
+    /// A cached tile and its position in the eviction order.
+    struct CacheEntry final
+    {
+        Tile _tile;
+        std::list<const TileDesc*>::iterator _lruPos;
+    };
+
+    /// Mark a cached tile as the most recently used.
+    void touchTile(CacheEntry& entry) { _lru.splice(_lru.begin(), _lru, entry._lruPos); }
+
     /// Lookup tile in our cache.
     Tile findTile(const TileDesc &desc);
 
@@ -321,9 +447,13 @@ private:
     size_t _maxCacheSize;
 
     // FIXME: should we have a tile-desc to WID map instead and a simpler lookup ?
-    std::unordered_map<TileDesc, Tile,
+    std::unordered_map<TileDesc, CacheEntry,
                        TileDescCacheHasher,
                        TileDescCacheCompareEq> _cache;
+    /// Keys of _cache, most recently used first; we evict from the back.
+    std::list<const TileDesc*> _lru;
+    /// Spatial index of _cache, so invalidation only visits intersecting tiles.
+    std::unordered_map<TileGroupKey, TileGrid, TileGroupKeyHasher> _tileIndex;
     // FIXME: TileBeingRendered contains TileDesc too ...
     std::unordered_map<TileDesc, std::shared_ptr<TileBeingRendered>,
                        TileDescCacheHasher,
@@ -368,6 +498,13 @@ public:
         return last;
     }
 
+    /// return wire-id of last tile sent - or 0 if not present
+    TileWireId getTileSeq(const TileDesc &desc) const
+    {
+        auto it = _cache.find(desc);
+        return it == _cache.end() ? 0 : it->getWireId();
+    }
+
     void resetTileSeq(const TileDesc &desc)
     {
         auto it = _cache.find(desc);